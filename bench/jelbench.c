@@ -0,0 +1,472 @@
+/*
+ * jelbench.c - Throughput benchmark for libjel.
+ *
+ * Loads every JPEG in the named directories into memory, then times
+ * capacity, embed and extract over the whole corpus: a few warm-up
+ * passes, followed by timed repetitions.  For each operation it
+ * reports images/s, decoded (JPEG) MB/s, payload MB/s, and p50/p99
+ * latency for the whole call and for each phase recorded in
+ * jel_stats.  The report is JSON, so that runs before and after a
+ * library change can be compared mechanically.
+ *
+ * All I/O is done before timing starts; sources and destinations are
+ * memory buffers.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <jel/jel.h>
+
+#define JELBENCH_VERSION "1.0"
+
+static const char * progname;
+static char * outfilename = NULL;  /* for -outfile switch */
+static int warmup = 1;             /* Untimed passes over the corpus. */
+static int reps = 3;               /* Timed passes over the corpus. */
+static int msgsize = 1024;         /* Message bytes, capped at capacity. */
+static int ecc = 1;
+static int quality = 0;            /* If >0, re-quantize the output. */
+
+
+/* One image of the corpus, with what the embed pass made of it: */
+typedef struct {
+  char *name;
+  unsigned char *jpeg;
+  int len;
+  int capacity;
+  unsigned char *stego;            /* Output of the last embed. */
+  int stegolen;
+  int msglen;
+} bench_image;
+
+
+/* Phases reported for each operation.  "total" is the whole call,
+ * including opening the source: */
+enum { PH_TOTAL, PH_HEADER, PH_READ_COEFS, PH_ECC, PH_SCAN,
+       PH_WRITE_COEFS, PH_FINISH, PH_COUNT };
+
+static const char *phase_names[PH_COUNT] = {
+  "total", "header", "read_coefs", "ecc", "scan", "write_coefs", "finish"
+};
+
+
+/* Samples and totals for one operation: */
+typedef struct {
+  const char *name;
+  long long *samples[PH_COUNT];    /* Nanoseconds, one per image per rep. */
+  int n;
+  long long elapsed_ns;            /* Wall time for the timed passes. */
+  double jpeg_bytes;               /* JPEG bytes decoded. */
+  double payload_bytes;            /* Message bytes embedded or extracted. */
+  int failures;
+} bench_op;
+
+
+LOCAL(void)
+usage (void)
+{
+  fprintf(stderr, "usage: %s [switches] directory...\n", progname);
+  fprintf(stderr, "Times capacity, embed and extract over the JPEG files in each directory.\n");
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -warmup N       Untimed passes over the corpus (default=1).\n");
+  fprintf(stderr, "  -reps N         Timed passes over the corpus (default=3).\n");
+  fprintf(stderr, "  -message N      Embed N bytes, or the capacity if smaller (default=1024).\n");
+  fprintf(stderr, "  -noecc          Do not use error correcting codes.\n");
+  fprintf(stderr, "  -quality Q      Set the output quality to Q when embedding.\n");
+  fprintf(stderr, "  -outfile <file> Write the JSON report to file (default=stdout).\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static boolean
+keymatch (char * arg, const char * keyword, int minchars)
+{
+  register int ca, ck;
+  register int nmatched = 0;
+
+  while ((ca = *arg++) != '\0') {
+    if ((ck = *keyword++) == '\0')
+      return FALSE;		/* arg longer than keyword, no good */
+    if (isupper(ca))		/* force arg to lcase (assume ck is already) */
+      ca = tolower(ca);
+    if (ca != ck)
+      return FALSE;		/* no good */
+    nmatched++;			/* count matched characters */
+  }
+  /* reached end of argument; fail if it's too short for unique abbrev */
+  if (nmatched < minchars)
+    return FALSE;
+  return TRUE;			/* A-OK */
+}
+
+
+LOCAL(int)
+parse_switches (int argc, char **argv)
+{
+  int argn;
+  char * arg;
+
+  for (argn = 1; argn < argc; argn++) {
+    arg = argv[argn];
+    if (*arg != '-') break;
+
+    arg++;			/* advance past switch marker character */
+
+    if (keymatch(arg, "warmup", 1)) {
+      if (++argn >= argc) usage();
+      warmup = atoi(argv[argn]);
+    } else if (keymatch(arg, "reps", 1)) {
+      if (++argn >= argc) usage();
+      reps = atoi(argv[argn]);
+    } else if (keymatch(arg, "message", 1)) {
+      if (++argn >= argc) usage();
+      msgsize = atoi(argv[argn]);
+    } else if (keymatch(arg, "noecc", 1)) {
+      ecc = 0;
+    } else if (keymatch(arg, "quality", 1)) {
+      if (++argn >= argc) usage();
+      quality = atoi(argv[argn]);
+    } else if (keymatch(arg, "outfile", 1)) {
+      if (++argn >= argc) usage();
+      outfilename = argv[argn];
+    } else {
+      usage();
+    }
+  }
+
+  if (warmup < 0 || reps < 1 || msgsize < 0) usage();
+
+  return argn;
+}
+
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int has_jpeg_suffix(const char *name) {
+  const char *dot = strrchr(name, '.');
+
+  if (dot == NULL) return 0;
+  return (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(((const bench_image *) a)->name, ((const bench_image *) b)->name);
+}
+
+
+static unsigned char *read_file(const char *path, int *len) {
+  FILE *fp;
+  struct stat st;
+  unsigned char *buf;
+
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) return NULL;
+
+  buf = malloc(st.st_size);
+  if (buf != NULL && fread(buf, 1, st.st_size, fp) != (size_t) st.st_size) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+
+  *len = (int) st.st_size;
+  return buf;
+}
+
+
+/* Append the JPEG files in 'dir' to the corpus, in name order: */
+static int load_dir(const char *dir, bench_image **images, int *nimages) {
+  DIR *dp;
+  struct dirent *de;
+  char path[4096];
+  bench_image *img;
+  int first = *nimages;
+
+  dp = opendir(dir);
+  if (dp == NULL) {
+    fprintf(stderr, "%s: cannot open directory %s\n", progname, dir);
+    return -1;
+  }
+
+  while ((de = readdir(dp)) != NULL) {
+    if (!has_jpeg_suffix(de->d_name)) continue;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+
+    *images = realloc(*images, (*nimages + 1) * sizeof(bench_image));
+    img = &(*images)[*nimages];
+    memset(img, 0, sizeof(bench_image));
+
+    img->jpeg = read_file(path, &img->len);
+    if (img->jpeg == NULL) {
+      fprintf(stderr, "%s: cannot read %s\n", progname, path);
+      continue;
+    }
+    img->name = strdup(path);
+    (*nimages)++;
+  }
+  closedir(dp);
+
+  qsort(*images + first, *nimages - first, sizeof(bench_image), compare_names);
+  return 0;
+}
+
+
+static jel_config *new_config(void) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+
+  jel_setprop(cfg, JEL_PROP_ECC_METHOD, ecc ? JEL_ECC_RSCODE : JEL_ECC_NONE);
+  return cfg;
+}
+
+
+static void record(bench_op *op, long long total, jel_stats *stats) {
+  int i = op->n++;
+
+  op->samples[PH_TOTAL][i] = total;
+  op->samples[PH_HEADER][i] = stats->header_ns;
+  op->samples[PH_READ_COEFS][i] = stats->read_coefs_ns;
+  op->samples[PH_ECC][i] = stats->ecc_ns;
+  op->samples[PH_SCAN][i] = stats->scan_ns;
+  op->samples[PH_WRITE_COEFS][i] = stats->write_coefs_ns;
+  op->samples[PH_FINISH][i] = stats->finish_ns;
+}
+
+
+/*
+ * The three operations.  Each returns 0 on success, and fills in
+ * the call's latency and statistics:
+ */
+static int run_capacity(bench_image *img, long long *ns, jel_stats *stats) {
+  jel_config *cfg;
+  long long t0 = now_ns();
+  int ret;
+
+  cfg = new_config();
+  ret = jel_set_mem_source(cfg, img->jpeg, img->len);
+  if (ret == 0) ret = img->capacity = jel_capacity(cfg);
+  *ns = now_ns() - t0;
+
+  jel_get_stats(cfg, stats);
+  jel_free(cfg);
+  return (ret < 0) ? ret : 0;
+}
+
+
+static int run_embed(bench_image *img, unsigned char *msg, long long *ns, jel_stats *stats) {
+  jel_config *cfg;
+  long long t0;
+  int ret;
+
+  /* Room for re-encoding at a higher quality than the input: */
+  int outsize = 4 * img->len + 65536;
+
+  if (img->stego == NULL) img->stego = malloc(outsize);
+
+  t0 = now_ns();
+  cfg = new_config();
+  ret = jel_set_mem_source(cfg, img->jpeg, img->len);
+  if (ret == 0) ret = jel_set_mem_dest(cfg, img->stego, outsize);
+  if (ret == 0 && quality > 0) ret = jel_setprop(cfg, JEL_PROP_QUALITY, quality);
+  if (ret == 0) ret = jel_embed(cfg, msg, img->msglen);
+  *ns = now_ns() - t0;
+
+  img->stegolen = cfg->jpeglen;
+  jel_get_stats(cfg, stats);
+  jel_free(cfg);
+
+  if (ret < 0) return ret;
+  return (ret == img->msglen) ? 0 : -1;
+}
+
+
+static int run_extract(bench_image *img, unsigned char *msg, unsigned char *buf,
+                       long long *ns, jel_stats *stats) {
+  jel_config *cfg;
+  long long t0 = now_ns();
+  int ret;
+
+  cfg = new_config();
+  ret = jel_set_mem_source(cfg, img->stego, img->stegolen);
+  if (ret == 0) ret = jel_extract(cfg, buf, img->capacity + 1);
+  *ns = now_ns() - t0;
+
+  jel_get_stats(cfg, stats);
+  jel_free(cfg);
+
+  if (ret < 0) return ret;
+  return (ret == img->msglen && memcmp(buf, msg, ret) == 0) ? 0 : -1;
+}
+
+
+/* Make passes over the corpus with one operation; only 'timed'
+ * passes are recorded: */
+static void run_op(bench_op *op, int which, bench_image *images, int nimages,
+                   unsigned char *msg, unsigned char *buf, int passes, int timed) {
+  int pass, i, ret;
+  long long ns, t0;
+  jel_stats stats;
+
+  t0 = now_ns();
+  for (pass = 0; pass < passes; pass++) {
+    for (i = 0; i < nimages; i++) {
+      if (which == 0) ret = run_capacity(&images[i], &ns, &stats);
+      else if (which == 1) ret = run_embed(&images[i], msg, &ns, &stats);
+      else ret = run_extract(&images[i], msg, buf, &ns, &stats);
+
+      if (!timed) continue;
+
+      if (ret != 0) op->failures++;
+      record(op, ns, &stats);
+      op->jpeg_bytes += (which == 2) ? images[i].stegolen : images[i].len;
+      op->payload_bytes += (which == 0) ? 0 : stats.msg_bytes;
+    }
+  }
+  if (timed) op->elapsed_ns += now_ns() - t0;
+}
+
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *) a;
+  long long y = *(const long long *) b;
+
+  return (x > y) - (x < y);
+}
+
+
+/* Nearest-rank percentile of a sorted sample, in microseconds: */
+static double percentile_us(long long *sorted, int n, double p) {
+  int k;
+
+  if (n == 0) return 0.0;
+  k = (int) (p * n + 0.999999) - 1;
+  if (k < 0) k = 0;
+  if (k >= n) k = n - 1;
+  return sorted[k] / 1000.0;
+}
+
+
+static void print_op(FILE *fp, bench_op *op, int last) {
+  double secs = op->elapsed_ns / 1e9;
+  int ph;
+
+  fprintf(fp, "    \"%s\": {\n", op->name);
+  fprintf(fp, "      \"samples\": %d,\n", op->n);
+  fprintf(fp, "      \"failures\": %d,\n", op->failures);
+  fprintf(fp, "      \"seconds\": %.6f,\n", secs);
+  fprintf(fp, "      \"images_per_sec\": %.3f,\n", secs > 0 ? op->n / secs : 0.0);
+  fprintf(fp, "      \"decoded_mb_per_sec\": %.3f,\n", secs > 0 ? op->jpeg_bytes / 1e6 / secs : 0.0);
+  fprintf(fp, "      \"payload_mb_per_sec\": %.3f,\n", secs > 0 ? op->payload_bytes / 1e6 / secs : 0.0);
+  fprintf(fp, "      \"latency_us\": {\n");
+
+  for (ph = 0; ph < PH_COUNT; ph++) {
+    qsort(op->samples[ph], op->n, sizeof(long long), compare_ll);
+    fprintf(fp, "        \"%s\": { \"p50\": %.1f, \"p99\": %.1f }%s\n", phase_names[ph],
+            percentile_us(op->samples[ph], op->n, 0.50),
+            percentile_us(op->samples[ph], op->n, 0.99),
+            (ph < PH_COUNT - 1) ? "," : "");
+  }
+
+  fprintf(fp, "      }\n");
+  fprintf(fp, "    }%s\n", last ? "" : ",");
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int argn, i, k, ph;
+  bench_image *images = NULL;
+  int nimages = 0;
+  double corpus_bytes = 0;
+  unsigned char *msg, *buf;
+  int maxcap = 0;
+  bench_op ops[3];
+  long long ns;
+  jel_stats stats;
+  FILE *fp = stdout;
+  int failed = 0;
+
+  progname = argv[0];
+
+  argn = parse_switches(argc, argv);
+  if (argn >= argc) usage();
+
+  for (; argn < argc; argn++)
+    if (load_dir(argv[argn], &images, &nimages) != 0) exit(EXIT_FAILURE);
+
+  if (nimages == 0) {
+    fprintf(stderr, "%s: no JPEG files found\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Size each message from the image's capacity, once, untimed: */
+  for (i = 0; i < nimages; i++) {
+    corpus_bytes += images[i].len;
+    run_capacity(&images[i], &ns, &stats);
+    images[i].msglen = (msgsize < images[i].capacity) ? msgsize : images[i].capacity;
+    if (images[i].capacity > maxcap) maxcap = images[i].capacity;
+  }
+
+  /* Incompressible payload, the same for every image: */
+  msg = malloc(maxcap + 1);
+  buf = malloc(maxcap + 1);
+  srand(1);
+  for (k = 0; k <= maxcap; k++) msg[k] = (unsigned char) rand();
+
+  memset(ops, 0, sizeof(ops));
+  ops[0].name = "capacity";
+  ops[1].name = "embed";
+  ops[2].name = "extract";
+
+  for (k = 0; k < 3; k++) {
+    for (ph = 0; ph < PH_COUNT; ph++)
+      ops[k].samples[ph] = malloc(sizeof(long long) * nimages * reps);
+
+    /* Extract needs the embed pass's output, even with no warm-up: */
+    if (k == 2 && warmup == 0) run_op(&ops[k], 1, images, nimages, msg, buf, 1, 0);
+
+    run_op(&ops[k], k, images, nimages, msg, buf, warmup, 0);
+    run_op(&ops[k], k, images, nimages, msg, buf, reps, 1);
+    failed += ops[k].failures;
+  }
+
+  if (outfilename != NULL) {
+    fp = fopen(outfilename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "%s: cannot open %s\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"benchmark\": \"jelbench\",\n");
+  fprintf(fp, "  \"version\": \"%s\",\n", JELBENCH_VERSION);
+  fprintf(fp, "  \"libjel\": \"%s\",\n", jel_version_string());
+  fprintf(fp, "  \"config\": { \"warmup\": %d, \"reps\": %d, \"message\": %d, \"ecc\": %s, \"quality\": %d },\n",
+          warmup, reps, msgsize, ecc ? "true" : "false", quality);
+  fprintf(fp, "  \"corpus\": { \"images\": %d, \"bytes\": %.0f },\n", nimages, corpus_bytes);
+  fprintf(fp, "  \"ops\": {\n");
+  for (k = 0; k < 3; k++) print_op(fp, &ops[k], k == 2);
+  fprintf(fp, "  }\n");
+  fprintf(fp, "}\n");
+
+  if (fp != stdout) fclose(fp);
+
+  if (failed) fprintf(stderr, "%s: %d operations failed\n", progname, failed);
+
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
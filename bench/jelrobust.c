@@ -0,0 +1,596 @@
+/*
+ * jelrobust.c - Recompression robustness benchmark for libjel.
+ *
+ * For each cover image: embed a message, then for each quality in a
+ * sweep, decode the result to pixels and re-encode it with libjpeg
+ * at that quality, all in memory, and extract the message again.
+ * The bit error rate of the recovered message and the fraction of
+ * exact recoveries are reported per quality, as JSON.
+ *
+ * This replaces the per-image wedge / convert / unwedge pipelines of
+ * stegtester/transcode/tests.py for bulk runs: nothing is spawned
+ * per image, and the corpus is split across worker processes, one
+ * per core by default.  Workers are processes rather than threads
+ * because libjel keeps the ECC coder's state in globals.
+ *
+ * Quality 0 in the sweep means "no recompression", which checks the
+ * embedding itself.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <setjmp.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <jel/jel.h>
+
+#define JELROBUST_VERSION "1.0"
+
+#define MAX_QUALITIES 32
+
+static const char * progname;
+static char * outfilename = NULL;  /* for -outfile switch */
+static int qualities[MAX_QUALITIES] = { 0, 90, 75, 50, 30 };
+static int nqualities = 5;
+static int msgsize = 256;          /* Message bytes, capped at capacity. */
+static int ecc = 1;
+static int ecclen = 0;             /* ECC block length; 0 for the default. */
+static int embed_length = 1;
+static int embed_quality = 0;      /* If >0, JEL_PROP_QUALITY for embedding. */
+static int nlevels = JEL_NLEVELS;
+static int nworkers = 0;           /* 0 means one per online CPU. */
+static int verbose = 0;
+
+
+/* What a worker reports for one image at one quality: */
+#define TRIAL_OK          0        /* Message recovered exactly. */
+#define TRIAL_DAMAGED     1        /* Message recovered with errors. */
+#define TRIAL_NO_EMBED   -1        /* Could not read or embed in the cover. */
+#define TRIAL_NO_RECODE  -2        /* libjpeg failed to recompress. */
+#define TRIAL_NO_EXTRACT -3        /* jel_extract returned an error. */
+
+typedef struct {
+  int image;
+  int quality;                     /* Index into qualities[]. */
+  int status;
+  int msglen;
+  long bit_errors;
+} trial_result;
+
+
+/* Totals for one quality: */
+typedef struct {
+  long trials;
+  long ok;
+  long damaged;
+  long no_embed;
+  long no_recode;
+  long no_extract;
+  double bit_errors;
+  double bits;
+} quality_totals;
+
+
+LOCAL(void)
+usage (void)
+{
+  fprintf(stderr, "usage: %s [switches] directory...\n", progname);
+  fprintf(stderr, "Embeds, recompresses and extracts over the JPEG files in each directory.\n");
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -qualities a,b,... Recompression qualities; 0 means none (default=0,90,75,50,30).\n");
+  fprintf(stderr, "  -message N      Embed N random bytes, or the capacity if smaller (default=256).\n");
+  fprintf(stderr, "  -quality Q      Embed at output quality Q (default=same as input quality).\n");
+  fprintf(stderr, "  -ecc L          Set ECC block length to L bytes.\n");
+  fprintf(stderr, "  -noecc          Do not use error correcting codes.\n");
+  fprintf(stderr, "  -nolength       Do not embed the message length.\n");
+  fprintf(stderr, "  -quanta N       Ask for N quanta for embedding (default=8).\n");
+  fprintf(stderr, "  -workers N      Number of worker processes (default=one per CPU).\n");
+  fprintf(stderr, "  -outfile <file> Write the JSON report to file (default=stdout).\n");
+  fprintf(stderr, "  -verbose        List every failed trial on stderr.\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static boolean
+keymatch (char * arg, const char * keyword, int minchars)
+{
+  register int ca, ck;
+  register int nmatched = 0;
+
+  while ((ca = *arg++) != '\0') {
+    if ((ck = *keyword++) == '\0')
+      return FALSE;		/* arg longer than keyword, no good */
+    if (isupper(ca))		/* force arg to lcase (assume ck is already) */
+      ca = tolower(ca);
+    if (ca != ck)
+      return FALSE;		/* no good */
+    nmatched++;			/* count matched characters */
+  }
+  /* reached end of argument; fail if it's too short for unique abbrev */
+  if (nmatched < minchars)
+    return FALSE;
+  return TRUE;			/* A-OK */
+}
+
+
+static void parse_qualities(char *list) {
+  char *tok;
+
+  nqualities = 0;
+  for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    if (nqualities >= MAX_QUALITIES) usage();
+    qualities[nqualities] = atoi(tok);
+    if (qualities[nqualities] < 0 || qualities[nqualities] > 100) usage();
+    nqualities++;
+  }
+  if (nqualities == 0) usage();
+}
+
+
+LOCAL(int)
+parse_switches (int argc, char **argv)
+{
+  int argn;
+  char * arg;
+
+  for (argn = 1; argn < argc; argn++) {
+    arg = argv[argn];
+    if (*arg != '-') break;
+
+    arg++;			/* advance past switch marker character */
+
+    if (keymatch(arg, "qualities", 3)) {
+      if (++argn >= argc) usage();
+      parse_qualities(argv[argn]);
+    } else if (keymatch(arg, "quality", 7)) {
+      if (++argn >= argc) usage();
+      embed_quality = atoi(argv[argn]);
+    } else if (keymatch(arg, "quanta", 5)) {
+      if (++argn >= argc) usage();
+      nlevels = atoi(argv[argn]);
+    } else if (keymatch(arg, "message", 1)) {
+      if (++argn >= argc) usage();
+      msgsize = atoi(argv[argn]);
+    } else if (keymatch(arg, "ecc", 3)) {
+      if (++argn >= argc) usage();
+      ecclen = atoi(argv[argn]);
+    } else if (keymatch(arg, "noecc", 3)) {
+      ecc = 0;
+    } else if (keymatch(arg, "nolength", 3)) {
+      embed_length = 0;
+    } else if (keymatch(arg, "workers", 1)) {
+      if (++argn >= argc) usage();
+      nworkers = atoi(argv[argn]);
+    } else if (keymatch(arg, "outfile", 1)) {
+      if (++argn >= argc) usage();
+      outfilename = argv[argn];
+    } else if (keymatch(arg, "verbose", 1)) {
+      verbose = 1;
+    } else {
+      usage();
+    }
+  }
+
+  if (msgsize < 1 || nworkers < 0) usage();
+
+  return argn;
+}
+
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int has_jpeg_suffix(const char *name) {
+  const char *dot = strrchr(name, '.');
+
+  if (dot == NULL) return 0;
+  return (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+
+static int compare_strings(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+/* Append the JPEG file names in 'dir' to the list, in name order: */
+static int list_dir(const char *dir, char ***names, int *nnames) {
+  DIR *dp;
+  struct dirent *de;
+  char path[4096];
+  int first = *nnames;
+
+  dp = opendir(dir);
+  if (dp == NULL) {
+    fprintf(stderr, "%s: cannot open directory %s\n", progname, dir);
+    return -1;
+  }
+
+  while ((de = readdir(dp)) != NULL) {
+    if (!has_jpeg_suffix(de->d_name)) continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    *names = realloc(*names, (*nnames + 1) * sizeof(char *));
+    (*names)[(*nnames)++] = strdup(path);
+  }
+  closedir(dp);
+
+  qsort(*names + first, *nnames - first, sizeof(char *), compare_strings);
+  return 0;
+}
+
+
+static unsigned char *read_file(const char *path, int *len) {
+  FILE *fp;
+  struct stat st;
+  unsigned char *buf;
+
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) return NULL;
+
+  buf = malloc(st.st_size);
+  if (buf != NULL && fread(buf, 1, st.st_size, fp) != (size_t) st.st_size) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+
+  *len = (int) st.st_size;
+  return buf;
+}
+
+
+static jel_config *new_config(void) {
+  jel_config *cfg = jel_init(nlevels);
+
+  jel_setprop(cfg, JEL_PROP_ECC_METHOD, ecc ? JEL_ECC_RSCODE : JEL_ECC_NONE);
+  if (ecclen > 0) jel_setprop(cfg, JEL_PROP_ECC_BLOCKLEN, ecclen);
+  jel_setprop(cfg, JEL_PROP_EMBED_LENGTH, embed_length);
+  return cfg;
+}
+
+
+/*
+ * libjpeg errors unwind to the recompression routine rather than
+ * exiting the worker:
+ */
+typedef struct {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jmpbuff;
+} recode_error_mgr;
+
+static void recode_error_exit (j_common_ptr cinfo) {
+  longjmp(((recode_error_mgr *) cinfo->err)->jmpbuff, 1);
+}
+
+static void recode_silent (j_common_ptr cinfo) {
+}
+
+
+/*
+ * Decode 'jpeg' to pixels and re-encode at 'quality', in memory.
+ * Returns a malloc'ed buffer (free it), or NULL if libjpeg fails:
+ */
+static unsigned char *recompress(unsigned char *jpeg, int len, int quality, unsigned long *outlen) {
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_compress_struct cinfo;
+  recode_error_mgr jerr;
+  unsigned char * volatile out = NULL;
+  JSAMPARRAY row;
+  int stride;
+
+  *outlen = 0;
+
+  /* One error manager serves both objects: */
+  dinfo.err = cinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = recode_error_exit;
+  jerr.mgr.output_message = recode_silent;
+
+  jpeg_create_decompress(&dinfo);
+  jpeg_create_compress(&cinfo);
+
+  if (setjmp(jerr.jmpbuff)) {
+    jpeg_destroy_decompress(&dinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(out);
+    return NULL;
+  }
+
+  jpeg_mem_src(&dinfo, jpeg, len);
+  jpeg_read_header(&dinfo, TRUE);
+  jpeg_start_decompress(&dinfo);
+
+  jpeg_mem_dest(&cinfo, (unsigned char **) &out, outlen);
+  cinfo.image_width = dinfo.output_width;
+  cinfo.image_height = dinfo.output_height;
+  cinfo.input_components = dinfo.output_components;
+  cinfo.in_color_space = dinfo.out_color_space;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  stride = dinfo.output_width * dinfo.output_components;
+  row = (*dinfo.mem->alloc_sarray) ((j_common_ptr) &dinfo, JPOOL_IMAGE, stride, 1);
+
+  while (dinfo.output_scanline < dinfo.output_height) {
+    jpeg_read_scanlines(&dinfo, row, 1);
+    jpeg_write_scanlines(&cinfo, row, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_compress(&cinfo);
+  jpeg_destroy_decompress(&dinfo);
+
+  return out;
+}
+
+
+static long count_bit_errors(unsigned char *a, unsigned char *b, int len) {
+  long n = 0;
+  int i;
+  unsigned char x;
+
+  for (i = 0; i < len; i++)
+    for (x = a[i] ^ b[i]; x; x &= x - 1) n++;
+  return n;
+}
+
+
+static void send_result(int fd, int image, int quality, int status, int msglen, long bit_errors) {
+  trial_result r;
+
+  r.image = image;
+  r.quality = quality;
+  r.status = status;
+  r.msglen = msglen;
+  r.bit_errors = bit_errors;
+
+  /* Records are much smaller than PIPE_BUF, so writes from different
+   * workers never interleave: */
+  if (write(fd, &r, sizeof(r)) != sizeof(r)) exit(EXIT_FAILURE);
+}
+
+
+/* Run every trial for one cover image: */
+static void run_image(int fd, int image, const char *path) {
+  unsigned char *cover, *stego = NULL, *msg = NULL, *buf = NULL;
+  unsigned char *recoded, *src;
+  unsigned long recodedlen;
+  int len, stegolen = 0, msglen = 0, srclen, maxlen, q, ret, k;
+  jel_config *cfg;
+
+  cover = read_file(path, &len);
+
+  if (cover != NULL) {
+    cfg = new_config();
+    if (jel_set_mem_source(cfg, cover, len) == 0) {
+      if (embed_quality > 0) jel_setprop(cfg, JEL_PROP_QUALITY, embed_quality);
+      msglen = jel_capacity(cfg);
+      if (msglen > msgsize) msglen = msgsize;
+
+      if (msglen > 0) {
+        msg = malloc(msglen);
+        /* Each image gets its own, reproducible, message: */
+        srand(image + 1);
+        for (k = 0; k < msglen; k++) msg[k] = (unsigned char) rand();
+
+        stego = malloc(4 * len + 65536);
+        if (jel_set_mem_dest(cfg, stego, 4 * len + 65536) == 0 &&
+            jel_embed(cfg, msg, msglen) == msglen)
+          stegolen = cfg->jpeglen;
+      }
+    }
+    jel_free(cfg);
+  }
+
+  for (q = 0; q < nqualities; q++) {
+    if (stegolen <= 0) {
+      send_result(fd, image, q, TRIAL_NO_EMBED, msglen, 0);
+      continue;
+    }
+
+    recoded = NULL;
+    src = stego;
+    srclen = stegolen;
+    if (qualities[q] > 0) {
+      recoded = recompress(stego, stegolen, qualities[q], &recodedlen);
+      if (recoded == NULL) {
+        send_result(fd, image, q, TRIAL_NO_RECODE, msglen, 0);
+        continue;
+      }
+      src = recoded;
+      srclen = (int) recodedlen;
+    }
+
+    cfg = new_config();
+    ret = jel_set_mem_source(cfg, src, srclen);
+    if (ret == 0) {
+      /* An embedded length bounds the ECC-coded length, so the buffer
+       * must be able to hold the raw capacity; otherwise the length
+       * we pass is the plaintext length: */
+      maxlen = embed_length ? jel_raw_capacity(cfg) : msglen;
+      if (maxlen < msglen) maxlen = msglen;
+      buf = calloc(maxlen, 1);
+      ret = jel_extract(cfg, buf, maxlen);
+    }
+    jel_free(cfg);
+    free(recoded);
+
+    if (ret < 0) {
+      send_result(fd, image, q, TRIAL_NO_EXTRACT, msglen, 8L * msglen);
+    } else {
+      /* Bytes that were never extracted stay zero and count as
+       * errors like any others: */
+      k = count_bit_errors(msg, buf, msglen);
+      send_result(fd, image, q, (k == 0 && ret == msglen) ? TRIAL_OK : TRIAL_DAMAGED, msglen, k);
+    }
+    free(buf);
+    buf = NULL;
+  }
+
+  free(cover);
+  free(stego);
+  free(msg);
+}
+
+
+static const char *status_name(int status) {
+  switch (status) {
+  case TRIAL_DAMAGED:    return "damaged";
+  case TRIAL_NO_EMBED:   return "embed failed";
+  case TRIAL_NO_RECODE:  return "recompression failed";
+  case TRIAL_NO_EXTRACT: return "extract failed";
+  default:               return "ok";
+  }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int argn, w, q;
+  char **names = NULL;
+  int nnames = 0;
+  int fds[2];
+  pid_t *pids;
+  trial_result r;
+  quality_totals totals[MAX_QUALITIES];
+  long ntrials = 0;
+  long long t0, elapsed;
+  double secs;
+  FILE *fp = stdout;
+  int status, failed = 0;
+  ssize_t n;
+
+  progname = argv[0];
+
+  argn = parse_switches(argc, argv);
+  if (argn >= argc) usage();
+
+  for (; argn < argc; argn++)
+    if (list_dir(argv[argn], &names, &nnames) != 0) exit(EXIT_FAILURE);
+
+  if (nnames == 0) {
+    fprintf(stderr, "%s: no JPEG files found\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
+  if (nworkers == 0) nworkers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nworkers < 1) nworkers = 1;
+  if (nworkers > nnames) nworkers = nnames;
+
+  if (pipe(fds) != 0) {
+    fprintf(stderr, "%s: pipe: %s\n", progname, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  t0 = now_ns();
+
+  /* Worker w takes images w, w + nworkers, ... */
+  pids = calloc(nworkers, sizeof(pid_t));
+  for (w = 0; w < nworkers; w++) {
+    pids[w] = fork();
+    if (pids[w] < 0) {
+      fprintf(stderr, "%s: fork: %s\n", progname, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    if (pids[w] == 0) {
+      close(fds[0]);
+      for (argn = w; argn < nnames; argn += nworkers) run_image(fds[1], argn, names[argn]);
+      close(fds[1]);
+      _exit(EXIT_SUCCESS);
+    }
+  }
+  close(fds[1]);
+
+  memset(totals, 0, sizeof(totals));
+
+  while ((n = read(fds[0], &r, sizeof(r))) == sizeof(r)) {
+    quality_totals *t = &totals[r.quality];
+
+    ntrials++;
+    t->trials++;
+    switch (r.status) {
+    case TRIAL_OK:         t->ok++; break;
+    case TRIAL_DAMAGED:    t->damaged++; break;
+    case TRIAL_NO_EMBED:   t->no_embed++; break;
+    case TRIAL_NO_RECODE:  t->no_recode++; break;
+    case TRIAL_NO_EXTRACT: t->no_extract++; break;
+    }
+
+    /* The bit error rate is over trials that got as far as an
+     * extraction: */
+    if (r.status != TRIAL_NO_EMBED && r.status != TRIAL_NO_RECODE) {
+      t->bit_errors += r.bit_errors;
+      t->bits += 8.0 * r.msglen;
+    }
+
+    if (verbose && r.status != TRIAL_OK)
+      fprintf(stderr, "%s q=%d: %s (%ld bit errors in %d bytes)\n", names[r.image],
+              qualities[r.quality], status_name(r.status), r.bit_errors, r.msglen);
+  }
+  close(fds[0]);
+
+  for (w = 0; w < nworkers; w++) {
+    if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      failed++;
+  }
+  elapsed = now_ns() - t0;
+  secs = elapsed / 1e9;
+
+  if (failed || ntrials != (long) nnames * nqualities)
+    fprintf(stderr, "%s: %d workers failed; %ld of %ld trials reported\n",
+            progname, failed, ntrials, (long) nnames * nqualities);
+
+  if (outfilename != NULL) {
+    fp = fopen(outfilename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "%s: cannot open %s\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"benchmark\": \"jelrobust\",\n");
+  fprintf(fp, "  \"version\": \"%s\",\n", JELROBUST_VERSION);
+  fprintf(fp, "  \"libjel\": \"%s\",\n", jel_version_string());
+  fprintf(fp, "  \"config\": { \"message\": %d, \"ecc\": %s, \"ecc_blocklen\": %d, \"embed_length\": %s, "
+          "\"embed_quality\": %d, \"quanta\": %d, \"workers\": %d },\n",
+          msgsize, ecc ? "true" : "false", ecclen, embed_length ? "true" : "false",
+          embed_quality, nlevels, nworkers);
+  fprintf(fp, "  \"images\": %d,\n", nnames);
+  fprintf(fp, "  \"seconds\": %.3f,\n", secs);
+  fprintf(fp, "  \"images_per_sec\": %.3f,\n", secs > 0 ? nnames / secs : 0.0);
+  fprintf(fp, "  \"results\": [\n");
+  for (q = 0; q < nqualities; q++) {
+    quality_totals *t = &totals[q];
+    long tried = t->trials - t->no_embed;
+
+    fprintf(fp, "    { \"quality\": %d, \"trials\": %ld, \"recovered\": %ld, \"damaged\": %ld, "
+            "\"embed_failed\": %ld, \"recompress_failed\": %ld, \"extract_failed\": %ld, "
+            "\"success_rate\": %.4f, \"bit_error_rate\": %.6f }%s\n",
+            qualities[q], t->trials, t->ok, t->damaged, t->no_embed, t->no_recode, t->no_extract,
+            tried > 0 ? (double) t->ok / tried : 0.0,
+            t->bits > 0 ? t->bit_errors / t->bits : 0.0,
+            (q < nqualities - 1) ? "," : "");
+  }
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+
+  if (fp != stdout) fclose(fp);
+
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
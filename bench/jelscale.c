@@ -0,0 +1,700 @@
+/*
+ * jelscale.c - Scaling benchmark for libjel over synthetic covers.
+ *
+ * The bundled covers are all small, so this builds its own: for each
+ * size (in megapixels), chroma subsampling and quality in the sweep,
+ * a cover is compressed in memory from a procedural texture or by
+ * tiling a PPM image (e.g. stegtester/data/images/tree640.pnm).  Rows
+ * are generated as libjpeg asks for them, so even 100+ MP covers never
+ * exist as a pixel buffer.
+ *
+ * Capacity, embed and extract are then timed on each cover.  Every
+ * phase runs in a child process so that its peak resident set can
+ * be read without the other phases or earlier covers in it.
+ * The JSON report gives, per case, the median time, the per-phase
+ * breakdown from jel_get_stats, nanoseconds per pixel, the peak
+ * memory, and the local scaling exponent against the next smaller
+ * size with the same subsampling and quality: 1.0 is linear in area,
+ * and anything well above it is where costs go superlinear.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <jel/jel.h>
+
+#define JELSCALE_VERSION "1.0"
+
+#define MAX_SIZES      32
+#define MAX_QUALITIES  16
+#define MAX_SAMPLINGS  3
+
+static const char * progname;
+static char * outfilename = NULL;  /* for -outfile switch */
+static char * tilename = NULL;     /* for -tile switch */
+static double sizes[MAX_SIZES] = { 0.1, 0.4, 1.6, 6.4, 25.6, 102.4 };
+static int nsizes = 6;
+static int qualities[MAX_QUALITIES] = { 75 };
+static int nqualities = 1;
+static int samplings[MAX_SAMPLINGS] = { 444, 422, 420 };
+static int nsamplings = 3;
+static double fill = 0.5;          /* Message size as a fraction of capacity. */
+static int reps = 3;
+static int ecc = 1;
+static int nlevels = JEL_NLEVELS;
+static int verbose = 0;
+
+
+/* A PPM image to tile, if -tile was given: */
+static unsigned char *tile = NULL;
+static int tile_width, tile_height;
+
+
+#define PHASE_CAPACITY 0
+#define PHASE_EMBED    1
+#define PHASE_EXTRACT  2
+#define NPHASES        3
+
+static const char *phase_names[NPHASES] = { "capacity", "embed", "extract" };
+
+/* Phase statuses besides libjel's own errors: */
+#define STATUS_MISMATCH  -100          /* Embed or extract came up short. */
+#define STATUS_NOT_RUN   -101          /* An earlier phase failed. */
+
+
+/* What a child reports for one phase: */
+typedef struct {
+  int status;                      /* 0, or the failing return code. */
+  int result;                      /* Capacity, or bytes embedded/extracted. */
+  long long median_ns;             /* Over reps, jel_init to jel_free. */
+  long long min_ns;
+  jel_stats stats;                 /* From the last rep. */
+  long peak_kb;                    /* Peak RSS above the child's baseline. */
+} phase_result;
+
+
+/* One cover in the sweep: */
+typedef struct {
+  double megapixels;
+  int width, height;
+  int sampling;
+  int quality;
+  long jpeg_bytes;
+  int msglen;
+  phase_result phase[NPHASES];
+} scale_case;
+
+
+LOCAL(void)
+usage (void)
+{
+  fprintf(stderr, "usage: %s [switches]\n", progname);
+  fprintf(stderr, "Times capacity, embed and extract on synthetic covers of increasing size.\n");
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -megapixels a,b,... Cover sizes (default=0.1,0.4,1.6,6.4,25.6,102.4).\n");
+  fprintf(stderr, "  -sampling a,b,...   Chroma subsampling, from 444, 422 and 420 (default=all).\n");
+  fprintf(stderr, "  -qualities a,b,...  Cover qualities (default=75).\n");
+  fprintf(stderr, "  -tile <file.ppm>    Tile a binary PPM instead of a procedural texture.\n");
+  fprintf(stderr, "  -fill F             Embed F times the capacity (default=0.5).\n");
+  fprintf(stderr, "  -reps N             Timed repetitions per phase (default=3).\n");
+  fprintf(stderr, "  -noecc              Do not use error correcting codes.\n");
+  fprintf(stderr, "  -quanta N           Ask for N quanta for embedding (default=8).\n");
+  fprintf(stderr, "  -outfile <file>     Write the JSON report to file (default=stdout).\n");
+  fprintf(stderr, "  -verbose            Report each case on stderr as it finishes.\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static boolean
+keymatch (char * arg, const char * keyword, int minchars)
+{
+  register int ca, ck;
+  register int nmatched = 0;
+
+  while ((ca = *arg++) != '\0') {
+    if ((ck = *keyword++) == '\0')
+      return FALSE;		/* arg longer than keyword, no good */
+    if (isupper(ca))		/* force arg to lcase (assume ck is already) */
+      ca = tolower(ca);
+    if (ca != ck)
+      return FALSE;		/* no good */
+    nmatched++;			/* count matched characters */
+  }
+  /* reached end of argument; fail if it's too short for unique abbrev */
+  if (nmatched < minchars)
+    return FALSE;
+  return TRUE;			/* A-OK */
+}
+
+
+/* Parse a comma separated list of numbers; returns the count: */
+static int parse_list(char *list, double *values, int max) {
+  char *tok;
+  int n = 0;
+
+  for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    if (n >= max) usage();
+    values[n++] = atof(tok);
+  }
+  if (n == 0) usage();
+  return n;
+}
+
+
+LOCAL(int)
+parse_switches (int argc, char **argv)
+{
+  int argn, k;
+  char * arg;
+  double values[MAX_SIZES];
+
+  for (argn = 1; argn < argc; argn++) {
+    arg = argv[argn];
+    if (*arg != '-') break;
+
+    arg++;			/* advance past switch marker character */
+
+    if (keymatch(arg, "megapixels", 1)) {
+      if (++argn >= argc) usage();
+      nsizes = parse_list(argv[argn], sizes, MAX_SIZES);
+      for (k = 0; k < nsizes; k++)
+        if (sizes[k] <= 0) usage();
+    } else if (keymatch(arg, "sampling", 1)) {
+      if (++argn >= argc) usage();
+      nsamplings = parse_list(argv[argn], values, MAX_SAMPLINGS);
+      for (k = 0; k < nsamplings; k++) {
+        samplings[k] = (int) values[k];
+        if (samplings[k] != 444 && samplings[k] != 422 && samplings[k] != 420) usage();
+      }
+    } else if (keymatch(arg, "qualities", 5)) {
+      if (++argn >= argc) usage();
+      nqualities = parse_list(argv[argn], values, MAX_QUALITIES);
+      for (k = 0; k < nqualities; k++) {
+        qualities[k] = (int) values[k];
+        if (qualities[k] < 1 || qualities[k] > 100) usage();
+      }
+    } else if (keymatch(arg, "quanta", 5)) {
+      if (++argn >= argc) usage();
+      nlevels = atoi(argv[argn]);
+    } else if (keymatch(arg, "tile", 1)) {
+      if (++argn >= argc) usage();
+      tilename = argv[argn];
+    } else if (keymatch(arg, "fill", 1)) {
+      if (++argn >= argc) usage();
+      fill = atof(argv[argn]);
+    } else if (keymatch(arg, "reps", 1)) {
+      if (++argn >= argc) usage();
+      reps = atoi(argv[argn]);
+    } else if (keymatch(arg, "noecc", 1)) {
+      ecc = 0;
+    } else if (keymatch(arg, "outfile", 1)) {
+      if (++argn >= argc) usage();
+      outfilename = argv[argn];
+    } else if (keymatch(arg, "verbose", 1)) {
+      verbose = 1;
+    } else {
+      usage();
+    }
+  }
+
+  if (reps < 1 || fill <= 0 || fill > 1) usage();
+
+  return argn;
+}
+
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static int compare_ll(const void *a, const void *b) {
+  long long x = *(const long long *) a, y = *(const long long *) b;
+
+  return (x > y) - (x < y);
+}
+
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+
+/* Read one whitespace separated header number from a PPM file: */
+static int ppm_number(FILE *fp) {
+  int c, n = 0;
+
+  do {
+    c = getc(fp);
+    if (c == '#')
+      while (c != '\n' && c != EOF) c = getc(fp);
+  } while (isspace(c));
+
+  if (!isdigit(c)) return -1;
+  while (isdigit(c)) {
+    n = 10 * n + (c - '0');
+    c = getc(fp);
+  }
+  return n;
+}
+
+
+/* Load a binary (P6) PPM with 8-bit samples into 'tile': */
+static int load_tile(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  int maxval;
+  size_t len;
+
+  if (fp == NULL) return -1;
+  if (getc(fp) != 'P' || getc(fp) != '6') {
+    fclose(fp);
+    return -1;
+  }
+  tile_width = ppm_number(fp);
+  tile_height = ppm_number(fp);
+  maxval = ppm_number(fp);
+  if (tile_width <= 0 || tile_height <= 0 || maxval != 255) {
+    fclose(fp);
+    return -1;
+  }
+
+  len = (size_t) tile_width * tile_height * 3;
+  tile = malloc(len);
+  if (tile == NULL || fread(tile, 1, len, fp) != len) {
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  return 0;
+}
+
+
+/* A cheap integer hash, for the noise in the procedural texture: */
+static unsigned int hash2(unsigned int x, unsigned int y) {
+  unsigned int h = x * 374761393u + y * 668265263u;
+
+  h = (h ^ (h >> 13)) * 1274126177u;
+  return h ^ (h >> 16);
+}
+
+
+/*
+ * Fill one RGB row.  Tiles are mirrored so that there are no seams;
+ * the procedural texture is smooth gradients and waves with some
+ * fine grain, which gives photograph-like AC energy at any size.
+ */
+static void make_row(JSAMPLE *row, int y, int width) {
+  int x, c, v;
+
+  if (tile != NULL) {
+    int ty = y % (2 * tile_height);
+    unsigned char *src;
+
+    if (ty >= tile_height) ty = 2 * tile_height - 1 - ty;
+    src = tile + (size_t) ty * tile_width * 3;
+    for (x = 0; x < width; x++) {
+      int tx = x % (2 * tile_width);
+
+      if (tx >= tile_width) tx = 2 * tile_width - 1 - tx;
+      row[3 * x] = src[3 * tx];
+      row[3 * x + 1] = src[3 * tx + 1];
+      row[3 * x + 2] = src[3 * tx + 2];
+    }
+    return;
+  }
+
+  for (x = 0; x < width; x++) {
+    double wave = 40.0 * sin(x * 0.021 + y * 0.013) + 25.0 * sin(hypot(x - 300.0, y - 200.0) * 0.05);
+    int grain = (int) (hash2(x, y) & 31) - 16;
+
+    for (c = 0; c < 3; c++) {
+      v = 128 + (int) (wave * (c == 1 ? -0.7 : 1.0)) + ((x >> 3) + (y >> 4) * (c + 1)) % 48 - 24 + grain;
+      row[3 * x + c] = (JSAMPLE) (v < 0 ? 0 : v > 255 ? 255 : v);
+    }
+  }
+}
+
+
+/* libjpeg errors while synthesizing a cover unwind to make_cover: */
+typedef struct {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jmpbuff;
+} synth_error_mgr;
+
+static void synth_error_exit (j_common_ptr cinfo) {
+  longjmp(((synth_error_mgr *) cinfo->err)->jmpbuff, 1);
+}
+
+
+/* Compress a width x height cover in memory.  Returns a malloc'ed
+ * buffer (free it), or NULL if libjpeg fails: */
+static unsigned char *make_cover(int width, int height, int sampling, int quality, unsigned long *outlen) {
+  struct jpeg_compress_struct cinfo;
+  synth_error_mgr jerr;
+  unsigned char * volatile out = NULL;
+  JSAMPROW row;
+
+  *outlen = 0;
+  cinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = synth_error_exit;
+  jpeg_create_compress(&cinfo);
+
+  if (setjmp(jerr.jmpbuff)) {
+    jpeg_destroy_compress(&cinfo);
+    free(out);
+    return NULL;
+  }
+
+  jpeg_mem_dest(&cinfo, (unsigned char **) &out, outlen);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+
+  /* Luminance sampling factors set the chroma subsampling: */
+  cinfo.comp_info[0].h_samp_factor = (sampling == 444) ? 1 : 2;
+  cinfo.comp_info[0].v_samp_factor = (sampling == 420) ? 2 : 1;
+
+  jpeg_start_compress(&cinfo, TRUE);
+
+  row = (*cinfo.mem->alloc_small) ((j_common_ptr) &cinfo, JPOOL_IMAGE, (size_t) width * 3);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    make_row(row, cinfo.next_scanline, width);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  return out;
+}
+
+
+static jel_config *new_config(void) {
+  jel_config *cfg = jel_init(nlevels);
+
+  jel_setprop(cfg, JEL_PROP_ECC_METHOD, ecc ? JEL_ECC_RSCODE : JEL_ECC_NONE);
+  jel_setprop(cfg, JEL_PROP_EMBED_LENGTH, 1);
+  return cfg;
+}
+
+
+static long resident_kb(void) {
+  long pages = 0, resident = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(fp);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+/*
+ * One rep of a phase, from jel_init to jel_free.  For the embed
+ * phase, 'out' receives the stego image; for extract, the message
+ * is checked against 'msg'.  Returns the phase's result, or a
+ * negative error:
+ */
+static int run_once(int phase, unsigned char *jpeg, int len, unsigned char *msg, int msglen,
+                    unsigned char *out, int outlen, int *stegolen, jel_stats *stats) {
+  jel_config *cfg = new_config();
+  unsigned char *buf;
+  int ret, maxlen;
+
+  ret = jel_set_mem_source(cfg, jpeg, len);
+  if (ret == 0) {
+    switch (phase) {
+    case PHASE_CAPACITY:
+      ret = jel_capacity(cfg);
+      break;
+
+    case PHASE_EMBED:
+      ret = jel_set_mem_dest(cfg, out, outlen);
+      if (ret == 0) ret = jel_embed(cfg, msg, msglen);
+      if (ret == msglen) *stegolen = cfg->jpeglen;
+      else if (ret >= 0) ret = STATUS_MISMATCH;
+      break;
+
+    case PHASE_EXTRACT:
+      /* The embedded length counts the ECC bytes, so the buffer has
+       * to hold the raw capacity: */
+      maxlen = jel_raw_capacity(cfg);
+      buf = malloc(maxlen > msglen ? maxlen : msglen);
+      ret = jel_extract(cfg, buf, maxlen);
+      if (ret >= 0 && (ret != msglen || memcmp(buf, msg, msglen) != 0)) ret = STATUS_MISMATCH;
+      free(buf);
+      break;
+    }
+  }
+  jel_get_stats(cfg, stats);
+  jel_free(cfg);
+  return ret;
+}
+
+
+/* The body of a phase's child process: */
+static void run_phase(int fd, int phase, unsigned char *jpeg, int len, unsigned char *msg, int msglen,
+                      unsigned char *out, int outlen) {
+  phase_result r;
+  long long *times = calloc(reps, sizeof(long long));
+  long baseline = resident_kb();
+  struct rusage ru;
+  int k, stegolen = 0;
+
+  memset(&r, 0, sizeof(r));
+  for (k = 0; k < reps; k++) {
+    long long t0 = now_ns();
+
+    r.result = run_once(phase, jpeg, len, msg, msglen, out, outlen, &stegolen, &r.stats);
+    times[k] = now_ns() - t0;
+    if (r.result < 0) {
+      r.status = r.result;
+      break;
+    }
+  }
+  if (k == reps) {
+    qsort(times, reps, sizeof(long long), compare_ll);
+    r.median_ns = times[reps / 2];
+    r.min_ns = times[0];
+  }
+
+  /* ru_maxrss is in kilobytes on Linux: */
+  getrusage(RUSAGE_SELF, &ru);
+  r.peak_kb = ru.ru_maxrss - baseline;
+  if (r.peak_kb < 0) r.peak_kb = 0;
+
+  if (write(fd, &r, sizeof(r)) != sizeof(r)) _exit(EXIT_FAILURE);
+  if (phase == PHASE_EMBED && r.status == 0) {
+    /* Hand the stego image back for the extract phase: */
+    if (write(fd, &stegolen, sizeof(stegolen)) != sizeof(stegolen) ||
+        write(fd, out, stegolen) != stegolen)
+      _exit(EXIT_FAILURE);
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+
+static int read_all(int fd, void *buf, size_t len) {
+  char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+
+/*
+ * Fork a child for one phase and collect its result.  For the embed
+ * phase the stego image comes back into 'out' and its length into
+ * 'stegolen':
+ */
+static int fork_phase(int phase, unsigned char *jpeg, int len, unsigned char *msg, int msglen,
+                      unsigned char *out, int outlen, int *stegolen, phase_result *r) {
+  int fds[2], status, ok;
+  pid_t pid;
+
+  if (pipe(fds) != 0) return -1;
+  fflush(NULL);
+
+  pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    close(fds[0]);
+    run_phase(fds[1], phase, jpeg, len, msg, msglen, out, outlen);
+  }
+  close(fds[1]);
+
+  ok = (read_all(fds[0], r, sizeof(*r)) == 0);
+  if (ok && phase == PHASE_EMBED && r->status == 0)
+    ok = (read_all(fds[0], stegolen, sizeof(*stegolen)) == 0 &&
+          *stegolen > 0 && *stegolen <= outlen &&
+          read_all(fds[0], out, *stegolen) == 0);
+  close(fds[0]);
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) ok = 0;
+  return ok ? 0 : -1;
+}
+
+
+/* Build one cover and run every phase on it: */
+static int run_case(scale_case *sc) {
+  unsigned char *cover, *stego = NULL, *msg = NULL;
+  unsigned long coverlen;
+  int k, stegolen = 0, outlen;
+  double pixels = sc->megapixels * 1e6;
+
+  /* 4:3 covers, whole MCUs: */
+  sc->width = ((int) sqrt(pixels * 4.0 / 3.0) + 15) & ~15;
+  sc->height = ((int) (sc->width * 3 / 4) + 15) & ~15;
+
+  cover = make_cover(sc->width, sc->height, sc->sampling, sc->quality, &coverlen);
+  if (cover == NULL) return -1;
+  sc->jpeg_bytes = (long) coverlen;
+
+  if (fork_phase(PHASE_CAPACITY, cover, (int) coverlen, NULL, 0, NULL, 0, NULL, &sc->phase[PHASE_CAPACITY]) != 0 ||
+      sc->phase[PHASE_CAPACITY].status != 0) {
+    free(cover);
+    return -1;
+  }
+
+  sc->msglen = (int) (fill * sc->phase[PHASE_CAPACITY].result);
+  if (sc->msglen < 1) sc->msglen = 1;
+  msg = malloc(sc->msglen);
+  srand(sc->width);
+  for (k = 0; k < sc->msglen; k++) msg[k] = (unsigned char) rand();
+
+  /* Output at the cover's quality is about the cover's size: */
+  outlen = 2 * (int) coverlen + 65536;
+  stego = malloc(outlen);
+
+  if (fork_phase(PHASE_EMBED, cover, (int) coverlen, msg, sc->msglen, stego, outlen, &stegolen,
+                 &sc->phase[PHASE_EMBED]) == 0 && sc->phase[PHASE_EMBED].status == 0)
+    fork_phase(PHASE_EXTRACT, stego, stegolen, msg, sc->msglen, NULL, 0, NULL, &sc->phase[PHASE_EXTRACT]);
+  else
+    sc->phase[PHASE_EXTRACT].status = STATUS_NOT_RUN;
+
+  free(cover);
+  free(stego);
+  free(msg);
+  return 0;
+}
+
+
+static void print_phase(FILE *fp, scale_case *sc, scale_case *prev, int phase) {
+  phase_result *r = &sc->phase[phase];
+  jel_stats *s = &r->stats;
+  double pixels = (double) sc->width * sc->height;
+
+  fprintf(fp, "\"%s\": { ", phase_names[phase]);
+  if (r->status != 0) {
+    fprintf(fp, "\"status\": %d }", r->status);
+    return;
+  }
+
+  fprintf(fp, "\"median_us\": %.1f, \"min_us\": %.1f, \"ns_per_pixel\": %.3f, ",
+          r->median_ns / 1e3, r->min_ns / 1e3, r->median_ns / pixels);
+
+  /* Local exponent of time against area, from the next smaller cover: */
+  if (prev != NULL && prev->phase[phase].status == 0 && prev->phase[phase].median_ns > 0 &&
+      pixels > (double) prev->width * prev->height)
+    fprintf(fp, "\"exponent\": %.3f, ",
+            log((double) r->median_ns / prev->phase[phase].median_ns) /
+            log(pixels / ((double) prev->width * prev->height)));
+  else
+    fprintf(fp, "\"exponent\": null, ");
+
+  fprintf(fp, "\"peak_kb\": %ld, \"pool_bytes\": %ld, "
+          "\"phases_us\": { \"header\": %.1f, \"read_coefs\": %.1f, \"ecc\": %.1f, "
+          "\"scan\": %.1f, \"write_coefs\": %.1f, \"finish\": %.1f } }",
+          r->peak_kb, s->pool_bytes,
+          s->header_ns / 1e3, s->read_coefs_ns / 1e3, s->ecc_ns / 1e3,
+          s->scan_ns / 1e3, s->write_coefs_ns / 1e3, s->finish_ns / 1e3);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int argn, i, j, p, ncases, failed = 0;
+  scale_case *cases, *sc, *prev;
+  long long t0;
+  FILE *fp = stdout;
+
+  progname = argv[0];
+
+  argn = parse_switches(argc, argv);
+  if (argn < argc) usage();
+
+  if (tilename != NULL && load_tile(tilename) != 0) {
+    fprintf(stderr, "%s: cannot read binary PPM %s\n", progname, tilename);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Run sizes in increasing order, so exponents compare neighbours: */
+  qsort(sizes, nsizes, sizeof(double), compare_double);
+
+  ncases = nsamplings * nqualities * nsizes;
+  cases = calloc(ncases, sizeof(scale_case));
+
+  t0 = now_ns();
+  for (i = 0; i < ncases; i++) {
+    sc = &cases[i];
+    sc->sampling = samplings[i / (nqualities * nsizes)];
+    sc->quality = qualities[(i / nsizes) % nqualities];
+    sc->megapixels = sizes[i % nsizes];
+
+    if (run_case(sc) != 0) {
+      fprintf(stderr, "%s: could not run %.2f MP %d q=%d\n", progname,
+              sc->megapixels, sc->sampling, sc->quality);
+      sc->phase[PHASE_CAPACITY].status = sc->phase[PHASE_EMBED].status =
+        sc->phase[PHASE_EXTRACT].status = STATUS_NOT_RUN;
+    }
+    for (p = 0; p < NPHASES; p++)
+      if (sc->phase[p].status != 0) failed++;
+
+    if (verbose)
+      fprintf(stderr, "%dx%d %d q=%d: capacity %.1f ms, embed %.1f ms, extract %.1f ms\n",
+              sc->width, sc->height, sc->sampling, sc->quality,
+              sc->phase[PHASE_CAPACITY].median_ns / 1e6, sc->phase[PHASE_EMBED].median_ns / 1e6,
+              sc->phase[PHASE_EXTRACT].median_ns / 1e6);
+  }
+
+  if (outfilename != NULL) {
+    fp = fopen(outfilename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "%s: cannot open %s\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"benchmark\": \"jelscale\",\n");
+  fprintf(fp, "  \"version\": \"%s\",\n", JELSCALE_VERSION);
+  fprintf(fp, "  \"libjel\": \"%s\",\n", jel_version_string());
+  fprintf(fp, "  \"config\": { \"source\": \"%s\", \"fill\": %.3f, \"reps\": %d, \"ecc\": %s, \"quanta\": %d },\n",
+          tilename != NULL ? tilename : "procedural", fill, reps, ecc ? "true" : "false", nlevels);
+  fprintf(fp, "  \"seconds\": %.3f,\n", (now_ns() - t0) / 1e9);
+  fprintf(fp, "  \"results\": [\n");
+  for (i = 0; i < ncases; i++) {
+    sc = &cases[i];
+    prev = (i % nsizes > 0) ? &cases[i - 1] : NULL;
+
+    fprintf(fp, "    { \"megapixels\": %.3f, \"width\": %d, \"height\": %d, \"sampling\": \"%d\", "
+            "\"quality\": %d, \"jpeg_bytes\": %ld, \"capacity_bytes\": %d, \"message_bytes\": %d,\n",
+            (double) sc->width * sc->height / 1e6, sc->width, sc->height, sc->sampling,
+            sc->quality, sc->jpeg_bytes, sc->phase[PHASE_CAPACITY].result, sc->msglen);
+    for (j = 0; j < NPHASES; j++) {
+      fprintf(fp, "      ");
+      print_phase(fp, sc, prev, j);
+      fprintf(fp, "%s\n", (j < NPHASES - 1) ? "," : "");
+    }
+    fprintf(fp, "    }%s\n", (i < ncases - 1) ? "," : "");
+  }
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+
+  if (fp != stdout) fclose(fp);
+  exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
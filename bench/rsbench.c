@@ -0,0 +1,473 @@
+/*
+ * rsbench.c - Microbenchmarks for the Reed-Solomon codec and the
+ * libjel ECC wrappers.
+ *
+ * Three groups of measurements, each swept over ECC block lengths:
+ *
+ *  codec     rscode's encode_data and decode_data + check_syndrome,
+ *            in ns per message byte.
+ *  correct   correct_errors_erasures on codewords with a given
+ *            number of injected errors and erasures per block, in ns
+ *            per block and ns per corrected symbol.  NPAR parity
+ *            bytes correct e errors and f erasures when 2e + f <= NPAR;
+ *            the sweep goes one step past that.
+ *  wrappers  ijel_encode_ecc / ijel_decode_ecc (whole messages) and
+ *            ijel_encode_ecc_block / ijel_decode_ecc_block (the
+ *            streaming path used by jel_embed and jel_extract), over
+ *            a range of message sizes and error rates.
+ *
+ * The report is JSON.  Every decode is checked against the original
+ * data, and the fraction recovered is reported alongside the timings.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <jel/jel.h>
+#include <ecc.h>
+
+#define RSBENCH_VERSION "1.0"
+
+/* Internal libjel ECC entry points: */
+unsigned char *ijel_encode_ecc(unsigned char *msg, int msglen, int *outlen);
+unsigned char *ijel_decode_ecc(unsigned char *ecc, int ecclen, int *msglen);
+int ijel_set_ecc_blocklen(int new_len);
+int ijel_ecc_block_payload(int blocklen, int embed_len);
+void ijel_encode_ecc_block(unsigned char *plain, int len, int blocklen,
+                           int embed_len, unsigned char *out);
+int ijel_decode_ecc_block(unsigned char *block, int blocklen, int embed_len,
+                          unsigned char **plain, int *status);
+
+static const char * progname;
+static char * outfilename = NULL;  /* for -outfile switch */
+static long target_bytes = 1000000; /* Bytes of data per measurement. */
+
+static const int blocklens[] = { 8, 12, 20, 32, 64, 128, 255 };
+#define NBLOCKLENS (int) (sizeof(blocklens) / sizeof(blocklens[0]))
+
+static const int msgsizes[] = { 64, 1024, 16384 };
+#define NMSGSIZES (int) (sizeof(msgsizes) / sizeof(msgsizes[0]))
+
+/* Errors and erasures per block for the 'correct' group: */
+static const int damage[][2] = {
+  { 0, 0 }, { 1, 0 }, { NPAR/2, 0 }, { 0, NPAR/2 }, { 0, NPAR },
+  { 1, NPAR-2 }, { NPAR/2 + 1, 0 }
+};
+#define NDAMAGE (int) (sizeof(damage) / sizeof(damage[0]))
+
+/* Errors per block for the wrappers, which cannot be told about
+ * erasures: */
+static const int wrapper_errors[] = { 0, 1, NPAR/2 };
+#define NWRAPPER_ERRORS (int) (sizeof(wrapper_errors) / sizeof(wrapper_errors[0]))
+
+#define POOL 64   /* Distinct codewords cycled through in each loop. */
+
+/* Keeps the copy-only timing loops from being optimized away: */
+static volatile unsigned char sink;
+
+
+LOCAL(void)
+usage (void)
+{
+  fprintf(stderr, "usage: %s [switches]\n", progname);
+  fprintf(stderr, "Times the Reed-Solomon codec and the libjel ECC wrappers.\n");
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -bytes N        Data bytes per measurement (default=1000000).\n");
+  fprintf(stderr, "  -outfile <file> Write the JSON report to file (default=stdout).\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static boolean
+keymatch (char * arg, const char * keyword, int minchars)
+{
+  register int ca, ck;
+  register int nmatched = 0;
+
+  while ((ca = *arg++) != '\0') {
+    if ((ck = *keyword++) == '\0')
+      return FALSE;		/* arg longer than keyword, no good */
+    if (isupper(ca))		/* force arg to lcase (assume ck is already) */
+      ca = tolower(ca);
+    if (ca != ck)
+      return FALSE;		/* no good */
+    nmatched++;			/* count matched characters */
+  }
+  /* reached end of argument; fail if it's too short for unique abbrev */
+  if (nmatched < minchars)
+    return FALSE;
+  return TRUE;			/* A-OK */
+}
+
+
+LOCAL(void)
+parse_switches (int argc, char **argv)
+{
+  int argn;
+  char * arg;
+
+  for (argn = 1; argn < argc; argn++) {
+    arg = argv[argn];
+    if (*arg != '-') usage();
+
+    arg++;			/* advance past switch marker character */
+
+    if (keymatch(arg, "bytes", 1)) {
+      if (++argn >= argc) usage();
+      target_bytes = atol(argv[argn]);
+    } else if (keymatch(arg, "outfile", 1)) {
+      if (++argn >= argc) usage();
+      outfilename = argv[argn];
+    } else {
+      usage();
+    }
+  }
+
+  if (target_bytes < 1) usage();
+}
+
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void fill_random(unsigned char *buf, int len) {
+  int i;
+
+  for (i = 0; i < len; i++) buf[i] = (unsigned char) rand();
+}
+
+
+/*
+ * Damage a codeword of 'len' bytes with 'nerr' errors and 'nera'
+ * erasures at distinct positions.  Erasure locations are stored the
+ * way correct_errors_erasures wants them, counted from the end of
+ * the codeword.
+ */
+static void damage_codeword(unsigned char *cw, int len, int nerr, int nera, int *erasures) {
+  int used[256];
+  int i, p;
+
+  memset(used, 0, sizeof(used));
+
+  for (i = 0; i < nerr + nera && i < len; i++) {
+    do p = rand() % len; while (used[p]);
+    used[p] = 1;
+
+    if (i < nerr) {
+      cw[p] ^= 1 + rand() % 255;
+    } else {
+      cw[p] = 0;
+      erasures[i - nerr] = len - 1 - p;
+    }
+  }
+}
+
+
+static long iterations(int bytes_per_iter) {
+  long n = target_bytes / bytes_per_iter;
+  return (n < POOL) ? POOL : n;
+}
+
+
+static void print_sep(FILE *fp, int *first) {
+  fprintf(fp, "%s\n", *first ? "" : ",");
+  *first = 0;
+}
+
+
+/* encode_data and decode_data + check_syndrome on clean codewords: */
+static void bench_codec(FILE *fp, int blocklen, int *first) {
+  static unsigned char msg[POOL][256], cw[POOL][256];
+  unsigned char work[256];
+  int mlen = blocklen - NPAR;
+  long n = iterations(mlen), i;
+  long long t0, enc_ns, dec_ns, copy_ns;
+  int bad = 0;
+
+  for (i = 0; i < POOL; i++) fill_random(msg[i], mlen);
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) encode_data(msg[i % POOL], mlen, cw[i % POOL]);
+  enc_ns = now_ns() - t0;
+
+  /* decode_data works in place, so each decode starts from a copy.
+   * The cost of the copy alone is measured and taken out: */
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    memcpy(work, cw[i % POOL], blocklen);
+    sink ^= work[0];
+  }
+  copy_ns = now_ns() - t0;
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    memcpy(work, cw[i % POOL], blocklen);
+    decode_data(work, blocklen);
+    if (check_syndrome() != 0) bad++;
+  }
+  dec_ns = now_ns() - t0 - copy_ns;
+
+  print_sep(fp, first);
+  fprintf(fp, "    { \"blocklen\": %d, \"payload\": %d, \"blocks\": %ld, "
+          "\"encode_ns_per_byte\": %.3f, \"syndrome_ns_per_byte\": %.3f, \"bad_syndromes\": %d }",
+          blocklen, mlen, n, (double) enc_ns / (n * mlen),
+          (double) (dec_ns > 0 ? dec_ns : 0) / (n * mlen), bad);
+}
+
+
+/* decode_data + check_syndrome + correct_errors_erasures on damaged
+ * codewords: */
+static void bench_correct(FILE *fp, int blocklen, int nerr, int nera, int *first) {
+  static unsigned char msg[POOL][256], cw[POOL][256];
+  static int erasures[POOL][NPAR+1];
+  unsigned char work[256];
+  int mlen = blocklen - NPAR;
+  long n = iterations(blocklen) / 4, i;  /* Correction is slow. */
+  long long t0, ns, copy_ns;
+  long fixed = 0;
+  int k;
+
+  if (n < POOL) n = POOL;
+
+  for (i = 0; i < POOL; i++) {
+    fill_random(msg[i], mlen);
+    encode_data(msg[i], mlen, cw[i]);
+    damage_codeword(cw[i], blocklen, nerr, nera, erasures[i]);
+  }
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    memcpy(work, cw[i % POOL], blocklen);
+    sink ^= work[0];
+  }
+  copy_ns = now_ns() - t0;
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    k = i % POOL;
+    memcpy(work, cw[k], blocklen);
+    decode_data(work, blocklen);
+    if (check_syndrome() != 0)
+      correct_errors_erasures(work, blocklen, nera, erasures[k]);
+  }
+  ns = now_ns() - t0 - copy_ns;
+  if (ns < 0) ns = 0;
+
+  /* Check the pool once, untimed: */
+  for (k = 0; k < POOL; k++) {
+    memcpy(work, cw[k], blocklen);
+    decode_data(work, blocklen);
+    if (check_syndrome() != 0)
+      correct_errors_erasures(work, blocklen, nera, erasures[k]);
+    if (memcmp(work, msg[k], mlen) == 0) fixed++;
+  }
+
+  print_sep(fp, first);
+  fprintf(fp, "    { \"blocklen\": %d, \"errors\": %d, \"erasures\": %d, \"blocks\": %ld, "
+          "\"recovered\": %.3f, \"ns_per_block\": %.1f, \"ns_per_byte\": %.3f, "
+          "\"ns_per_corrected_symbol\": %s",
+          blocklen, nerr, nera, n, (double) fixed / POOL, (double) ns / n,
+          (double) ns / (n * mlen), (nerr + nera && fixed) ? "" : "null");
+  if (nerr + nera && fixed) fprintf(fp, "%.1f", (double) ns / (n * (nerr + nera)));
+  fprintf(fp, " }");
+}
+
+
+/* Damage each 'blocklen' block of an encoded buffer with 'nerr'
+ * errors: */
+static void damage_buffer(unsigned char *buf, int len, int blocklen, int nerr) {
+  int erasures[NPAR+1];
+  int off;
+
+  for (off = 0; off + blocklen <= len; off += blocklen)
+    damage_codeword(buf + off, blocklen, nerr, 0, erasures);
+}
+
+
+/* ijel_encode_ecc / ijel_decode_ecc on whole messages: */
+static void bench_wrapper(FILE *fp, int blocklen, int msglen, int nerr, int *first) {
+  unsigned char *msg, *ecc, *bad, *work, *out;
+  int ecclen, outlen = 0;
+  long n, i, ok = 0;
+  long long t0, enc_ns, dec_ns, copy_ns;
+  int nblocks;
+
+  ijel_set_ecc_blocklen(blocklen);
+
+  msg = malloc(msglen);
+  fill_random(msg, msglen);
+
+  n = iterations(msglen);
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) free(ijel_encode_ecc(msg, msglen, &ecclen));
+  enc_ns = now_ns() - t0;
+
+  ecc = ijel_encode_ecc(msg, msglen, &ecclen);
+  nblocks = ecclen / blocklen;
+  bad = malloc(ecclen);
+  work = malloc(ecclen);
+  memcpy(bad, ecc, ecclen);
+  damage_buffer(bad, ecclen, blocklen, nerr);
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    memcpy(work, bad, ecclen);
+    sink ^= work[0];
+  }
+  copy_ns = now_ns() - t0;
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    memcpy(work, bad, ecclen);
+    free(ijel_decode_ecc(work, ecclen, &outlen));
+  }
+  dec_ns = now_ns() - t0 - copy_ns;
+  if (dec_ns < 0) dec_ns = 0;
+
+  memcpy(work, bad, ecclen);
+  out = ijel_decode_ecc(work, ecclen, &outlen);
+  ok = (out != NULL && outlen == msglen && memcmp(out, msg, msglen) == 0);
+  free(out);
+
+  print_sep(fp, first);
+  fprintf(fp, "    { \"api\": \"ijel_encode_ecc\", \"blocklen\": %d, \"message\": %d, \"errors_per_block\": %d, "
+          "\"reps\": %ld, \"recovered\": %s, \"encode_ns_per_byte\": %.3f, \"decode_ns_per_byte\": %.3f, "
+          "\"ns_per_corrected_symbol\": %s",
+          blocklen, msglen, nerr, n, ok ? "true" : "false",
+          (double) enc_ns / ((double) n * msglen), (double) dec_ns / ((double) n * msglen),
+          nerr ? "" : "null");
+  if (nerr) fprintf(fp, "%.1f", (double) dec_ns / ((double) n * nblocks * nerr));
+  fprintf(fp, " }");
+
+  free(msg);
+  free(ecc);
+  free(bad);
+  free(work);
+}
+
+
+/* ijel_encode_ecc_block / ijel_decode_ecc_block, as the streaming
+ * embed and extract use them (length byte in each block): */
+static void bench_block_wrapper(FILE *fp, int blocklen, int msglen, int nerr, int *first) {
+  int payload = ijel_ecc_block_payload(blocklen, 1);
+  int nblocks = msglen / payload + 1;
+  unsigned char *msg, *ecc, *bad, *out, *plain;
+  unsigned char work[256];
+  long n, i;
+  long long t0, enc_ns, dec_ns;
+  int b, len, mlen, status, pos, ok = 1;
+  long corrected = 0;
+
+  msg = malloc(msglen);
+  fill_random(msg, msglen);
+  ecc = malloc(nblocks * blocklen);
+  bad = malloc(nblocks * blocklen);
+  out = malloc(msglen + payload);
+
+  n = iterations(msglen);
+
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    for (b = 0, pos = 0; b < nblocks; b++, pos += len) {
+      len = (msglen - pos < payload) ? msglen - pos : payload;
+      ijel_encode_ecc_block(msg + pos, len, blocklen, 1, ecc + b * blocklen);
+    }
+  }
+  enc_ns = now_ns() - t0;
+
+  memcpy(bad, ecc, nblocks * blocklen);
+  damage_buffer(bad, nblocks * blocklen, blocklen, nerr);
+
+  /* Blocks are decoded one at a time from a small copy, as the
+   * extraction sink does: */
+  t0 = now_ns();
+  for (i = 0; i < n; i++) {
+    for (b = 0, pos = 0; b < nblocks; b++) {
+      memcpy(work, bad + b * blocklen, blocklen);
+      mlen = ijel_decode_ecc_block(work, blocklen, 1, &plain, &status);
+      if (i == 0) {
+        if (status > 0) corrected++;
+        if (pos + mlen > msglen + payload) mlen = 0;
+        memcpy(out + pos, plain, mlen);
+      }
+      pos += mlen;
+    }
+    if (i == 0 && (pos != msglen || memcmp(out, msg, msglen) != 0)) ok = 0;
+  }
+  dec_ns = now_ns() - t0;
+
+  print_sep(fp, first);
+  fprintf(fp, "    { \"api\": \"ijel_encode_ecc_block\", \"blocklen\": %d, \"message\": %d, \"errors_per_block\": %d, "
+          "\"reps\": %ld, \"recovered\": %s, \"corrected_blocks\": %ld, \"encode_ns_per_byte\": %.3f, "
+          "\"decode_ns_per_byte\": %.3f, \"ns_per_corrected_symbol\": %s",
+          blocklen, msglen, nerr, n, ok ? "true" : "false", corrected,
+          (double) enc_ns / ((double) n * msglen), (double) dec_ns / ((double) n * msglen),
+          nerr ? "" : "null");
+  if (nerr) fprintf(fp, "%.1f", (double) dec_ns / ((double) n * nblocks * nerr));
+  fprintf(fp, " }");
+
+  free(msg);
+  free(ecc);
+  free(bad);
+  free(out);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  FILE *fp = stdout;
+  int b, d, m, e, first;
+
+  progname = argv[0];
+  parse_switches(argc, argv);
+
+  if (outfilename != NULL) {
+    fp = fopen(outfilename, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "%s: cannot open %s\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  srand(1);
+  initialize_ecc();
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"benchmark\": \"rsbench\",\n");
+  fprintf(fp, "  \"version\": \"%s\",\n", RSBENCH_VERSION);
+  fprintf(fp, "  \"libjel\": \"%s\",\n", jel_version_string());
+  fprintf(fp, "  \"npar\": %d,\n", NPAR);
+  fprintf(fp, "  \"bytes_per_measurement\": %ld,\n", target_bytes);
+
+  fprintf(fp, "  \"codec\": [");
+  for (first = 1, b = 0; b < NBLOCKLENS; b++) bench_codec(fp, blocklens[b], &first);
+  fprintf(fp, "\n  ],\n");
+
+  fprintf(fp, "  \"correct\": [");
+  for (first = 1, b = 0; b < NBLOCKLENS; b++)
+    for (d = 0; d < NDAMAGE; d++)
+      bench_correct(fp, blocklens[b], damage[d][0], damage[d][1], &first);
+  fprintf(fp, "\n  ],\n");
+
+  fprintf(fp, "  \"wrappers\": [");
+  for (first = 1, b = 0; b < NBLOCKLENS; b++)
+    for (m = 0; m < NMSGSIZES; m++)
+      for (e = 0; e < NWRAPPER_ERRORS; e++) {
+        bench_wrapper(fp, blocklens[b], msgsizes[m], wrapper_errors[e], &first);
+        bench_block_wrapper(fp, blocklens[b], msgsizes[m], wrapper_errors[e], &first);
+      }
+  fprintf(fp, "\n  ]\n");
+  fprintf(fp, "}\n");
+
+  if (fp != stdout) fclose(fp);
+
+  exit(EXIT_SUCCESS);
+}
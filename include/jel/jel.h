@@ -2,7 +2,8 @@
  * libjel: JPEG Embedding Library.  Embeds messages in selected
  * frequency components of a JPEG source, and emits the result on a
  * JPEG destination.  Sources and destinations can be named files,
- * FILE* streams, or memory areas.
+ * FILE* streams, file descriptors (including pipes and sockets), or
+ * memory areas.
  *
  * libjel header.  Defines basic structs and functions for libjel.
  *
@@ -31,11 +32,39 @@
 extern "C" {
 #endif
 
-  /* switches on verbose logging; defined and set in jel.c */
+  /* switches on verbose logging; defined and set in jel.c.  Read by
+   * jel_init: a config made while it is true logs at JEL_LOG_DEBUG. */
   extern bool jel_verbose;
 
 #define JEL_NLEVELS 8  /* Default number of quanta for each freq. */
 
+#define JEL_IO_BUFSIZE 65536  /* Default buffer size for fd sources and destinations. */
+
+/*
+ * Log levels, from least to most verbose.  A message is logged if its
+ * level is at most JEL_PROP_LOG_LEVEL (jel_config.verbose, default
+ * JEL_LOG_ERROR) and there is somewhere to send it.
+ */
+#define JEL_LOG_NONE    0
+#define JEL_LOG_ERROR   1
+#define JEL_LOG_WARN    2
+#define JEL_LOG_INFO    3
+#define JEL_LOG_DEBUG   4
+
+/* Messages above this level are compiled out of the library
+ * entirely; e.g., build with -DJEL_LOG_MAX_LEVEL=JEL_LOG_WARN. */
+#ifndef JEL_LOG_MAX_LEVEL
+#define JEL_LOG_MAX_LEVEL JEL_LOG_DEBUG
+#endif
+
+#define JEL_LOG_BUFSIZE 4096  /* Log output is buffered up to this many bytes. */
+
+/*
+ * Receives buffered log output: 'len' bytes of text, possibly several
+ * lines, not NUL-terminated.
+ */
+typedef void (*jel_log_sink)( void *ctx, const char *text, int len );
+
 /*
  * A trivial frequency spec for now.  Later, we might want a way to
  * generate varying sequences based on a shared secret.  We will also
@@ -45,10 +74,13 @@ extern "C" {
 
   typedef struct {
     int nfreqs;
+    int nwanted;            /* JEL_PROP_NFREQS, for images not yet read. */
     int nlevels;
     unsigned int seed;
     int freqs[DCTSIZE2]; /* List of admissible frequency indices. */
     int in_use[DCTSIZE2];   /* List of frequency indices that we will use. */
+    unsigned int rtab[31];  /* Shuffle generator state, reseeded from */
+    int rfront, rrear;      /* 'seed' at the start of each operation. */
   } jel_freq_spec;
 
 
@@ -59,9 +91,82 @@ extern "C" {
 #define JEL_ECC_NONE    0
 #define JEL_ECC_RSCODE  1
 
+/* ECC block lengths (JEL_PROP_ECC_BLOCKLEN) that can be used: a block
+ * holds JEL_ECC_NPAR parity bytes, a length byte and at least one
+ * message byte, and no more than 255 bytes in all.  jel_setprop
+ * turns other lengths away with JEL_ERR_INVALIDARG. */
+#define JEL_ECC_NPAR          4
+#define JEL_ECC_MIN_BLOCKLEN  (JEL_ECC_NPAR + 2)
+#define JEL_ECC_MAX_BLOCKLEN  255
+
+/* Message framing (JEL_PROP_FRAME).  JEL_FRAME_NONE embeds a bare
+ * 4-byte length and, with ECC, a length byte in every ECC block.
+ * JEL_FRAME_V1 embeds a checked header giving the length, ECC block
+ * length and flags, and a CRC of the message after it.  Embedding and
+ * extraction must agree. */
+#define JEL_FRAME_NONE  0
+#define JEL_FRAME_V1    1
+
+/* Message compression (JEL_PROP_COMPRESS).  With JEL_COMPRESS_LZF,
+ * jel_embed compresses the message before ECC whenever that makes
+ * the embedded message smaller, and flags it in the frame header, so
+ * it needs JEL_FRAME_V1 (which setting it turns on).  Extraction
+ * decompresses any flagged message whatever this is set to. */
+#define JEL_COMPRESS_NONE  0
+#define JEL_COMPRESS_LZF   1
+
+/* Output quality (JEL_PROP_QUALITY).  1 to 100 re-quantizes the
+ * embedded image at that quality.  JEL_QUALITY_COVER, the default,
+ * (or any value below 1) keeps the cover's own quant tables, and
+ * puts them back if a quality was set for the current source. */
+#define JEL_QUALITY_COVER  -1
+
   /* #define JEL_ECC_BLKSIZE 200 */
 
 
+/*
+ * Statistics for the most recent embed or extract, filled in as it
+ * runs and read back with jel_get_stats.  Times come from a monotonic
+ * clock.  The header and coefficient times are recorded when the
+ * source is opened, which for most sources is in jel_set_*_source.
+ */
+typedef struct {
+  long long header_ns;       /* jpeg_read_header */
+  long long read_coefs_ns;   /* jpeg_read_coefficients */
+  long long ecc_ns;          /* Reed-Solomon encoding or decoding */
+  long long scan_ns;         /* Walking the blocks, less ecc_ns */
+  long long write_coefs_ns;  /* jpeg_write_coefficients */
+  long long finish_ns;       /* jpeg_finish_compress/decompress: entropy
+                                coding and the final output flush */
+
+  long blocks_scanned;       /* Luminance blocks visited. */
+  long blocks_usable;        /* ... of which carried a byte. */
+  long blocks_dc_rejected;   /* ... of which were skipped for their DC value. */
+  long blocks_energy_rejected; /* ... or for their AC energy. */
+
+  long ecc_blocks;           /* Reed-Solomon blocks coded. */
+  long ecc_corrected;        /* Blocks decoded with errors corrected. */
+  long ecc_failed;           /* Blocks with too many errors to correct. */
+
+  long msg_bytes;            /* Message bytes read from the caller or
+                                handed back to it. */
+  long embedded_bytes;       /* Bytes put in or taken out of the image,
+                                including length and ECC. */
+  long jpeg_bytes_out;       /* Compressed output; 0 when extracting. */
+
+  long pool_bytes;           /* Coefficient arrays held in libjpeg's
+                                pools.  These dominate peak memory;
+                                libjpeg does not report its total. */
+  long temp_bytes;           /* ... and kept in temp files instead
+                                (JEL_PROP_MAX_MEMORY). */
+} jel_stats;
+
+
+/* How many source and destination manager kinds there are (see
+ * libjel/misc.h), for jel_config's src_mgrs and dst_mgrs: */
+#define JEL_NSRCMGRS 5
+#define JEL_NDSTMGRS 4
+
 /*
  * jel_config struct contains information to be used during the
  * embedding and extraction operations.
@@ -76,6 +181,18 @@ typedef struct {
   /* For embedding, we need a destination.  NULL otherwise. */
   struct jpeg_compress_struct dstinfo;
   FILE *dstfp;   /* Non-NULL iff. we are using filenames or FILEs. */
+  int dst_kind;  /* Which destination manager is in use. */
+  int src_kind;  /* Which source manager is in use. */
+  int src_state; /* How much of the source has been read. */
+
+  /* The manager structs of each kind used so far, one per kind; see
+   * libjel/misc.h: */
+  struct jpeg_source_mgr *src_mgrs[JEL_NSRCMGRS];
+  struct jpeg_destination_mgr *dst_mgrs[JEL_NDSTMGRS];
+
+  int iobufsize;       /* Buffer size for file descriptor sources and
+			  destinations.  Must be set before the
+			  source or destination. */
 
   /* It might be necessary to allocate a separate coefficient array
    * for the destination: */
@@ -86,10 +203,15 @@ typedef struct {
 
   FILE * logger;       /* FILE pointer for logging */
 
-  int verbose;         /* Decide how much to spew out in the
-                        * log. Default is 1.  3 is pretty chatty. */
+  jel_log_sink log_sink; /* If set, receives the log instead of 'logger'. */
+  void *log_ctx;       /* Passed through to log_sink. */
+  int loglen;          /* Bytes waiting in logbuf. */
+  char logbuf[JEL_LOG_BUFSIZE];
+
+  int verbose;         /* Highest JEL_LOG_* level that is logged.
+                        * Default is JEL_LOG_ERROR. */
 
-  int quality;         /* Base JPEG quality.  If -1, then the
+  int quality;         /* Base JPEG quality.  If JEL_QUALITY_COVER, the
 			* destination preserves the source quality
 			* level.  Is set through the jel_setprop call,
 			* which will automatically recompute output
@@ -120,7 +242,20 @@ typedef struct {
   int ecc_blocklen;
   int bits_per_freq;
   int bytes_per_mcu;
-  int ethresh;       // Energy threshold for MCU
+  int ethresh;       // Energy threshold for MCU; 0 means no threshold
+  int emask[DCTSIZE2]; // AC energy weights, rebuilt by each pass
+  JCOEF elimit[DCTSIZE2]; // ... and per-frequency limits for ethresh
+  int frame;         // JEL_FRAME_*; only used with embed_length
+  int compress;      // JEL_COMPRESS_*; only used with a frame
+  int unpacked;      // Length before compression of the message being embedded, or 0
+  int max_memory;    // JEL_PROP_MAX_MEMORY, in kilobytes; 0 for no limit
+  void *barrays;     // Coefficient array store for max_memory, or NULL
+  int decode_threads; // JEL_PROP_DECODE_THREADS; 0 for one per processor
+  int restart_rows;  // JEL_PROP_RESTART_ROWS; 0 for no restart markers
+  unsigned char *src_mem; // The source, if it is in memory, or NULL
+  int src_len;       // ... and its length
+
+  jel_stats stats;   // Statistics for the current or last operation
 } jel_config;
 
 
@@ -137,6 +272,14 @@ typedef enum {
   JEL_PROP_NFREQS,
   JEL_PROP_BYTES_PER_MCU,
   JEL_PROP_BITS_PER_FREQ,
+  JEL_PROP_IO_BUFSIZE,
+  JEL_PROP_LOG_LEVEL,
+  JEL_PROP_ENERGY_THRESHOLD,
+  JEL_PROP_FRAME,
+  JEL_PROP_COMPRESS,
+  JEL_PROP_MAX_MEMORY,
+  JEL_PROP_DECODE_THREADS,
+  JEL_PROP_RESTART_ROWS,
 } jel_property;
 
 
@@ -147,8 +290,48 @@ jel_config * jel_init( int nlevels );  /* Initialize and requests at least 'nlev
 
 void jel_free( jel_config *cfg );   /* Free the jel_config struct: */
 
+/*
+ * Make a config ready for another image without freeing it.  Any
+ * operation in progress is abandoned and the image memory released;
+ * properties and the log are kept.  Frequencies chosen for the last
+ * image are forgotten, so explicitly chosen ones must be set again.
+ * Source and destination managers are kept, one of each kind, and
+ * reused by the next source and destination.  Returns 0.
+ */
+int jel_reset( jel_config *cfg );
+
 void jel_describe( jel_config *cfg ); /* Describe the jel object in the log */
 
+/*
+ * Callbacks for caller-managed I/O.
+ *
+ * jel_read_callback points *buf at the next run of JPEG bytes and
+ * returns how many there are: 0 at end of input, negative on error.
+ * The bytes are used in place and must stay valid until the next
+ * call.
+ *
+ * jel_skip_callback discards 'nbytes' bytes that lie beyond the
+ * last buffer handed out, returning negative on error.  It may be
+ * NULL, in which case skipped data is simply read.
+ *
+ * jel_write_callback receives 'len' finished bytes in 'buf' and
+ * returns the buffer to fill next, storing its size in *bufsize.
+ * The first call has buf == NULL and len == 0.  The same buffer may
+ * be returned again once its contents have been consumed.  Returning
+ * NULL aborts compression, except on the call that hands over the
+ * last bytes, whose return value is ignored; that call reports a
+ * failed write by storing a negative value in *bufsize, which makes
+ * the embed fail.
+ *
+ * jel_flush_callback is called once after the final write, and may
+ * be NULL.  It returns negative on error.
+ */
+typedef int (*jel_read_callback)( void *ctx, const unsigned char **buf );
+typedef int (*jel_skip_callback)( void *ctx, long nbytes );
+typedef unsigned char * (*jel_write_callback)( void *ctx, unsigned char *buf,
+                                               int len, int *bufsize );
+typedef int (*jel_flush_callback)( void *ctx );
+
 /*
  * Set source and destination objects - return 0 on success, negative
  * error code on failure.
@@ -156,10 +339,42 @@ void jel_describe( jel_config *cfg ); /* Describe the jel object in the log */
 int jel_set_file_source(jel_config * cfg, char * filename);
 int jel_set_fp_source(jel_config * cfg, FILE *fp);
 int jel_set_mem_source(jel_config * cfg, unsigned char *mem, int len);
+int jel_set_fd_source(jel_config * cfg, int fd);
+int jel_set_callback_source(jel_config * cfg, jel_read_callback read,
+                            jel_skip_callback skip, void *ctx);
+int jel_set_push_source(jel_config * cfg);
 
 int jel_set_file_dest(jel_config * cfg, char *filename);
 int jel_set_fp_dest(jel_config * cfg, FILE *fp);
 int jel_set_mem_dest(jel_config * cfg, unsigned char *mem, int len);
+int jel_set_fd_dest(jel_config * cfg, int fd);
+int jel_set_callback_dest(jel_config * cfg, jel_write_callback write,
+                          jel_flush_callback flush, void *ctx);
+
+/*
+ * The fd variants read and write the descriptor directly, in chunks
+ * of JEL_PROP_IO_BUFSIZE bytes (default JEL_IO_BUFSIZE), so pipes
+ * and sockets can be used without wrapping them in a FILE*.  Regular
+ * files get a sequential readahead hint.  The caller keeps ownership
+ * of the descriptor and must close it.
+ *
+ * The callback variants let the caller own every buffer.  See the
+ * jel_read_callback and jel_write_callback typedefs above.
+ */
+
+/*
+ * Push sources never block, which suits an event loop.  After
+ * jel_set_push_source, hand over the image bytes with jel_push_source
+ * as they arrive, and call jel_push_source_end when there are no
+ * more.  Each call decodes as far as the data allows and returns
+ * JEL_NEED_MORE_DATA until the whole image has been read; then it
+ * returns 0, and the source is ready for jel_embed, jel_extract or
+ * jel_capacity.  A negative return is an error, JEL_ERR_INVALIDARG if
+ * the source is not a push source.  The data is copied, so the
+ * caller's buffer can be reused as soon as the call returns.
+ */
+int jel_push_source(jel_config * cfg, const unsigned char *data, int len);
+int jel_push_source_end(jel_config * cfg);
 
 
 /* Get and set jel_config properties.
@@ -179,7 +394,28 @@ char *jel_version_string();
 
 int jel_open_log( jel_config *cfg, char *filename);
 int jel_close_log( jel_config *cfg);
+int jel_set_log_sink( jel_config *cfg, jel_log_sink sink, void *ctx );
+int jel_flush_log( jel_config *cfg );
 int jel_log( jel_config *cfg, const char *format, ... );
+int jel_log_at( jel_config *cfg, int level, const char *format, ... );
+
+/*
+ * Logging.  Output is collected in the jel_config and handed to the
+ * sink (or written to the log FILE) when the buffer fills, when an
+ * error is logged, at the end of each embed or extract, and on
+ * jel_flush_log, jel_close_log and jel_free.  jel_log logs whenever
+ * there is a log FILE or sink, whatever the level, as it always has;
+ * jel_log_at is filtered like JEL_LOG.
+ *
+ * JEL_LOG is what the library itself uses.  A message above
+ * JEL_LOG_MAX_LEVEL costs nothing, and one above the configured level
+ * costs a single comparison; the arguments are not evaluated.
+ */
+#define JEL_LOG(cfg, level, ...)                                        \
+  do {                                                                  \
+    if ((level) <= JEL_LOG_MAX_LEVEL && (level) <= (cfg)->verbose)      \
+      jel_log_at((cfg), (level), __VA_ARGS__);                          \
+  } while (0)
 
 
 /* where:
@@ -193,6 +429,13 @@ int jel_log( jel_config *cfg, const char *format, ... );
 int    jel_error_code( jel_config * cfg );    /* Returns the most recent error code. */
 char * jel_error_string( jel_config * cfg );  /* Returns the most recent error string. */
 
+/*
+ * Copies the statistics for the most recent embed or extract into
+ * 'stats'.  They are reset whenever a new source is opened.  Returns
+ * 0, or JEL_ERR_INVALIDARG if 'stats' is NULL.
+ */
+int    jel_get_stats( jel_config * cfg, jel_stats * stats );
+
 /*
  * jel_capacity returns the number of plaintext bytes we can save in
  * the object.  This is computed taking into account any overhead
@@ -204,12 +447,34 @@ char * jel_error_string( jel_config * cfg );  /* Returns the most recent error s
 int    jel_capacity( jel_config * cfg );      /* Returns the capacity in bytes of the source. */
 int    jel_raw_capacity( jel_config * cfg );  /* Returns the "raw" capacity in bytes of the source. */
 
+/*
+ * Estimates how many bytes of messages like 'sample' fit once
+ * compressed (see JEL_PROP_COMPRESS), by scaling jel_capacity by how
+ * well the sample compresses.  Returns jel_capacity when compression
+ * is off or does not help the sample.
+ */
+int    jel_compressed_capacity( jel_config * cfg, unsigned char * sample, int len );
+
 /* Allocates a buffer that is sufficient to hold any message
  * (per-frame) in the source.  Any such buffer can be passed to
  * free().
  */
 void * jel_alloc_buffer( jel_config * cfg );
 
+/*
+ * Read just enough of an in-memory JPEG to decode the embedded
+ * message length, without reading the whole image.  Returns the
+ * length (in coded bytes, as jel_raw_capacity counts them) if it is
+ * plausible for an image of this size and, with ECC, the first ECC
+ * block decodes (with a frame, the header parses and the message
+ * fits); 0 if the image can't be carrying a message; or a
+ * negative error code.  Needs
+ * JEL_PROP_EMBED_LENGTH and the extraction properties (seed,
+ * frequencies, threshold).  Any image already read from the config's
+ * source is dropped, so set the source afterward.
+ */
+int jel_probe_length( jel_config * cfg, unsigned char * jpeg, int len );
+
 /*  Embed a message in an image: */
 
 int jel_embed( jel_config * cfg, unsigned char * msg, int len);
@@ -241,11 +506,132 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int len);
  * contain the bytes that WERE extracted.
  */
 
+
+/*
+ * Streaming variants.  Instead of a buffer, the message is pulled
+ * from a reader while it is embedded, and pushed to a writer as it is
+ * extracted.  With ECC, blocks are encoded and decoded one at a time,
+ * so memory use does not grow with the message size.
+ *
+ * jel_message_reader fills 'buf' with at most 'len' bytes and returns
+ * the number read; 0 (end of data) or a negative value before the
+ * promised length has been read is an error.
+ *
+ * jel_message_writer consumes 'len' bytes of 'buf' and returns
+ * negative on error.
+ */
+typedef int (*jel_message_reader)( void *ctx, unsigned char *buf, int len );
+typedef int (*jel_message_writer)( void *ctx, const unsigned char *buf, int len );
+
+int jel_embed_stream( jel_config * cfg, jel_message_reader read, void *ctx, int len );
+/* where:
+ *
+ * cfg       A properly initialized jel_config object
+ * read      Supplies the bytes to be embedded
+ * ctx       Passed through to 'read'
+ * len       The number of bytes to embed; this must be known up front
+ *
+ * Returns as jel_embed does.  JEL_ERR_MSGIO is returned if the reader
+ * fails or runs out early, in which case no output is written.
+ */
+
+int jel_extract_stream( jel_config * cfg, jel_message_writer write, void *ctx, int len );
+/* where:
+ *
+ * cfg       A properly initialized jel_config object
+ * write     Receives the extracted bytes, in order
+ * ctx       Passed through to 'write'
+ * len       As for jel_extract: an upper bound on the message, or its
+ *           exact length when the length is not embedded
+ *
+ * Returns the number of bytes that were extracted, or a negative error
+ * code.  JEL_ERR_MSGIO is returned if the writer fails.
+ */
+
+
+/*
+ * Multi-cover variants, for messages larger than any one cover.  The
+ * message is split into one shard per cover, in proportion to the
+ * covers' capacities, and each shard is embedded with a small header
+ * (JEL_SHARD_HEADER bytes) giving its place in the message.  Covers
+ * are processed concurrently when the library is built with threads.
+ *
+ * Each config must have its source (and, for embedding, its
+ * destination) set and its properties chosen, exactly as for
+ * jel_embed and jel_extract.  The configs must be distinct.
+ */
+#define JEL_SHARD_HEADER 20
+
+int jel_embed_multi( jel_config ** cfgs, int ncovers, unsigned char * msg, int len );
+/* where:
+ *
+ * cfgs      'ncovers' configs, one per cover
+ * msg       A region of memory containing bytes to be embedded
+ * len       The number of bytes of msg to embed
+ *
+ * Returns 'len', or a negative error code.  JEL_ERR_NOSPACE is
+ * returned if the covers cannot hold the message between them.  If
+ * one cover fails, its error is returned and can also be read from
+ * its config.  Covers too small for a shard header are skipped and
+ * their destinations are not written.
+ */
+
+int jel_extract_multi( jel_config ** cfgs, int ncovers, unsigned char * msg, int maxlen );
+/* where:
+ *
+ * cfgs      One config per stego image, in any order
+ * msg       A region of memory to contain the reassembled message
+ * maxlen    The size in bytes of msg
+ *
+ * Returns the length of the message, or a negative error code.
+ * JEL_ERR_SHARD is returned if any shard is missing or the shard
+ * headers disagree; images carrying no shard are ignored.  If the
+ * message is longer than 'maxlen', JEL_ERR_INVALIDARG is returned
+ * and msg holds what fits.
+ */
+
+/*
+ * Extraction under several candidate settings, for a receiver that
+ * does not know the sender's seed, quanta or ECC block length.  The
+ * image is decoded once.  Each candidate's length (or frame header)
+ * and first ECC block are checked as jel_probe_length checks them,
+ * and only the candidates that pass are extracted in full,
+ * concurrently when the library is built with threads.
+ */
+typedef struct {
+  int seed;            /* As JEL_PROP_FREQ_SEED. */
+  int nlevels;         /* Quanta, as for jel_init; 0 keeps cfg's. */
+  int nfreqs;          /* As JEL_PROP_NFREQS; 0 keeps cfg's.  With either
+                          set, the frequencies are chosen afresh. */
+  int ecc_method;      /* JEL_ECC_NONE or JEL_ECC_RSCODE. */
+  int ecc_blocklen;    /* 0 keeps cfg's. */
+  int frame;           /* JEL_FRAME_NONE or JEL_FRAME_V1. */
+  int ethresh;         /* As JEL_PROP_ENERGY_THRESHOLD. */
+  int result;          /* Set on return: the message length, 0 if the
+                          candidate was ruled out, or an error code. */
+} jel_hypothesis;
+
+int jel_extract_hypotheses( jel_config * cfg, jel_hypothesis * hyps, int nhyps,
+                            unsigned char * msg, int maxlen );
+/* where:
+ *
+ * cfg       A config with its source set and JEL_PROP_EMBED_LENGTH on
+ * hyps      'nhyps' candidates
+ * msg       A region of memory to contain the extracted message
+ * maxlen    The maximum size in bytes of msg
+ *
+ * Returns the index of the first candidate, in list order, whose
+ * message was extracted (msg holds it and its 'result' gives the
+ * length), JEL_ERR_NOMSG if there was none, or a negative error
+ * code.  Like jel_extract, this finishes with the source.
+ */
+
 /*
  * Error Codes:
  */
 
 #define JEL_SUCCESS		 0
+#define JEL_NEED_MORE_DATA	 1	/* Not an error: a push source wants more input. */
 #define JEL_ERR_NOSUCHPROP	-2
 #define JEL_ERR_BADDIMS         -3
 #define JEL_ERR_NOMSG           -4
@@ -254,6 +640,13 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int len);
 #define JEL_ERR_CANTOPENFILE    -7
 #define JEL_ERR_INVALIDFPTR     -8
 #define JEL_ERR_NODEST          -9
+#define JEL_ERR_INVALIDFD       -10
+#define JEL_ERR_INVALIDCALLBACK -11
+#define JEL_ERR_MSGIO           -12
+#define JEL_ERR_INVALIDARG      -13
+#define JEL_ERR_SHARD           -14	/* Missing or inconsistent multi-cover shards. */
+#define JEL_ERR_NOSPACE         -15	/* The message (or a memory destination's image) does not fit. */
+#define JEL_ERR_CHECKSUM        -16	/* A framed message failed its CRC. */
 
 #ifdef __cplusplus
 } /* close extern "C" { */
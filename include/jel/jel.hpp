@@ -0,0 +1,266 @@
+/*
+ * libjel: JPEG Embedding Library.
+ *
+ * C++ wrapper.  jel::Context owns a jel_config and is reused from
+ * image to image: each call resets it with jel_reset, so libjpeg's
+ * permanent state and the properties carry over.  Inputs are spans of
+ * the caller's memory and are only read.  Outputs go to spans the
+ * caller provides.  The wrapper allocates nothing itself and throws
+ * nothing; every call returns a jel::result holding either a value or
+ * a JEL_ERR_* code.  Needs C++17; under C++20 jel::span is std::span.
+ *
+ * A Context is not safe to share between threads.  Use one per
+ * thread, as with jel_config.
+ */
+
+#ifndef __JEL_HPP__
+#define __JEL_HPP__
+
+#include <jel/jel.h>
+
+#include <climits>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 202002L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define JEL_HAVE_STD_SPAN 1
+#endif
+#endif
+
+namespace jel {
+
+#ifdef JEL_HAVE_STD_SPAN
+
+template <class T> using span = std::span<T>;
+
+#else
+
+/*
+ * Just enough of std::span for the calls below: a pointer and a
+ * count, made from arrays, from containers with data() and size(),
+ * or from a span of a less qualified type.
+ */
+template <class T> class span {
+public:
+  typedef T element_type;
+  typedef typename std::remove_cv<T>::type value_type;
+  typedef std::size_t size_type;
+  typedef T *pointer;
+  typedef T *iterator;
+
+  constexpr span() noexcept : data_(nullptr), size_(0) {}
+  constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+  template <std::size_t N>
+  constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+
+  template <class C,
+            class = typename std::enable_if<
+              !std::is_array<typename std::remove_reference<C>::type>::value &&
+              std::is_convertible<decltype(std::declval<C &>().data()), T *>::value>::type,
+            class = decltype(std::declval<C &>().size())>
+  constexpr span(C &container) noexcept
+    : data_(container.data()), size_(container.size()) {}
+
+  template <class U,
+            class = typename std::enable_if<
+              !std::is_same<U, T>::value &&
+              std::is_convertible<U (*)[], T (*)[]>::value>::type>
+  constexpr span(const span<U> &other) noexcept
+    : data_(other.data()), size_(other.size()) {}
+
+  constexpr T *data() const noexcept { return data_; }
+  constexpr std::size_t size() const noexcept { return size_; }
+  constexpr bool empty() const noexcept { return size_ == 0; }
+  constexpr T *begin() const noexcept { return data_; }
+  constexpr T *end() const noexcept { return data_ + size_; }
+  constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+
+  constexpr span first(std::size_t n) const noexcept { return span(data_, n); }
+  constexpr span subspan(std::size_t offset, std::size_t n = std::size_t(-1)) const noexcept {
+    return span(data_ + offset, n == std::size_t(-1) ? size_ - offset : n);
+  }
+
+private:
+  T *data_;
+  std::size_t size_;
+};
+
+#endif
+
+typedef span<const unsigned char> bytes;
+typedef span<unsigned char> mutable_bytes;
+
+/* The failure half of a result, as std::unexpected is for std::expected: */
+struct failure {
+  int code;
+};
+
+/*
+ * A value or a negative JEL_ERR_* code (or -1 for a libjpeg error
+ * caught while reading the header).  value() must only be called
+ * when has_value() is true.
+ */
+template <class T> class result {
+public:
+  result(T value) noexcept : value_(value), code_(0) {}
+  result(failure f) noexcept : value_(), code_(f.code < 0 ? f.code : -1) {}
+
+  bool has_value() const noexcept { return code_ == 0; }
+  explicit operator bool() const noexcept { return code_ == 0; }
+
+  T value() const noexcept { return value_; }
+  T operator*() const noexcept { return value_; }
+  T value_or(T other) const noexcept { return code_ == 0 ? value_ : other; }
+
+  int error() const noexcept { return code_; }
+
+private:
+  T value_;
+  int code_;
+};
+
+class Context {
+public:
+  explicit Context(int nlevels = JEL_NLEVELS) noexcept
+    : cfg_(jel_init(nlevels)), used_(false) {}
+
+  /* Closes any log opened through get(), which jel_free leaves open: */
+  ~Context() { release(); }
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  Context(Context &&other) noexcept
+    : cfg_(other.cfg_), used_(other.used_) {
+    other.cfg_ = nullptr;
+  }
+
+  Context &operator=(Context &&other) noexcept {
+    if (this != &other) {
+      release();
+      cfg_ = other.cfg_;
+      used_ = other.used_;
+      other.cfg_ = nullptr;
+    }
+    return *this;
+  }
+
+  /* False if jel_init failed or the context was moved from: */
+  bool valid() const noexcept { return cfg_ != nullptr; }
+  explicit operator bool() const noexcept { return cfg_ != nullptr; }
+
+  /* The config itself, for calls the wrapper does not cover: */
+  jel_config *get() noexcept { return cfg_; }
+
+  result<int> set(jel_property prop, int value) noexcept {
+    if (!cfg_) return failure{JEL_ERR_INVALIDARG};
+    int ret = jel_setprop(cfg_, prop, value);
+    if (ret < 0) return failure{ret};
+    return ret;
+  }
+
+  result<int> property(jel_property prop) noexcept {
+    if (!cfg_) return failure{JEL_ERR_INVALIDARG};
+    int ret = jel_getprop(cfg_, prop);
+    if (ret == JEL_ERR_NOSUCHPROP) return failure{ret};
+    return ret;
+  }
+
+  /*
+   * Embeds 'message' in 'cover', writing the new JPEG to 'out'.
+   * Returns the size of the JPEG.  JEL_ERR_NOSPACE means the message
+   * did not fit in the cover or the JPEG did not fit in 'out'.
+   */
+  result<std::size_t> embed(bytes cover, bytes message, mutable_bytes out) noexcept {
+    if (message.size() > INT_MAX || out.size() > INT_MAX) return failure{JEL_ERR_INVALIDARG};
+    int ret = open(cover);
+    if (ret < 0) return failure{ret};
+    ret = jel_set_mem_dest(cfg_, out.data(), (int) out.size());
+    if (ret < 0) return failure{ret};
+    ret = jel_embed(cfg_, const_cast<unsigned char *>(message.data()), (int) message.size());
+    if (ret < 0) return failure{ret};
+    /* With ECC a cut-off message still reports its whole length, but
+     * the stats count what was read (unless it was compressed): */
+    if (ret < (int) message.size() || cfg_->jpeglen <= 0 ||
+        (cfg_->compress == JEL_COMPRESS_NONE &&
+         cfg_->stats.msg_bytes < (long) message.size()))
+      return failure{JEL_ERR_NOSPACE};
+    return (std::size_t) cfg_->jpeglen;
+  }
+
+  /*
+   * Extracts the message in 'stego' into 'out'.  Returns its length.
+   * With JEL_PROP_EMBED_LENGTH off, 'out' must be exactly the size
+   * of the message.
+   */
+  result<std::size_t> extract(bytes stego, mutable_bytes out) noexcept {
+    if (out.size() > INT_MAX) return failure{JEL_ERR_INVALIDARG};
+    int ret = open(stego);
+    if (ret < 0) return failure{ret};
+    ret = jel_extract(cfg_, out.data(), (int) out.size());
+    if (ret < 0) return failure{ret};
+    return (std::size_t) ret;
+  }
+
+  /* The number of message bytes 'cover' can carry, as jel_capacity: */
+  result<std::size_t> capacity(bytes cover) noexcept {
+    int ret = open(cover);
+    if (ret < 0) return failure{ret};
+    ret = jel_capacity(cfg_);
+    if (ret < 0) return failure{ret};
+    return (std::size_t) ret;
+  }
+
+  /* The raw capacity, which bounds the 'out' an extract needs: */
+  result<std::size_t> raw_capacity(bytes cover) noexcept {
+    int ret = open(cover);
+    if (ret < 0) return failure{ret};
+    ret = jel_raw_capacity(cfg_);
+    if (ret < 0) return failure{ret};
+    return (std::size_t) ret;
+  }
+
+  /*
+   * The embedded length, read from the first rows only, as
+   * jel_probe_length does: 0 if 'stego' carries no message.  With ECC
+   * this is the coded length, so it is also enough room to extract
+   * into.  Needs JEL_PROP_EMBED_LENGTH.
+   */
+  result<std::size_t> probe_length(bytes stego) noexcept {
+    if (!cfg_ || stego.size() > INT_MAX) return failure{JEL_ERR_INVALIDARG};
+    if (used_) jel_reset(cfg_);
+    used_ = true;
+    int ret = jel_probe_length(cfg_, const_cast<unsigned char *>(stego.data()), (int) stego.size());
+    if (ret < 0) return failure{ret};
+    return (std::size_t) ret;
+  }
+
+private:
+  void release() noexcept {
+    if (cfg_) {
+      jel_close_log(cfg_);
+      jel_free(cfg_);
+      cfg_ = nullptr;
+    }
+  }
+
+  /* Readies the config for 'jpeg', reusing it if it has had an image: */
+  int open(bytes jpeg) noexcept {
+    if (!cfg_ || jpeg.size() > INT_MAX) return JEL_ERR_INVALIDARG;
+    if (used_) jel_reset(cfg_);
+    used_ = true;
+    /* The memory source never writes to the image: */
+    return jel_set_mem_source(cfg_, const_cast<unsigned char *>(jpeg.data()), (int) jpeg.size());
+  }
+
+  jel_config *cfg_;
+  bool used_;
+};
+
+} /* namespace jel */
+
+#endif /* __JEL_HPP__ */
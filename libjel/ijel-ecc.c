@@ -16,12 +16,14 @@
 /*
  * Converts the plaintext message in msg into ecc-encoded blocks.
  * Each block's first byte is a length, followed by at most 255 bytes.
+ *
+ * block_len is the default for new configs and the setting used by
+ * the whole-message coders below; the library itself passes each
+ * config's block length explicitly.
  */
-static int init = 1;
 static int block_len = BLOCKLEN;
 static int max_mlen = BLOCKLEN-NPAR;
 
-void ijel_buffer_dump(unsigned char *, int);
 
 int ijel_set_ecc_blocklen(int new_len) {
   block_len = new_len;
@@ -62,11 +64,6 @@ unsigned char *ijel_encode_ecc(unsigned char *msg, int msglen, int *outlen) {
   unsigned char *out, *next_out;
   unsigned char *in;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
   
   /* This is the max number of bytes of message that we will put in
    * each block, EXCLUSIVE of length and parity: */
@@ -139,11 +136,6 @@ unsigned char *ijel_decode_ecc(unsigned char *ecc, int ecclen, int *msglen) {
   unsigned char *in=NULL;
   int done = 0;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
 
   /* 
    * The size of ECC-encoded data, ecclen, must be a multiple of block_len,
@@ -213,10 +205,10 @@ unsigned char *ijel_decode_ecc(unsigned char *ecc, int ecclen, int *msglen) {
  * that space, and then compute the number of bytes of message that
  * can be supported with ECC.  This is always less than 'nbytes'.
  */
-int ijel_capacity_ecc(int nbytes) {
-  int nblocks = (nbytes / block_len);  /* conservative estimate */
+int ijel_capacity_ecc(int nbytes, int blocklen) {
+  int nblocks = (nbytes / blocklen);  /* conservative estimate */
   
-  return nblocks * (max_mlen-1);  /* We can fit this many plaintext bytes AFTER RS coding. */
+  return nblocks * (blocklen-NPAR-1);  /* We can fit this many plaintext bytes AFTER RS coding. */
 }
 
 
@@ -230,12 +222,12 @@ int ijel_capacity_ecc(int nbytes) {
  * was ijel_ecc_length
  */
 
-int ijel_message_ecc_length(int msglen, int embed_len) {
+int ijel_message_ecc_length(int msglen, int blocklen, int embed_len) {
   assert( embed_len == 0 || embed_len == 1 );
   /* If embed_len is 1, then we are embedding length in each block.
    * If 0, then we are not embedding the length.  */
 
-  int block_text_length = max_mlen-embed_len;    /* (maybe) Subtract 1 for the length byte. */
+  int block_text_length = blocklen-NPAR-embed_len;    /* (maybe) Subtract 1 for the length byte. */
   int nblocks = (msglen / block_text_length);    /* Number of chunks of original message */
 
   if (msglen % block_text_length != 0) nblocks++;
@@ -245,7 +237,7 @@ int ijel_message_ecc_length(int msglen, int embed_len) {
      its length is 0, to terminate the ECC-encoded message. */
 
   /* nblocks is the number of ECC blocks required, so return the result in bytes: */
-  return nblocks * block_len; 
+  return nblocks * blocklen; 
 }
 
 
@@ -310,11 +302,6 @@ unsigned char *ijel_encode_ecc_nolength(unsigned char *msg, int msglen, int *out
   unsigned char *out, *next_out;
   unsigned char *in;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
 
   /* This is the max number of bytes of message that we will put in
    * each block, EXCLUSIVE of length and parity: */
@@ -384,11 +371,6 @@ unsigned char *ijel_decode_ecc_nolength(unsigned char *ecc, int ecclen, int leng
   unsigned char *out, *next_out;
   unsigned char *in;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
 
   /* 
    * The size of ECC-encoded data, ecclen, must be a multiple of block_len,
@@ -446,3 +428,76 @@ unsigned char *ijel_decode_ecc_nolength(unsigned char *ecc, int ecclen, int leng
   return(out);
 }
 
+
+
+
+
+/*
+ * Block-at-a-time coding, for streaming embedding and extraction.
+ * These produce and consume exactly the blocks written by
+ * ijel_encode_ecc (embed_len == 1, a length byte leads each block)
+ * and ijel_encode_ecc_nolength (embed_len == 0), but take the block
+ * length explicitly instead of using the file-level setting.
+ */
+
+/*
+ * Number of plaintext bytes that one block of 'blocklen' bytes
+ * carries:
+ */
+int ijel_ecc_block_payload(int blocklen, int embed_len) {
+  return blocklen - NPAR - embed_len;
+}
+
+
+/*
+ * Encode 'len' bytes of 'plain' (at most the block payload) into the
+ * 'blocklen' bytes at 'out'.  Short blocks are zero-padded:
+ */
+void ijel_encode_ecc_block(unsigned char *plain, int len, int blocklen,
+                           int embed_len, unsigned char *out) {
+  unsigned char message[256];
+
+
+  assert(len >= 0 && len <= ijel_ecc_block_payload(blocklen, embed_len));
+
+  memset(message, 0, 256);
+  if (embed_len) message[0] = len;
+  if (len > 0) memcpy(message+embed_len, plain, len);
+
+  encode_data(message, blocklen-NPAR, out);
+}
+
+
+/*
+ * Decode (and, if needed, correct) one block in place.  On return,
+ * *plain points into 'block' at the recovered plaintext, and the
+ * return value is its length.  With embed_len, a length shorter than
+ * the full payload marks the last block of the message.  *status is
+ * 0 for a clean block, 1 if errors were corrected, and -1 if there
+ * were too many to correct.
+ */
+int ijel_decode_ecc_block(unsigned char *block, int blocklen,
+                          int embed_len, unsigned char **plain, int *status) {
+  int payload = ijel_ecc_block_payload(blocklen, embed_len);
+  int mlen;
+
+
+  decode_data(block, blocklen);
+
+  /* Error correction if needed: */
+  *status = 0;
+  if (check_syndrome() != 0)
+    *status = correct_errors_erasures(block, blocklen, 0, 0) ? 1 : -1;
+
+  if (!embed_len) {
+    *plain = block;
+    return payload;
+  }
+
+  /* A corrupted length byte must not run past the block: */
+  mlen = block[0];
+  if (mlen > payload) mlen = payload;
+
+  *plain = block+1;
+  return mlen;
+}
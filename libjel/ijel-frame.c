@@ -0,0 +1,178 @@
+/*
+ * ijel-frame.c - the JEL_FRAME_V1 message frame.  See misc.h for the
+ * layout.
+ *
+ * The header is checked as soon as its bytes are in, so an image
+ * with no message is given up after a handful of blocks rather than
+ * after decoding (and failing to correct) its whole capacity.
+ */
+
+#include <jel/jel.h>
+#include <ecc.h>
+#include <limits.h>
+
+#include "misc.h"
+
+BIT16 crchware(BIT16 data, BIT16 genpoly, BIT16 accum);
+int ijel_message_ecc_length(int, int, int);
+int ijel_ecc_block_payload(int, int);
+
+#define JEL_FRAME_VERSION    1
+
+/* jel.h gives callers the block length bounds that follow from NPAR: */
+#if NPAR != JEL_ECC_NPAR
+#error "JEL_ECC_NPAR in jel.h does not match NPAR in ecc.h"
+#endif
+
+
+/* crc_ccitt, carried on from 'acc' so it can be taken a piece at a
+ * time; ijel_frame_crc(0, buf, n) == crc_ccitt(buf, n): */
+unsigned short ijel_frame_crc(unsigned short acc, const unsigned char *buf, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) acc = crchware((BIT16) buf[i], (BIT16) 0x1021, acc);
+  return acc;
+}
+
+
+/* Appends 'v' as a varint, returning the new length: */
+static int ijel_put_varint(unsigned char *out, int n, int length) {
+  unsigned int v = (unsigned int) length;
+
+  do {
+    out[n] = v & 0x7F;
+    v >>= 7;
+    if (v) out[n] |= 0x80;
+    n++;
+  } while (v);
+  return n;
+}
+
+
+/* Reads a varint of at most 31 bits starting at buf[*i].  Returns 1
+ * with *i just past it, 0 if more bytes are needed, or -1 if it
+ * can't be one: */
+static int ijel_get_varint(const unsigned char *buf, int n, int *i, int *value) {
+  unsigned int v = 0;
+  int k, shift;
+
+  /* At most 5 varint bytes, and no more than 31 bits: */
+  for (k = *i, shift = 0; ; shift += 7, k++) {
+    if (k >= n) return 0;
+    if (shift > 28 || (shift == 28 && (buf[k] & 0x78))) return -1;
+    v |= (unsigned int) (buf[k] & 0x7F) << shift;
+    if (!(buf[k] & 0x80)) break;
+  }
+  *i = k + 1;
+  *value = (int) v;
+  return 1;
+}
+
+
+/* Writes the header for a message of 'length' bytes ('unpacked'
+ * once decompressed, with JEL_FRAME_FLAG_LZF) into 'out'
+ * (JEL_FRAME_MAX_HEADER bytes) and returns its length: */
+int ijel_frame_header(unsigned char *out, int flags, int blocklen, int length, int unpacked) {
+  BIT16 crc;
+  int n = 0;
+
+  out[n++] = JEL_FRAME_MAGIC | JEL_FRAME_VERSION;
+  out[n++] = flags;
+  if (flags & JEL_FRAME_FLAG_ECC) out[n++] = blocklen;
+  n = ijel_put_varint(out, n, length);
+  if (flags & JEL_FRAME_FLAG_LZF) n = ijel_put_varint(out, n, unpacked);
+
+  crc = crc_ccitt(out, n);
+  out[n++] = crc & 0xFF;
+  out[n++] = (crc >> 8) & 0xFF;
+  return n;
+}
+
+
+/*
+ * Parses the first 'n' bytes of a header.  Returns the header length
+ * once it is complete and checks out, 0 if more bytes are needed, or
+ * -1 as soon as the bytes can't be a header:
+ */
+int ijel_frame_parse(const unsigned char *buf, int n, ijel_frame *frame) {
+  int i, end, status;
+  BIT16 crc;
+
+  if (n < 1) return 0;
+  if (buf[0] != (JEL_FRAME_MAGIC | JEL_FRAME_VERSION)) return -1;
+
+  if (n < 2) return 0;
+  frame->flags = buf[1];
+  if (frame->flags & ~JEL_FRAME_FLAG_KNOWN) return -1;
+
+  i = 2;
+  frame->blocklen = 0;
+  if (frame->flags & JEL_FRAME_FLAG_ECC) {
+    if (n < 3) return 0;
+    frame->blocklen = buf[2];
+    if (ijel_ecc_block_payload(frame->blocklen, 0) <= 0) return -1;
+    i = 3;
+  }
+
+  status = ijel_get_varint(buf, n, &i, &(frame->length));
+  if (status <= 0) return status;
+
+  /* Compression is only used when it shrinks the message, and LZF
+   * never expands a byte to more than 88: */
+  frame->unpacked = frame->length;
+  if (frame->flags & JEL_FRAME_FLAG_LZF) {
+    status = ijel_get_varint(buf, n, &i, &(frame->unpacked));
+    if (status <= 0) return status;
+    if (frame->unpacked <= frame->length ||
+        frame->unpacked / 88 > frame->length) return -1;
+  }
+  end = i;
+
+  if (n < end + 2) return 0;
+  crc = crc_ccitt((unsigned char *) buf, end);
+  if (buf[end] != (crc & 0xFF) || buf[end + 1] != ((crc >> 8) & 0xFF)) return -1;
+
+  frame->hlen = end + 2;
+  return frame->hlen;
+}
+
+
+/* Bytes that follow the header in the image, or -1 if a length read
+ * from an image would not fit in an int: */
+int ijel_frame_coded_length(const ijel_frame *frame) {
+  int n, payload, nblocks;
+
+  if (frame->length < 0 || frame->length > INT_MAX - JEL_FRAME_TRAILER) return -1;
+  n = frame->length + JEL_FRAME_TRAILER;
+
+  if (frame->flags & JEL_FRAME_FLAG_ECC) {
+    payload = ijel_ecc_block_payload(frame->blocklen, 0);
+    nblocks = n / payload + (n % payload != 0);
+    if (nblocks > INT_MAX / frame->blocklen) return -1;
+    return ijel_message_ecc_length(n, frame->blocklen, 0);
+  }
+  return n;
+}
+
+
+/* Bytes a whole framed message takes in the image: */
+int ijel_frame_size(int flags, int blocklen, int length, int unpacked) {
+  unsigned char head[JEL_FRAME_MAX_HEADER];
+  ijel_frame frame;
+
+  frame.flags = flags;
+  frame.blocklen = blocklen;
+  frame.length = length;
+  return ijel_frame_header(head, flags, blocklen, length, unpacked) + ijel_frame_coded_length(&frame);
+}
+
+
+/* Plaintext capacity of 'raw' bytes, allowing for the largest
+ * header without compression: */
+int ijel_frame_capacity(int raw, int ecc, int blocklen) {
+  int cap = raw - (JEL_FRAME_MAX_HEADER - JEL_FRAME_LZF_FIELD);
+
+  if (ecc) cap = (cap / blocklen) * ijel_ecc_block_payload(blocklen, 0);
+  cap -= JEL_FRAME_TRAILER;
+  return (cap > 0) ? cap : 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * ijel-lzf.c - LZF coding for JEL_PROP_COMPRESS.
+ *
+ * This writes the LZF format (as liblzf does) so that compression
+ * needs nothing beyond libjpeg.  Each control byte is either a run
+ * of literals:
+ *
+ *   000LLLLL  <L+1 bytes>
+ *
+ * or a back reference to earlier output:
+ *
+ *   LLLooooo  [L - 7, if L == 7]  oooooooo
+ *
+ * copying L+2 bytes from 'o'+1 bytes back.  Runs are at most 32
+ * bytes, references at most 264 bytes long and 8192 bytes back.
+ * Compression is a single greedy pass with a hash of the next three
+ * bytes, which is fast and does well on text and protocol data.
+ */
+
+#include <string.h>
+
+#include "misc.h"
+
+#define LZF_HLOG     13
+#define LZF_HSIZE    (1 << LZF_HLOG)
+#define LZF_MAX_LIT  32
+#define LZF_MAX_OFF  8192
+#define LZF_MAX_REF  264
+
+
+static unsigned int ijel_lzf_hash(const unsigned char *p) {
+  unsigned int v = ((unsigned int) p[0] << 16) | ((unsigned int) p[1] << 8) | p[2];
+
+  return ((v * 2654435761u) >> (32 - LZF_HLOG)) & (LZF_HSIZE - 1);
+}
+
+
+/*
+ * Compresses 'inlen' bytes of 'in' into 'out'.  Returns the
+ * compressed length, or 0 if it would not fit in 'outlen' bytes (so
+ * a caller that only wants a smaller result passes inlen - 1):
+ */
+int ijel_lzf_compress(const unsigned char *in, int inlen, unsigned char *out, int outlen) {
+  int htab[LZF_HSIZE];
+  int ip = 0;
+  int op = 1;       /* out[0] is kept for the first run's control byte. */
+  int lit = 0;      /* Literals in the current run. */
+  int ref, off, len, maxlen, j;
+  unsigned int h;
+
+  if (inlen <= 0 || outlen < 2) return 0;
+
+  for (j = 0; j < LZF_HSIZE; j++) htab[j] = -1;
+
+  while (ip < inlen) {
+    ref = -1;
+    if (ip + 2 < inlen) {
+      h = ijel_lzf_hash(in + ip);
+      ref = htab[h];
+      htab[h] = ip;
+    }
+    off = ip - ref - 1;
+
+    if (ref >= 0 && off < LZF_MAX_OFF &&
+        in[ref] == in[ip] && in[ref+1] == in[ip+1] && in[ref+2] == in[ip+2]) {
+      maxlen = inlen - ip;
+      if (maxlen > LZF_MAX_REF) maxlen = LZF_MAX_REF;
+      for (len = 3; len < maxlen && in[ref+len] == in[ip+len]; len++) ;
+
+      /* Close the run (or drop its unused control byte), then the
+       * reference and the next run's control byte: */
+      if (op + 4 > outlen) return 0;
+      if (lit > 0) out[op - lit - 1] = lit - 1;
+      else op--;
+      lit = 0;
+
+      if (len - 2 < 7) {
+        out[op++] = ((len - 2) << 5) | (off >> 8);
+      } else {
+        out[op++] = (7 << 5) | (off >> 8);
+        out[op++] = len - 2 - 7;
+      }
+      out[op++] = off & 0xFF;
+      op++;
+
+      /* Let later matches start inside this one: */
+      for (j = ip + 1; j < ip + len && j + 2 < inlen; j++)
+        htab[ijel_lzf_hash(in + j)] = j;
+      ip += len;
+    } else {
+      if (op + 2 > outlen) return 0;
+      out[op++] = in[ip++];
+      if (++lit == LZF_MAX_LIT) {
+        out[op - lit - 1] = lit - 1;
+        lit = 0;
+        op++;
+      }
+    }
+  }
+
+  if (lit > 0) out[op - lit - 1] = lit - 1;
+  else op--;
+
+  return op;
+}
+
+
+/*
+ * Decompresses 'inlen' bytes of 'in' into 'out'.  Returns the
+ * decompressed length, or -1 if the data is not LZF or would not fit
+ * in 'outlen' bytes:
+ */
+int ijel_lzf_decompress(const unsigned char *in, int inlen, unsigned char *out, int outlen) {
+  int ip = 0, op = 0;
+  int c, len, ref;
+
+  while (ip < inlen) {
+    c = in[ip++];
+
+    if (c < LZF_MAX_LIT) {
+      len = c + 1;
+      if (ip + len > inlen || op + len > outlen) return -1;
+      memcpy(out + op, in + ip, len);
+      ip += len;
+      op += len;
+    } else {
+      len = c >> 5;
+      if (len == 7) {
+        if (ip >= inlen) return -1;
+        len += in[ip++];
+      }
+      if (ip >= inlen) return -1;
+      ref = op - ((c & 0x1F) << 8) - in[ip++] - 1;
+      len += 2;
+      if (ref < 0 || op + len > outlen) return -1;
+
+      /* The copy may overlap its own output: */
+      while (len-- > 0) out[op++] = out[ref++];
+    }
+  }
+
+  return op;
+}
@@ -0,0 +1,512 @@
+/*
+ * ijel-restart.c - Decoding restart intervals on several threads
+ * (JEL_PROP_DECODE_THREADS).
+ *
+ * An RSTn marker resets the entropy decoder and the DC predictions,
+ * so an image with a restart interval can be cut at its markers and
+ * the pieces decoded separately.  Here the pieces are bands of whole
+ * MCU rows that start every 8th interval, so that a band's own
+ * markers run RST0, RST1, ... as libjpeg expects.  A worker decodes a
+ * band from a stream made up of a copy of the source's tables (with
+ * the frame height cut to the band), the band's entropy-coded data,
+ * read in place, and an EOI, then copies the band's blocks into the
+ * source's coefficient arrays.
+ *
+ * The source's own decoder is still run, over an empty scan, so that
+ * it allocates the (zeroed) arrays and ends up in the state jel_embed
+ * and jel_extract expect.  Only single-scan Huffman images in memory
+ * are handled.  Anything else, or a band that does not decode
+ * cleanly, leaves the image for libjpeg to read as usual.
+ */
+
+#include <jel/jel.h>
+
+#include "misc.h"
+
+#include <setjmp.h>
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+void jpeg_memory_src (j_decompress_ptr cinfo, unsigned char *data, int size);
+
+
+#ifdef HAVE_LIBPTHREAD
+
+/* Bands per thread, so that a slow band does not hold up the rest: */
+#define JEL_BANDS_PER_THREAD 4
+
+/* Markers jpeglib.h has no names for: */
+#define JEL_M_SOF0 0xC0
+#define JEL_M_SOF1 0xC1
+#define JEL_M_SOI  0xD8
+#define JEL_M_SOS  0xDA
+
+static const JOCTET ijel_eoi[2] = { 0xFF, JPEG_EOI };
+
+
+typedef struct {
+  const JOCTET *data;        /* The band's entropy-coded data. */
+  size_t len;
+  int row;                   /* First MCU row. */
+  int nrows;                 /* ... and how many. */
+  int interval;              /* First restart interval. */
+} ijel_band;
+
+
+/* Work shared by the band workers: */
+typedef struct {
+  JOCTET *header;            /* SOI, tables, frame and scan headers. */
+  int hlen;
+  int sof_height;            /* Offset of the frame height in header. */
+  int mcu_height;            /* Image rows per MCU row. */
+  int image_height;
+  ijel_band *bands;
+  int nbands;
+  int next;                  /* Next band to hand out. */
+  int failed;
+  int ncomps;
+  int mcu_blocks[MAX_COMPONENTS];  /* Block rows per MCU row. */
+  long nrows[MAX_COMPONENTS];      /* Block rows in the source's arrays. */
+  JBLOCKROW *rows[MAX_COMPONENTS]; /* ... and where they are. */
+  pthread_mutex_t lock;
+} ijel_band_pool;
+
+
+/* Source manager for one band: */
+typedef struct {
+  struct jpeg_source_mgr pub;
+  const JOCTET *piece[3];
+  size_t size[3];
+  int next;
+} ijel_band_src;
+
+
+typedef struct {
+  struct jpeg_error_mgr mgr;
+  jmp_buf jmpbuff;
+} ijel_band_error;
+
+
+/* a rounded up to a multiple of b, as jround_up: */
+static long ijel_round_up(long a, long b) {
+  a += b - 1L;
+  return a - (a % b);
+}
+
+
+static void ijel_band_init_source(j_decompress_ptr cinfo) {
+}
+
+
+static boolean ijel_band_fill_input_buffer(j_decompress_ptr cinfo) {
+  ijel_band_src *src = (ijel_band_src *) cinfo->src;
+
+  while (src->next < 3 && src->size[src->next] == 0) src->next++;
+
+  if (src->next < 3) {
+    src->pub.next_input_byte = src->piece[src->next];
+    src->pub.bytes_in_buffer = src->size[src->next];
+    src->next++;
+  } else {
+    /* Past the end; libjpeg only gets here on bad data, which the
+     * warning count catches: */
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    src->pub.next_input_byte = ijel_eoi;
+    src->pub.bytes_in_buffer = 2;
+  }
+  return TRUE;
+}
+
+
+static void ijel_band_skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+  struct jpeg_source_mgr *src = cinfo->src;
+
+  if (num_bytes <= 0) return;
+  while (num_bytes > (long) src->bytes_in_buffer) {
+    num_bytes -= (long) src->bytes_in_buffer;
+    ijel_band_fill_input_buffer(cinfo);
+  }
+  src->next_input_byte += (size_t) num_bytes;
+  src->bytes_in_buffer -= (size_t) num_bytes;
+}
+
+
+static void ijel_band_term_source(j_decompress_ptr cinfo) {
+}
+
+
+static void ijel_band_error_exit(j_common_ptr cinfo) {
+  longjmp(((ijel_band_error *) cinfo->err)->jmpbuff, 1);
+}
+
+
+/* Warnings are only counted.  Any warning in a band sends the image
+ * back to libjpeg, which then reports it as usual: */
+static void ijel_band_emit_message(j_common_ptr cinfo, int msg_level) {
+  if (msg_level < 0) cinfo->err->num_warnings++;
+}
+
+
+static void ijel_band_output_message(j_common_ptr cinfo) {
+}
+
+
+static int ijel_next_band(ijel_band_pool *pool) {
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  i = (pool->next < pool->nbands && !pool->failed) ? pool->next++ : -1;
+  pthread_mutex_unlock(&pool->lock);
+  return i;
+}
+
+
+/*
+ * Decode one band and copy its blocks into the source's arrays.
+ * Returns 1 on success, 0 if the band did not decode cleanly:
+ */
+static int ijel_decode_band(ijel_band_pool *pool, ijel_band *band) {
+  struct jpeg_decompress_struct dinfo;
+  ijel_band_error jerr;
+  ijel_band_src src;
+  jvirt_barray_ptr *coefs;
+  jpeg_component_info *compptr;
+  JBLOCKARRAY buffer;
+  JOCTET * volatile header;
+  long height, first, nrows, r, n, k;
+  int ci, ok = 0;
+
+  header = malloc(pool->hlen);
+  if (!header) return 0;
+  memcpy(header, pool->header, pool->hlen);
+
+  height = (long) pool->image_height - (long) band->row * pool->mcu_height;
+  if (height > (long) band->nrows * pool->mcu_height)
+    height = (long) band->nrows * pool->mcu_height;
+  header[pool->sof_height] = (JOCTET) (height >> 8);
+  header[pool->sof_height + 1] = (JOCTET) (height & 0xFF);
+
+  memset(&dinfo, 0, sizeof(dinfo));
+  dinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = ijel_band_error_exit;
+  jerr.mgr.emit_message = ijel_band_emit_message;
+  jerr.mgr.output_message = ijel_band_output_message;
+
+  if (setjmp(jerr.jmpbuff)) {
+    jpeg_destroy_decompress(&dinfo);
+    free(header);
+    return 0;
+  }
+
+  jpeg_create_decompress(&dinfo);
+
+  src.pub.init_source = ijel_band_init_source;
+  src.pub.fill_input_buffer = ijel_band_fill_input_buffer;
+  src.pub.skip_input_data = ijel_band_skip_input_data;
+  src.pub.resync_to_restart = jpeg_resync_to_restart;
+  src.pub.term_source = ijel_band_term_source;
+  src.pub.next_input_byte = NULL;
+  src.pub.bytes_in_buffer = 0;
+  src.piece[0] = header;
+  src.size[0] = pool->hlen;
+  src.piece[1] = band->data;
+  src.size[1] = band->len;
+  src.piece[2] = ijel_eoi;
+  src.size[2] = 2;
+  src.next = 0;
+  dinfo.src = &src.pub;
+
+  jpeg_read_header(&dinfo, TRUE);
+  coefs = jpeg_read_coefficients(&dinfo);
+
+  if (coefs && dinfo.err->num_warnings == 0 &&
+      dinfo.num_components == pool->ncomps) {
+    for (ci = 0; ci < dinfo.num_components; ci++) {
+      compptr = dinfo.comp_info + ci;
+      first = (long) band->row * pool->mcu_blocks[ci];
+      nrows = ijel_round_up(compptr->height_in_blocks, compptr->v_samp_factor);
+      if (nrows > pool->nrows[ci] - first) nrows = pool->nrows[ci] - first;
+      n = ijel_round_up(compptr->width_in_blocks, compptr->h_samp_factor);
+
+      for (r = 0; r < nrows; r += compptr->v_samp_factor) {
+        buffer = (*dinfo.mem->access_virt_barray)
+          ((j_common_ptr) &dinfo, coefs[ci], (JDIMENSION) r,
+           (JDIMENSION) compptr->v_samp_factor, FALSE);
+        for (k = 0; k < compptr->v_samp_factor && r + k < nrows; k++)
+          memcpy(pool->rows[ci][first + r + k], buffer[k], n * SIZEOF(JBLOCK));
+      }
+    }
+    ok = 1;
+  }
+
+  jpeg_destroy_decompress(&dinfo);
+  free(header);
+  return ok;
+}
+
+
+static void *ijel_band_worker(void *arg) {
+  ijel_band_pool *pool = (ijel_band_pool *) arg;
+  int i;
+
+  while ((i = ijel_next_band(pool)) >= 0) {
+    if (!ijel_decode_band(pool, pool->bands + i)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->failed = 1;
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+  return NULL;
+}
+
+
+/*
+ * Copy the segments of the header at mem[0 .. hlen) that a band
+ * decoder needs (everything but APPn and COM) into pool->header, and
+ * find the frame height.  Returns 0 if the header is not as expected:
+ */
+static int ijel_band_header(ijel_band_pool *pool, const JOCTET *mem, int hlen) {
+  int pos = 2, out = 2, m, len, sof = -1;
+
+  if (hlen < 4 || mem[0] != 0xFF || mem[1] != JEL_M_SOI) return 0;
+  pool->header = malloc(hlen);
+  if (!pool->header) return 0;
+  pool->header[0] = 0xFF;
+  pool->header[1] = JEL_M_SOI;
+
+  while (pos + 4 <= hlen) {
+    if (mem[pos] != 0xFF) return 0;
+    if (mem[pos+1] == 0xFF) {
+      pos++;
+      continue;
+    }
+    m = mem[pos+1];
+    len = (mem[pos+2] << 8) | mem[pos+3];
+    if (len < 2 || pos + 2 + len > hlen) return 0;
+
+    if (m == JEL_M_SOF0 || m == JEL_M_SOF1) sof = out;
+    if (!(m >= JPEG_APP0 && m <= JPEG_APP0 + 15) && m != JPEG_COM) {
+      memcpy(pool->header + out, mem + pos, 2 + len);
+      out += 2 + len;
+    }
+    pos += 2 + len;
+
+    if (m == JEL_M_SOS) {
+      /* The scan header is the last thing before the data: */
+      if (pos != hlen || sof < 0) return 0;
+      pool->hlen = out;
+      pool->sof_height = sof + 5;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+ * Find where each band's data starts and ends in the scan at
+ * mem[start .. size).  Every restart marker must be in sequence and
+ * the scan must end in EOI, so that the bands are all of the image:
+ */
+static int ijel_band_scan(ijel_band_pool *pool, const JOCTET *mem, int start, int size,
+                          long nintervals) {
+  const JOCTET *p = mem + start, *end = mem + size, *q;
+  long count = 0;
+  int b = 1, m;
+
+  pool->bands[0].data = p;
+  for (;;) {
+    q = memchr(p, 0xFF, end - p);
+    if (!q || q + 1 >= end) return 0;
+    m = q[1];
+    if (m == 0x00 || m == 0xFF) {
+      /* A stuffed byte, or fill before a marker: */
+      p = q + 1;
+      continue;
+    }
+    if (m < JPEG_RST0 || m > JPEG_RST0 + 7) break;
+
+    if (m - JPEG_RST0 != (count & 7)) return 0;
+    count++;
+    if (b < pool->nbands && count == pool->bands[b].interval) {
+      pool->bands[b-1].len = q - pool->bands[b-1].data;
+      pool->bands[b].data = q + 2;
+      b++;
+    }
+    p = q + 2;
+  }
+
+  if (m != JPEG_EOI || count != nintervals - 1 || b != pool->nbands) return 0;
+  pool->bands[b-1].len = q - pool->bands[b-1].data;
+  return 1;
+}
+
+
+/*
+ * Let the source's decoder read an empty scan, which gives it zeroed
+ * coefficient arrays.  libjpeg stops at the EOI, so it never asks the
+ * source for more:
+ */
+static jvirt_barray_ptr *ijel_empty_scan(j_decompress_ptr cinfo) {
+  struct jpeg_source_mgr *src = cinfo->src;
+  void (*emit)(j_common_ptr, int) = cinfo->err->emit_message;
+  long nwarnings = cinfo->err->num_warnings;
+  jvirt_barray_ptr *coefs;
+
+  /* Every interval is missing, which is worth a warning each: */
+  cinfo->err->emit_message = ijel_band_emit_message;
+  src->next_input_byte = ijel_eoi;
+  src->bytes_in_buffer = 2;
+  coefs = jpeg_read_coefficients(cinfo);
+  cinfo->err->emit_message = emit;
+  cinfo->err->num_warnings = nwarnings;
+  return coefs;
+}
+
+
+static long ijel_gcd(long a, long b) {
+  long t;
+
+  while (b) {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+
+/*
+ * Read the source's coefficients on cfg->decode_threads threads, if
+ * it can be done.  Returns 1 if cfg->coefs has been filled in, or 0
+ * with the source just past its header as before, to be read as
+ * usual:
+ */
+int ijel_read_restarts(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  jpeg_component_info *compptr;
+  ijel_band_pool pool;
+  pthread_t *threads = NULL;
+  const JOCTET *mem = cfg->src_mem;
+  long nthreads, mcus_per_row, mcu_rows, step, nsteps, nintervals, r;
+  int ci, b, t, hlen, start, started = 0, mcu_width;
+
+  nthreads = cfg->decode_threads;
+  if (nthreads == 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads < 2 || !mem || cfg->barrays ||
+      cinfo->restart_interval == 0 || cinfo->progressive_mode ||
+      cinfo->arith_code || cinfo->comps_in_scan != cinfo->num_components)
+    return 0;
+
+  /* The scan's data starts where the header left off: */
+  for (start = 0; start < cfg->src_len && mem[start] == 0; start++) ;
+  hlen = cinfo->src->next_input_byte - mem;
+  if (hlen <= start || hlen > cfg->src_len) return 0;
+
+  /* MCU geometry, as jdinput.c works it out for the scan: */
+  if (cinfo->comps_in_scan == 1) {
+    pool.mcu_height = mcu_width = DCTSIZE;
+  } else {
+    pool.mcu_height = cinfo->max_v_samp_factor * DCTSIZE;
+    mcu_width = cinfo->max_h_samp_factor * DCTSIZE;
+  }
+  mcus_per_row = (cinfo->image_width + mcu_width - 1) / mcu_width;
+  mcu_rows = (cinfo->image_height + pool.mcu_height - 1) / pool.mcu_height;
+  nintervals = (mcus_per_row * mcu_rows + cinfo->restart_interval - 1) /
+    cinfo->restart_interval;
+
+  /* Bands start on a row that is also the start of an interval
+   * numbered 0 mod 8; those rows are multiples of 'step': */
+  step = 8L * cinfo->restart_interval;
+  step /= ijel_gcd(mcus_per_row, step);
+  nsteps = (mcu_rows + step - 1) / step;
+
+  pool.nbands = nthreads * JEL_BANDS_PER_THREAD;
+  if (pool.nbands > nsteps) pool.nbands = nsteps;
+  if (pool.nbands < 2) return 0;
+
+  pool.header = NULL;
+  pool.bands = calloc(pool.nbands, sizeof(ijel_band));
+  if (!pool.bands) return 0;
+  for (b = 0; b < pool.nbands; b++) {
+    pool.bands[b].row = (nsteps * b / pool.nbands) * step;
+    pool.bands[b].interval = pool.bands[b].row * mcus_per_row / cinfo->restart_interval;
+  }
+  for (b = 0; b < pool.nbands; b++) {
+    r = (b + 1 < pool.nbands) ? pool.bands[b+1].row : mcu_rows;
+    pool.bands[b].nrows = r - pool.bands[b].row;
+  }
+
+  if (!ijel_band_header(&pool, mem + start, hlen - start) ||
+      !ijel_band_scan(&pool, mem, hlen, cfg->src_len, nintervals)) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_read_restarts: restart intervals not usable.\n");
+    free(pool.header);
+    free(pool.bands);
+    return 0;
+  }
+
+  /* From here on the source is committed, and a failure means
+   * reading it again: */
+  cfg->coefs = ijel_empty_scan(cinfo);
+
+  pool.image_height = cinfo->image_height;
+  pool.ncomps = cinfo->num_components;
+  pool.next = 0;
+  pool.failed = 0;
+  for (ci = 0; ci < pool.ncomps; ci++) {
+    compptr = cinfo->comp_info + ci;
+    pool.mcu_blocks[ci] = (cinfo->comps_in_scan == 1) ? 1 : compptr->v_samp_factor;
+    pool.nrows[ci] = ijel_round_up(compptr->height_in_blocks, compptr->v_samp_factor);
+    pool.rows[ci] = malloc(pool.nrows[ci] * sizeof(JBLOCKROW));
+    if (!pool.rows[ci]) {
+      pool.failed = 1;
+      continue;
+    }
+    /* The arrays are wholly in memory, so these stay put: */
+    for (r = 0; r < pool.nrows[ci]; r++)
+      pool.rows[ci][r] = (*cinfo->mem->access_virt_barray)
+        ((j_common_ptr) cinfo, cfg->coefs[ci], (JDIMENSION) r, 1, TRUE)[0];
+  }
+
+  pthread_mutex_init(&pool.lock, NULL);
+  if (nthreads > pool.nbands) nthreads = pool.nbands;
+  threads = malloc((nthreads - 1) * sizeof(pthread_t));
+  for (t = 0; threads != NULL && t < nthreads - 1; t++) {
+    if (pthread_create(&threads[t], NULL, ijel_band_worker, &pool) != 0) break;
+    started++;
+  }
+  ijel_band_worker(&pool);
+  for (t = 0; t < started; t++) pthread_join(threads[t], NULL);
+  free(threads);
+  pthread_mutex_destroy(&pool.lock);
+
+  for (ci = 0; ci < pool.ncomps; ci++) free(pool.rows[ci]);
+  free(pool.header);
+  free(pool.bands);
+
+  if (pool.failed) {
+    /* Start over, so that libjpeg reads the image and reports what
+     * is wrong with it: */
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_read_restarts: a band failed; reading serially.\n");
+    cfg->coefs = NULL;
+    jpeg_abort_decompress(cinfo);
+    jpeg_memory_src(cinfo, cfg->src_mem, cfg->src_len);
+    jpeg_read_header(cinfo, TRUE);
+    return 0;
+  }
+
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_read_restarts: %d bands on %ld threads.\n",
+          pool.nbands, (long) started + 1);
+  return 1;
+}
+
+#else
+
+int ijel_read_restarts(jel_config *cfg) {
+  return 0;
+}
+
+#endif
@@ -12,15 +12,17 @@
 
 #include <math.h>
 #include "jel/jel.h"
+#include "misc.h"
+
+/* An energy limit that no quantized coefficient reaches: */
+#define JEL_ENERGY_NOLIMIT 0x7FFF
 
 /* ECC-related prototypes: */
 
-unsigned char *ijel_encode_ecc(unsigned char *, int, int *);
-unsigned char *ijel_decode_ecc(unsigned char *, int, int *);
-unsigned char *ijel_encode_ecc_nolength(unsigned char *, int, int *);
-unsigned char *ijel_decode_ecc_nolength(unsigned char *, int, int);
-int ijel_ecc_sanity_check(unsigned char *, int);
-int ijel_message_ecc_length(int, int);
+int ijel_ecc_block_payload(int, int);
+void ijel_encode_ecc_block(unsigned char *, int, int, int, unsigned char *);
+int ijel_decode_ecc_block(unsigned char *, int, int, unsigned char **, int *);
+int ijel_message_ecc_length(int, int, int);
 int ijel_ecc_block_length(int);
 int ijel_set_ecc_blocklen(int);
 int ijel_get_ecc_blocklen();
@@ -63,6 +65,14 @@ int ijel_find_freqs(JQUANT_TBL *q, int *i, int nfreq, int nlevels) {
 }
 
 
+/* How many frequencies to choose for an image when none were given
+ * explicitly: JEL_PROP_NFREQS if it was set before the image was
+ * read, otherwise the 4 that one byte per block needs. */
+static int ijel_nwanted( jel_freq_spec *fspec ) {
+  return (fspec->nwanted > 0) ? fspec->nwanted : 4;
+}
+
+
 
 int * ijel_get_quanta(JQUANT_TBL *q, int *quanta) {
   int j;
@@ -74,6 +84,41 @@ int * ijel_get_quanta(JQUANT_TBL *q, int *quanta) {
 }
 
 
+/*
+ * The frequency shuffle draws from a generator kept in the config,
+ * so that configs on different threads don't share one.  It is the
+ * additive feedback generator behind glibc's srand() and rand(), and
+ * yields the same sequence, so seeded images made when the library
+ * used rand() directly still extract.
+ */
+static int ijel_freq_rand( jel_freq_spec *fspec ) {
+  unsigned int r;
+
+  r = fspec->rtab[fspec->rfront] += fspec->rtab[fspec->rrear];
+  if (++fspec->rfront >= 31) fspec->rfront = 0;
+  if (++fspec->rrear >= 31) fspec->rrear = 0;
+  return (int) (r >> 1);
+}
+
+
+static void ijel_seed_freqs( jel_freq_spec *fspec ) {
+  long word;
+  int i;
+
+  word = fspec->seed ? fspec->seed : 1;
+  fspec->rtab[0] = word;
+  for (i = 1; i < 31; i++) {
+    /* 16807 * word % 2147483647, without overflowing 32 bits: */
+    word = 16807 * (word % 127773) - 2836 * (word / 127773);
+    if (word < 0) word += 2147483647;
+    fspec->rtab[i] = word;
+  }
+  fspec->rfront = 3;
+  fspec->rrear = 0;
+  for (i = 0; i < 310; i++) ijel_freq_rand(fspec);
+}
+
+
 /*
  * Returns an array containing the frequency indices to use for embedding.
  */
@@ -90,25 +135,18 @@ int *ijel_freqs( jel_config *cfg ) {
     n = fspec->nfreqs;
     /* Fisher-Yates */
     for (i = 0; i < n; i++) {
-      if (i > 0) j = rand() % i;
+      if (i > 0) j = ijel_freq_rand(fspec) % i;
       else j = 0;
       if (j != i) fspec->in_use[i] = fspec->in_use[j];
       fspec->in_use[j] = fspec->freqs[i];
     }
-    if(jel_verbose){
-      jel_log(cfg, "ijel_freqs selected frequencies: %d %d %d %d\n",
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_freqs selected frequencies: %d %d %d %d\n",
               fspec->in_use[0], fspec->in_use[1], fspec->in_use[2], fspec->in_use[3]);
-    }
   }
   return fspec->in_use;
 }
 
 
-/*
- * Returns the l2 norm of the AC energy EXCLUDING those frequencies
- * that will be used for embedding.
- */
-
 static int dc_value( jel_config *cfg, JCOEF *mcu) {
   struct jpeg_decompress_struct *info = &(cfg->srcinfo);
   jpeg_component_info *compptr;
@@ -124,43 +162,85 @@ static int dc_value( jel_config *cfg, JCOEF *mcu) {
 
 
 
-static int ac_energy( jel_config *cfg, JCOEF *mcu ) {
-  int val;
-  int i, j, ok;
-  int e = 0;
+/*
+ * Build the weights that ac_energy applies to each coefficient: the
+ * quantum for AC frequencies outside the admissible embedding set,
+ * and 0 for the DC and for the admissible frequencies (which
+ * embedding may change, so they must not count, or extraction would
+ * not see the energy that embedding saw).
+ *
+ * For block selection the threshold is folded into the weights as
+ * well: |coef| * quantum >= ethresh exactly when |coef| reaches
+ * ceil(ethresh / quantum), so ijel_high_energy can compare the raw
+ * coefficients against a per-frequency limit with no multiplies.
+ * Masked frequencies get a limit no coefficient can reach.
+ *
+ * Done once per pass, so the per-block work is a plain 64-lane loop
+ * with no search of the frequency list.
+ */
+
+static void ijel_energy_mask( jel_config *cfg ) {
+  int i, limit;
   jel_freq_spec *fspec = &(cfg->freqs);
-  struct jpeg_decompress_struct *info = &(cfg->srcinfo);
-  jpeg_component_info *compptr;
-  JQUANT_TBL *qtable;
+  JQUANT_TBL *qtable = cfg->srcinfo.comp_info[0].quant_table;
 
-  compptr = &(info->comp_info[0]); // per-component information
-  qtable = compptr->quant_table;
-  
+  cfg->emask[0] = 0;
+  for (i = 1; i < DCTSIZE2; i++) cfg->emask[i] = (qtable && qtable->quantval[i]) ? qtable->quantval[i] : 1;
 
-  /* We'll treat the DC component separately, so leave it out: */
-  for (i = 1; i < DCTSIZE2; i++) {
+  for (i = 0; i < fspec->nfreqs; i++)
+    if (fspec->freqs[i] > 0 && fspec->freqs[i] < DCTSIZE2) cfg->emask[fspec->freqs[i]] = 0;
+
+  for (i = 0; i < DCTSIZE2; i++) {
+    if (cfg->emask[i] == 0 || cfg->ethresh <= 0) {
+      cfg->elimit[i] = JEL_ENERGY_NOLIMIT;
+    } else {
+      limit = (cfg->ethresh + cfg->emask[i] - 1) / cfg->emask[i];
+      cfg->elimit[i] = (limit < JEL_ENERGY_NOLIMIT) ? limit : JEL_ENERGY_NOLIMIT;
+    }
+  }
+}
 
-    /* This version computes the energy for frequencies that are not
-       in the admissible set of embedding freqs.  We could narrow this
-       down to the list of in_use freqs. */
 
-    ok = 1;
-    for (j = 0; j < fspec->nfreqs && ok; j++)
-      if (i == fspec->freqs[j]) ok = 0;
+/*
+ * Max-abs of the dequantized AC coefficients under the mask.  Used
+ * for surveys; block selection uses ijel_high_energy.
+ */
 
-    if (ok) {
-      val = mcu[i] * qtable->quantval[i];
-      if ( val < 0 ) val = -val;
-      if ( val > e ) e = val;
-      //      e += (double) (val*val);
-    }
+static int ac_energy( jel_config *cfg, JCOEF *mcu ) {
+  const int *w = cfg->emask;
+  int i, val;
+  int e = 0;
+
+  for (i = 0; i < DCTSIZE2; i++) {
+    val = mcu[i] * w[i];
+    val = (val < 0) ? -val : val;
+    e = (val > e) ? val : e;
   }
 
-  //  return sqrt(e);
   return e;
 }
 
 
+/*
+ * Non-zero if ac_energy(cfg, mcu) >= cfg->ethresh.  Works on 16-bit
+ * lanes against the precomputed limits; the loop is branch-free with
+ * a fixed trip count, so the compiler can vectorize it.
+ */
+
+static int ijel_high_energy( jel_config *cfg, JCOEF *mcu ) {
+  const JCOEF *limit = cfg->elimit;
+  JCOEF val;
+  int i, hit = 0;
+
+  for (i = 0; i < DCTSIZE2; i++) {
+    val = (mcu[i] < 0) ? -mcu[i] : mcu[i];
+    hit |= (val >= limit[i]);
+  }
+
+  return hit;
+}
+
+
 /* More information could be stored in Message structs, e.g., how many
  * bits per freq. to use.
  */
@@ -186,7 +266,7 @@ static unsigned char extract_byte( int *freq, JCOEF *mcu ) {
  * Survey of MCU energies:
  */
 
-int ijel_print_energies(jel_config *cfg) {
+int ijel_print_energies(jel_config *cfg, FILE *fp) {
 
   struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
   struct jpeg_compress_struct *dinfo = &(cfg->dstinfo);
@@ -196,8 +276,6 @@ int ijel_print_energies(jel_config *cfg) {
   /* This could use some cleanup to make sure that we really need all
    * these variables! */
   int compnum = 0; /* Component (0 = luminance, 1 = U, 2 = V) */
-  /* need to be able to know what went wrong in deployments */
-  int debug = (cfg->logger != NULL);
   int blk_y, bheight, bwidth, offset_y;
   //  JDIMENSION blocknum, MCU_cols;
   JDIMENSION blocknum;
@@ -218,19 +296,19 @@ int ijel_print_energies(jel_config *cfg) {
     qtable = dinfo->quant_tbl_ptrs[0];
     if (!qtable) qtable = cinfo->quant_tbl_ptrs[0];
 
-    fspec->nfreqs = ijel_find_freqs(qtable, fspec->freqs, 4, fspec->nlevels);
+    fspec->nfreqs = ijel_find_freqs(qtable, fspec->freqs, ijel_nwanted(fspec), fspec->nlevels);
   }
 
   /* Check to see that we have at least 4 good frequencies.  This
      implicitly assumes that we are packing 8 bits per MCU.  We will
      want to change that in future versions. */ 
   if (fspec->nfreqs < 4) {
-    if( debug ) {
-      jel_log(cfg, "ijel_stuff_message: Sorry - not enough good frequencies at this quality factor.\n");
-    }
+    JEL_LOG(cfg, JEL_LOG_WARN, "ijel_stuff_message: Sorry - not enough good frequencies at this quality factor.\n");
     return 0;
   }
 
+  ijel_energy_mask(cfg);
+
   bheight = cinfo->comp_info[compnum].height_in_blocks;
   bwidth = cinfo->comp_info[compnum].width_in_blocks;
 
@@ -241,12 +319,13 @@ int ijel_print_energies(jel_config *cfg) {
   for (blk_y = 0; blk_y < bheight;
        blk_y += compptr->v_samp_factor) {
 
+    /* Read only, so rows kept in a temp file are not written back: */
     row_ptrs = ( (cinfo)->mem->access_virt_barray ) 
       ((j_common_ptr) cinfo,
        comp_array,
        blk_y,
        (JDIMENSION) compptr->v_samp_factor,
-       TRUE);
+       FALSE);
 
     for (offset_y = 0; offset_y < compptr->v_samp_factor;  offset_y++) {
 
@@ -255,7 +334,7 @@ int ijel_print_energies(jel_config *cfg) {
          * byte: */
         mcu =(JCOEF*) row_ptrs[offset_y][blocknum];
         energy = ac_energy(cfg, mcu);
-        printf("%d\n", energy);
+        fprintf(fp, "%d\n", energy);
         if (min_energy < 0 || energy < min_energy)
           min_energy = energy;
         if (max_energy < 0 || energy > max_energy)
@@ -264,21 +343,32 @@ int ijel_print_energies(jel_config *cfg) {
       }
     }
   }
-  printf("# min,max energy = %d, %d\n", min_energy, max_energy);
+  fprintf(fp, "# min,max energy = %d, %d\n", min_energy, max_energy);
   
   return 0;
 }
 
 
 
+/*
+ * A block is usable if its DC value is well away from black and
+ * white and, when there is an energy threshold, its AC energy is
+ * below it.  The cheap DC test goes first, so the energy is only
+ * computed for blocks that pass it.  Energy rejections are counted
+ * in the stats.
+ */
+
 int ijel_usable_mcu(jel_config *cfg, JCOEF *mcu) {
   int x = dc_value(cfg, mcu);
   //  jel_log(cfg, " DC = %f\n", x);
-  return ( // 1 ||
-          (
-           x > 15 && x < 240
-           //	    && ac_energy(cfg, mcu) < cfg->ethresh
-           ));
+  if ( x <= 15 || x >= 240 ) return 0;
+
+  if ( cfg->ethresh > 0 && ijel_high_energy(cfg, mcu) ) {
+    cfg->stats.blocks_energy_rejected++;
+    return 0;
+  }
+
+  return 1;
 }
 
 
@@ -294,8 +384,6 @@ int ijel_capacity(jel_config *cfg) {
   /* This could use some cleanup to make sure that we really need all
    * these variables! */
   int compnum = 0; /* Component (0 = luminance, 1 = U, 2 = V) */
-  /* need to be able to know what went wrong in deployments */
-  int debug = (cfg->logger != NULL);
   int blk_y, bheight, bwidth, offset_y;
   //  JDIMENSION blocknum, MCU_cols;
   JDIMENSION blocknum;
@@ -305,6 +393,7 @@ int ijel_capacity(jel_config *cfg) {
   JCOEF *mcu;
   JBLOCKARRAY row_ptrs;
   int capacity = 0;
+  long energy_rejected = cfg->stats.blocks_energy_rejected;
 
   /* If not already specified, find a set of frequencies suitable for
      embedding 8 bits per MCU.  Use the destination object, NOT cinfo,
@@ -316,19 +405,19 @@ int ijel_capacity(jel_config *cfg) {
     qtable = dinfo->quant_tbl_ptrs[0];
     if (!qtable) qtable = cinfo->quant_tbl_ptrs[0];
 
-    fspec->nfreqs = ijel_find_freqs(qtable, fspec->freqs, 4, fspec->nlevels);
+    fspec->nfreqs = ijel_find_freqs(qtable, fspec->freqs, ijel_nwanted(fspec), fspec->nlevels);
   }
 
   /* Check to see that we have at least 4 good frequencies.  This
      implicitly assumes that we are packing 8 bits per MCU.  We will
      want to change that in future versions. */ 
   if (fspec->nfreqs < 4) {
-    if( debug ) {
-      jel_log(cfg, "ijel_stuff_message: Sorry - not enough good frequencies at this quality factor.\n");
-    }
+    JEL_LOG(cfg, JEL_LOG_WARN, "ijel_stuff_message: Sorry - not enough good frequencies at this quality factor.\n");
     return 0;
   }
 
+  ijel_energy_mask(cfg);
+
   bheight = cinfo->comp_info[compnum].height_in_blocks;
   bwidth = cinfo->comp_info[compnum].width_in_blocks;
 
@@ -338,12 +427,13 @@ int ijel_capacity(jel_config *cfg) {
   for (blk_y = 0; blk_y < bheight;
        blk_y += compptr->v_samp_factor) {
 
+    /* Read only, so rows kept in a temp file are not written back: */
     row_ptrs = ( (cinfo)->mem->access_virt_barray ) 
       ((j_common_ptr) cinfo,
        comp_array,
        blk_y,
        (JDIMENSION) compptr->v_samp_factor,
-       TRUE);
+       FALSE);
 
     for (offset_y = 0; offset_y < compptr->v_samp_factor;  offset_y++) {
 
@@ -355,94 +445,384 @@ int ijel_capacity(jel_config *cfg) {
       }
     }
   }
+
+  /* Only embedding and extraction keep stats: */
+  cfg->stats.blocks_energy_rejected = energy_rejected;
   
   return capacity;
 }
 
+/*
+ * Streaming message source for embedding.  Plaintext is pulled from
+ * the reader a block at a time and, when ECC is in use, encoded just
+ * before its bytes are inserted, so no more than one block of the
+ * message is held here regardless of its size:
+ */
+typedef struct {
+  jel_message_reader read;
+  void *ctx;
+  int remaining;        /* Plaintext bytes not yet pulled. */
+  int nblocks;          /* ECC blocks not yet encoded. */
+  int ecc;              /* 1 if the message is RS encoded. */
+  int blocklen;         /* ECC block length. */
+  int embed_length;     /* 1 if each ECC block carries a length byte. */
+  int trailer;          /* Frame CRC bytes not yet pulled. */
+  unsigned short crc;   /* Frame CRC so far. */
+  unsigned char plain[256];
+  unsigned char block[256];
+  int pos;              /* Next byte of 'block' to insert. */
+  int n;                /* Number of valid bytes in 'block'. */
+  int error;            /* Set if the reader failed or ran dry. */
+  jel_stats *stats;
+} ijel_msg_source;
+
+
+static void ijel_init_source(jel_config *cfg, ijel_msg_source *src,
+                             jel_message_reader read, void *ctx, int len) {
+  int payload;
+
+  memset(src, 0, sizeof(ijel_msg_source));
+  src->read = read;
+  src->ctx = ctx;
+  src->remaining = len;
+  src->ecc = (jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE);
+  src->blocklen = cfg->ecc_blocklen;
+  src->embed_length = cfg->embed_length;
+  src->stats = &(cfg->stats);
+
+  /* A frame gives the length up front and ends with its CRC: */
+  if (cfg->embed_length && cfg->frame == JEL_FRAME_V1) {
+    src->embed_length = 0;
+    src->trailer = JEL_FRAME_TRAILER;
+  }
+
+  if (src->ecc) {
+    payload = ijel_ecc_block_payload(src->blocklen, src->embed_length);
+    /* With embedded length, a short (possibly empty) block always
+     * terminates the message: */
+    if (src->embed_length) src->nblocks = len / payload + 1;
+    else src->nblocks = (len + src->trailer + payload - 1) / payload;
+  }
+}
+
+
+/*
+ * Number of bytes the source will produce, i.e., the number of bytes
+ * that go into the image after any embedded length:
+ */
+static int ijel_source_length(ijel_msg_source *src) {
+  if (src->ecc) return src->nblocks * src->blocklen;
+  return src->remaining + src->trailer;
+}
+
+
+/*
+ * Pull up to 'want' bytes of plaintext, retrying short reads, and
+ * then any frame trailer.  The length was promised up front, so an
+ * early EOF is an error:
+ */
+static int ijel_pull(ijel_msg_source *src, unsigned char *buf, int want) {
+  int got = 0;
+  int n, plain;
+
+  if (want > src->remaining + src->trailer) want = src->remaining + src->trailer;
+  plain = (want < src->remaining) ? want : src->remaining;
+
+  while (got < plain) {
+    n = (*src->read)(src->ctx, buf+got, plain-got);
+    if (n <= 0) {
+      src->error = 1;
+      break;
+    }
+    got += n;
+  }
+  src->remaining -= got;
+  src->stats->msg_bytes += got;
+
+  if (src->trailer > 0 && !src->error) {
+    src->crc = ijel_frame_crc(src->crc, buf, got);
+    /* Low byte first: */
+    for (; got < want && src->trailer > 0; src->trailer--)
+      buf[got++] = (src->trailer == 2) ? (src->crc & 0xFF) : ((src->crc >> 8) & 0xFF);
+  }
+  return got;
+}
+
+
+/* Load the next block into the source.  Returns 0 if none is left: */
+static int ijel_refill(ijel_msg_source *src) {
+  int len;
+  long long t0;
+
+  src->pos = src->n = 0;
+  if (src->error) return 0;
+
+  if (!src->ecc) {
+    src->n = ijel_pull(src, src->block, sizeof(src->block));
+    return src->n;
+  }
+
+  if (src->nblocks <= 0) return 0;
+
+  len = ijel_pull(src, src->plain,
+                  ijel_ecc_block_payload(src->blocklen, src->embed_length));
+  if (src->error) return 0;
+
+  t0 = ijel_now_ns();
+  ijel_encode_ecc_block(src->plain, len, src->blocklen, src->embed_length, src->block);
+  src->stats->ecc_ns += ijel_now_ns() - t0;
+  src->stats->ecc_blocks++;
+  src->nblocks--;
+  src->n = src->blocklen;
+  return src->n;
+}
+
+
+static int ijel_next_byte(ijel_msg_source *src, unsigned char *byte) {
+  if (src->pos >= src->n && !ijel_refill(src)) return 0;
+  *byte = src->block[src->pos++];
+  return 1;
+}
+
+
+
+/*
+ * Streaming message sink for extraction.  Bytes are collected into a
+ * block, decoded as soon as the block is full, and the plaintext is
+ * handed to the writer:
+ */
+typedef struct {
+  jel_message_writer write;
+  void *ctx;
+  int remaining;        /* Plaintext bytes expected, if length is not embedded. */
+  int ecc;              /* 1 if the message is RS encoded. */
+  int blocklen;         /* ECC block length. */
+  int embed_length;     /* 1 if each ECC block carries a length byte. */
+  int trailer;          /* Frame CRC bytes expected after the plaintext. */
+  int plain_left;       /* ... and plaintext bytes before them. */
+  unsigned short crc;   /* Frame CRC so far. */
+  unsigned char tail[JEL_FRAME_TRAILER];
+  int ntail;            /* Frame CRC bytes collected. */
+  unsigned char *packed; /* A compressed frame's plaintext, held back until it is all in. */
+  int npacked;          /* ... bytes collected so far, */
+  int unpacked;         /* ... and its length once decompressed. */
+  int maxlen;           /* Most plaintext the caller will take. */
+  unsigned char block[256];
+  int n;                /* Number of bytes collected in 'block'. */
+  int done;             /* Set once the last block has been decoded. */
+  int total;            /* Plaintext bytes written so far. */
+  int error;            /* Set if the writer failed. */
+  jel_stats *stats;
+} ijel_msg_sink;
+
+
+static void ijel_init_sink(jel_config *cfg, ijel_msg_sink *snk,
+                           jel_message_writer write, void *ctx, int len) {
+  memset(snk, 0, sizeof(ijel_msg_sink));
+  snk->write = write;
+  snk->ctx = ctx;
+  snk->remaining = len;
+  snk->ecc = (jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE);
+  snk->blocklen = cfg->ecc_blocklen;
+  snk->embed_length = cfg->embed_length;
+  snk->maxlen = cfg->maxlen;
+  snk->stats = &(cfg->stats);
+}
+
+
+/* Once a frame header is in, it says how the rest is coded: */
+static void ijel_frame_sink(ijel_msg_sink *snk, ijel_frame *frame, unsigned short crc) {
+  snk->ecc = (frame->flags & JEL_FRAME_FLAG_ECC) != 0;
+  snk->blocklen = frame->blocklen;
+  snk->embed_length = 0;
+  snk->remaining = frame->length + JEL_FRAME_TRAILER;
+  snk->trailer = JEL_FRAME_TRAILER;
+  snk->plain_left = frame->length;
+  snk->crc = crc;
+
+  /* A compressed message is only of use once it is all in: */
+  if (frame->flags & JEL_FRAME_FLAG_LZF) {
+    snk->unpacked = frame->unpacked;
+    snk->packed = malloc(frame->length);
+    if (!snk->packed) snk->error = 1;
+  }
+}
+
+
+static void ijel_push(ijel_msg_sink *snk, unsigned char *buf, int len) {
+  int i, n;
+
+  if (snk->error || len <= 0) return;
+
+  /* Hold back a frame's CRC, checking the plaintext against it: */
+  if (snk->trailer > 0) {
+    n = (len < snk->plain_left) ? len : snk->plain_left;
+    snk->crc = ijel_frame_crc(snk->crc, buf, n);
+    snk->plain_left -= n;
+    for (i = n; i < len && snk->ntail < snk->trailer; i++) snk->tail[snk->ntail++] = buf[i];
+    len = n;
+    if (len <= 0) return;
+  }
+
+  if (snk->packed) {
+    memcpy(snk->packed + snk->npacked, buf, len);
+    snk->npacked += len;
+    return;
+  }
+
+  if ((*snk->write)(snk->ctx, buf, len) < 0) snk->error = 1;
+  else {
+    snk->total += len;
+    snk->stats->msg_bytes += len;
+  }
+}
+
+
+/*
+ * Deliver whatever has been collected.  A partial ECC block only
+ * happens when the image runs out early; it is zero-padded and
+ * decoded anyway, as the whole-buffer decoder always did:
+ */
+static void ijel_flush_block(ijel_msg_sink *snk) {
+  unsigned char *plain;
+  int mlen, status;
+  long long t0;
+
+  if (snk->n == 0) return;
+
+  if (!snk->ecc) {
+    ijel_push(snk, snk->block, snk->n);
+    snk->n = 0;
+    return;
+  }
+
+  memset(snk->block + snk->n, 0, snk->blocklen - snk->n);
+  snk->n = 0;
+  t0 = ijel_now_ns();
+  mlen = ijel_decode_ecc_block(snk->block, snk->blocklen, snk->embed_length, &plain, &status);
+  snk->stats->ecc_ns += ijel_now_ns() - t0;
+  snk->stats->ecc_blocks++;
+  if (status > 0) snk->stats->ecc_corrected++;
+  else if (status < 0) snk->stats->ecc_failed++;
+
+  if (snk->embed_length) {
+    /* A short block terminates the message: */
+    if (mlen < ijel_ecc_block_payload(snk->blocklen, 1)) snk->done = 1;
+  } else {
+    if (mlen > snk->remaining) mlen = snk->remaining;
+    snk->remaining -= mlen;
+    if (snk->remaining <= 0) snk->done = 1;
+  }
+
+  ijel_push(snk, plain, mlen);
+}
+
+
+/*
+ * Decompress a compressed frame's plaintext and hand it to the
+ * writer.  Returns 0, or JEL_ERR_CHECKSUM if it does not decompress
+ * to the length its header gave.  That length comes from the image,
+ * so it must be one LZF could produce from the bytes that arrived
+ * (no more than 88 per byte) and one the caller can take:
+ */
+static int ijel_unpack(ijel_msg_sink *snk) {
+  unsigned char *plain;
+  int n;
+
+  if (snk->unpacked <= 0 || snk->unpacked / 88 > snk->npacked ||
+      snk->unpacked > snk->maxlen) {
+    free(snk->packed);
+    snk->packed = NULL;
+    return JEL_ERR_CHECKSUM;
+  }
+
+  plain = malloc(snk->unpacked);
+  if (!plain) {
+    snk->error = 1;
+    return 0;
+  }
+
+  n = ijel_lzf_decompress(snk->packed, snk->npacked, plain, snk->unpacked);
+  free(snk->packed);
+  snk->packed = NULL;
+
+  if (n != snk->unpacked) {
+    free(plain);
+    return JEL_ERR_CHECKSUM;
+  }
+
+  /* The CRC has been checked, so this goes straight to the writer: */
+  snk->trailer = 0;
+  ijel_push(snk, plain, n);
+  free(plain);
+  return 0;
+}
+
+
+static void ijel_put_byte(ijel_msg_sink *snk, unsigned char byte) {
+  snk->block[snk->n++] = byte;
+
+  if (snk->n == (snk->ecc ? snk->blocklen : (int) sizeof(snk->block)))
+    ijel_flush_block(snk);
+}
+
+
+
+/* Record the block counts from a pass over the image.  Every usable
+ * block carries one byte: */
+static void ijel_count_blocks(jel_config *cfg, long scanned, long usable) {
+  cfg->stats.blocks_scanned = scanned;
+  cfg->stats.blocks_usable = usable;
+  /* ijel_usable_mcu counted its energy rejections as it went: */
+  cfg->stats.blocks_dc_rejected = scanned - usable - cfg->stats.blocks_energy_rejected;
+  cfg->stats.embedded_bytes = usable;
+}
+
+
+
 /*
  * Primary embedding function:
  *
  * By default, this function will wedge the message into the
  * monochrome component, 1 byte per MCU.  Returns the number of
- * characters inserted.
+ * characters inserted, or a negative error code if the reader fails.
  *
- * We check for ECC here.  If present and requested, ECC will be
- * performed and written to the buffer 'message'.  Otherwise 'message'
- * simply points to the message buffer itself.  After embedding, any
- * ECC buffer must be deallocated.
+ * The message is pulled from 'read', 'len' bytes in all.  If ECC is
+ * requested, each block is encoded as it is needed, so only one
+ * block of the message is ever buffered.
  */
 
-int ijel_stuff_message(jel_config *cfg) {
+int ijel_stuff_stream(jel_config *cfg, jel_message_reader read, void *ctx, int len) {
 
   struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
   struct jpeg_compress_struct *dinfo = &(cfg->dstinfo);
   jvirt_barray_ptr *coef_arrays = cfg->coefs;
   jel_freq_spec *fspec = &(cfg->freqs);
   int *flist;
-  unsigned char *message = cfg->data;
-  int msglen = cfg->len;
-
-  /* ECC variables: */
-  unsigned char *raw = cfg->data;
-  int ecc = 0;
-  int plain_len = 0;
+  ijel_msg_source src;
+  int msglen;
 
   /* This could use some cleanup to make sure that we really need all
    * these variables! */
-  //int echo = 0;
-  int embed_k = 4; /* Allows us to embed 4 bytes of length. */
+  unsigned char head[JEL_FRAME_MAX_HEADER]; /* Length or frame header, embedded first. */
+  int nhead = 0;
+  int embed_k = 0;
   int compnum = 0; /* Component (0 = luminance, 1 = U, 2 = V) */
-  int length_in;
-  /* need to be able to know what went wrong in deployments */
-  int debug = (cfg->logger != NULL);
   unsigned char byte;
   int blk_y, bheight, bwidth, offset_y, i, k;
-  //  JDIMENSION blocknum, MCU_cols;
   JDIMENSION blocknum;
   jvirt_barray_ptr comp_array = coef_arrays[compnum];
   jpeg_component_info *compptr;
   JQUANT_TBL *qtable;
   JCOEF *mcu;
   JBLOCKARRAY row_ptrs;
-  //size_t block_row_size = (size_t) SIZEOF(JCOEF)*DCTSIZE2*cinfo->comp_info[compnum].width_in_blocks;
-
-  if(jel_verbose){
-    jel_log(cfg, "ijel_stuff_message: 1st 5 bytes of plain text = %d %d %d %d %d\n", 
-            raw[0], raw[1], raw[2], raw[3], raw[4]);
-  }
-
-  plain_len = msglen; /* Save the plaintext length */
-
-  /* Check to see if we want ECC turned on: */
-  if (jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE) {
-
-    if (ijel_ecc_sanity_check(raw, msglen)){
-      jel_log(cfg, "ijel_stuff_message: FYI, sanity check failed.\n");
-      /* iam asks: why do we carry on regardless? */
-    }
-    
-    if (!cfg->embed_length){
-      message = ijel_encode_ecc_nolength(raw, msglen, &i);
-    } else {
-      message = ijel_encode_ecc(raw,  msglen, &i);
-    }
+  long scanned = 0, usable = 0;
 
-    if (!message){
-      message = raw; /* No ecc */
-    }  else {
-
-      if (cfg->verbose > 1)
-        jel_log(cfg, "ijel_stuff_message: 1st 5 bytes of ECC data = %d %d %d %d %d\n", 
-                message[0], message[1], message[2], message[3], message[4]);
-      
-      if(jel_verbose){
-        jel_log(cfg, "ijel_stuff_message: ECC enabled, %d bytes of message encoded in %d bytes.\n", msglen, i);
-      }
-      msglen = i;
-      ecc = 1;
-    }
-  }
+  ijel_init_source(cfg, &src, read, ctx, len);
+  msglen = ijel_source_length(&src);
 
+  if (src.ecc)
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_stuff_message: ECC enabled, %d bytes of message encoded in %d bytes.\n", len, msglen);
 
   /* If not already specified, find a set of frequencies suitable for
      embedding 8 bits per MCU.  Use the destination object, NOT cinfo,
@@ -454,26 +834,28 @@ int ijel_stuff_message(jel_config *cfg) {
     qtable = dinfo->quant_tbl_ptrs[0];
     if (!qtable) qtable = cinfo->quant_tbl_ptrs[0];
 
-    fspec->nfreqs = ijel_find_freqs(qtable, fspec->freqs, 4, fspec->nlevels);
+    fspec->nfreqs = ijel_find_freqs(qtable, fspec->freqs, ijel_nwanted(fspec), fspec->nlevels);
   }
 
   /* Check to see that we have at least 4 good frequencies.  This
      implicitly assumes that we are packing 8 bits per MCU.  We will
      want to change that in future versions. */ 
   if (fspec->nfreqs < 4) {
-    if( debug ) {
-      jel_log(cfg, "ijel_stuff_message: Sorry - not enough good frequencies at this quality factor.\n");
-    }
-    free(message);
+    JEL_LOG(cfg, JEL_LOG_WARN, "ijel_stuff_message: Sorry - not enough good frequencies at this quality factor.\n");
     return 0;
   }
+
+  /* Each operation starts the shuffle afresh: */
+  ijel_seed_freqs(fspec);
+  ijel_energy_mask(cfg);
+  cfg->stats.blocks_energy_rejected = 0;
   
 
   /* If requested, be verbose: */
-  if ( debug && jel_verbose ) {     /* Do we want to use verbosity levels? */
-    jel_log(cfg, "(:components #(");
-    for (i = 0; i < fspec->nfreqs; i++) jel_log(cfg, "%d ", fspec->freqs[i]);
-    jel_log(cfg, "))\n");
+  if ( JEL_LOG_DEBUG <= cfg->verbose ) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "(:components #(");
+    for (i = 0; i < fspec->nfreqs; i++) JEL_LOG(cfg, JEL_LOG_DEBUG, "%d ", fspec->freqs[i]);
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "))\n");
   }
 
   /* Need to double check the message length, to see whether it's
@@ -483,25 +865,25 @@ int ijel_stuff_message(jel_config *cfg) {
   */
   bheight = cinfo->comp_info[compnum].height_in_blocks;
   bwidth = cinfo->comp_info[compnum].width_in_blocks;
-  //  printf("In theory, we can store %d bytes\n", bheight*bwidth);
 
-  //  MCU_cols = cinfo->image_width / (cinfo->max_h_samp_factor * DCTSIZE);
   compptr = cinfo->comp_info + compnum;
 
-  /* Redundant counters?  4 bytes from length_in will be embedded>.. */
-  length_in = msglen;
   k = 0;
 
-  if (!cfg->embed_length){
-    embed_k = 0;
-  } else {
-    if(jel_verbose){
-      jel_log(cfg, "ijel_stuff_message: embedded length = %d bytes\n", length_in);
-    }
+  if (cfg->embed_length && cfg->frame == JEL_FRAME_V1) {
+    nhead = ijel_frame_header(head, (src.ecc ? JEL_FRAME_FLAG_ECC : 0) |
+                              (cfg->unpacked > 0 ? JEL_FRAME_FLAG_LZF : 0),
+                              src.blocklen, len, cfg->unpacked);
+    src.crc = ijel_frame_crc(0, head, nhead);
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_stuff_message: %d byte frame header, %d bytes follow\n", nhead, msglen);
+  } else if (cfg->embed_length) {
+    /* 4 bytes of length, low byte first: */
+    for (nhead = 0; nhead < 4; nhead++) head[nhead] = (unsigned char) (0xFF & (msglen >> (8 * nhead)));
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_stuff_message: embedded length = %d bytes\n", msglen);
   }
 
   /* Now we walk through the MCUs of the JPEG image. */
-  for (blk_y = 0; blk_y < bheight && k < msglen;
+  for (blk_y = 0; blk_y < bheight && k < msglen && !src.error;
        blk_y += compptr->v_samp_factor) {
 
     row_ptrs = ( (cinfo)->mem->access_virt_barray ) 
@@ -511,28 +893,24 @@ int ijel_stuff_message(jel_config *cfg) {
        (JDIMENSION) compptr->v_samp_factor,
        TRUE);
 
-    for (offset_y = 0; offset_y < compptr->v_samp_factor && k < msglen;
+    for (offset_y = 0; offset_y < compptr->v_samp_factor && k < msglen && !src.error;
          offset_y++) {
 
-      for (blocknum=0; blocknum < bwidth && k < msglen; blocknum++) {
+      for (blocknum=0; blocknum < bwidth && k < msglen && !src.error; blocknum++) {
         /* Grab the next MCU, get the frequencies to use, and insert a
          * byte: */
         mcu =(JCOEF*) row_ptrs[offset_y][blocknum];
+        scanned++;
         
         /* Don't use this MCU unless it's well-behaved: */
         if ( ijel_usable_mcu(cfg, mcu) ) {
+          usable++;
           flist = ijel_freqs(cfg);
 
-          if (embed_k > 0) {  /* Message length goes first: */
-            byte = (unsigned char) (0xFF & length_in);
-            //	  insert_byte( byte, fspec->freqs, mcu );
+          if (embed_k < nhead) {  /* Message length goes first: */
+            insert_byte( head[embed_k++], flist, mcu );
+          } else if ( ijel_next_byte(&src, &byte) ) {  /* Bytes of the message: */
             insert_byte( byte, flist, mcu );
-            length_in = length_in >> 8;
-            embed_k--;
-          } else {            /* Bytes of the message: */
-            //if (echo) printf("%c", message[k]);
-            //	  insert_byte( (unsigned char) (message[k] & 0xFF), fspec->freqs, mcu );
-            insert_byte( (unsigned char) (message[k] & 0xFF), flist, mcu );
             k++;
           }
         }
@@ -540,78 +918,90 @@ int ijel_stuff_message(jel_config *cfg) {
     }
   }
 
-  if (ecc) {
-    /* ECC sets up a temporary buffer for decoding, so free it: */
-    free(message);
-    /* If we got here, we were successful and should set the return
-     * value to be the number of bytes of plaintext that were
-     * embedded: */
-    k = plain_len;
+  ijel_count_blocks(cfg, scanned, usable);
+
+  if (src.error) {
+    JEL_LOG(cfg, JEL_LOG_ERROR, "ijel_stuff_message: message reader failed after %d of %d bytes.\n",
+            len - src.remaining, len);
+    cfg->jel_errno = JEL_ERR_MSGIO;
+    return JEL_ERR_MSGIO;
   }
+
+  /* With ECC, report the number of bytes of plaintext that were
+   * embedded, and never count a frame's CRC: */
+  if (src.ecc) k = len;
+  else if (k > len) k = len;
   
   return k;
 }
 
 
 
-/* Extract a message from the DCT info: */
+/* Extract a message from the DCT info, handing it to 'write' as it
+ * is decoded.  The message length limits come from cfg->len and
+ * cfg->maxlen, as set up by jel_extract: */
 
-int ijel_unstuff_message(jel_config *cfg) {
+int ijel_unstuff_stream(jel_config *cfg, jel_message_writer write, void *ctx) {
 
   struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
   jvirt_barray_ptr *coef_arrays = cfg->coefs;
   jel_freq_spec *fspec = &(cfg->freqs);
   int *flist;
-  unsigned char *message = cfg->data;
+  ijel_msg_sink snk;
   int capacity = 0;
 
   static int compnum = 0;  /* static?  Really?  This is the component number, 0=luminance.  */
   int plain_len = 0;
   int msglen = 0;
   int embed_k = 4;         /* For now, we will always embed 4 bytes of message length first. */
+  int framed = (cfg->embed_length && cfg->frame == JEL_FRAME_V1);
+  unsigned char head[JEL_FRAME_MAX_HEADER];
+  ijel_frame frame;
+  int nhead = 0;
+  int hlen = 0;
   int length_in = 0;
   int bits_up = 0;
-  //int echo = 0;
   int v;
   int blk_y, bheight, bwidth, offset_y, i, k;
-  JDIMENSION blocknum; // , MCU_cols;
+  JDIMENSION blocknum;
   jvirt_barray_ptr comp_array = coef_arrays[compnum];
   jpeg_component_info *compptr;
   JCOEF *mcu;
   JBLOCKARRAY row_ptrs;
+  long scanned = 0;
 
-  /* need to be able to know what went wrong in deployments */
-  int debug = (cfg->logger != NULL);
-  //size_t block_row_size = (size_t) SIZEOF(JCOEF)*DCTSIZE2*cinfo->comp_info[compnum].width_in_blocks;
 
   /* This uses the source quant tables, which is fine: */
   if (fspec->nfreqs == 0)
-    fspec->nfreqs = ijel_find_freqs( cinfo->quant_tbl_ptrs[0], fspec->freqs, 4, fspec->nlevels);
+    fspec->nfreqs = ijel_find_freqs( cinfo->quant_tbl_ptrs[0], fspec->freqs, ijel_nwanted(fspec), fspec->nlevels);
 
   if ( fspec->nfreqs < 4 ) {
-    if(debug){
-      jel_log(cfg, "ijel_unstuff_message: Sorry - not enough good frequencies at this quality factor.\n");
-    }
+    JEL_LOG(cfg, JEL_LOG_WARN, "ijel_unstuff_message: Sorry - not enough good frequencies at this quality factor.\n");
     return -1;
   }
 
-  if ( cinfo->err->trace_level > 0 && debug && jel_verbose) {
-    jel_log(cfg, "(:components #(");
-    for (i = 0; i < fspec->nfreqs; i++) jel_log(cfg, "%d ", fspec->freqs[i]);
-    jel_log(cfg, "))\n");
+  ijel_seed_freqs(fspec);
+  ijel_energy_mask(cfg);
+  cfg->stats.blocks_energy_rejected = 0;
+
+  if ( cinfo->err->trace_level > 0 && JEL_LOG_DEBUG <= cfg->verbose ) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "(:components #(");
+    for (i = 0; i < fspec->nfreqs; i++) JEL_LOG(cfg, JEL_LOG_DEBUG, "%d ", fspec->freqs[i]);
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "))\n");
   }
 
   bheight = cinfo->comp_info[compnum].height_in_blocks;
   bwidth = cinfo->comp_info[compnum].width_in_blocks;
-  //  printf("In theory, we can store %d bytes\n", bheight*bwidth);
 
-  //  MCU_cols = cinfo->image_width / (cinfo->max_h_samp_factor * DCTSIZE);
   compptr = cinfo->comp_info + compnum;
 
   /* Initialize msglen to some positive value.  We will reset this
      once we get the length in: */
-  if ( cfg->embed_length ) msglen = 4;  
-  else {
+  if ( cfg->embed_length ) {
+    msglen = 4;
+    /* A frame header is no longer than this; we stop once it parses: */
+    if ( framed ) embed_k = JEL_FRAME_MAX_HEADER;
+  } else {
     /* If the length is not embedded, it was supplied on the command
      * line and passed in through the message 'len' field:
      */
@@ -622,47 +1012,63 @@ int ijel_unstuff_message(jel_config *cfg) {
     /* If ECC is in use, then we need to adjust msglen, since it will
      * be the length in bytes of the original message. */
     if (cfg->ecc_method == JEL_ECC_RSCODE) {
-      //      msglen = length_in = ijel_ecc_length(msglen);
-      msglen = length_in = ijel_message_ecc_length(msglen, 0);
-      if(jel_verbose){
-        jel_log(cfg, "ijel_unstuff_message: msglen=%d, length_in=%d, cfg->len=%d\n",
-                msglen, length_in, cfg->len);
-      }
+      msglen = length_in = ijel_message_ecc_length(msglen, cfg->ecc_blocklen, 0);
     }
 
   }
 
-  if(jel_verbose){
-    jel_log(cfg, "ijel_unstuff_message: msglen=%d, length_in=%d, cfg->len=%d\n",
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: msglen=%d, length_in=%d, cfg->len=%d\n",
             msglen, length_in, cfg->len);
-  }
+
+  ijel_init_sink(cfg, &snk, write, ctx, plain_len);
 	  
   k = 0;
 
-  for (blk_y = 0; blk_y < bheight && k < msglen;
+  for (blk_y = 0; blk_y < bheight && k < msglen && !snk.done && !snk.error;
        blk_y += compptr->v_samp_factor) {
 
     row_ptrs = ((cinfo)->mem->access_virt_barray) 
       ( (j_common_ptr) cinfo, comp_array, blk_y,
         (JDIMENSION) compptr->v_samp_factor, FALSE);
 
-    for (offset_y = 0; offset_y < compptr->v_samp_factor && k < msglen;
+    for (offset_y = 0; offset_y < compptr->v_samp_factor && k < msglen && !snk.done && !snk.error;
          offset_y++) {
-      for (blocknum=0; blocknum < bwidth && k < msglen;  blocknum++) {
+      for (blocknum=0; blocknum < bwidth && k < msglen && !snk.done && !snk.error; blocknum++) {
         mcu =(JCOEF*) row_ptrs[offset_y][blocknum];
+        scanned++;
 
         /* Don't extract from this MCU unless it's well-behaved: */
 
         if ( ijel_usable_mcu(cfg, mcu) ) {
           flist = ijel_freqs(cfg);
 
-          //	v = extract_byte(fspec->freqs, mcu);
           v = extract_byte(flist, mcu);
           capacity++;
 
           if (embed_k <= 0) {
-            message[k++] = v;
-            //if (echo) printf("%c", v);
+            ijel_put_byte(&snk, (unsigned char) v);
+            k++;
+          } else if (framed) {  /* Give up on the first byte that can't be a header: */
+            head[nhead++] = v;
+            hlen = ijel_frame_parse(head, nhead, &frame);
+            if (hlen < 0) msglen = 0;
+            else if (hlen > 0) {
+              /* The header comes from the image, so its length must fit
+               * in the blocks that are left and in the caller's limit
+               * before anything is allocated for it: */
+              msglen = ijel_frame_coded_length(&frame);
+              if (msglen < 0 || msglen > (long) bwidth * bheight - scanned ||
+                  msglen > cfg->maxlen) {
+                JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: frame length %d does not fit.\n", frame.length);
+                hlen = -1;
+                msglen = 0;
+              } else {
+                embed_k = 0;
+                length_in = msglen;
+                cfg->len = msglen;
+                ijel_frame_sink(&snk, &frame, ijel_frame_crc(0, head, nhead));
+              }
+            }
           } else {  /* Message length goes first: */
             length_in = length_in | (v << bits_up);
             bits_up += 8;
@@ -678,66 +1084,100 @@ int ijel_unstuff_message(jel_config *cfg) {
     }
   }
 
-  printf ( "capacity = %d\n", capacity);
+  if (framed && hlen <= 0) {
+    ijel_count_blocks(cfg, scanned, capacity);
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: no message frame in the first %d bytes.\n", nhead);
+    cfg->jel_errno = JEL_ERR_NOMSG;
+    return JEL_ERR_NOMSG;
+  }
 
-  //  printf ("k = %d, msglen = %d\n", k, msglen);
+  /* Pick up the last, partial block if the image ran out first: */
+  if (!snk.done) ijel_flush_block(&snk);
 
-  if (cfg->embed_length && jel_verbose){
-    jel_log(cfg, "ijel_unstuff_message: embedded length = %d bytes\n", length_in);
-  }
+  ijel_count_blocks(cfg, scanned, capacity);
 
-  if (jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE) {
-    /* If we have reached here, we are using rscode for Reed-Solomon
-     * error correction.  The codeword is in 'message', obtained from
-     * cfg->data, but must be RS decoded to reconstruct the original
-     * plaintext.  The value of k needs to be ceiling'ed up to the
-     * nearest block to get all of the ECC blocks.
-     */
-    int truek;
-    unsigned char *raw;
-    truek = ijel_ecc_block_length(k);
-    if(jel_verbose){
-      jel_log(cfg, "ijel_unstuff_message: ijel_ecc_length(%d) => %d\n", k, truek);
-      jel_log(cfg, "ijel_unstuff_message: 1st 5 bytes of ECC data = %d %d %d %d %d\n", 
-              message[0], message[1], message[2], message[3], message[4]);
-    }
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: capacity = %d\n", capacity);
 
-    /* If we are not embedding length, then plaintext length is a
-     * shared secret and we pass it: */
-    if (cfg->embed_length) raw = ijel_decode_ecc(message,  truek, &i);
-    else {
-      raw = ijel_decode_ecc_nolength(message, truek, plain_len);
-      i = plain_len;
-    }
+  if (cfg->embed_length)
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: embedded length = %d bytes\n", length_in);
 
-    /* 'raw' is a newly-allocated buffer.  When should it be freed?? */
-    if (raw) {
-      if(jel_verbose){
-        jel_log(cfg, "ijel_unstuff_message: ECC enabled, %d bytes of ECC data decoded into %d bytes of message.\n", k, i);
-      }
-      
-      /* Fails on Linux: */
-      //      free(message);
-      k = i;
-
-      /* What happens to the original buffer in cfg->data??? */
-      //      cfg->data = raw;
-      memcpy(cfg->data, raw, k);
-
-      if(jel_verbose){
-        jel_log(cfg, "ijel_unstuff_message: 1st 5 bytes of plain text = %d %d %d %d %d\n", 
-                raw[0], raw[1], raw[2], raw[3], raw[4]);
-      }
- 
-      /* Raw was allocated above solely because of ECC.  Free it here? */
-      free(raw);
+  if (snk.ecc)
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: ECC enabled, %d bytes of ECC data decoded into %d bytes of message.\n", k, snk.total);
+
+  if (framed && !snk.error && (snk.ntail < JEL_FRAME_TRAILER || snk.plain_left > 0 ||
+                               snk.crc != (snk.tail[0] | (snk.tail[1] << 8)))) {
+    JEL_LOG(cfg, JEL_LOG_WARN, "ijel_unstuff_message: message frame failed its CRC.\n");
+    free(snk.packed);
+    cfg->jel_errno = JEL_ERR_CHECKSUM;
+    return JEL_ERR_CHECKSUM;
+  }
 
+  /* Only now is a compressed message complete and checked: */
+  if (snk.packed && !snk.error) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: %d compressed bytes unpack to %d.\n",
+            snk.npacked, snk.unpacked);
+    if (ijel_unpack(&snk) < 0) {
+      JEL_LOG(cfg, JEL_LOG_WARN, "ijel_unstuff_message: compressed message does not decompress.\n");
+      cfg->jel_errno = JEL_ERR_CHECKSUM;
+      return JEL_ERR_CHECKSUM;
     }
   }
+  free(snk.packed);
+
+  if (snk.error) {
+    JEL_LOG(cfg, JEL_LOG_ERROR, "ijel_unstuff_message: message writer failed after %d bytes.\n", snk.total);
+    cfg->jel_errno = JEL_ERR_MSGIO;
+    return JEL_ERR_MSGIO;
+  }
+
+  cfg->len = snk.total;
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_unstuff_message: k=%d\n", snk.total);
+
+  return snk.total;
+}
+
+
+/*
+ * Read the first 'want' message bytes (the embedded length, and
+ * whatever follows) into 'buf' from the first 'nrows' luminance
+ * block rows (a whole number of iMCU rows), which are all that have
+ * been decoded.  The blocks are chosen exactly as ijel_unstuff_stream
+ * chooses them.  Returns the number of bytes read, which is less
+ * than 'want' if the rows hold too few usable blocks, or -1 if there
+ * are not enough good frequencies.
+ */
+int ijel_probe_stream(jel_config *cfg, int nrows, unsigned char *buf, int want) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  jel_freq_spec *fspec = &(cfg->freqs);
+  jpeg_component_info *compptr = cinfo->comp_info;
+  jvirt_barray_ptr comp_array = cfg->coefs[0];
+  JBLOCKARRAY row_ptrs;
+  JDIMENSION blocknum;
+  JCOEF *mcu;
+  int blk_y, offset_y;
+  int k = 0;
+
+  if (fspec->nfreqs == 0)
+    fspec->nfreqs = ijel_find_freqs( cinfo->quant_tbl_ptrs[0], fspec->freqs, ijel_nwanted(fspec), fspec->nlevels);
+
+  if ( fspec->nfreqs < 4 ) return -1;
 
-  cfg->len = k;
-  if(jel_verbose){
-    jel_log(cfg, "ijel_unstuff_message: k=%d\n", k);
+  ijel_seed_freqs(fspec);
+  ijel_energy_mask(cfg);
+
+  for (blk_y = 0; blk_y < nrows && blk_y < (int) compptr->height_in_blocks && k < want;
+       blk_y += compptr->v_samp_factor) {
+    row_ptrs = ((cinfo)->mem->access_virt_barray)
+      ( (j_common_ptr) cinfo, comp_array, blk_y,
+        (JDIMENSION) compptr->v_samp_factor, FALSE);
+
+    for (offset_y = 0; offset_y < compptr->v_samp_factor && k < want; offset_y++) {
+      for (blocknum = 0; blocknum < compptr->width_in_blocks && k < want; blocknum++) {
+        mcu = (JCOEF*) row_ptrs[offset_y][blocknum];
+        if ( ijel_usable_mcu(cfg, mcu) )
+          buf[k++] = extract_byte(ijel_freqs(cfg), mcu);
+      }
+    }
   }
 
   return k;
@@ -795,8 +1235,8 @@ void ijel_log_hufftables(jel_config *c) {
 }
 
 
-void ijel_buffer_dump( unsigned char *data, int nbytes) {
+void ijel_buffer_dump( jel_config *cfg, unsigned char *data, int nbytes) {
   int i;
-  for (i = 0; i < nbytes; i++) printf(" %d ", data[i]);
-  printf("\n");
+  for (i = 0; i < nbytes; i++) JEL_LOG(cfg, JEL_LOG_DEBUG, " %d ", data[i]);
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "\n");
 }
@@ -0,0 +1,344 @@
+/*
+ * JPEG Embedding Library - jel-multi.c
+ *
+ * Splitting one message across several covers.  Each cover carries
+ * one shard: a JEL_SHARD_HEADER-byte header followed by a slice of
+ * the message.  The header is
+ *
+ *   bytes  0-1   'J' 'S'
+ *   byte   2     version (1)
+ *   byte   3     reserved (0)
+ *   bytes  4-5   shard index
+ *   bytes  6-7   shard count
+ *   bytes  8-11  total message length
+ *   bytes 12-15  offset of this slice in the message
+ *   bytes 16-19  length of this slice
+ *
+ * all big-endian.  Shards go through the cover's own jel_embed, so
+ * each is ECC-coded (and length-prefixed) according to that cover's
+ * config.  Since every shard says where it belongs, extraction does
+ * not care about the order of the covers.
+ *
+ * With threads, covers are handed out to a pool of workers, one per
+ * processor; each config is only ever touched by one worker.  This
+ * relies on nothing in an embed or extract being shared between
+ * configs: rscode's working state is per thread, and the frequency
+ * shuffle's generator lives in the config.
+ */
+
+#include <jel/jel.h>
+
+#include "misc.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define JEL_SHARD_VERSION 1
+#define JEL_MAX_SHARDS    65535
+
+
+/* Work shared by the cover workers: */
+typedef struct {
+  int ncovers;
+  int next;                  /* Next cover to hand out. */
+  int (*work)(void *job, int i);
+  void *job;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+#endif
+} ijel_cover_pool;
+
+
+/* One cover's part of an embed: */
+typedef struct {
+  unsigned char *msg;
+  int len;
+  int count;                 /* Number of shards. */
+  int *index;                /* Shard index per cover, -1 if skipped. */
+  int *offset;
+  int *slice;
+  int *status;               /* jel_embed's result per cover. */
+  jel_config **cfgs;
+} ijel_embed_job;
+
+
+/* One cover's part of an extract: */
+typedef struct {
+  jel_config **cfgs;
+  unsigned char **shards;    /* Extracted bytes per cover. */
+  int *lens;
+} ijel_extract_job;
+
+
+static void ijel_put32(unsigned char *p, unsigned int v) {
+  p[0] = (v >> 24) & 0xFF;
+  p[1] = (v >> 16) & 0xFF;
+  p[2] = (v >> 8) & 0xFF;
+  p[3] = v & 0xFF;
+}
+
+
+static unsigned int ijel_get32(const unsigned char *p) {
+  return ((unsigned int) p[0] << 24) | ((unsigned int) p[1] << 16) |
+    ((unsigned int) p[2] << 8) | p[3];
+}
+
+
+static int ijel_next_cover(ijel_cover_pool *pool) {
+  int i;
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&pool->lock);
+#endif
+  i = pool->next < pool->ncovers ? pool->next++ : -1;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&pool->lock);
+#endif
+  return i;
+}
+
+
+static void *ijel_cover_worker(void *arg) {
+  ijel_cover_pool *pool = (ijel_cover_pool *) arg;
+  int i;
+
+  while ((i = ijel_next_cover(pool)) >= 0)
+    pool->work(pool->job, i);
+  return NULL;
+}
+
+
+/*
+ * Run work(job, i) for i from 0 to ncovers - 1 on up to 'nthreads'
+ * threads, or as many as there are processors if that is 0 (but no
+ * more than there are covers).  jel_extract_hypotheses uses this for
+ * its candidates too:
+ */
+void ijel_for_each_cover(int ncovers, int nthreads, int (*work)(void *, int), void *job) {
+  ijel_cover_pool pool;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t *threads = NULL;
+  int t, started = 0;
+#endif
+
+  pool.ncovers = ncovers;
+  pool.next = 0;
+  pool.work = work;
+  pool.job = job;
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_init(&pool.lock, NULL);
+
+  if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads > ncovers) nthreads = ncovers;
+  if (nthreads > 1) threads = malloc((nthreads - 1) * sizeof(pthread_t));
+
+  for (t = 0; threads != NULL && t < nthreads - 1; t++) {
+    if (pthread_create(&threads[t], NULL, ijel_cover_worker, &pool) != 0) break;
+    started++;
+  }
+
+  /* This thread works too, and does everything if no other thread
+   * could be started: */
+  ijel_cover_worker(&pool);
+
+  for (t = 0; t < started; t++) pthread_join(threads[t], NULL);
+  free(threads);
+  pthread_mutex_destroy(&pool.lock);
+#else
+  ijel_cover_worker(&pool);
+#endif
+}
+
+
+static int ijel_embed_cover(void *arg, int i) {
+  ijel_embed_job *job = (ijel_embed_job *) arg;
+  unsigned char *shard;
+  int n = JEL_SHARD_HEADER + job->slice[i];
+
+  if (job->index[i] < 0) return 0;
+
+  shard = malloc(n);
+  if (shard == NULL) {
+    job->status[i] = job->cfgs[i]->jel_errno = JEL_ERR_NOSPACE;
+    return job->status[i];
+  }
+
+  shard[0] = 'J';
+  shard[1] = 'S';
+  shard[2] = JEL_SHARD_VERSION;
+  shard[3] = 0;
+  shard[4] = (job->index[i] >> 8) & 0xFF;
+  shard[5] = job->index[i] & 0xFF;
+  shard[6] = (job->count >> 8) & 0xFF;
+  shard[7] = job->count & 0xFF;
+  ijel_put32(shard+8, job->len);
+  ijel_put32(shard+12, job->offset[i]);
+  ijel_put32(shard+16, job->slice[i]);
+  if (job->slice[i] > 0) memcpy(shard+JEL_SHARD_HEADER, job->msg+job->offset[i], job->slice[i]);
+
+  job->status[i] = jel_embed(job->cfgs[i], shard, n);
+  if (job->status[i] >= 0 && job->status[i] != n) job->status[i] = JEL_ERR_NOSPACE;
+
+  free(shard);
+  return job->status[i];
+}
+
+
+int jel_embed_multi( jel_config ** cfgs, int ncovers, unsigned char * msg, int len ) {
+  ijel_embed_job job;
+  int *caps, i, k, count = 0, ret = len;
+  long long total = 0, placed = 0;
+
+  if (cfgs == NULL || ncovers <= 0 || msg == NULL || len < 0) return JEL_ERR_INVALIDARG;
+
+  caps = calloc(5 * ncovers, sizeof(int));
+  if (caps == NULL) return JEL_ERR_NOSPACE;
+  job.index = caps + ncovers;
+  job.offset = caps + 2 * ncovers;
+  job.slice = caps + 3 * ncovers;
+  job.status = caps + 4 * ncovers;
+
+  /* Room for message bytes in each cover, after its header: */
+  for (i = 0; i < ncovers; i++) {
+    caps[i] = jel_capacity(cfgs[i]) - JEL_SHARD_HEADER;
+    if (caps[i] >= 0 && count < JEL_MAX_SHARDS) {
+      job.index[i] = count++;
+      total += caps[i];
+    } else {
+      job.index[i] = -1;
+      caps[i] = 0;
+    }
+  }
+
+  if (count == 0 || total < len) {
+    free(caps);
+    return JEL_ERR_NOSPACE;
+  }
+
+  /* Slices in proportion to capacity, so that the covers fill
+   * equally; rounding leftovers go to whoever has room: */
+  for (i = 0; i < ncovers; i++) {
+    if (job.index[i] < 0) continue;
+    job.slice[i] = (int) ((long long) len * caps[i] / total);
+    placed += job.slice[i];
+  }
+  for (i = 0; placed < len; i = (i + 1) % ncovers) {
+    if (job.index[i] >= 0 && job.slice[i] < caps[i]) {
+      job.slice[i]++;
+      placed++;
+    }
+  }
+  for (i = 0, k = 0; i < ncovers; i++) {
+    job.offset[i] = k;
+    if (job.index[i] >= 0) k += job.slice[i];
+  }
+
+  job.msg = msg;
+  job.len = len;
+  job.count = count;
+  job.cfgs = cfgs;
+
+  ijel_for_each_cover(ncovers, 0, ijel_embed_cover, &job);
+
+  for (i = 0; i < ncovers; i++) {
+    if (job.index[i] >= 0 && job.status[i] < 0) {
+      ret = job.status[i];
+      break;
+    }
+  }
+
+  free(caps);
+  return ret;
+}
+
+
+static int ijel_extract_cover(void *arg, int i) {
+  ijel_extract_job *job = (ijel_extract_job *) arg;
+  jel_config *cfg = job->cfgs[i];
+  int raw, maxlen;
+
+  /* An embedded length bounds the ECC-coded length, so the buffer
+   * must take the raw capacity; otherwise take all the plaintext the
+   * cover can hold and let the header say how much is real: */
+  raw = jel_raw_capacity(cfg);
+  maxlen = jel_getprop(cfg, JEL_PROP_EMBED_LENGTH) ? raw : jel_capacity(cfg);
+  if (maxlen < JEL_SHARD_HEADER) return 0;
+
+  job->shards[i] = malloc(raw > maxlen ? raw : maxlen);
+  if (job->shards[i] == NULL) return 0;
+
+  job->lens[i] = jel_extract(cfg, job->shards[i], maxlen);
+  return job->lens[i];
+}
+
+
+int jel_extract_multi( jel_config ** cfgs, int ncovers, unsigned char * msg, int maxlen ) {
+  ijel_extract_job job;
+  unsigned char *seen = NULL, *h;
+  unsigned int count = 0, total = 0, index, offset, slice;
+  int i, found = 0, ret;
+
+  if (cfgs == NULL || ncovers <= 0 || msg == NULL || maxlen < 0) return JEL_ERR_INVALIDARG;
+
+  job.cfgs = cfgs;
+  job.shards = calloc(ncovers, sizeof(unsigned char *));
+  job.lens = calloc(ncovers, sizeof(int));
+  if (job.shards == NULL || job.lens == NULL) {
+    free(job.shards);
+    free(job.lens);
+    return JEL_ERR_NOSPACE;
+  }
+
+  ijel_for_each_cover(ncovers, 0, ijel_extract_cover, &job);
+
+  /* Every shard must agree on the count and total, and land inside
+   * the message: */
+  ret = 0;
+  for (i = 0; i < ncovers && ret == 0; i++) {
+    h = job.shards[i];
+    if (h == NULL || job.lens[i] < JEL_SHARD_HEADER ||
+        h[0] != 'J' || h[1] != 'S' || h[2] != JEL_SHARD_VERSION)
+      continue;
+
+    index = (h[4] << 8) | h[5];
+    offset = ijel_get32(h+12);
+    slice = ijel_get32(h+16);
+
+    if (seen == NULL) {
+      count = (h[6] << 8) | h[7];
+      total = ijel_get32(h+8);
+      seen = calloc(count > 0 ? count : 1, 1);
+      if (seen == NULL) ret = JEL_ERR_NOSPACE;
+    }
+
+    if (ret == 0 &&
+        (((unsigned int) ((h[6] << 8) | h[7])) != count || ijel_get32(h+8) != total ||
+         index >= count || slice > (unsigned int) (job.lens[i] - JEL_SHARD_HEADER) ||
+         offset > total || slice > total - offset))
+      ret = JEL_ERR_SHARD;
+
+    if (ret == 0 && !seen[index]) {
+      seen[index] = 1;
+      found++;
+      /* Copy what fits: */
+      if (offset < (unsigned int) maxlen)
+        memcpy(msg+offset, h+JEL_SHARD_HEADER,
+               slice < (unsigned int) maxlen - offset ? slice : (unsigned int) maxlen - offset);
+    }
+  }
+
+  if (ret == 0) {
+    if (seen == NULL || found != (int) count) ret = JEL_ERR_SHARD;
+    else if (total > (unsigned int) maxlen) ret = JEL_ERR_INVALIDARG;
+    else ret = (int) total;
+  }
+
+  for (i = 0; i < ncovers; i++) free(job.shards[i]);
+  free(job.shards);
+  free(job.lens);
+  free(seen);
+  return ret;
+}
@@ -13,9 +13,6 @@
 
 #include "misc.h"
 
-#define WEDGEDEBUG 0
-#define UNWEDGEDEBUG 0
-
 bool jel_verbose = false;
 
 /* 
@@ -25,14 +22,35 @@ bool jel_verbose = false;
  */
 #include <setjmp.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 void jpeg_memory_src (j_decompress_ptr cinfo, unsigned char *data, int size);
 void jpeg_memory_dest (j_compress_ptr cinfo, unsigned char* data, int size);
-
-int ijel_stuff_message(jel_config *cfg);
-int ijel_unstuff_message(jel_config *cfg);
-
-int ijel_capacity_ecc(int);
-int ijel_set_ecc_blocklen(int);
+int jpeg_mem_errno (j_compress_ptr cinfo);
+void jpeg_fd_src (j_decompress_ptr cinfo, int fd, size_t bufsize);
+void jpeg_fd_dest (j_compress_ptr cinfo, int fd, size_t bufsize);
+void jpeg_callback_src (j_decompress_ptr cinfo, jel_read_callback read,
+                        jel_skip_callback skip, void *ctx);
+void jpeg_callback_dest (j_compress_ptr cinfo, jel_write_callback write,
+                         jel_flush_callback flush, void *ctx);
+void jpeg_push_src (j_decompress_ptr cinfo);
+void jpeg_push_src_append (j_decompress_ptr cinfo, const unsigned char *data, size_t len);
+void jpeg_push_src_end (j_decompress_ptr cinfo);
+void *jpeg_temp_barrays (j_common_ptr src, j_common_ptr dst);
+void jpeg_temp_barrays_limit (void *store, long max_bytes);
+long jpeg_temp_barrays_spilled (void *store);
+int ijel_read_restarts (jel_config *cfg);
+
+int ijel_stuff_stream(jel_config *cfg, jel_message_reader read, void *ctx, int len);
+int ijel_unstuff_stream(jel_config *cfg, jel_message_writer write, void *ctx);
+int ijel_probe_stream(jel_config *cfg, int nrows, unsigned char *buf, int want);
+int ijel_decode_ecc_block(unsigned char *, int, int, unsigned char **, int *);
+
+int ijel_capacity_ecc(int, int);
 
 
 char* jel_error_strings[] = {
@@ -70,19 +88,22 @@ jel_config * jel_init( int nlevels ) {
   /* also zero the nfreqs (valgrind) */
   result->freqs.nfreqs = 0;
 
-  /* Zero seed implies fixed set of frequencies.  Nonzero seed implies
-   * use of srand() to generate frequencies. */
+  /* Zero seed implies fixed set of frequencies.  Nonzero seed
+   * shuffles them with the seed (see ijel_freqs). */
   result->freqs.seed = 0;
 
   /* better zero this too (valgrind); maybe calloc the whole structure?? */
   result->dstfp =  NULL;
+  result->dst_kind = JEL_DST_MEM;
+
+  result->iobufsize = JEL_IO_BUFSIZE;
 
-  /* This is the output quality.  A quality of -1 means that the same
+  /* This is the output quality.  JEL_QUALITY_COVER means that the same
    * quant tables are used for input and output.  */
 
-  result->verbose = 1;  /* "Normal" logging.  */
+  result->verbose = jel_verbose ? JEL_LOG_DEBUG : JEL_LOG_ERROR;  /* "Normal" logging.  */
 
-  result->quality = -1;
+  result->quality = JEL_QUALITY_COVER;
 
   /* Set up the decompression object: */
   result->srcinfo.err = jpeg_std_error(&result->jerr);
@@ -141,9 +162,12 @@ jel_config * jel_init( int nlevels ) {
   result->bits_per_freq = 2;
   result->bytes_per_mcu = 1;
 
-  /* MCU energy threshold is 20.0: */
-  //  result->ethresh = 700.0;
-  result->ethresh = 40000;
+  /* No energy threshold: every block with a usable DC value carries
+   * a byte, as in earlier versions: */
+  result->ethresh = 0;
+
+  /* Sources are decoded on the calling thread unless asked: */
+  result->decode_threads = 1;
 
   return result;
 }
@@ -152,8 +176,10 @@ jel_config * jel_init( int nlevels ) {
 
 void jel_free( jel_config *cfg ) {
   /* Does anything else need to be freed here? */
+  jel_flush_log(cfg);
   jpeg_destroy_decompress(&cfg->srcinfo);
   jpeg_destroy_compress(&cfg->dstinfo);
+  free(cfg->barrays);
   memset(cfg, 0, sizeof(jel_config));
   free(cfg);
   return;
@@ -161,6 +187,42 @@ void jel_free( jel_config *cfg ) {
 
 
 
+/*
+ * Reuse a config: everything that belongs to one image goes, the
+ * libjpeg objects and their permanent pools stay.
+ */
+int jel_reset( jel_config *cfg ) {
+  /* An embed or extract may have left the error manager
+   * pointing at a stack frame that is gone: */
+  cfg->srcinfo.err = &(cfg->jerr);
+  cfg->dstinfo.err = &(cfg->jerr);
+
+  jpeg_abort_decompress(&cfg->srcinfo);
+  jpeg_abort_compress(&cfg->dstinfo);
+
+  cfg->coefs = NULL;
+  cfg->dstcoefs = NULL;
+  cfg->srcfp = NULL;
+  cfg->dstfp = NULL;
+  cfg->src_mem = NULL;
+  cfg->src_len = 0;
+  cfg->src_state = JEL_SRC_HEADER;
+
+  cfg->freqs.nfreqs = 0;
+  cfg->jpeglen = 0;
+  cfg->len = 0;
+  cfg->maxlen = 0;
+  cfg->data = NULL;
+  cfg->plain = NULL;
+  cfg->jel_errno = 0;
+  memset(&(cfg->stats), 0, sizeof(jel_stats));
+
+  jel_flush_log(cfg);
+  return 0;
+}
+
+
+
 void jel_describe( jel_config *cfg ) {
   int i, nf;
   jel_log(cfg, "jel_config Object 0x%x {\n", cfg);
@@ -181,7 +243,13 @@ void jel_describe( jel_config *cfg ) {
   if (cfg->ecc_method == JEL_ECC_NONE) jel_log(cfg, "NONE,\n");
   else if (cfg->ecc_method == JEL_ECC_RSCODE) jel_log(cfg, "RSCODE,\n");
   else jel_log(cfg, "UNRECOGNIZED,\n");
-  jel_log(cfg, "    ecc_blocklen = %d\n", cfg->ecc_blocklen);
+  jel_log(cfg, "    ecc_blocklen = %d,\n", cfg->ecc_blocklen);
+  jel_log(cfg, "    ethresh = %d,\n", cfg->ethresh);
+  jel_log(cfg, "    frame = %d,\n", cfg->frame);
+  jel_log(cfg, "    compress = %d,\n", cfg->compress);
+  jel_log(cfg, "    max_memory = %d,\n", cfg->max_memory);
+  jel_log(cfg, "    decode_threads = %d,\n", cfg->decode_threads);
+  jel_log(cfg, "    restart_rows = %d\n", cfg->restart_rows);
   jel_log(cfg, "}\n");
 }
 
@@ -212,36 +280,126 @@ static long round_up (long a, long b)
   return a - (a % b);
 }
 
+
+long long ijel_now_ns(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq, now;
+
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (long long) ((double) now.QuadPart * 1e9 / (double) freq.QuadPart);
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
     
+/*
+ * A new source is read from the start and begins a new set of
+ * statistics.  A push source may take several calls to get through
+ * the header; its times accumulate.
+ */
+static void ijel_reset_source(jel_config *cfg) {
+  /* Called just after the jpeg_*_src call, which may have allocated: */
+  cfg->src_mgrs[cfg->src_kind] = cfg->srcinfo.src;
+  cfg->src_state = JEL_SRC_HEADER;
+  cfg->src_mem = NULL;
+  cfg->src_len = 0;
+  memset(&(cfg->stats), 0, sizeof(jel_stats));
+}
+
+
+/*
+ * Each jpeg_*_src and jpeg_*_dest allocates its manager struct, once,
+ * when it finds the pointer NULL, and the structs differ in size.  So
+ * that a config can change kinds (across jel_reset, say) the libjpeg
+ * objects are pointed at the one kept for the kind being set, or NULL
+ * if there is none yet:
+ */
+#if JEL_SRCMGR_PUSH + 1 != JEL_NSRCMGRS || JEL_DST_CALLBACK + 1 != JEL_NDSTMGRS
+#error "JEL_NSRCMGRS and JEL_NDSTMGRS must count the kinds in misc.h"
+#endif
+
+static void ijel_select_src(jel_config *cfg, int kind) {
+  cfg->srcinfo.src = cfg->src_mgrs[kind];
+  cfg->src_kind = kind;
+}
+
+static void ijel_select_dest(jel_config *cfg, int kind) {
+  cfg->dstinfo.dest = cfg->dst_mgrs[kind];
+  cfg->dst_kind = kind;
+}
+
+
+/*
+ * The source setters catch libjpeg errors with an error manager on
+ * their own stack.  Put the config's back before returning, so that
+ * nothing longjmps into a frame that is gone:
+ */
+static int ijel_source_done(jel_config *cfg, int ret) {
+  cfg->srcinfo.err = &(cfg->jerr);
+  return ret;
+}
+
+
 /*
  * Internal function to open the source and get coefficients:
  */
+/*
+ * Read the header and coefficients from the source and set up the
+ * destination.  With a suspending source this can return
+ * JEL_NEED_MORE_DATA at either read; cfg->src_state records how far
+ * we got, so calling again after more input arrives picks up where
+ * it left off.
+ */
 static int ijel_open_source(jel_config *cfg) {
   int ci;
-  jvirt_barray_ptr *coef_arrays = NULL;
   jpeg_component_info *compptr;
   struct jpeg_decompress_struct *srcinfo = &(cfg->srcinfo);
-  struct jpeg_compress_struct *dstinfo = &(cfg->dstinfo);
-  /* Read file header, set default decompression parameters */
-  jpeg_read_header( srcinfo, TRUE);
+  jel_stats *stats = &(cfg->stats);
+  long long t0 = ijel_now_ns();
+  int ret;
 
-  /* Read the file as arrays of DCT coefficients: */
-  cfg->coefs = jpeg_read_coefficients( srcinfo );
+  if (cfg->src_state == JEL_SRC_HEADER) {
+    /* Read file header, set default decompression parameters */
+    ret = jpeg_read_header( srcinfo, TRUE);
+    stats->header_ns += ijel_now_ns() - t0;
+    if (ret == JPEG_SUSPENDED)
+      return JEL_NEED_MORE_DATA;
+    cfg->src_state = JEL_SRC_COEFS;
+  }
+
+  if (cfg->src_state == JEL_SRC_COEFS) {
+    /* Read the file as arrays of DCT coefficients, on several
+     * threads if the source allows it: */
+    t0 = ijel_now_ns();
+    if (!ijel_read_restarts(cfg))
+      cfg->coefs = jpeg_read_coefficients( srcinfo );
+    stats->read_coefs_ns += ijel_now_ns() - t0;
+    if (cfg->coefs == NULL)
+      return JEL_NEED_MORE_DATA;
+    cfg->src_state = JEL_SRC_OPEN;
+  } else {
+    /* Already open: */
+    return 0;
+  }
 
-  coef_arrays = (jvirt_barray_ptr *)
-      (*dstinfo->mem->alloc_small) ((j_common_ptr) srcinfo, JPOOL_IMAGE,
-                                    SIZEOF(jvirt_barray_ptr) * srcinfo->num_components);
+  /* The destination writes out the source's arrays, so they are the
+   * only ones; with JEL_PROP_MAX_MEMORY, some of them may be in temp
+   * files: */
   for (ci = 0; ci < srcinfo->num_components; ci++) {
     compptr = srcinfo->comp_info + ci;
-    coef_arrays[ci] = (*dstinfo->mem->request_virt_barray)
-      ((j_common_ptr) dstinfo, JPOOL_IMAGE, FALSE,
-       (JDIMENSION) round_up((long) compptr->width_in_blocks,
-                              (long) compptr->h_samp_factor),
-       (JDIMENSION) round_up((long) compptr->height_in_blocks,
-                              (long) compptr->v_samp_factor),
-       (JDIMENSION) compptr->v_samp_factor);
+    stats->pool_bytes += SIZEOF(JBLOCK) *
+      round_up((long) compptr->width_in_blocks, (long) compptr->h_samp_factor) *
+      round_up((long) compptr->height_in_blocks, (long) compptr->v_samp_factor);
+  }
+  if (cfg->barrays) {
+    stats->temp_bytes = jpeg_temp_barrays_spilled(cfg->barrays);
+    stats->pool_bytes -= stats->temp_bytes;
   }
-  cfg->dstcoefs = coef_arrays;
 
   /* Copy the source parameters to the destination object. This sets
    * up the default transcoding environment.  From this point on, the
@@ -250,9 +408,7 @@ static int ijel_open_source(jel_config *cfg) {
 
   jpeg_copy_critical_parameters( &(cfg->srcinfo), &(cfg->dstinfo) );
 
-  if(jel_verbose){
-    jel_log(cfg, "ijel_open_source: all done.\n");
-  }
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "ijel_open_source: all done.\n");
 
   cfg->jel_errno = 0;
   return 0;  /* TO DO: more detailed error reporting. */
@@ -268,8 +424,10 @@ int jel_set_fp_source( jel_config *cfg, FILE *fpin ) {
 
   if (fpin == NULL) return JEL_ERR_INVALIDFPTR;
     
+  ijel_select_src(cfg, JEL_SRCMGR_STDIO);
   jpeg_stdio_src( &(cfg->srcinfo), fpin );
 
+  ijel_reset_source(cfg);
   return ijel_open_source( cfg );
 }
 
@@ -283,7 +441,10 @@ int jel_set_fp_dest( jel_config *cfg, FILE *fpout ) {
 
   if (fpout == NULL) return JEL_ERR_INVALIDFPTR;
 
+  ijel_select_dest(cfg, JEL_DST_STDIO);
   jpeg_stdio_dest( &(cfg->dstinfo), fpout );
+  cfg->dst_mgrs[JEL_DST_STDIO] = cfg->dstinfo.dest;
+  cfg->dstfp = fpout;
 
   cfg->jel_errno = 0;
 
@@ -304,19 +465,67 @@ int jel_set_mem_source( jel_config *cfg, unsigned char *mem, int size ) {
   jerr.mgr.error_exit = jel_error_exit;
 
   if (setjmp(jerr.jmpbuff)) { 
-    jel_log(cfg, "jel_set_mem_source: caught a libjpeg error!\n");
-    return -1; 
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_set_mem_source: caught a libjpeg error!\n");
+    return ijel_source_done(cfg, -1);
   }
 
+  ijel_select_src(cfg, JEL_SRCMGR_MEM);
   jpeg_memory_src( &(cfg->srcinfo), mem, size );
 
-  return ijel_open_source( cfg );
+  ijel_reset_source(cfg);
+  cfg->src_mem = mem;
+  cfg->src_len = size;
+  return ijel_source_done(cfg, ijel_open_source( cfg ));
 }
 
 
 int jel_set_mem_dest( jel_config *cfg, unsigned char *mem, int size) {
 
+  ijel_select_dest(cfg, JEL_DST_MEM);
   jpeg_memory_dest( &(cfg->dstinfo), mem, size );
+  cfg->dst_mgrs[JEL_DST_MEM] = cfg->dstinfo.dest;
+  cfg->jel_errno = 0;
+
+  return 0;
+}
+
+
+
+/*
+ * File descriptor source and destination.  These read and write the
+ * descriptor directly, so pipes and sockets need no FILE* wrapper:
+ */
+int jel_set_fd_source( jel_config *cfg, int fd ) {
+
+  /* graceful-ish exit on error  */
+
+  struct jel_error_mgr jerr;
+
+  if (fd < 0) return JEL_ERR_INVALIDFD;
+
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+
+  if (setjmp(jerr.jmpbuff)) { 
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_set_fd_source: caught a libjpeg error!\n");
+    return ijel_source_done(cfg, -1);
+  }
+
+  ijel_select_src(cfg, JEL_SRCMGR_FD);
+  jpeg_fd_src( &(cfg->srcinfo), fd, (size_t) cfg->iobufsize );
+
+  ijel_reset_source(cfg);
+  return ijel_source_done(cfg, ijel_open_source( cfg ));
+}
+
+
+int jel_set_fd_dest( jel_config *cfg, int fd ) {
+
+  if (fd < 0) return JEL_ERR_INVALIDFD;
+
+  ijel_select_dest(cfg, JEL_DST_FD);
+  jpeg_fd_dest( &(cfg->dstinfo), fd, (size_t) cfg->iobufsize );
+  cfg->dst_mgrs[JEL_DST_FD] = cfg->dstinfo.dest;
   cfg->jel_errno = 0;
 
   return 0;
@@ -324,6 +533,125 @@ int jel_set_mem_dest( jel_config *cfg, unsigned char *mem, int size) {
 
 
 
+/*
+ * Callback source and destination.  The caller supplies (and owns)
+ * every buffer; libjpeg reads from and writes into them in place:
+ */
+int jel_set_callback_source( jel_config *cfg, jel_read_callback read,
+                             jel_skip_callback skip, void *ctx ) {
+
+  /* graceful-ish exit on error  */
+
+  struct jel_error_mgr jerr;
+
+  if (read == NULL) return JEL_ERR_INVALIDCALLBACK;
+
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+
+  if (setjmp(jerr.jmpbuff)) { 
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_set_callback_source: caught a libjpeg error!\n");
+    return ijel_source_done(cfg, -1);
+  }
+
+  ijel_select_src(cfg, JEL_SRCMGR_CALLBACK);
+  jpeg_callback_src( &(cfg->srcinfo), read, skip, ctx );
+
+  ijel_reset_source(cfg);
+  return ijel_source_done(cfg, ijel_open_source( cfg ));
+}
+
+
+int jel_set_callback_dest( jel_config *cfg, jel_write_callback write,
+                           jel_flush_callback flush, void *ctx ) {
+
+  if (write == NULL) return JEL_ERR_INVALIDCALLBACK;
+
+  ijel_select_dest(cfg, JEL_DST_CALLBACK);
+  jpeg_callback_dest( &(cfg->dstinfo), write, flush, ctx );
+  cfg->dst_mgrs[JEL_DST_CALLBACK] = cfg->dstinfo.dest;
+  cfg->jel_errno = 0;
+
+  return 0;
+}
+
+
+
+/*
+ * Push (suspending) source.  Nothing is read here; the caller feeds
+ * the image with jel_push_source as it arrives, and each push parses
+ * as much of the header and coefficients as the data allows:
+ */
+int jel_set_push_source( jel_config *cfg ) {
+
+  /* graceful-ish exit on error  */
+
+  struct jel_error_mgr jerr;
+
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+
+  if (setjmp(jerr.jmpbuff)) { 
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_set_push_source: caught a libjpeg error!\n");
+    return ijel_source_done(cfg, -1);
+  }
+
+  ijel_select_src(cfg, JEL_SRCMGR_PUSH);
+  jpeg_push_src( &(cfg->srcinfo) );
+  ijel_reset_source(cfg);
+  cfg->jel_errno = 0;
+
+  return ijel_source_done(cfg, 0);
+}
+
+
+/*
+ * Common tail for jel_push_source and jel_push_source_end: append the
+ * data (if any) and advance the decoder.
+ */
+static int ijel_push_source(jel_config *cfg, const unsigned char *data, int len, int eof) {
+
+  /* graceful-ish exit on error  */
+
+  struct jel_error_mgr jerr;
+
+  /* Only after jel_set_push_source; anything else in srcinfo.src is
+   * another kind's manager, or none at all: */
+  if (cfg->src_kind != JEL_SRCMGR_PUSH || cfg->srcinfo.src == NULL) {
+    cfg->jel_errno = JEL_ERR_INVALIDARG;
+    return JEL_ERR_INVALIDARG;
+  }
+
+  if (cfg->src_state == JEL_SRC_OPEN) return 0;
+
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+
+  if (setjmp(jerr.jmpbuff)) { 
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_push_source: caught a libjpeg error!\n");
+    return ijel_source_done(cfg, -1);
+  }
+
+  if (data != NULL && len > 0)
+    jpeg_push_src_append( &(cfg->srcinfo), data, (size_t) len );
+  if (eof)
+    jpeg_push_src_end( &(cfg->srcinfo) );
+
+  return ijel_source_done(cfg, ijel_open_source( cfg ));
+}
+
+
+int jel_push_source( jel_config *cfg, const unsigned char *data, int len ) {
+  return ijel_push_source( cfg, data, len, 0 );
+}
+
+
+int jel_push_source_end( jel_config *cfg ) {
+  return ijel_push_source( cfg, NULL, 0, 1 );
+}
+
+
+
 /*
  * Name a file to be used as source:
  */
@@ -373,7 +701,7 @@ int jel_getprop( jel_config *cfg, jel_property prop ) {
     return cfg->freqs.seed;
 
   case JEL_PROP_NFREQS:
-    return cfg->freqs.nfreqs;
+    return cfg->freqs.nfreqs ? cfg->freqs.nfreqs : cfg->freqs.nwanted;
 
   case JEL_PROP_BYTES_PER_MCU:
     return cfg->bytes_per_mcu;
@@ -381,6 +709,30 @@ int jel_getprop( jel_config *cfg, jel_property prop ) {
   case JEL_PROP_BITS_PER_FREQ:
     return cfg->bits_per_freq;
 
+  case JEL_PROP_IO_BUFSIZE:
+    return cfg->iobufsize;
+
+  case JEL_PROP_LOG_LEVEL:
+    return cfg->verbose;
+
+  case JEL_PROP_ENERGY_THRESHOLD:
+    return cfg->ethresh;
+
+  case JEL_PROP_FRAME:
+    return cfg->frame;
+
+  case JEL_PROP_COMPRESS:
+    return cfg->compress;
+
+  case JEL_PROP_MAX_MEMORY:
+    return cfg->max_memory;
+
+  case JEL_PROP_DECODE_THREADS:
+    return cfg->decode_threads;
+
+  case JEL_PROP_RESTART_ROWS:
+    return cfg->restart_rows;
+
   }
 
   cfg->jel_errno = JEL_ERR_NOSUCHPROP;
@@ -402,10 +754,23 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
   struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
   struct jpeg_compress_struct *dinfo = &(cfg->dstinfo);
   JQUANT_TBL *qtable;
+  int i;
   int ijel_find_freqs(JQUANT_TBL *, int *, int, int);
   switch( prop ) {
 
   case JEL_PROP_QUALITY:
+    if (value < 1) {
+      /* The source copied its tables to the destination when it was
+       * opened; undo any quality set since: */
+      cfg->quality = JEL_QUALITY_COVER;
+      if (cfg->src_state == JEL_SRC_OPEN) {
+        for (i = 0; i < NUM_QUANT_TBLS; i++)
+          if (cinfo->quant_tbl_ptrs[i] && dinfo->quant_tbl_ptrs[i])
+            memcpy(dinfo->quant_tbl_ptrs[i]->quantval, cinfo->quant_tbl_ptrs[i]->quantval,
+                   sizeof(dinfo->quant_tbl_ptrs[i]->quantval));
+      }
+      return JEL_QUALITY_COVER;
+    }
     cfg->quality = value;
     /* Since jel_init initializes a compressor, we can always do this,
      * even if we don't use it: */
@@ -425,18 +790,25 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
     return value;
 
   case JEL_PROP_ECC_BLOCKLEN:
+    /* The ECC coders work on blocks of at most 255 bytes on the stack: */
+    if (value < JEL_ECC_MIN_BLOCKLEN || value > JEL_ECC_MAX_BLOCKLEN) {
+      cfg->jel_errno = JEL_ERR_INVALIDARG;
+      return JEL_ERR_INVALIDARG;
+    }
     cfg->ecc_blocklen = value;
-#ifdef ECC
-    ijel_set_ecc_blocklen(value);
-#endif
     return value;
 
   case JEL_PROP_FREQ_SEED:
-    cfg->freqs.seed = value;  /* Redundant. */
-    srand(value);
+    cfg->freqs.seed = value;
     return value;
 
   case JEL_PROP_NFREQS:
+    cfg->freqs.nwanted = value;
+    if (cfg->src_state != JEL_SRC_OPEN) {
+      /* No image yet: choose them from its tables once it is read. */
+      cfg->freqs.nfreqs = 0;
+      return value;
+    }
     cfg->freqs.nfreqs = value;
     qtable = dinfo->quant_tbl_ptrs[0];
     if (!qtable) qtable = cinfo->quant_tbl_ptrs[0];
@@ -451,6 +823,64 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
     cfg->bits_per_freq = value;
     return value;
 
+  case JEL_PROP_IO_BUFSIZE:
+    /* Only takes effect for sources and destinations set afterward. */
+    if (value < 2) value = JEL_IO_BUFSIZE;
+    cfg->iobufsize = value;
+    return value;
+
+  case JEL_PROP_LOG_LEVEL:
+    if (value < JEL_LOG_NONE) value = JEL_LOG_NONE;
+    if (value > JEL_LOG_DEBUG) value = JEL_LOG_DEBUG;
+    cfg->verbose = value;
+    return value;
+
+  case JEL_PROP_ENERGY_THRESHOLD:
+    /* Embedding and extraction must agree on this, like the seed: */
+    if (value < 0) value = 0;
+    cfg->ethresh = value;
+    return value;
+
+  case JEL_PROP_FRAME:
+    /* Like the threshold, extraction must use the embedder's choice: */
+    if (value != JEL_FRAME_V1) value = JEL_FRAME_NONE;
+    cfg->frame = value;
+    return value;
+
+  case JEL_PROP_COMPRESS:
+    /* The frame header carries the compression flag: */
+    if (value != JEL_COMPRESS_LZF) value = JEL_COMPRESS_NONE;
+    else cfg->frame = JEL_FRAME_V1;
+    cfg->compress = value;
+    return value;
+
+  case JEL_PROP_MAX_MEMORY:
+    /* Kilobytes, as for djpeg -maxmemory.  Only takes effect for
+     * sources set afterward: */
+    if (value < 0) value = 0;
+    if (value > 0 && !cfg->barrays) {
+      cfg->barrays = jpeg_temp_barrays((j_common_ptr) &(cfg->srcinfo),
+                                       (j_common_ptr) &(cfg->dstinfo));
+      if (!cfg->barrays) value = 0;
+    }
+    if (cfg->barrays) jpeg_temp_barrays_limit(cfg->barrays, (long) value * 1024L);
+    cfg->max_memory = value;
+    return value;
+
+  case JEL_PROP_DECODE_THREADS:
+    /* 0 means one per processor.  Only memory sources with restart
+     * markers, read without a memory limit, use more than one: */
+    if (value < 0) value = 1;
+    cfg->decode_threads = value;
+    return value;
+
+  case JEL_PROP_RESTART_ROWS:
+    /* Restart markers every 'value' MCU rows in embedded images, as
+     * for cjpeg -restart; 0 for none: */
+    if (value < 0) value = 0;
+    cfg->restart_rows = value;
+    return value;
+
   }
 
   cfg->jel_errno = JEL_ERR_NOSUCHPROP;
@@ -464,6 +894,7 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
  * For now, caller will need to set it explicitly in the cfg object.
  */
 int jel_open_log(jel_config *cfg, char *filename) {
+  jel_flush_log(cfg);
   cfg->logger = fopen( filename, "a+" );
   if ( cfg->logger == NULL ) {
     cfg->logger = stderr;
@@ -476,10 +907,8 @@ int jel_open_log(jel_config *cfg, char *filename) {
 }
 
 
-/*
- * Close the log file, if any.
- */
 int jel_close_log(jel_config *cfg) {
+  jel_flush_log(cfg);
   if (cfg->logger != stderr && cfg->logger != NULL) {
     FILE* tmp = cfg->logger;
     cfg->logger = NULL;
@@ -497,15 +926,90 @@ int jel_close_log(jel_config *cfg) {
 }
 
 
-int jel_log( jel_config *cfg, const char *format, ... ){
-  int retval = 0;
-  if ( cfg->logger != NULL ) {
-    va_list arg;
-    va_start(arg,format);
-    retval = vfprintf(cfg->logger, format, arg); 
-    va_end(arg);
+/*
+ * Send the log to a callback rather than a FILE.  Pass a NULL sink
+ * to go back to the log FILE, if any:
+ */
+int jel_set_log_sink( jel_config *cfg, jel_log_sink sink, void *ctx ) {
+  jel_flush_log(cfg);
+  cfg->log_sink = sink;
+  cfg->log_ctx = ctx;
+  return 0;
+}
+
+
+/*
+ * Hand any buffered log output to the sink or the log FILE:
+ */
+int jel_flush_log( jel_config *cfg ) {
+  int len = cfg->loglen;
+
+  if (len == 0) return 0;
+  cfg->loglen = 0;
+
+  if (cfg->log_sink != NULL) {
+    (*cfg->log_sink)(cfg->log_ctx, cfg->logbuf, len);
+  } else if (cfg->logger != NULL) {
+    fwrite(cfg->logbuf, 1, len, cfg->logger);
     fflush(cfg->logger);
   }
+  return len;
+}
+
+
+/*
+ * Format into the log buffer, flushing first if the message does not
+ * fit.  A message longer than the whole buffer is truncated:
+ */
+static int ijel_vlog( jel_config *cfg, int level, const char *format, va_list arg ) {
+  int room, n;
+  va_list copy;
+
+  if ( cfg->log_sink == NULL && cfg->logger == NULL ) return 0;
+
+  room = JEL_LOG_BUFSIZE - cfg->loglen;
+  va_copy(copy, arg);
+  n = vsnprintf(cfg->logbuf + cfg->loglen, room, format, copy);
+  va_end(copy);
+  if (n < 0) return n;
+
+  if (n >= room) {
+    jel_flush_log(cfg);
+    room = JEL_LOG_BUFSIZE;
+    n = vsnprintf(cfg->logbuf, room, format, arg);
+    if (n < 0) return n;
+    if (n >= room) n = room - 1;
+  }
+  cfg->loglen += n;
+
+  /* Don't sit on errors: */
+  if (level <= JEL_LOG_ERROR) jel_flush_log(cfg);
+
+  return n;
+}
+
+
+int jel_log_at( jel_config *cfg, int level, const char *format, ... ){
+  int retval;
+  va_list arg;
+
+  if ( level > cfg->verbose ) return 0;
+
+  va_start(arg,format);
+  retval = ijel_vlog(cfg, level, format, arg);
+  va_end(arg);
+  return retval;
+}
+
+
+/* Unfiltered, for callers that open a log and expect to see it: */
+int jel_log( jel_config *cfg, const char *format, ... ){
+  int retval;
+  va_list arg;
+
+  va_start(arg,format);
+  retval = ijel_vlog(cfg, JEL_LOG_INFO, format, arg);
+  va_end(arg);
   return retval;
 }
 
@@ -524,6 +1028,13 @@ char * jel_error_string( jel_config * cfg ) {
 }
 
 
+int jel_get_stats( jel_config * cfg, jel_stats * stats ) {
+  if (stats == NULL) return JEL_ERR_INVALIDARG;
+  *stats = cfg->stats;
+  return 0;
+}
+
+
 
 /*
  * Returns an integer capacity in bytes.  Does not take into account
@@ -543,6 +1054,11 @@ int    jel_capacity( jel_config * cfg ) {
   int ijel_capacity(jel_config *);
   int cap1;
 
+  /* graceful-ish exit on error: with JEL_PROP_MAX_MEMORY the blocks
+   * are read back from a temp file, which can fail */
+  struct jel_error_mgr jerr;
+  struct jpeg_error_mgr *saved_err = cfg->srcinfo.err;
+
 #if 0
   cinfo = &(cfg->srcinfo);
 
@@ -562,25 +1078,42 @@ int    jel_capacity( jel_config * cfg ) {
   cap2 = (cinfo->output_width / 8) * (cinfo->output_height / 8);
 
   /* cap2 is consistently 0 */
-  if(jel_verbose){
-    jel_log(cfg, "jel_capacity returns %d (bwidth=%d, bheight=%d, image dimension says %d)\n",
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_capacity returns %d (bwidth=%d, bheight=%d, image dimension says %d)\n",
 	    cap1, bwidth, bheight, cap2);
-  }
 
 #endif
 
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+
+  if (setjmp(jerr.jmpbuff)) {
+    cfg->srcinfo.err = saved_err;
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_capacity: caught a libjpeg error!\n");
+    return -1;
+  }
+
   /* This measures capacity by taking into account the energy constraints: */
   cap1 = ijel_capacity(cfg);
+  cfg->srcinfo.err = saved_err;
+
+  /* A frame's header, trailer and ECC blocks have their own sizes: */
+  if (cfg->embed_length && cfg->frame == JEL_FRAME_V1) {
+    cap1 = ijel_frame_capacity(cap1, jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE,
+                               cfg->ecc_blocklen);
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_capacity with a message frame returns %d\n", cap1);
+    cfg->jel_errno = JEL_SUCCESS;
+    return cap1;
+  }
 
   /* If ECC is requested, compute capacity subject to ECC overhead: */
   if (jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE) {
-    cap1 = ijel_capacity_ecc(cap1);
-    if(jel_verbose){ jel_log(cfg, "jel_capacity assuming ECC returns %d\n", cap1); }
+    cap1 = ijel_capacity_ecc(cap1, cfg->ecc_blocklen);
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_capacity assuming ECC returns %d\n", cap1);
   }
 
   if (jel_getprop(cfg, JEL_PROP_EMBED_LENGTH) == 1) {
     cap1 = cap1 - 4;
-    if(jel_verbose){ jel_log(cfg, "jel_capacity assuming embedded length returns %d\n", cap1); }
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_capacity assuming embedded length returns %d\n", cap1);
   }
 
   cfg->jel_errno = JEL_SUCCESS;
@@ -590,6 +1123,35 @@ int    jel_capacity( jel_config * cfg ) {
 
 
 
+/*
+ * Compressed capacity - jel_capacity scaled by how well a sample
+ * message compresses:
+ */
+int jel_compressed_capacity( jel_config * cfg, unsigned char * sample, int len ) {
+  unsigned char *buf;
+  long long est;
+  int cap, zlen;
+
+  cap = jel_capacity(cfg);
+  if (cap <= 0 || !sample || len <= 0 || cfg->compress != JEL_COMPRESS_LZF ||
+      !cfg->embed_length || cfg->frame != JEL_FRAME_V1) return cap;
+
+  buf = malloc(len);
+  if (!buf) return cap;
+  zlen = ijel_lzf_compress(sample, len, buf, len - 1);
+  free(buf);
+  if (zlen <= 0) return cap;
+
+  /* A compressed frame also carries the unpacked length: */
+  est = (long long) (cap - JEL_FRAME_LZF_FIELD) * len / zlen;
+  if (est > 0x7FFFFFFF) est = 0x7FFFFFFF;
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_compressed_capacity: sample %d -> %d bytes, capacity %d -> %lld\n",
+          len, zlen, cap, est);
+  return (est > cap) ? (int) est : cap;
+}
+
+
+
 /*
  * Raw capacity - regardless of ECC, this is how many bytes we can
  * store in the image:
@@ -613,6 +1175,214 @@ void * jel_alloc_buffer( jel_config *cfg ) {
 
 
 
+/*
+ * Probing for the embedded length.  libjpeg has no way to decode part
+ * of an image's coefficients, so the probe source hands the decoder
+ * only the first 'limit' bytes and then a fake EOI, noting how many
+ * iMCU rows of the first scan were complete when the data ran out.
+ * The decoder fills in the rest of the image with zeros, which we
+ * never look at.
+ */
+
+#define JEL_PROBE_BYTES 16384	/* Entropy-coded bytes for the first try. */
+
+typedef struct {
+  struct jpeg_source_mgr pub;
+  const JOCTET *data;
+  size_t len;			/* Bytes in the image */
+  size_t given;			/* Bytes handed to the decoder so far */
+  size_t limit;			/* Bytes the decoder may see */
+  int rows;			/* Complete iMCU rows at the cut, or -1 */
+  JOCTET eoi[2];
+} ijel_probe_src;
+
+
+static void ijel_probe_init_source(j_decompress_ptr cinfo) {
+}
+
+
+static boolean ijel_probe_fill_input_buffer(j_decompress_ptr cinfo) {
+  ijel_probe_src *src = (ijel_probe_src *) cinfo->src;
+
+  if (src->given < src->limit) {
+    src->pub.next_input_byte = src->data + src->given;
+    src->pub.bytes_in_buffer = src->limit - src->given;
+    src->given = src->limit;
+    return TRUE;
+  }
+
+  /* Later scans only start once the first is complete: */
+  if (src->rows < 0)
+    src->rows = (cinfo->input_scan_number <= 1) ? (int) cinfo->input_iMCU_row : (int) cinfo->total_iMCU_rows;
+
+  src->eoi[0] = (JOCTET) 0xFF;
+  src->eoi[1] = (JOCTET) JPEG_EOI;
+  src->pub.next_input_byte = src->eoi;
+  src->pub.bytes_in_buffer = 2;
+  return TRUE;
+}
+
+
+static void ijel_probe_skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+  struct jpeg_source_mgr *src = cinfo->src;
+
+  if (num_bytes <= 0) return;
+  while (num_bytes > (long) src->bytes_in_buffer) {
+    num_bytes -= (long) src->bytes_in_buffer;
+    (void) (*src->fill_input_buffer) (cinfo);
+  }
+  src->next_input_byte += (size_t) num_bytes;
+  src->bytes_in_buffer -= (size_t) num_bytes;
+}
+
+
+static void ijel_probe_term_source(j_decompress_ptr cinfo) {
+}
+
+
+/* Warnings are expected once the data is cut short: */
+static void ijel_probe_emit_message(j_common_ptr cinfo, int msg_level) {
+}
+
+
+static void ijel_probe_output_message(j_common_ptr cinfo) {
+}
+
+
+/*
+ * How many message bytes the probe needs.  With ECC, the first block
+ * must decode as well; a frame header checks itself:
+ */
+static int ijel_probe_want(jel_config *cfg) {
+  if (cfg->frame == JEL_FRAME_V1) return JEL_FRAME_MAX_HEADER;
+  return (cfg->ecc_method == JEL_ECC_RSCODE) ? 4 + cfg->ecc_blocklen : 4;
+}
+
+
+/*
+ * Check the first 'n' message bytes in 'buf', read from an image of
+ * 'nblocks' luminance blocks.  Returns the embedded length, or 0 if
+ * there can't be a message:
+ */
+static int ijel_probe_check(jel_config *cfg, unsigned char *buf, int n, int nblocks) {
+  int ecc = (cfg->ecc_method == JEL_ECC_RSCODE);
+  ijel_frame frame;
+  unsigned char *plain;
+  int status, length, hlen;
+
+  if (cfg->frame == JEL_FRAME_V1) {
+    hlen = ijel_frame_parse(buf, n, &frame);
+    length = (hlen > 0) ? ijel_frame_coded_length(&frame) : 0;
+    if (length <= 0 || length > nblocks - hlen) {
+      JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_probe_length: no message frame\n");
+      return 0;
+    }
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_probe_length: framed message, %d bytes\n", length);
+    return length;
+  }
+
+  /* Too few usable blocks, a length no image this size could hold,
+   * or a first ECC block that is not one: */
+  length = (n >= ijel_probe_want(cfg)) ? (buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24)) : 0;
+  status = 0;
+  if (ecc && length > 0 && length % cfg->ecc_blocklen == 0)
+    ijel_decode_ecc_block(buf + 4, cfg->ecc_blocklen, cfg->embed_length, &plain, &status);
+
+  if (length <= 0 || length > nblocks - 4 ||
+      (ecc && length % cfg->ecc_blocklen != 0) || status < 0) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_probe_length: no message\n");
+    return 0;
+  }
+
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_probe_length: embedded length = %d\n", length);
+  return length;
+}
+
+
+int jel_probe_length( jel_config * cfg, unsigned char * jpeg, int len ) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jpeg_source_mgr *saved_src = cinfo->src;
+  int nfreqs = cfg->freqs.nfreqs;
+  ijel_probe_src src;
+  struct jel_error_mgr jerr;
+  size_t budget = JEL_PROBE_BYTES;
+  size_t pos;
+  unsigned char buf[4 + 256];
+  int ret, rows;
+  int nblocks = 0;
+  int want = ijel_probe_want(cfg);
+
+  if (!cfg->embed_length || jpeg == NULL || len <= 0 || want > (int) sizeof(buf)) {
+    cfg->jel_errno = JEL_ERR_INVALIDARG;
+    return JEL_ERR_INVALIDARG;
+  }
+
+  jpeg_abort_decompress(cinfo);
+
+  cinfo->err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+  jerr.mgr.emit_message = ijel_probe_emit_message;
+  jerr.mgr.output_message = ijel_probe_output_message;
+
+  src.pub.init_source = ijel_probe_init_source;
+  src.pub.fill_input_buffer = ijel_probe_fill_input_buffer;
+  src.pub.skip_input_data = ijel_probe_skip_input_data;
+  src.pub.resync_to_restart = jpeg_resync_to_restart;
+  src.pub.term_source = ijel_probe_term_source;
+  src.data = jpeg;
+  src.len = len;
+
+  if (setjmp(jerr.jmpbuff)) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_probe_length: caught a libjpeg error!\n");
+    ret = -1;
+  } else {
+    cinfo->src = &(src.pub);
+    for (;;) {
+      src.pub.next_input_byte = NULL;
+      src.pub.bytes_in_buffer = 0;
+      src.given = 0;
+      src.limit = src.len;
+      src.rows = -1;
+
+      (void) jpeg_read_header(cinfo, TRUE);
+
+      /* Cut the data short only if the luminance comes first and
+       * complete; otherwise read it all: */
+      pos = src.pub.next_input_byte - src.data;
+      if (!cinfo->progressive_mode && cinfo->comps_in_scan > 0 &&
+          cinfo->cur_comp_info[0]->component_index == 0 &&
+          pos + budget < src.len) {
+        src.pub.bytes_in_buffer = budget;
+        src.given = src.limit = pos + budget;
+      }
+
+      cfg->coefs = jpeg_read_coefficients(cinfo);
+      rows = (src.rows < 0) ? (int) cinfo->total_iMCU_rows : src.rows;
+      nblocks = cinfo->comp_info[0].width_in_blocks * cinfo->comp_info[0].height_in_blocks;
+
+      ret = ijel_probe_stream(cfg, rows * cinfo->comp_info[0].v_samp_factor, buf, want);
+      jpeg_abort_decompress(cinfo);
+
+      if (ret < 0 || ret >= want || src.limit >= src.len) break;
+      budget *= 4;
+    }
+  }
+
+  /* The next source starts from scratch: */
+  jpeg_abort_decompress(cinfo);
+  cinfo->src = saved_src;
+  cinfo->err = &(cfg->jerr);
+  cfg->coefs = NULL;
+  cfg->src_state = JEL_SRC_HEADER;
+  cfg->freqs.nfreqs = nfreqs;
+
+  if (ret < 0) return ret;
+
+  return ijel_probe_check(cfg, buf, ret, nblocks);
+}
+
+
+
 /*
  * Set up the message buffer for embedding:
  */
@@ -631,15 +1401,62 @@ static void ijel_set_buffer(jel_config *cfg, unsigned char *buf, int maxlen) {
 }
 
 
+/*
+ * Memory readers and writers, so that jel_embed and jel_extract can
+ * share the streaming code paths:
+ */
+typedef struct {
+  unsigned char *data;
+  int len;
+  int pos;
+} ijel_mem_cursor;
+
+static int ijel_mem_read(void *ctx, unsigned char *buf, int len) {
+  ijel_mem_cursor *c = (ijel_mem_cursor *) ctx;
+
+  if (len > c->len - c->pos) len = c->len - c->pos;
+  memcpy(buf, c->data + c->pos, len);
+  c->pos += len;
+  return len;
+}
+
+static int ijel_mem_write(void *ctx, const unsigned char *buf, int len) {
+  ijel_mem_cursor *c = (ijel_mem_cursor *) ctx;
+  int fit = c->len - c->pos;
+
+  /* Keep what fits, but report the overflow: */
+  if (len > fit) {
+    memcpy(c->data + c->pos, buf, fit);
+    c->pos += fit;
+    return -1;
+  }
+  memcpy(c->data + c->pos, buf, len);
+  c->pos += len;
+  return len;
+}
+
+
 static size_t ijel_get_jpeg_length(jel_config * jel) {
   int jpeg_mem_packet_size(j_compress_ptr);
   int jpeg_stdio_packet_size(j_compress_ptr);
+  int jpeg_fd_packet_size(j_compress_ptr);
+  int jpeg_callback_packet_size(j_compress_ptr);
   int k;
 
-  if (jel->dstfp == NULL)
-    k = jpeg_mem_packet_size( &(jel->dstinfo) );
-  else
+  switch (jel->dst_kind) {
+  case JEL_DST_STDIO:
     k = jpeg_stdio_packet_size( &(jel->dstinfo) );
+    break;
+  case JEL_DST_FD:
+    k = jpeg_fd_packet_size( &(jel->dstinfo) );
+    break;
+  case JEL_DST_CALLBACK:
+    k = jpeg_callback_packet_size( &(jel->dstinfo) );
+    break;
+  default:
+    k = jpeg_mem_packet_size( &(jel->dstinfo) );
+    break;
+  }
 
   return k;
 }
@@ -659,19 +1476,114 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
    * code.  If the return value is positive but less than 'len', call
    * 'jel_error' for more information.
    */
-  int nwedge;
-  void ijel_log_qtables(jel_config*);
+  ijel_mem_cursor cursor;
 
   cfg->jpeglen = 0;
 
   /* If message is NULL, shouldn't we punt? */
   if ( !msg ) {
-    jel_log(cfg, "No message provided!  Exiting.\n" );
+    JEL_LOG(cfg, JEL_LOG_ERROR, "No message provided!  Exiting.\n" );
     jel_close_log(cfg);
     cfg->jel_errno = JEL_ERR_NOMSG;
     return cfg->jel_errno;
   }
 
+  ijel_set_message(cfg, msg, len);
+
+  cursor.data = msg;
+  cursor.len = len;
+  cursor.pos = 0;
+
+  return jel_embed_stream( cfg, ijel_mem_read, &cursor, len );
+}
+
+
+/*
+ * For JEL_PROP_COMPRESS: read all 'len' bytes of the message into
+ * *packed and compress them if that shrinks the embedded message,
+ * which sets cfg->unpacked.  Returns the number of bytes in *packed,
+ * or JEL_ERR_MSGIO.
+ */
+static int ijel_pack_message(jel_config *cfg, jel_message_reader read, void *ctx, int len,
+                             unsigned char **packed) {
+  unsigned char *plain, *z;
+  int ecc = (cfg->ecc_method == JEL_ECC_RSCODE) ? JEL_FRAME_FLAG_ECC : 0;
+  int got, n, zlen;
+
+  *packed = NULL;
+  cfg->unpacked = 0;
+
+  plain = malloc(len);
+  z = malloc(len);
+  if (!plain || !z) {
+    free(plain);
+    free(z);
+    cfg->jel_errno = JEL_ERR_MSGIO;
+    return JEL_ERR_MSGIO;
+  }
+
+  for (got = 0; got < len; got += n) {
+    n = (*read)(ctx, plain + got, len - got);
+    if (n <= 0) {
+      JEL_LOG(cfg, JEL_LOG_ERROR, "jel_embed: message reader failed after %d of %d bytes.\n", got, len);
+      free(plain);
+      free(z);
+      cfg->jel_errno = JEL_ERR_MSGIO;
+      return JEL_ERR_MSGIO;
+    }
+  }
+
+  /* Keep the compressed copy only if it takes fewer blocks, header
+   * and ECC included: */
+  zlen = ijel_lzf_compress(plain, len, z, len - 1);
+  if (zlen > 0 &&
+      ijel_frame_size(ecc | JEL_FRAME_FLAG_LZF, cfg->ecc_blocklen, zlen, len) <
+      ijel_frame_size(ecc, cfg->ecc_blocklen, len, 0)) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_embed: message compressed from %d to %d bytes\n", len, zlen);
+    free(plain);
+    cfg->unpacked = len;
+    *packed = z;
+    return zlen;
+  }
+
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_embed: compression does not help, %d bytes embedded as is\n", len);
+  free(z);
+  *packed = plain;
+  return len;
+}
+
+
+/*  
+ * Embed a message that is pulled from a reader as it is needed:
+ */
+int jel_embed_stream( jel_config * cfg, jel_message_reader read, void *ctx, int len ) {
+  int nwedge;
+  jel_stats *stats = &(cfg->stats);
+  long long t0;
+  unsigned char *packed = NULL;
+  ijel_mem_cursor cursor;
+  int mlen = len;
+
+  cfg->jpeglen = 0;
+
+  if ( !read ) {
+    JEL_LOG(cfg, JEL_LOG_ERROR, "No message provided!  Exiting.\n" );
+    cfg->jel_errno = JEL_ERR_NOMSG;
+    return cfg->jel_errno;
+  }
+
+  /* Compression needs the whole message before anything is embedded: */
+  if (cfg->compress == JEL_COMPRESS_LZF && cfg->embed_length &&
+      cfg->frame == JEL_FRAME_V1 && len > 0) {
+    mlen = ijel_pack_message(cfg, read, ctx, len, &packed);
+    if (mlen < 0) return mlen;
+    cursor.data = packed;
+    cursor.len = mlen;
+    cursor.pos = 0;
+    read = ijel_mem_read;
+    ctx = &cursor;
+  }
+
   /* graceful-ish exit on error  */
 
   struct jel_error_mgr src_jerr;
@@ -687,31 +1599,56 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
 
   if (setjmp(src_jerr.jmpbuff)) { 
     /* jpeg library has signalled an error on srcinfo */
-    jel_log(cfg, "jel_embed: caught a libjpeg error in srcinfo!\n");
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_embed: caught a libjpeg error in srcinfo!\n");
+    free(packed);
+    cfg->unpacked = 0;
     return -1; 
   }
 
   if (setjmp(dst_jerr.jmpbuff)) { 
     /* jpeg library has signalled an error on destinfo */
-    jel_log(cfg, "jel_embed: caught a libjpeg error in destinfo!\n");
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_embed: caught a libjpeg error in destinfo!\n");
+    free(packed);
+    cfg->unpacked = 0;
+    /* A memory destination that filled up is reported as such: */
+    if (cfg->dst_kind == JEL_DST_MEM && cfg->dstinfo.dest &&
+        jpeg_mem_errno(&cfg->dstinfo)) {
+      cfg->jel_errno = JEL_ERR_NOSPACE;
+      return cfg->jel_errno;
+    }
     return -1; 
   }
   
   
 
   /* Insert the message: */
-  ijel_set_message(cfg, msg, len);
-  nwedge = ijel_stuff_message(cfg);
+  t0 = ijel_now_ns();
+  nwedge = ijel_stuff_stream(cfg, read, ctx, mlen);
+  stats->scan_ns = ijel_now_ns() - t0 - stats->ecc_ns;
+
+  /* A whole compressed message stands for all of the plaintext; part
+   * of one is reported as a truncation: */
+  if (cfg->unpacked > 0 && nwedge == mlen) nwedge = len;
+  cfg->unpacked = 0;
+  if (nwedge < 0) {
+    free(packed);
+    return nwedge;
+  }
 
   if ( cfg->quality > 0 ) {
     jpeg_set_quality( &(cfg->dstinfo), cfg->quality, FALSE );
-    if(jel_verbose){ jel_log(cfg, "jel_embed: Reset quality to %d after jpeg_copy_critical_parameters.\n", cfg->quality); }
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_embed: Reset quality to %d after jpeg_copy_critical_parameters.\n", cfg->quality);
   }
 
   //  ijel_log_qtables(cfg);
 
+  if ( cfg->restart_rows > 0 )
+    cfg->dstinfo.restart_in_rows = cfg->restart_rows;
+
   /* Start compressor (note no image data is actually written here) */
+  t0 = ijel_now_ns();
   jpeg_write_coefficients( &(cfg->dstinfo), cfg->coefs );
+  stats->write_coefs_ns = ijel_now_ns() - t0;
 
   /* Copy to the output file any extra markers that we want to preserve */
   //  jcopy_markers_execute(&srcinfo, &dstinfo, JCOPYOPT_ALL);
@@ -719,19 +1656,25 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
   //  ijel_log_qtables(cfg);
 
   /* Finish compression and release memory */
+  t0 = ijel_now_ns();
   jpeg_finish_compress(&cfg->dstinfo);
 
   cfg->jpeglen = ijel_get_jpeg_length(cfg);
-  if(jel_verbose){ jel_log(cfg, "jel_embed: JPEG compressed output size is %d.\n", cfg->jpeglen); }
+  stats->jpeg_bytes_out = cfg->jpeglen;
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_embed: JPEG compressed output size is %d.\n", cfg->jpeglen);
 
   //ian moved this to jel_free
   //jpeg_destroy_compress(&cfg->dstinfo);
 
   (void) jpeg_finish_decompress(&cfg->srcinfo);
+  stats->finish_ns = ijel_now_ns() - t0;
 
   //ian moved this to jel_free
   //jpeg_destroy_decompress(&cfg->srcinfo);
 
+  jel_flush_log(cfg);
+  free(packed);
+
   /* Should probably check for JPEG warnings here: */
   return nwedge; /* suppress no-return-value warnings */
 
@@ -757,25 +1700,51 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int maxlen) {
    * message, a negative error code will be returned, but msg will still
    * contain the bytes that WERE extracted.
    */
+  ijel_mem_cursor cursor;
+
+  cursor.data = msg;
+  cursor.len = maxlen;
+  cursor.pos = 0;
+
+  ijel_set_buffer(cfg, msg, maxlen);
+
+  return jel_extract_stream( cfg, ijel_mem_write, &cursor, maxlen );
+}
+
+
+/*
+ * Extract a message, handing it to a writer as it is decoded:
+ */
+int jel_extract_stream( jel_config * cfg, jel_message_writer write, void *ctx, int maxlen ) {
   int msglen;
+  jel_stats *stats = &(cfg->stats);
+  long long t0;
 
   /* graceful-ish exit on error */
   struct jel_error_mgr jerr;
   cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
   jerr.mgr.error_exit = jel_error_exit;
   
-  if (setjmp(jerr.jmpbuff)) { return -1; }
+  if (setjmp(jerr.jmpbuff)) {
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_extract: caught a libjpeg error!\n");
+    return -1;
+  }
 
 
-  ijel_set_buffer(cfg, msg, maxlen);
-  cfg->len = maxlen;
-  msglen = ijel_unstuff_message(cfg);
+  /* cfg->data is left alone: jel_extract points it at the caller's
+   * buffer, and a pure stream has none. */
+  cfg->maxlen = cfg->len = maxlen;
+  t0 = ijel_now_ns();
+  msglen = ijel_unstuff_stream(cfg, write, ctx);
+  stats->scan_ns = ijel_now_ns() - t0 - stats->ecc_ns;
   
-  if(UNWEDGEDEBUG){
-    jel_log(cfg, "jel_extract: %d bytes extracted\n", msglen);
-  }    
+  JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_extract: %d bytes extracted\n", msglen);
 
+  t0 = ijel_now_ns();
   (void) jpeg_finish_decompress(&(cfg->srcinfo));
+  stats->finish_ns = ijel_now_ns() - t0;
+
+  jel_flush_log(cfg);
 
   //ian moved this to jel_free
   //jpeg_destroy_decompress(&(cfg->srcinfo));
@@ -785,3 +1754,161 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int maxlen) {
 }
 
 
+
+
+
+/*
+ * Extraction under several candidate settings.  Each candidate gets
+ * a copy of the config with its settings applied.  The copies share
+ * the source's coefficient arrays, which extraction only reads, and
+ * never touch the libjpeg objects otherwise.  They do not log.
+ */
+typedef struct {
+  jel_hypothesis *hyps;
+  jel_config **cfgs;
+  unsigned char **msgs;      /* Extracted bytes per candidate. */
+  int maxlen;
+} ijel_hypothesis_job;
+
+
+static int ijel_try_hypothesis(void *arg, int i) {
+  ijel_hypothesis_job *job = (ijel_hypothesis_job *) arg;
+  jel_config *cfg = job->cfgs[i];
+  jpeg_component_info *compptr;
+  unsigned char buf[4 + 256];
+  ijel_mem_cursor cursor;
+  struct jel_error_mgr jerr;
+  int n;
+
+  /* Skipped, or its copy could not be made: */
+  if (!cfg) return job->hyps[i].result;
+
+  /* As jel_probe_length, the probe must fit in 'buf': */
+  if (ijel_probe_want(cfg) > (int) sizeof(buf)) {
+    job->hyps[i].result = JEL_ERR_INVALIDARG;
+    return JEL_ERR_INVALIDARG;
+  }
+  compptr = cfg->srcinfo.comp_info;
+
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+
+  if (setjmp(jerr.jmpbuff)) {
+    job->hyps[i].result = -1;
+    return -1;
+  }
+
+  /* The cheap test first: the length, or frame header, and the first
+   * ECC block: */
+  job->hyps[i].result = 0;
+  n = ijel_probe_stream(cfg, compptr->height_in_blocks, buf, ijel_probe_want(cfg));
+  if (n < 0 ||
+      ijel_probe_check(cfg, buf, n, compptr->width_in_blocks * compptr->height_in_blocks) <= 0)
+    return 0;
+
+  job->msgs[i] = malloc(job->maxlen);
+  if (!job->msgs[i]) {
+    job->hyps[i].result = JEL_ERR_NOSPACE;
+    return JEL_ERR_NOSPACE;
+  }
+
+  cursor.data = job->msgs[i];
+  cursor.len = job->maxlen;
+  cursor.pos = 0;
+  ijel_set_buffer(cfg, job->msgs[i], job->maxlen);
+  cfg->len = job->maxlen;
+
+  job->hyps[i].result = ijel_unstuff_stream(cfg, ijel_mem_write, &cursor);
+  return job->hyps[i].result;
+}
+
+
+int jel_extract_hypotheses( jel_config * cfg, jel_hypothesis * hyps, int nhyps,
+                            unsigned char * msg, int maxlen ) {
+  ijel_hypothesis_job job;
+  struct jel_error_mgr jerr;
+  jel_config *c;
+  int i, best = JEL_ERR_NOMSG;
+
+  if (!cfg->embed_length || cfg->src_state != JEL_SRC_OPEN || !hyps || nhyps <= 0 ||
+      !msg || maxlen <= 0) {
+    cfg->jel_errno = JEL_ERR_INVALIDARG;
+    return JEL_ERR_INVALIDARG;
+  }
+
+  job.hyps = hyps;
+  job.maxlen = maxlen;
+  job.cfgs = calloc(nhyps, sizeof(jel_config *));
+  job.msgs = calloc(nhyps, sizeof(unsigned char *));
+  if (!job.cfgs || !job.msgs) {
+    free(job.cfgs);
+    free(job.msgs);
+    cfg->jel_errno = JEL_ERR_NOSPACE;
+    return JEL_ERR_NOSPACE;
+  }
+
+  jel_flush_log(cfg);
+
+  for (i = 0; i < nhyps; i++) {
+    hyps[i].result = JEL_ERR_INVALIDARG;
+    /* A block length no ECC block can have is skipped: */
+    if (hyps[i].ecc_blocklen != 0 &&
+        (hyps[i].ecc_blocklen < JEL_ECC_MIN_BLOCKLEN || hyps[i].ecc_blocklen > JEL_ECC_MAX_BLOCKLEN))
+      continue;
+    c = job.cfgs[i] = malloc(sizeof(jel_config));
+    if (!c) {
+      hyps[i].result = JEL_ERR_NOSPACE;
+      continue;
+    }
+
+    memcpy(c, cfg, sizeof(jel_config));
+    c->verbose = JEL_LOG_NONE;
+    c->loglen = 0;
+
+    c->freqs.seed = hyps[i].seed;
+    if (hyps[i].nlevels > 0) c->freqs.nlevels = hyps[i].nlevels;
+    if (hyps[i].nfreqs > 0) c->freqs.nwanted = hyps[i].nfreqs;
+    if (hyps[i].nlevels > 0 || hyps[i].nfreqs > 0) c->freqs.nfreqs = 0;
+#ifdef ECC
+    c->ecc_method = (hyps[i].ecc_method == JEL_ECC_RSCODE) ? JEL_ECC_RSCODE : JEL_ECC_NONE;
+#else
+    c->ecc_method = JEL_ECC_NONE;
+#endif
+    if (hyps[i].ecc_blocklen > 0) c->ecc_blocklen = hyps[i].ecc_blocklen;
+    c->frame = (hyps[i].frame == JEL_FRAME_V1) ? JEL_FRAME_V1 : JEL_FRAME_NONE;
+    c->ethresh = (hyps[i].ethresh > 0) ? hyps[i].ethresh : 0;
+  }
+
+  /* Paged coefficient arrays move under a reader, so with a memory
+   * limit the candidates take turns: */
+  ijel_for_each_cover(nhyps, cfg->barrays ? 1 : 0, ijel_try_hypothesis, &job);
+
+  for (i = 0; i < nhyps; i++) {
+    JEL_LOG(cfg, JEL_LOG_DEBUG, "jel_extract_hypotheses: candidate %d (seed %d) gives %d\n",
+            i, hyps[i].seed, hyps[i].result);
+    if (best < 0 && hyps[i].result > 0) {
+      best = i;
+      memcpy(msg, job.msgs[i], hyps[i].result);
+      cfg->len = hyps[i].result;
+      cfg->stats = job.cfgs[i]->stats;
+    }
+    free(job.msgs[i]);
+    free(job.cfgs[i]);
+  }
+  free(job.msgs);
+  free(job.cfgs);
+
+  cfg->jel_errno = (best < 0) ? best : 0;
+
+  /* As jel_extract does, finish with the source: */
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+  if (setjmp(jerr.jmpbuff)) {
+    JEL_LOG(cfg, JEL_LOG_ERROR, "jel_extract_hypotheses: caught a libjpeg error!\n");
+    return -1;
+  }
+  (void) jpeg_finish_decompress(&(cfg->srcinfo));
+
+  jel_flush_log(cfg);
+  return best;
+}
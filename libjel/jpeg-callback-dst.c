@@ -0,0 +1,152 @@
+#include <jel/jel.h>
+
+#include "misc.h"
+
+
+/*
+ * This output manager hands buffer management to the caller.  The
+ * 'write' callback receives each finished buffer and returns the
+ * next one to fill, so compressed output can go straight into pooled
+ * or pre-registered buffers without an intermediate copy.
+ */
+
+/* Expanded data destination object for callback output */
+
+typedef struct {
+  struct jpeg_destination_mgr pub; /* public fields */
+  long length;                  /* Keeps track of the number of output bytes. */
+
+  jel_write_callback write;	/* takes a full buffer, returns the next */
+  jel_flush_callback flush;	/* called after the last write; may be NULL */
+  void *ctx;			/* caller's context for both */
+  JOCTET * buffer;		/* start of the current buffer */
+  int bufsize;			/* size of the current buffer */
+} callback_destination_mgr;
+
+typedef callback_destination_mgr * callback_dest_ptr;
+
+
+/*
+ * Hand 'len' bytes of the current buffer to the caller and install
+ * whatever buffer comes back.  After the final bytes no buffer is
+ * needed, so the caller may return NULL then, and reports a failed
+ * write with a negative *bufsize instead.
+ */
+LOCAL(void)
+next_buffer (j_compress_ptr cinfo, int len, boolean final)
+{
+  callback_dest_ptr dest = (callback_dest_ptr) cinfo->dest;
+  unsigned char *buf;
+  int size = 0;
+
+  buf = (*dest->write) (dest->ctx, (unsigned char *) dest->buffer, len, &size);
+  dest->length += len;
+  if (final) {
+    if (size < 0)
+      ERREXIT(cinfo, JERR_FILE_WRITE);
+    dest->buffer = NULL;
+    dest->bufsize = 0;
+    dest->pub.next_output_byte = NULL;
+    dest->pub.free_in_buffer = 0;
+    return;
+  }
+  if (buf == NULL || size <= 0)
+    ERREXIT(cinfo, JERR_FILE_WRITE);
+
+  dest->buffer = (JOCTET *) buf;
+  dest->bufsize = size;
+  dest->pub.next_output_byte = dest->buffer;
+  dest->pub.free_in_buffer = size;
+}
+
+
+/*
+ * Initialize destination --- called by jpeg_start_compress
+ * before any data is actually written.  The first buffer comes from
+ * a write call with no data.
+ */
+
+METHODDEF(void)
+init_destination (j_compress_ptr cinfo)
+{
+  callback_dest_ptr dest = (callback_dest_ptr) cinfo->dest;
+
+  dest->length = 0;
+  dest->buffer = NULL;
+  next_buffer(cinfo, 0, FALSE);
+}
+
+
+/*
+ * Empty the output buffer --- called whenever buffer fills up.
+ */
+
+METHODDEF(boolean)
+empty_output_buffer (j_compress_ptr cinfo)
+{
+  callback_dest_ptr dest = (callback_dest_ptr) cinfo->dest;
+
+  next_buffer(cinfo, dest->bufsize, FALSE);
+
+  return TRUE;
+}
+
+
+/*
+ * Terminate destination --- called by jpeg_finish_compress
+ * after all data has been written.  The partial last buffer goes to
+ * the caller, followed by the flush callback.
+ */
+
+METHODDEF(void)
+term_destination (j_compress_ptr cinfo)
+{
+  callback_dest_ptr dest = (callback_dest_ptr) cinfo->dest;
+  int datacount = dest->bufsize - (int) dest->pub.free_in_buffer;
+
+  if (datacount > 0)
+    next_buffer(cinfo, datacount, TRUE);
+
+  if (dest->flush != NULL && (*dest->flush) (dest->ctx) < 0)
+    ERREXIT(cinfo, JERR_FILE_WRITE);
+}
+
+
+/*
+ * Prepare for output through caller-supplied callbacks.
+ */
+
+GLOBAL(void)
+jpeg_callback_dest (j_compress_ptr cinfo, jel_write_callback write,
+                    jel_flush_callback flush, void *ctx)
+{
+  callback_dest_ptr dest;
+
+  /* The destination object is made permanent, as in jdatadst.c.  It
+   * is reused whenever cinfo->dest is non-NULL, so the caller must hand
+   * back a struct made here, never another kind's: jel.c keeps one
+   * per destination kind for that.
+   */
+  if (cinfo->dest == NULL) {	/* first time for this JPEG object? */
+    cinfo->dest = (struct jpeg_destination_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  SIZEOF(callback_destination_mgr));
+  }
+
+  dest = (callback_dest_ptr) cinfo->dest;
+  dest->pub.init_destination = init_destination;
+  dest->pub.empty_output_buffer = empty_output_buffer;
+  dest->pub.term_destination = term_destination;
+  dest->write = write;
+  dest->flush = flush;
+  dest->ctx = ctx;
+  dest->length = 0;
+}
+
+
+GLOBAL(int) jpeg_callback_packet_size(j_compress_ptr cinfo) {
+  callback_dest_ptr dest;
+  dest =  (callback_dest_ptr) cinfo->dest;
+
+  return (int) dest->length;
+}
@@ -0,0 +1,165 @@
+/*
+ * Adapted from jdatasrc.c ((C) 1994-1996, Thomas G. Lane.)
+ *
+ * This is a callback data source manager.  The caller supplies the
+ * buffers: each call to the 'read' callback hands back a pointer to
+ * the next run of JPEG-compressed bytes, which libjpeg consumes in
+ * place.  Nothing is copied on the way in, so the bytes can come
+ * straight from a buffer pool or ring buffer.
+ *
+ */
+
+#include <jel/jel.h>
+
+#include "misc.h"
+
+
+/* Expanded data source object for callback input */
+
+typedef struct {
+  struct jpeg_source_mgr pub;	/* public fields */
+
+  jel_read_callback read;	/* hands us the next buffer */
+  jel_skip_callback skip;	/* discards unbuffered bytes; may be NULL */
+  void *ctx;			/* caller's context for both */
+  boolean start_of_file;	/* have we gotten any data yet? */
+} callback_source_mgr;
+
+typedef callback_source_mgr * callback_src_ptr;
+
+static const JOCTET fake_eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+
+
+/*
+ * Initialize source --- called by jpeg_read_header
+ * before any data is actually read.
+ */
+
+METHODDEF(void)
+init_source (j_decompress_ptr cinfo)
+{
+  callback_src_ptr src = (callback_src_ptr) cinfo->src;
+
+  src->start_of_file = TRUE;
+}
+
+
+/*
+ * Fill the input buffer --- called whenever buffer is emptied.
+ *
+ * The buffer is whatever the caller's read callback points us at; it
+ * must stay valid until the next call.  End of input is handled as in
+ * jdatasrc.c: fatal if nothing was ever read, otherwise a warning and
+ * a fake EOI marker.
+ */
+
+METHODDEF(boolean)
+fill_input_buffer (j_decompress_ptr cinfo)
+{
+  callback_src_ptr src = (callback_src_ptr) cinfo->src;
+  const unsigned char *buf = NULL;
+  int nbytes;
+
+  nbytes = (*src->read) (src->ctx, &buf);
+
+  if (nbytes < 0)
+    ERREXIT(cinfo, JERR_FILE_READ);
+
+  if (nbytes == 0 || buf == NULL) {
+    if (src->start_of_file)	/* Treat empty input file as fatal error */
+      ERREXIT(cinfo, JERR_INPUT_EMPTY);
+    WARNMS(cinfo, JWRN_JPEG_EOF);
+    /* Insert a fake EOI marker */
+    buf = fake_eoi;
+    nbytes = 2;
+  }
+
+  src->pub.next_input_byte = (const JOCTET *) buf;
+  src->pub.bytes_in_buffer = nbytes;
+  src->start_of_file = FALSE;
+
+  return TRUE;
+}
+
+
+/*
+ * Skip data --- used to skip over a potentially large amount of
+ * uninteresting data (such as an APPn marker).
+ *
+ * Whatever lies beyond the current buffer is passed to the caller's
+ * skip callback, if there is one; otherwise we read through it.
+ */
+
+METHODDEF(void)
+skip_input_data (j_decompress_ptr cinfo, long num_bytes)
+{
+  callback_src_ptr src = (callback_src_ptr) cinfo->src;
+
+  if (num_bytes <= 0) return;
+
+  if (src->skip != NULL && num_bytes > (long) src->pub.bytes_in_buffer) {
+    num_bytes -= (long) src->pub.bytes_in_buffer;
+    src->pub.next_input_byte += src->pub.bytes_in_buffer;
+    src->pub.bytes_in_buffer = 0;
+    if ((*src->skip) (src->ctx, num_bytes) < 0)
+      ERREXIT(cinfo, JERR_FILE_READ);
+    return;
+  }
+
+  while (num_bytes > (long) src->pub.bytes_in_buffer) {
+    num_bytes -= (long) src->pub.bytes_in_buffer;
+    (void) fill_input_buffer(cinfo);
+    /* note we assume that fill_input_buffer will never return FALSE,
+     * so suspension need not be handled.
+     */
+  }
+  src->pub.next_input_byte += (size_t) num_bytes;
+  src->pub.bytes_in_buffer -= (size_t) num_bytes;
+}
+
+
+/*
+ * Terminate source --- called by jpeg_finish_decompress
+ * after all data has been read.  Often a no-op.
+ */
+
+METHODDEF(void)
+term_source (j_decompress_ptr cinfo)
+{
+  /* no work necessary here */
+}
+
+
+/*
+ * Prepare for input through caller-supplied callbacks.
+ */
+
+GLOBAL(void)
+jpeg_callback_src (j_decompress_ptr cinfo, jel_read_callback read,
+                   jel_skip_callback skip, void *ctx)
+{
+  callback_src_ptr src;
+
+  /* The source object is made permanent, as in jdatasrc.c, and is
+   * only allocated when cinfo->src is NULL.  Another kind of manager's
+   * struct is a different size, so jel.c keeps one struct per kind and
+   * passes this one back (or NULL) each time a callback source is set.
+   */
+  if (cinfo->src == NULL) {	/* first time for this JPEG object? */
+    cinfo->src = (struct jpeg_source_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  SIZEOF(callback_source_mgr));
+  }
+
+  src = (callback_src_ptr) cinfo->src;
+  src->pub.init_source = init_source;
+  src->pub.fill_input_buffer = fill_input_buffer;
+  src->pub.skip_input_data = skip_input_data;
+  src->pub.resync_to_restart = jpeg_resync_to_restart; /* use default method */
+  src->pub.term_source = term_source;
+  src->read = read;
+  src->skip = skip;
+  src->ctx = ctx;
+  src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer on first read */
+  src->pub.next_input_byte = NULL; /* until buffer loaded */
+}
@@ -1,8 +1,12 @@
 #include <jel/jel.h>
 
-#include "misc.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include "unistd.h"
+#include "misc.h"
 
 /*
  * This output manager interfaces jpeg I/O with file descriptors and
@@ -16,14 +20,49 @@
 
 typedef struct {
   struct jpeg_destination_mgr pub; /* public fields */
+  long length;                  /* Keeps track of the number of output bytes. */
 
   int fd;		/* target stream */
+  boolean is_socket;	/* use send(), so a closed peer is an error, not SIGPIPE */
   JOCTET * buffer;		/* start of buffer */
+  size_t bufsize;	/* size of buffer */
 } fd_destination_mgr;
 
 typedef fd_destination_mgr * fd_dest_ptr;
 
-#define OUTPUT_BUF_SIZE  4096	/* choose an efficiently fwrite'able size */
+
+/*
+ * Write all 'len' bytes to fd, riding out short writes, EINTR, and
+ * a full pipe or socket on a non-blocking fd.  Returns the number of
+ * bytes written, which is less than len only on error.
+ */
+static size_t fullwrite(fd_dest_ptr dest, const char *buf, size_t len) {
+  size_t done = 0;
+  ssize_t n;
+  struct pollfd pfd;
+
+  while (done < len) {
+#ifdef MSG_NOSIGNAL
+    if (dest->is_socket)
+      n = send(dest->fd, buf + done, len - done, MSG_NOSIGNAL);
+    else
+#endif
+      n = write(dest->fd, buf + done, len - done);
+
+    if (n > 0) {
+      done += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pfd.fd = dest->fd;
+      pfd.events = POLLOUT;
+      (void) poll(&pfd, 1, -1);
+    } else {
+      break;
+    }
+  }
+  return done;
+}
 
 
 /*
@@ -36,13 +75,14 @@ init_destination (j_compress_ptr cinfo)
 {
   fd_dest_ptr dest = (fd_dest_ptr) cinfo->dest;
 
+  dest->length = 0;
   /* Allocate the output buffer --- it will be released when done with image */
   dest->buffer = (JOCTET *)
-      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
-				  OUTPUT_BUF_SIZE * SIZEOF(JOCTET));
+      (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				  dest->bufsize * SIZEOF(JOCTET));
 
   dest->pub.next_output_byte = dest->buffer;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  dest->pub.free_in_buffer = dest->bufsize;
 }
 
 
@@ -73,12 +113,12 @@ METHODDEF(boolean)
 empty_output_buffer (j_compress_ptr cinfo)
 {
   fd_dest_ptr dest = (fd_dest_ptr) cinfo->dest;
-  if (fullwrite(dest->fd, (char*) dest->buffer, OUTPUT_BUF_SIZE) !=
-      (size_t) OUTPUT_BUF_SIZE)
+  if (fullwrite(dest, (char*) dest->buffer, dest->bufsize) != dest->bufsize)
     ERREXIT(cinfo, JERR_FILE_WRITE);
 
+  dest->length += dest->bufsize;
   dest->pub.next_output_byte = dest->buffer;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  dest->pub.free_in_buffer = dest->bufsize;
 
   return TRUE;
 }
@@ -97,12 +137,13 @@ METHODDEF(void)
 term_destination (j_compress_ptr cinfo)
 {
   fd_dest_ptr dest = (fd_dest_ptr) cinfo->dest;
-  size_t datacount = OUTPUT_BUF_SIZE - dest->pub.free_in_buffer;
+  size_t datacount = dest->bufsize - dest->pub.free_in_buffer;
 
   /* Write any data remaining in the buffer */
   if (datacount > 0) {
-    if (fullwrite(dest->fd, (char*) dest->buffer, datacount) != datacount)
+    if (fullwrite(dest, (char*) dest->buffer, datacount) != datacount)
       ERREXIT(cinfo, JERR_FILE_WRITE);
+    dest->length += datacount;
   }
   /* Make sure we wrote the output file OK */
   // Probably not needed for file descriptors
@@ -111,15 +152,17 @@ term_destination (j_compress_ptr cinfo)
 
 
 /*
- * Prepare for output to a stdio stream.
- * The caller must have already opened the stream, and is responsible
+ * Prepare for output to a file descriptor, pipe or socket.  Each
+ * 'bufsize' chunk is handed to the fd as soon as it is complete.
+ * The caller must have already opened the fd, and is responsible
  * for closing it after finishing compression.
  */
 
 GLOBAL(void)
-jpeg_fd_dest (j_compress_ptr cinfo, int fd)
+jpeg_fd_dest (j_compress_ptr cinfo, int fd, size_t bufsize)
 {
   fd_dest_ptr dest;
+  struct stat st;
 
   /* The destination object is made permanent so that multiple JPEG images
    * can be written to the same file without re-executing jpeg_stdio_dest.
@@ -138,5 +181,16 @@ jpeg_fd_dest (j_compress_ptr cinfo, int fd)
   dest->pub.empty_output_buffer = empty_output_buffer;
   dest->pub.term_destination = term_destination;
   dest->fd = fd;
+  dest->bufsize = bufsize;
+  dest->is_socket = (fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode));
+  dest->length = 0;
+}
+
+
+GLOBAL(int) jpeg_fd_packet_size(j_compress_ptr cinfo) {
+  fd_dest_ptr dest;
+  dest =  (fd_dest_ptr) cinfo->dest;
+
+  return (int) dest->length;
 }
 
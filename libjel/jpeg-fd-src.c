@@ -16,7 +16,11 @@
 
 #include <jel/jel.h>
 
-#include "unistd.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "misc.h"
 
@@ -28,12 +32,39 @@ typedef struct {
 
   int fd;			/* source filedes or socket */
   JOCTET * buffer;		/* start of buffer */
+  size_t bufsize;		/* size of buffer, fixed at first use */
+  boolean seekable;		/* regular file: skips can use lseek() */
   boolean start_of_file;	/* have we gotten any data yet? */
 } my_source_mgr;
 
 typedef my_source_mgr * my_src_ptr;
 
-#define INPUT_BUF_SIZE  1024	/* choose an efficiently fread'able size */
+
+/*
+ * Read whatever is available on fd, up to len bytes.  For regular
+ * files this is the full request (short only at EOF); for pipes and
+ * sockets it is whatever has arrived, so decoding can start before
+ * the sender is done.  Interrupted reads are retried, and a
+ * non-blocking fd is waited on rather than treated as EOF.  Returns
+ * the byte count, 0 at EOF, or -1 on error.
+ */
+static ssize_t fullread(int fd, char *buf, size_t len) {
+  ssize_t n;
+  struct pollfd pfd;
+
+  for (;;) {
+    n = read(fd, buf, len);
+    if (n >= 0) return n;
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      (void) poll(&pfd, 1, -1);
+      continue;
+    }
+    return -1;
+  }
+}
 
 
 /*
@@ -103,11 +134,14 @@ fill_input_buffer (j_decompress_ptr cinfo)
 {
   int i = 0;
   my_src_ptr src = (my_src_ptr) cinfo->src;
-  size_t nbytes;
+  ssize_t nbytes;
+
+  nbytes = fullread(src->fd, (char*)src->buffer, src->bufsize);
 
-  nbytes = fullread(src->fd, (char*)src->buffer, INPUT_BUF_SIZE);
+  if (nbytes < 0)
+    ERREXIT(cinfo, JERR_FILE_READ);
 
-  if (nbytes <= 0) {
+  if (nbytes == 0) {
     if (src->start_of_file)	/* Treat empty input file as fatal error */
       ERREXIT(cinfo, JERR_INPUT_EMPTY);
     WARNMS(cinfo, JWRN_JPEG_EOF);
@@ -124,7 +158,7 @@ fill_input_buffer (j_decompress_ptr cinfo)
     for (i = 0; i < nbytes && !src->buffer[i]; i++) continue;
   }
   src->pub.next_input_byte = src->buffer+i;
-  src->pub.bytes_in_buffer = nbytes;
+  src->pub.bytes_in_buffer = nbytes-i;
   src->start_of_file = FALSE;
 
   return TRUE;
@@ -148,11 +182,18 @@ skip_input_data (j_decompress_ptr cinfo, long num_bytes)
 {
   my_src_ptr src = (my_src_ptr) cinfo->src;
 
-  /* Just a dumb implementation for now.  Could use fseek() except
-   * it doesn't work on pipes.  Not clear that being smart is worth
-   * any trouble anyway --- large skips are infrequent.
+  /* Regular files can seek past whatever isn't buffered; pipes and
+   * sockets have to read through it.
    */
   if (num_bytes > 0) {
+    if (src->seekable && num_bytes > (long) src->pub.bytes_in_buffer) {
+      off_t ahead = num_bytes - (long) src->pub.bytes_in_buffer;
+      if (lseek(src->fd, ahead, SEEK_CUR) != (off_t) -1) {
+        src->pub.next_input_byte += src->pub.bytes_in_buffer;
+        src->pub.bytes_in_buffer = 0;
+        return;
+      }
+    }
     while (num_bytes > (long) src->pub.bytes_in_buffer) {
       num_bytes -= (long) src->pub.bytes_in_buffer;
       (void) fill_input_buffer(cinfo);
@@ -194,13 +235,16 @@ term_source (j_decompress_ptr cinfo)
 /*
  * Prepare for input from a filedes or socket.
  * The caller must have already opened the fd, and is responsible
- * for closing it after finishing decompression.
+ * for closing it after finishing decompression.  'bufsize' is the
+ * size of each read; for regular files the kernel is also told that
+ * access will be sequential, so it can read ahead aggressively.
  */
 
 GLOBAL(void)
-jpeg_fd_src (j_decompress_ptr cinfo, int fd)
+jpeg_fd_src (j_decompress_ptr cinfo, int fd, size_t bufsize)
 {
   my_src_ptr src;
+  struct stat st;
 
   /* The source object and input buffer are made permanent so that a series
    * of JPEG images can be read from the same file by calling jpeg_fd_src
@@ -214,12 +258,21 @@ jpeg_fd_src (j_decompress_ptr cinfo, int fd)
       (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
 				  SIZEOF(my_source_mgr));
     src = (my_src_ptr) cinfo->src;
+    src->bufsize = bufsize;
     src->buffer = (JOCTET *)
-      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
-				  INPUT_BUF_SIZE * SIZEOF(JOCTET));
+      (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  bufsize * SIZEOF(JOCTET));
   }
 
   src = (my_src_ptr) cinfo->src;
+  src->seekable = FALSE;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    src->seekable = TRUE;
+#ifdef POSIX_FADV_SEQUENTIAL
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  }
   src->pub.init_source = init_source;
   src->pub.fill_input_buffer = fill_input_buffer;
   src->pub.skip_input_data = skip_input_data;
@@ -17,26 +17,24 @@ typedef struct {
 
   unsigned char *outbuf;		/* target stream */
   int maxsize;
-  JOCTET * buffer;		/* start of buffer */
+  int error;			/* JUDP_ERR_*, or 0 */
 } mem_destination_mgr;
 
 typedef mem_destination_mgr * mem_dest_ptr;
 
-#define OUTPUT_BUF_SIZE  4096	/* choose an efficiently fwrite'able size */
-
-static int judp_errno = 0;
-
 #define JUDP_ERR_CANTEMPTY     1
-#define JUDP_ERR_TOOMUCHDATA   2
 
-GLOBAL(int) jpeg_mem_errno() {
-  return judp_errno;
+/* Kept in the manager, not a global, so that threads writing
+ * different images don't trample each other's: */
+GLOBAL(int) jpeg_mem_errno(j_compress_ptr cinfo) {
+  return ((mem_dest_ptr) cinfo->dest)->error;
 }
 
 
 /*
  * Initialize destination --- called by jpeg_start_compress
- * before any data is actually written.
+ * before any data is actually written.  libjpeg writes straight
+ * into the caller's memory; there is no buffer to copy out of.
  */
 
 METHODDEF(void)
@@ -44,71 +42,39 @@ init_destination (j_compress_ptr cinfo)
 {
   mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
 
-  judp_errno = 0;
+  dest->error = 0;
 
   dest->length = 0;
 
-  dest->buffer = (JOCTET *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
-				OUTPUT_BUF_SIZE * SIZEOF(JOCTET));
-
-  dest->pub.next_output_byte = dest->buffer;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  dest->pub.next_output_byte = (JOCTET *) dest->outbuf;
+  dest->pub.free_in_buffer = dest->maxsize > 0 ? dest->maxsize : 0;
 }
 
 
 /*
  * Empty the output buffer --- called whenever buffer fills up.
  *
- * In typical applications, this should write the entire output buffer
- * (ignoring the current state of next_output_byte & free_in_buffer),
- * reset the pointer & count to the start of the buffer, and return TRUE
- * indicating that the buffer has been dumped.
- *
- * In applications that need to be able to suspend compression due to output
- * overrun, a FALSE return indicates that the buffer cannot be emptied now.
- * In this situation, the compressor will return to its caller (possibly with
- * an indication that it has not accepted all the supplied scanlines).  The
- * application should resume compression after it has made more room in the
- * output buffer.  Note that there are substantial restrictions on the use of
- * suspension --- see the documentation.
- *
- * When suspending, the compressor will back up to a convenient restart point
- * (typically the start of the current MCU). next_output_byte & free_in_buffer
- * indicate where the restart point will be if the current call returns FALSE.
- * Data beyond this point will be regenerated after resumption, so do not
- * write it out when emptying the buffer externally.
+ * Since the buffer is the whole of the caller's memory, this means
+ * the image does not fit.  A FALSE return asks libjpeg to suspend,
+ * which it refuses to do while transcoding, so compression ends with
+ * an error.  free_in_buffer is left at 0 for the caller to see.
  */
 
 METHODDEF(boolean)
 empty_output_buffer (j_compress_ptr cinfo)
 {
-  int i, j;
   mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
 
-  j = dest->length;
-  for (i = 0; i < OUTPUT_BUF_SIZE && j < dest->maxsize; i++) {
-    dest->outbuf[j++] = dest->buffer[i];
-  }
-
-  dest->length = j;
-
-  if (j >= dest->maxsize) {
-    // printf("jpeg-mem-dst.c: empty_output_buffer exceeded the output buffer length.\n");
-    judp_errno = JUDP_ERR_CANTEMPTY;
-    return FALSE;
-  }
-
-  dest->pub.next_output_byte = dest->buffer;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
-
-  return TRUE;
+  dest->length = dest->maxsize;
+  dest->error = JUDP_ERR_CANTEMPTY;
+  return FALSE;
 }
 
 
 /*
  * Terminate destination --- called by jpeg_finish_compress
- * after all data has been written.  Usually needs to flush buffer.
+ * after all data has been written.  The data is already in place, so
+ * this only records its length.
  *
  * NB: *not* called by jpeg_abort or jpeg_destroy; surrounding
  * application must deal with any cleanup that should happen even
@@ -118,22 +84,9 @@ empty_output_buffer (j_compress_ptr cinfo)
 METHODDEF(void)
 term_destination (j_compress_ptr cinfo)
 {
-  int i, j;
   mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
-  size_t datacount = OUTPUT_BUF_SIZE - dest->pub.free_in_buffer;
-
-  /* Write any data remaining in the buffer */
-  if (datacount > 0) {
-    j = dest->length;
-    for (i = 0; i < datacount && j < dest->maxsize; i++)
-      dest->outbuf[j++] = dest->buffer[i];
-
-    dest->length = j;
-    if (j >= dest->maxsize) {
-      // printf("jpeg-mem-dst.c: term_destination exceeded the output buffer length.\n");
-      judp_errno = JUDP_ERR_TOOMUCHDATA;
-    }
-  }
+
+  dest->length = dest->pub.next_output_byte - (JOCTET *) dest->outbuf;
 }
 
 
@@ -169,6 +122,9 @@ jpeg_memory_dest (j_compress_ptr cinfo, unsigned char* data, int size)
   dest->outbuf = data;
   dest->maxsize = size;
   dest->length = 0;
+  dest->error = 0;
+  dest->pub.next_output_byte = (JOCTET *) data;
+  dest->pub.free_in_buffer = size > 0 ? size : 0;
 }
 
 GLOBAL(int) jpeg_mem_packet_size(j_compress_ptr cinfo) {
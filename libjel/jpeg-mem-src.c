@@ -84,33 +84,38 @@ init_source (j_decompress_ptr cinfo)
 METHODDEF(boolean)
 fill_input_buffer (j_decompress_ptr cinfo)
 {
-  // Here, we're just swapping pointers around.  We've been given a
-  // pointer to jpeg-compressed data in memory (deposited in inbuf),
-  // so just use that.
+  /* Here, we're just swapping pointers around.  We've been given a
+   * pointer to jpeg-compressed data in memory (deposited in inbuf),
+   * so hand all of it over the first time.  After that the data is
+   * gone, and the fake EOI goes in our own buffer: the caller's
+   * memory is only ever read.
+   */
   int i = 0;
   my_src_ptr src = (my_src_ptr) cinfo->src;
   size_t nbytes;
+  const JOCTET *next;
 
-  src->buffer = (JOCTET*) src->inbuf;
-
-  nbytes = src->nbytes;
-
-  if (nbytes <= 0) {
+  if (src->nbytes <= 0) {
     if (src->start_of_file)	/* Treat empty input file as fatal error */
       ERREXIT(cinfo, JERR_INPUT_EMPTY);
     WARNMS(cinfo, JWRN_JPEG_EOF);
     /* Insert a fake EOI marker */
     src->buffer[0] = (JOCTET) 0xFF;
     src->buffer[1] = (JOCTET) JPEG_EOI;
+    next = src->buffer;
     nbytes = 2;
+  } else {
+    next = (const JOCTET *) src->inbuf;
+    nbytes = src->nbytes;
+    src->nbytes = 0;
   }
 
   i = 0;
   if (src->start_of_file) {
-    for (i = 0; i < nbytes && !src->buffer[i]; i++) continue;
+    for (i = 0; i < nbytes && !next[i]; i++) continue;
   }
 
-  src->pub.next_input_byte = src->buffer+i;
+  src->pub.next_input_byte = next+i;
   src->pub.bytes_in_buffer = nbytes-i;
   src->start_of_file = FALSE;
 
@@ -0,0 +1,207 @@
+/*
+ * Adapted from jdatasrc.c ((C) 1994-1996, Thomas G. Lane.)
+ *
+ * This is a suspending data source manager.  The caller pushes bytes
+ * as they arrive (typically from a non-blocking socket), and
+ * fill_input_buffer returns FALSE when it runs dry, so libjpeg
+ * suspends and the header and coefficient readers return to the
+ * caller instead of blocking.  See "I/O suspension" in libjpeg.txt.
+ *
+ * On suspension libjpeg backs up to the start of the unit it could
+ * not finish, so the unconsumed bytes are always the ones between
+ * next_input_byte and the end of the buffer.  Each push slides those
+ * to the front and appends the new data, so the buffer only has to
+ * hold the largest single unit plus one push.
+ */
+
+#include <jel/jel.h>
+
+#include "misc.h"
+
+#define INITIAL_BUF_SIZE  16384	/* first allocation; grows as needed */
+
+
+/* Expanded data source object for pushed input */
+
+typedef struct {
+  struct jpeg_source_mgr pub;	/* public fields */
+
+  JOCTET * buffer;		/* start of buffer */
+  size_t bufsize;		/* allocated size of buffer */
+  long skip_pending;		/* bytes to drop from future pushes */
+  boolean at_eof;		/* caller has signalled end of input */
+  boolean start_of_file;	/* have we gotten any data yet? */
+} push_source_mgr;
+
+typedef push_source_mgr * push_src_ptr;
+
+static const JOCTET fake_eoi[2] = { (JOCTET) 0xFF, (JOCTET) JPEG_EOI };
+
+
+METHODDEF(void)
+init_source (j_decompress_ptr cinfo)
+{
+  /* Nothing to do: data may have been pushed before the header
+   * reader ever looked at it. */
+}
+
+
+/*
+ * Fill the input buffer --- called whenever buffer is emptied.
+ *
+ * Everything pushed so far is already in the buffer, so there is
+ * nothing to fill from.  Suspend until more is pushed, or, once the
+ * caller has signalled end of input, behave as jdatasrc.c does at
+ * EOF.
+ */
+
+METHODDEF(boolean)
+fill_input_buffer (j_decompress_ptr cinfo)
+{
+  push_src_ptr src = (push_src_ptr) cinfo->src;
+
+  if (!src->at_eof)
+    return FALSE;
+
+  if (src->start_of_file)	/* Treat empty input file as fatal error */
+    ERREXIT(cinfo, JERR_INPUT_EMPTY);
+  WARNMS(cinfo, JWRN_JPEG_EOF);
+  /* Insert a fake EOI marker */
+  src->pub.next_input_byte = fake_eoi;
+  src->pub.bytes_in_buffer = 2;
+
+  return TRUE;
+}
+
+
+/*
+ * Skip data --- used to skip over a potentially large amount of
+ * uninteresting data (such as an APPn marker).
+ *
+ * Whatever has not arrived yet is remembered and dropped from later
+ * pushes, which is the approach libjpeg.txt suggests for suspending
+ * sources.
+ */
+
+METHODDEF(void)
+skip_input_data (j_decompress_ptr cinfo, long num_bytes)
+{
+  push_src_ptr src = (push_src_ptr) cinfo->src;
+
+  if (num_bytes <= 0) return;
+
+  if (num_bytes > (long) src->pub.bytes_in_buffer) {
+    src->skip_pending += num_bytes - (long) src->pub.bytes_in_buffer;
+    src->pub.next_input_byte += src->pub.bytes_in_buffer;
+    src->pub.bytes_in_buffer = 0;
+  } else {
+    src->pub.next_input_byte += (size_t) num_bytes;
+    src->pub.bytes_in_buffer -= (size_t) num_bytes;
+  }
+}
+
+
+METHODDEF(void)
+term_source (j_decompress_ptr cinfo)
+{
+  /* no work necessary here */
+}
+
+
+/*
+ * Append 'len' bytes to the input.  Consumed bytes are discarded
+ * first; the buffer only grows when the unconsumed data plus the new
+ * data does not fit.  Old buffers stay in the permanent pool until
+ * the decompressor is destroyed, but growth is geometric so they add
+ * up to no more than the final buffer, and that one is kept for the
+ * next image (see jpeg_push_src).
+ */
+
+GLOBAL(void)
+jpeg_push_src_append (j_decompress_ptr cinfo, const unsigned char *data, size_t len)
+{
+  push_src_ptr src = (push_src_ptr) cinfo->src;
+  size_t have, need, newsize;
+  JOCTET *newbuf;
+
+  if (src->skip_pending > 0) {
+    size_t drop = (size_t) src->skip_pending < len ? (size_t) src->skip_pending : len;
+    data += drop;
+    len -= drop;
+    src->skip_pending -= (long) drop;
+  }
+  if (len == 0) return;
+
+  have = src->pub.bytes_in_buffer;
+  need = have + len;
+
+  if (need > src->bufsize) {
+    newsize = src->bufsize ? src->bufsize : INITIAL_BUF_SIZE;
+    while (newsize < need) newsize *= 2;
+    newbuf = (JOCTET *)
+      (*cinfo->mem->alloc_large) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  newsize * SIZEOF(JOCTET));
+    if (have > 0) memcpy(newbuf, src->pub.next_input_byte, have);
+    src->buffer = newbuf;
+    src->bufsize = newsize;
+  } else if (have > 0 && src->pub.next_input_byte != src->buffer) {
+    memmove(src->buffer, src->pub.next_input_byte, have);
+  }
+
+  memcpy(src->buffer + have, data, len);
+  src->pub.next_input_byte = src->buffer;
+  src->pub.bytes_in_buffer = need;
+  src->start_of_file = FALSE;
+}
+
+
+/*
+ * No more data will be pushed.  The next empty buffer ends the image.
+ */
+
+GLOBAL(void)
+jpeg_push_src_end (j_decompress_ptr cinfo)
+{
+  push_src_ptr src = (push_src_ptr) cinfo->src;
+
+  src->at_eof = TRUE;
+}
+
+
+/*
+ * Prepare for input that will be pushed by the caller.
+ */
+
+GLOBAL(void)
+jpeg_push_src (j_decompress_ptr cinfo)
+{
+  push_src_ptr src;
+
+  /* The source object is made permanent, as in jdatasrc.c, and
+   * reused from image to image.  A non-NULL cinfo->src must therefore
+   * be a push source's own struct; jel.c keeps the push struct apart
+   * from the other kinds' to ensure it.
+   */
+  if (cinfo->src == NULL) {	/* first time for this JPEG object? */
+    cinfo->src = (struct jpeg_source_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+				  SIZEOF(push_source_mgr));
+    src = (push_src_ptr) cinfo->src;
+    src->buffer = NULL;
+    src->bufsize = 0;
+  }
+
+  src = (push_src_ptr) cinfo->src;
+  src->pub.init_source = init_source;
+  src->pub.fill_input_buffer = fill_input_buffer;
+  src->pub.skip_input_data = skip_input_data;
+  src->pub.resync_to_restart = jpeg_resync_to_restart; /* use default method */
+  src->pub.term_source = term_source;
+  /* A config reused through jel_reset pushes image after image; the
+   * buffer from the last one is reused rather than left in the pool: */
+  src->skip_pending = 0;
+  src->at_eof = FALSE;
+  src->start_of_file = TRUE;
+  src->pub.bytes_in_buffer = 0; /* forces fill_input_buffer on first read */
+  src->pub.next_input_byte = NULL; /* until buffer loaded */
+}
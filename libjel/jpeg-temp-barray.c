@@ -0,0 +1,400 @@
+/*
+ * jpeg-temp-barray.c
+ *
+ * Coefficient arrays that are held to a memory budget
+ * (JEL_PROP_MAX_MEMORY).  libjpeg keeps the whole image's DCT
+ * coefficients in "virtual" block arrays, but the libjpeg-turbo
+ * memory manager has no backing store: every array lives in memory in
+ * full, so a gigapixel cover needs gigabytes.  This replaces the
+ * virtual block array methods of a pair of libjpeg objects (the
+ * source and destination of one jel_config, which share arrays).
+ * Arrays that fit in the budget stay in memory; the others keep a
+ * window of rows in memory and the rest in an unlinked temporary file
+ * in $TMPDIR (or /tmp).  The windowing follows jmemmgr.c, so passes
+ * that go down the image a row at a time, as libjel's and libjpeg's
+ * do, read and write the file sequentially.
+ *
+ * Other virtual arrays (sample arrays, which transcoding never uses)
+ * and arrays requested while no budget is set are left to libjpeg.
+ */
+
+#include <jel/jel.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <jerror.h>
+
+#include "misc.h"
+
+
+/* One of our arrays: */
+typedef struct my_barray {
+  struct my_barray *next;
+  j_common_ptr owner;		/* object whose image pool holds it */
+  JBLOCKARRAY mem_buffer;	/* the in-memory rows, or NULL until realized */
+  JDIMENSION rows_in_array;	/* total virtual array height */
+  JDIMENSION blocksperrow;	/* width of array (and of memory buffer) */
+  JDIMENSION maxaccess;		/* max rows accessed by access_virt_barray */
+  JDIMENSION rows_in_mem;	/* height of memory buffer */
+  JDIMENSION cur_start_row;	/* first logical row # in the buffer */
+  JDIMENSION first_undef_row;	/* row # of first uninitialized row */
+  boolean pre_zero;		/* pre-zero mode requested? */
+  boolean dirty;		/* do current buffer contents need written? */
+  FILE *fp;			/* rows not in memory, or NULL if all are */
+  long bytes;			/* memory used by mem_buffer */
+} my_barray;
+
+typedef struct my_store my_store;
+
+/* Per libjpeg object: the methods we replace, kept to pass on to: */
+typedef struct {
+  my_store *store;
+  jvirt_barray_ptr (*request_virt_barray) (j_common_ptr cinfo, int pool_id,
+                                           boolean pre_zero,
+                                           JDIMENSION blocksperrow,
+                                           JDIMENSION numrows,
+                                           JDIMENSION maxaccess);
+  void (*realize_virt_arrays) (j_common_ptr cinfo);
+  JBLOCKARRAY (*access_virt_barray) (j_common_ptr cinfo, jvirt_barray_ptr ptr,
+                                     JDIMENSION start_row, JDIMENSION num_rows,
+                                     boolean writable);
+  void (*free_pool) (j_common_ptr cinfo, int pool_id);
+  void (*self_destruct) (j_common_ptr cinfo);
+} my_hooks;
+
+/* Shared by both objects, since the destination writes out the
+ * source's arrays: */
+struct my_store {
+  my_hooks hooks[2];
+  my_barray *arrays;
+  long max_bytes;		/* budget for mem_buffers; 0 for none */
+  long in_use;			/* bytes of mem_buffers realized */
+};
+
+#define HOOKS(cinfo)  ((my_hooks *) (cinfo)->client_data)
+
+
+static my_barray * find_barray (my_store * store, jvirt_barray_ptr ptr)
+{
+  my_barray *ba;
+
+  for (ba = store->arrays; ba != NULL; ba = ba->next)
+    if ((jvirt_barray_ptr) ba == ptr) return ba;
+  return NULL;
+}
+
+
+/*
+ * A temporary file that is gone as soon as it is closed:
+ */
+static FILE * open_temp_file (j_common_ptr cinfo)
+{
+  const char *dir = getenv("TMPDIR");
+  char *path;
+  FILE *fp = NULL;
+  int fd;
+
+  if (dir == NULL || *dir == '\0') dir = "/tmp";
+
+  path = malloc(strlen(dir) + 16);
+  if (path != NULL) {
+    sprintf(path, "%s/jelXXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd >= 0) {
+      unlink(path);
+      fp = fdopen(fd, "w+b");
+      if (fp == NULL) close(fd);
+    }
+    free(path);
+  }
+
+  if (fp == NULL) ERREXITS(cinfo, JERR_TFILE_CREATE, dir);
+  return fp;
+}
+
+
+/*
+ * Write the buffer out to its rows in the file, or read it back in.
+ * Only rows that have ever been written are transferred:
+ */
+static void do_barray_io (j_common_ptr cinfo, my_barray * ba, boolean writing)
+{
+  size_t bytesperrow = (size_t) ba->blocksperrow * SIZEOF(JBLOCK);
+  JDIMENSION i, rows;
+
+  if (ba->first_undef_row <= ba->cur_start_row) return;
+  rows = ba->rows_in_mem;
+  if (rows > ba->first_undef_row - ba->cur_start_row)
+    rows = ba->first_undef_row - ba->cur_start_row;
+  if (rows > ba->rows_in_array - ba->cur_start_row)
+    rows = ba->rows_in_array - ba->cur_start_row;
+
+  if (fseeko(ba->fp, (off_t) ba->cur_start_row * (off_t) bytesperrow, SEEK_SET) != 0)
+    ERREXIT(cinfo, JERR_TFILE_SEEK);
+
+  for (i = 0; i < rows; i++) {
+    if (writing) {
+      if (fwrite(ba->mem_buffer[i], 1, bytesperrow, ba->fp) != bytesperrow)
+        ERREXIT(cinfo, JERR_TFILE_WRITE);
+    } else {
+      if (fread(ba->mem_buffer[i], 1, bytesperrow, ba->fp) != bytesperrow)
+        ERREXIT(cinfo, JERR_TFILE_READ);
+    }
+  }
+
+  /* Reads and writes may alternate on the same stream: */
+  if (writing && fflush(ba->fp) != 0) ERREXIT(cinfo, JERR_TFILE_WRITE);
+}
+
+
+METHODDEF(jvirt_barray_ptr)
+request_virt_barray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
+                     JDIMENSION blocksperrow, JDIMENSION numrows,
+                     JDIMENSION maxaccess)
+{
+  my_hooks *hooks = HOOKS(cinfo);
+  my_store *store = hooks->store;
+  my_barray *ba;
+
+  if (store->max_bytes <= 0)
+    return (*hooks->request_virt_barray) (cinfo, pool_id, pre_zero,
+                                          blocksperrow, numrows, maxaccess);
+
+  /* Only image lifetime is supported for virtual arrays: */
+  if (pool_id != JPOOL_IMAGE)
+    ERREXIT1(cinfo, JERR_BAD_POOL_ID, pool_id);
+
+  ba = (my_barray *) calloc(1, SIZEOF(my_barray));
+  if (ba == NULL) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+
+  ba->owner = cinfo;
+  ba->rows_in_array = numrows;
+  ba->blocksperrow = blocksperrow;
+  ba->maxaccess = maxaccess;
+  ba->pre_zero = pre_zero;
+  ba->next = store->arrays;
+  store->arrays = ba;
+
+  return (jvirt_barray_ptr) ba;
+}
+
+
+/*
+ * Give each array awaiting it a buffer.  If the arrays do not all fit
+ * in what is left of the budget, each gets the same number of
+ * 'maxaccess' slices of rows, as jmemmgr.c would, and a temp file:
+ */
+METHODDEF(void)
+realize_virt_arrays (j_common_ptr cinfo)
+{
+  my_hooks *hooks = HOOKS(cinfo);
+  my_store *store = hooks->store;
+  my_barray *ba;
+  long space_per_minheight = 0, maximum_space = 0, avail, bytesperrow;
+  long max_minheights, minheights;
+
+  (*hooks->realize_virt_arrays) (cinfo);
+
+  for (ba = store->arrays; ba != NULL; ba = ba->next) {
+    if (ba->owner != cinfo || ba->mem_buffer != NULL) continue;
+    bytesperrow = (long) ba->blocksperrow * SIZEOF(JBLOCK);
+    space_per_minheight += (long) ba->maxaccess * bytesperrow;
+    maximum_space += (long) ba->rows_in_array * bytesperrow;
+  }
+  if (space_per_minheight <= 0) return;
+
+  avail = store->max_bytes - store->in_use;
+  if (avail >= maximum_space) max_minheights = 1000000000L;
+  else {
+    max_minheights = (avail > 0) ? avail / space_per_minheight : 0;
+    if (max_minheights <= 0) max_minheights = 1;
+  }
+
+  for (ba = store->arrays; ba != NULL; ba = ba->next) {
+    if (ba->owner != cinfo || ba->mem_buffer != NULL) continue;
+    minheights = ((long) ba->rows_in_array - 1L) / ba->maxaccess + 1L;
+    if (minheights <= max_minheights) {
+      ba->rows_in_mem = ba->rows_in_array;
+    } else {
+      ba->rows_in_mem = (JDIMENSION) (max_minheights * ba->maxaccess);
+      ba->fp = open_temp_file(cinfo);
+    }
+    ba->mem_buffer = (*cinfo->mem->alloc_barray) (cinfo, JPOOL_IMAGE,
+                                                  ba->blocksperrow, ba->rows_in_mem);
+    ba->bytes = (long) ba->rows_in_mem * ba->blocksperrow * SIZEOF(JBLOCK);
+    store->in_use += ba->bytes;
+    ba->cur_start_row = 0;
+    ba->first_undef_row = 0;
+    ba->dirty = FALSE;
+  }
+}
+
+
+METHODDEF(JBLOCKARRAY)
+access_virt_barray (j_common_ptr cinfo, jvirt_barray_ptr ptr,
+                    JDIMENSION start_row, JDIMENSION num_rows,
+                    boolean writable)
+{
+  my_hooks *hooks = HOOKS(cinfo);
+  my_barray *ba = find_barray(hooks->store, ptr);
+  JDIMENSION end_row = start_row + num_rows;
+  JDIMENSION undef_row;
+  size_t bytesperrow;
+  long ltemp;
+
+  if (ba == NULL)
+    return (*hooks->access_virt_barray) (cinfo, ptr, start_row, num_rows, writable);
+
+  if (end_row > ba->rows_in_array || num_rows > ba->maxaccess ||
+      ba->mem_buffer == NULL)
+    ERREXIT(cinfo, JERR_BAD_VIRTUAL_ACCESS);
+
+  /* Move the window if the rows are not all in it.  Going down, it
+   * starts at start_row; going up, it ends at end_row: */
+  if (start_row < ba->cur_start_row ||
+      end_row > ba->cur_start_row + ba->rows_in_mem) {
+    if (ba->fp == NULL)
+      ERREXIT(cinfo, JERR_VIRTUAL_BUG);
+    if (ba->dirty) {
+      do_barray_io(cinfo, ba, TRUE);
+      ba->dirty = FALSE;
+    }
+    if (start_row > ba->cur_start_row) {
+      ba->cur_start_row = start_row;
+    } else {
+      ltemp = (long) end_row - (long) ba->rows_in_mem;
+      if (ltemp < 0) ltemp = 0;
+      ba->cur_start_row = (JDIMENSION) ltemp;
+    }
+    do_barray_io(cinfo, ba, FALSE);
+  }
+
+  /* Rows never written are zeroed, if the array was asked to be: */
+  if (ba->first_undef_row < end_row) {
+    if (ba->first_undef_row < start_row) {
+      if (writable)		/* writer skipped over a section of array */
+        ERREXIT(cinfo, JERR_BAD_VIRTUAL_ACCESS);
+      undef_row = start_row;	/* but reader is allowed to read ahead */
+    } else {
+      undef_row = ba->first_undef_row;
+    }
+    if (writable)
+      ba->first_undef_row = end_row;
+    if (ba->pre_zero) {
+      bytesperrow = (size_t) ba->blocksperrow * SIZEOF(JBLOCK);
+      for (; undef_row < end_row; undef_row++)
+        memset(ba->mem_buffer[undef_row - ba->cur_start_row], 0, bytesperrow);
+    } else if (!writable) {
+      ERREXIT(cinfo, JERR_BAD_VIRTUAL_ACCESS);
+    }
+  }
+
+  if (writable)
+    ba->dirty = TRUE;
+  return ba->mem_buffer + (start_row - ba->cur_start_row);
+}
+
+
+/* Drop 'cinfo's arrays; their buffers go with its image pool: */
+static void release_barrays (j_common_ptr cinfo)
+{
+  my_store *store = HOOKS(cinfo)->store;
+  my_barray **link = &(store->arrays);
+  my_barray *ba;
+
+  while ((ba = *link) != NULL) {
+    if (ba->owner != cinfo) {
+      link = &(ba->next);
+      continue;
+    }
+    *link = ba->next;
+    if (ba->fp != NULL) fclose(ba->fp);
+    store->in_use -= ba->bytes;
+    free(ba);
+  }
+}
+
+
+METHODDEF(void)
+free_pool (j_common_ptr cinfo, int pool_id)
+{
+  my_hooks *hooks = HOOKS(cinfo);
+
+  if (pool_id == JPOOL_IMAGE) release_barrays(cinfo);
+  (*hooks->free_pool) (cinfo, pool_id);
+}
+
+
+METHODDEF(void)
+self_destruct (j_common_ptr cinfo)
+{
+  my_hooks *hooks = HOOKS(cinfo);
+
+  release_barrays(cinfo);
+  (*hooks->self_destruct) (cinfo);
+}
+
+
+static void install_hooks (my_store * store, int i, j_common_ptr cinfo)
+{
+  my_hooks *hooks = &(store->hooks[i]);
+  struct jpeg_memory_mgr *mem = cinfo->mem;
+
+  hooks->store = store;
+  hooks->request_virt_barray = mem->request_virt_barray;
+  hooks->realize_virt_arrays = mem->realize_virt_arrays;
+  hooks->access_virt_barray = mem->access_virt_barray;
+  hooks->free_pool = mem->free_pool;
+  hooks->self_destruct = mem->self_destruct;
+
+  mem->request_virt_barray = request_virt_barray;
+  mem->realize_virt_arrays = realize_virt_arrays;
+  mem->access_virt_barray = access_virt_barray;
+  mem->free_pool = free_pool;
+  mem->self_destruct = self_destruct;
+  cinfo->client_data = hooks;
+}
+
+
+/*
+ * Route the block arrays of 'src' and 'dst' (which must not have any
+ * yet) through a shared store.  Returns the store, or NULL if it
+ * cannot be allocated.  Free it with free() once both objects have
+ * been destroyed.
+ */
+GLOBAL(void *)
+jpeg_temp_barrays (j_common_ptr src, j_common_ptr dst)
+{
+  my_store *store = (my_store *) calloc(1, SIZEOF(my_store));
+
+  if (store == NULL) return NULL;
+  install_hooks(store, 0, src);
+  install_hooks(store, 1, dst);
+  return store;
+}
+
+
+/* Arrays requested from now on share 'max_bytes' of buffers; 0
+ * leaves them to libjpeg: */
+GLOBAL(void)
+jpeg_temp_barrays_limit (void * store, long max_bytes)
+{
+  ((my_store *) store)->max_bytes = max_bytes;
+}
+
+
+/* Bytes of the store's arrays that are kept in temp files rather
+ * than in memory: */
+GLOBAL(long)
+jpeg_temp_barrays_spilled (void * store)
+{
+  my_barray *ba;
+  long spilled = 0;
+
+  for (ba = ((my_store *) store)->arrays; ba != NULL; ba = ba->next)
+    if (ba->fp != NULL)
+      spilled += (long) (ba->rows_in_array - ba->rows_in_mem) *
+                 ba->blocksperrow * SIZEOF(JBLOCK);
+  return spilled;
+}
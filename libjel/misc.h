@@ -5,4 +5,72 @@
 //jpeg libraries insist on this macro.
 #define SIZEOF(object)	((size_t) sizeof(object))
 
+/* Destination manager kinds, recorded in jel_config.dst_kind so that
+ * the compressed length can be read back from the right manager: */
+#define JEL_DST_MEM      0
+#define JEL_DST_STDIO    1
+#define JEL_DST_FD       2
+#define JEL_DST_CALLBACK 3	/* The last; see JEL_NDSTMGRS in jel.h. */
+
+/* Source manager kinds, recorded in jel_config.src_kind.  Each kind
+ * has its own manager struct in the permanent pool, so the config
+ * keeps one of each in src_mgrs (dst_mgrs for destinations): */
+#define JEL_SRCMGR_STDIO    0
+#define JEL_SRCMGR_MEM      1
+#define JEL_SRCMGR_FD       2
+#define JEL_SRCMGR_CALLBACK 3
+#define JEL_SRCMGR_PUSH     4	/* The last; see JEL_NSRCMGRS in jel.h. */
+
+/* How far ijel_open_source has got, recorded in jel_config.src_state.
+ * Only a suspending source is ever left short of JEL_SRC_OPEN: */
+#define JEL_SRC_HEADER   0
+#define JEL_SRC_COEFS    1
+#define JEL_SRC_OPEN     2
+
+/* JEL_FRAME_V1 message frame (ijel-frame.c).  The header goes where
+ * the bare length would, byte by byte in the first usable blocks:
+ *
+ *   0xE0 | version, flags, [ECC block length,] varint length,
+ *   [varint unpacked length,] CRC16
+ *
+ * The varints are the plaintext length as embedded and, with
+ * JEL_FRAME_FLAG_LZF, its length once decompressed, 7 bits to a byte,
+ * low bits first.  The CRC is crc_ccitt of the header bytes before
+ * it, low byte first.  The message follows, then a CRC of the whole
+ * header and the plaintext, and only then is it ECC coded (with no
+ * per-block length bytes), so the trailer is protected too. */
+#define JEL_FRAME_MAGIC      0xE0
+#define JEL_FRAME_FLAG_ECC   0x01
+#define JEL_FRAME_FLAG_LZF   0x02
+#define JEL_FRAME_FLAG_KNOWN (JEL_FRAME_FLAG_ECC | JEL_FRAME_FLAG_LZF)
+#define JEL_FRAME_MAX_HEADER 15
+#define JEL_FRAME_LZF_FIELD  5   /* Largest unpacked length varint. */
+#define JEL_FRAME_TRAILER    2
+
+typedef struct {
+  int flags;
+  int blocklen;     /* ECC block length, if JEL_FRAME_FLAG_ECC. */
+  int length;       /* Plaintext bytes. */
+  int unpacked;     /* ... and once decompressed, if JEL_FRAME_FLAG_LZF. */
+  int hlen;         /* Header bytes. */
+} ijel_frame;
+
+int ijel_frame_header(unsigned char *out, int flags, int blocklen, int length, int unpacked);
+int ijel_frame_parse(const unsigned char *buf, int n, ijel_frame *frame);
+int ijel_frame_coded_length(const ijel_frame *frame);
+int ijel_frame_size(int flags, int blocklen, int length, int unpacked);
+int ijel_frame_capacity(int raw, int ecc, int blocklen);
+unsigned short ijel_frame_crc(unsigned short acc, const unsigned char *buf, int n);
+
+/* LZF coding for JEL_PROP_COMPRESS (ijel-lzf.c): */
+int ijel_lzf_compress(const unsigned char *in, int inlen, unsigned char *out, int outlen);
+int ijel_lzf_decompress(const unsigned char *in, int inlen, unsigned char *out, int outlen);
+
+/* Runs work(job, i) for each of n items on a pool of threads
+ * (jel-multi.c): */
+void ijel_for_each_cover(int n, int nthreads, int (*work)(void *, int), void *job);
+
+/* Monotonic clock for jel_stats, in nanoseconds: */
+long long ijel_now_ns(void);
+
 #endif //_MISC_H_
@@ -0,0 +1,369 @@
+/*
+ * jelmodule.c - CPython extension module for libjel.
+ *
+ * Embeds and extracts in-process, on bytes-like objects, so scripts
+ * need not run wcap, wedge and unwedge once per image and pass the
+ * data through temporary files.  'make python' builds jel.<suffix>
+ * with the library compiled in:
+ *
+ *   import jel
+ *   n = jel.capacity(cover)
+ *   stego = jel.embed(cover, message, seed=20)
+ *   message = jel.extract(stego, seed=20)
+ *
+ * The keywords follow the wedge and unwedge switches.  Failures raise
+ * jel.error with the JEL_ERR_* code (or -1 for a libjpeg error) and a
+ * description as its arguments.
+ *
+ * Each call has a jel_config of its own and holds no Python objects
+ * while it works, so the GIL is released and calls from different
+ * threads run at the same time.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <limits.h>
+#include <jel/jel.h>
+
+#define JELPY_CHUNK 65536	/* Output buffer growth, in bytes. */
+
+static PyObject *jelpy_error;	/* jel.error */
+
+
+/*
+ * The settings shared by every call, as the wedge switches set them:
+ */
+typedef struct {
+  int seed;			/* -seed; 0 for the default frequencies */
+  int quality;			/* -quality; 0 keeps the cover's */
+  int ecc;			/* False for -noecc */
+  int ecclen;			/* -ecc; 0 for the default block length */
+  int ethresh;			/* -ethresh */
+  int frame;			/* -frame */
+  int compress;			/* -compress */
+  int restart;			/* -restart */
+  int length;			/* unwedge -length, for messages embedded
+				   with -nolength; 0 if the length is
+				   embedded */
+} jelpy_options;
+
+
+/*
+ * A buffer that grows as libjel writes to it.  It is used both as a
+ * callback destination and as a message writer, without the GIL, so
+ * it only uses malloc.
+ */
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t size;
+  int failed;
+} jelpy_buffer;
+
+
+static int jelpy_reserve(jelpy_buffer *b, size_t want) {
+  unsigned char *p;
+  size_t size;
+
+  if (b->size - b->len >= want) return 0;
+  size = b->size ? b->size : JELPY_CHUNK;
+  while (size - b->len < want) size *= 2;
+  p = realloc(b->data, size);
+  if (p == NULL) {
+    b->failed = 1;
+    return -1;
+  }
+  b->data = p;
+  b->size = size;
+  return 0;
+}
+
+
+/*
+ * jel_write_callback: libjpeg fills the free end of the buffer, which
+ * is grown (and possibly moved) once it has been handed back.
+ */
+static unsigned char *jelpy_dest_write(void *ctx, unsigned char *buf, int len, int *bufsize) {
+  jelpy_buffer *b = (jelpy_buffer *) ctx;
+
+  b->len += len;
+  if (jelpy_reserve(b, JELPY_CHUNK) < 0) return NULL;
+  *bufsize = (b->size - b->len > INT_MAX) ? INT_MAX : (int) (b->size - b->len);
+  return b->data + b->len;
+}
+
+
+/* jel_message_writer: */
+static int jelpy_message_write(void *ctx, const unsigned char *buf, int len) {
+  jelpy_buffer *b = (jelpy_buffer *) ctx;
+
+  if (jelpy_reserve(b, len) < 0) return -1;
+  memcpy(b->data + b->len, buf, len);
+  b->len += len;
+  return len;
+}
+
+
+static const char *jelpy_strerror(int code) {
+  switch (code) {
+  case -1:			  return "libjpeg could not read or write the image";
+  case JEL_ERR_NOSUCHPROP:	  return "no such property";
+  case JEL_ERR_BADDIMS:		  return "bad image dimensions";
+  case JEL_ERR_NOMSG:		  return "no message";
+  case JEL_ERR_INVALIDARG:	  return "invalid argument";
+  case JEL_ERR_NOSPACE:		  return "the message does not fit";
+  case JEL_ERR_CHECKSUM:	  return "the message failed its checksum";
+  case JEL_ERR_MSGIO:		  return "message I/O error";
+  default:			  return "libjel error";
+  }
+}
+
+
+static PyObject *jelpy_raise(int code) {
+  PyObject *args = Py_BuildValue("(is)", code, jelpy_strerror(code));
+
+  if (args != NULL) {
+    PyErr_SetObject(jelpy_error, args);
+    Py_DECREF(args);
+  }
+  return NULL;
+}
+
+
+/*
+ * Options that must be set before the source is opened:
+ */
+static void jelpy_set_coding_options(jel_config *jel, jelpy_options *opt) {
+  if (!opt->ecc)
+    jel_setprop(jel, JEL_PROP_ECC_METHOD, JEL_ECC_NONE);
+  else if (opt->ecclen > 0)
+    jel_setprop(jel, JEL_PROP_ECC_BLOCKLEN, opt->ecclen);
+
+  if (opt->ethresh > 0) jel_setprop(jel, JEL_PROP_ENERGY_THRESHOLD, opt->ethresh);
+  if (opt->frame) jel_setprop(jel, JEL_PROP_FRAME, JEL_FRAME_V1);
+  if (opt->compress) jel_setprop(jel, JEL_PROP_COMPRESS, JEL_COMPRESS_LZF);
+  if (opt->restart > 0) jel_setprop(jel, JEL_PROP_RESTART_ROWS, opt->restart);
+  jel_setprop(jel, JEL_PROP_EMBED_LENGTH, opt->length == 0);
+}
+
+
+/*
+ * ... and those that depend on the source's quant tables:
+ */
+static void jelpy_set_image_options(jel_config *jel, jelpy_options *opt) {
+  if (opt->quality > 0) jel_setprop(jel, JEL_PROP_QUALITY, opt->quality);
+  if (opt->seed > 0) {
+    jel_setprop(jel, JEL_PROP_FREQ_SEED, opt->seed);
+    jel_setprop(jel, JEL_PROP_NFREQS, 8);
+  }
+}
+
+
+/*
+ * Makes a config and opens 'jpeg' as its source.  Called without the
+ * GIL.  Returns NULL with *ret set on failure.
+ */
+static jel_config *jelpy_open(Py_buffer *jpeg, jelpy_options *opt, int *ret) {
+  jel_config *jel = jel_init(JEL_NLEVELS);
+
+  if (jel == NULL) {
+    *ret = JEL_ERR_INVALIDARG;
+    return NULL;
+  }
+  jelpy_set_coding_options(jel, opt);
+  /* The memory source only reads the image: */
+  *ret = jel_set_mem_source(jel, (unsigned char *) jpeg->buf, (int) jpeg->len);
+  if (*ret != 0) {
+    jel_free(jel);
+    return NULL;
+  }
+  jelpy_set_image_options(jel, opt);
+  return jel;
+}
+
+
+static int jelpy_check_size(Py_buffer *buf) {
+  if (buf->len > INT_MAX) {
+    PyErr_SetString(PyExc_OverflowError, "jel: buffer is too large");
+    return -1;
+  }
+  return 0;
+}
+
+
+PyDoc_STRVAR(jelpy_capacity_doc,
+"capacity(jpeg, *, ecc=True, ecclen=0, ethresh=0, frame=False) -> int\n\n"
+"The number of message bytes the image can carry.");
+
+static PyObject *jelpy_capacity(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "jpeg", "ecc", "ecclen", "ethresh", "frame", NULL };
+  jelpy_options opt = { 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+  jel_config *jel;
+  Py_buffer jpeg;
+  int ret;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|$piip:capacity", kwlist, &jpeg,
+                                   &opt.ecc, &opt.ecclen, &opt.ethresh, &opt.frame))
+    return NULL;
+  if (jelpy_check_size(&jpeg) < 0) {
+    PyBuffer_Release(&jpeg);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  jel = jelpy_open(&jpeg, &opt, &ret);
+  if (jel != NULL) {
+    ret = jel_capacity(jel);
+    jel_free(jel);
+  }
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&jpeg);
+  if (ret < 0) return jelpy_raise(ret);
+  return PyLong_FromLong(ret);
+}
+
+
+PyDoc_STRVAR(jelpy_embed_doc,
+"embed(cover, message, *, seed=0, quality=0, length=True, ecc=True, ecclen=0,\n"
+"      ethresh=0, frame=False, compress=False, restart=0) -> bytes\n\n"
+"Embeds 'message' in the JPEG 'cover' and returns the new JPEG.  With\n"
+"length=False the length is not embedded, and the extractor must be\n"
+"given it.");
+
+static PyObject *jelpy_embed(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "cover", "message", "seed", "quality", "length", "ecc",
+                            "ecclen", "ethresh", "frame", "compress", "restart", NULL };
+  jelpy_options opt = { 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+  jelpy_buffer out = { NULL, 0, 0, 0 };
+  jel_config *jel;
+  jel_stats stats;
+  Py_buffer cover, message;
+  PyObject *result = NULL;
+  int embed_length = 1;
+  int ret;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*y*|$iippiippi:embed", kwlist,
+                                   &cover, &message, &opt.seed, &opt.quality,
+                                   &embed_length, &opt.ecc, &opt.ecclen, &opt.ethresh,
+                                   &opt.frame, &opt.compress, &opt.restart))
+    return NULL;
+  if (jelpy_check_size(&cover) < 0 || jelpy_check_size(&message) < 0)
+    goto done;
+  /* Only its absence matters when embedding: */
+  opt.length = !embed_length;
+
+  Py_BEGIN_ALLOW_THREADS
+  jel = jelpy_open(&cover, &opt, &ret);
+  if (jel != NULL) {
+    ret = jel_set_callback_dest(jel, jelpy_dest_write, NULL, &out);
+    if (ret == 0)
+      ret = jel_embed(jel, (unsigned char *) message.buf, (int) message.len);
+    /* With ECC a message that was cut short still reports its whole
+     * length, but the stats count what was read: */
+    jel_get_stats(jel, &stats);
+    if (ret >= 0 && (ret < message.len || (!opt.compress && stats.msg_bytes < message.len)))
+      ret = JEL_ERR_NOSPACE;
+    if (ret >= 0 && out.failed) ret = JEL_ERR_MSGIO;
+    if (ret >= 0) ret = jel->jpeglen;
+    jel_free(jel);
+  }
+  Py_END_ALLOW_THREADS
+
+  if (ret < 0) jelpy_raise(ret);
+  else result = PyBytes_FromStringAndSize((const char *) out.data, ret);
+
+ done:
+  free(out.data);
+  PyBuffer_Release(&cover);
+  PyBuffer_Release(&message);
+  return result;
+}
+
+
+PyDoc_STRVAR(jelpy_extract_doc,
+"extract(stego, *, length=0, seed=0, ecc=True, ecclen=0, ethresh=0,\n"
+"        frame=False) -> bytes\n\n"
+"Extracts the message from the JPEG 'stego'.  'length' is the message\n"
+"length for images embedded with length=False.");
+
+static PyObject *jelpy_extract(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = { "stego", "length", "seed", "ecc", "ecclen", "ethresh",
+                            "frame", NULL };
+  jelpy_options opt = { 0, 0, 1, 0, 0, 0, 0, 0, 0 };
+  jelpy_buffer out = { NULL, 0, 0, 0 };
+  jel_config *jel;
+  Py_buffer stego;
+  PyObject *result = NULL;
+  int maxlen, ret;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*|$iipiip:extract", kwlist, &stego,
+                                   &opt.length, &opt.seed, &opt.ecc, &opt.ecclen,
+                                   &opt.ethresh, &opt.frame))
+    return NULL;
+  if (jelpy_check_size(&stego) < 0) goto done;
+  if (opt.length < 0) {
+    PyErr_SetString(PyExc_ValueError, "jel: length must not be negative");
+    goto done;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  jel = jelpy_open(&stego, &opt, &ret);
+  if (jel != NULL) {
+    /* As unwedge does: */
+    maxlen = jel_raw_capacity(jel);
+    if (opt.length > 0 && opt.length < maxlen) maxlen = opt.length;
+    /* A compressed frame unpacks to at most 88 bytes per byte: */
+    if (opt.frame && opt.length == 0 && maxlen > 0)
+      maxlen = (maxlen > INT_MAX / 88) ? INT_MAX : maxlen * 88;
+    ret = jel_extract_stream(jel, jelpy_message_write, &out, maxlen);
+    jel_free(jel);
+  }
+  Py_END_ALLOW_THREADS
+
+  if (ret < 0) jelpy_raise(ret);
+  else result = PyBytes_FromStringAndSize((const char *) out.data, out.len);
+
+ done:
+  free(out.data);
+  PyBuffer_Release(&stego);
+  return result;
+}
+
+
+static PyMethodDef jelpy_methods[] = {
+  { "capacity", (PyCFunction) (void (*)(void)) jelpy_capacity, METH_VARARGS | METH_KEYWORDS, jelpy_capacity_doc },
+  { "embed", (PyCFunction) (void (*)(void)) jelpy_embed, METH_VARARGS | METH_KEYWORDS, jelpy_embed_doc },
+  { "extract", (PyCFunction) (void (*)(void)) jelpy_extract, METH_VARARGS | METH_KEYWORDS, jelpy_extract_doc },
+  { NULL, NULL, 0, NULL }
+};
+
+
+static struct PyModuleDef jelpy_module = {
+  PyModuleDef_HEAD_INIT,
+  "jel",
+  "JPEG Embedding Library: embed messages in JPEG images and extract them.",
+  -1,
+  jelpy_methods
+};
+
+
+PyMODINIT_FUNC PyInit_jel(void) {
+  PyObject *m = PyModule_Create(&jelpy_module);
+
+  if (m == NULL) return NULL;
+
+  jelpy_error = PyErr_NewException("jel.error", NULL, NULL);
+  if (jelpy_error == NULL || PyModule_AddObject(m, "error", jelpy_error) < 0) {
+    Py_XDECREF(jelpy_error);
+    Py_DECREF(m);
+    return NULL;
+  }
+  Py_INCREF(jelpy_error);
+
+#ifdef JEL_VERSION
+  PyModule_AddStringConstant(m, "__version__", JEL_VERSION);
+#endif
+  return m;
+}
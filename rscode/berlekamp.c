@@ -47,10 +47,10 @@
 #include "ecc.h"
 
 /* The Error Locator Polynomial, also known as Lambda or Sigma. Lambda[0] == 1 */
-static int Lambda[MAXDEG];
+static RS_THREAD_LOCAL int Lambda[MAXDEG];
 
 /* The Error Evaluator Polynomial */
-static int Omega[MAXDEG];
+static RS_THREAD_LOCAL int Omega[MAXDEG];
 
 /* local ANSI declarations */
 static int compute_discrepancy(int lambda[], int S[], int L, int n);
@@ -59,12 +59,12 @@ static void compute_modified_omega (void);
 static void mul_z_poly (int src[]);
 
 /* error locations found using Chien's search*/
-static int ErrorLocs[256];
-static int NErrors;
+static RS_THREAD_LOCAL int ErrorLocs[256];
+static RS_THREAD_LOCAL int NErrors;
 
 /* erasure flags */
-static int ErasureLocs[256];
-static int NErasures;
+static RS_THREAD_LOCAL int ErasureLocs[256];
+static RS_THREAD_LOCAL int NErasures;
 
 /* From  Cain, Clark, "Error-Correction Coding For Digital Communications", pp. 216. */
 void
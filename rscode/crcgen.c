@@ -61,7 +61,7 @@ BIT16 crc_ccitt(unsigned char *msg, int len)
 /* models crc hardware (minor variation on polynomial division algorithm) */
 BIT16 crchware(BIT16 data, BIT16 genpoly, BIT16 accum)
 {
-	static BIT16 i;
+	BIT16 i;
 	data <<= 8;
 	for (i = 8; i > 0; i--) {
 		if ((data ^ accum) & 0x8000)
@@ -69,12 +69,23 @@ typedef unsigned short BIT16;
 /* Maximum degree of various polynomials. */
 #define MAXDEG (NPAR*2)
 
+/* The tables in gftables.c are constant, but the encoder and decoder
+ * keep their working state in globals.  Giving each thread its own
+ * copy lets different threads code blocks at the same time. */
+#ifndef RS_THREAD_LOCAL
+#if defined(_MSC_VER)
+#define RS_THREAD_LOCAL __declspec(thread)
+#else
+#define RS_THREAD_LOCAL __thread
+#endif
+#endif
+
 /*************************************/
 /* Encoder parity bytes */
-extern int pBytes[MAXDEG];
+extern RS_THREAD_LOCAL int pBytes[MAXDEG];
 
 /* Decoder syndrome bytes */
-extern int synBytes[MAXDEG];
+extern RS_THREAD_LOCAL int synBytes[MAXDEG];
 
 /* print debugging info */
 extern int DEBUG;
@@ -88,9 +99,12 @@ void encode_data (unsigned char msg[], int nbytes, unsigned char dst[]);
 /* CRC-CCITT checksum generator */
 BIT16 crc_ccitt(unsigned char *msg, int len);
 
-/* galois arithmetic tables */
-extern int gexp[];
-extern int glog[];
+/* galois arithmetic tables (gftables.c) */
+extern const int gexp[];
+extern const int glog[];
+
+/* encoder generator polynomial for NPAR parity bytes (gftables.c) */
+extern const int genPoly[];
 
 void init_galois_tables (void);
 int ginv(int elt); 
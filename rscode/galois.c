@@ -51,58 +51,15 @@
 #define PPOLY 0x1D 
 
 
-int gexp[512];
-int glog[256];
-
-
-static void init_exp_table (void);
-
-
+/* gexp and glog are constant tables in gftables.c, written by
+ * gentables.c.  There is nothing left to initialize; this is kept for
+ * existing callers. */
 void
 init_galois_tables (void)
 {	
-  /* initialize the table of powers of alpha */
-  init_exp_table();
 }
 
 
-static void
-init_exp_table (void)
-{
-  int i, z;
-  int pinit = 0, p1 = 1, p2 = 0, p3 = 0, p4 = 0, p5 = 0, p6 = 0, p7 = 0, p8 = 0;
-
-  //pinit = p2 = p3 = p4 = p5 = p6 = p7 = p8 = 0;
-  //p1 = 1;
-	
-  gexp[0] = 1;
-  gexp[255] = gexp[0];
-  glog[0] = 0;			/* shouldn't log[0] be an error? */
-	
-  for (i = 1; i < 256; i++) {
-    pinit = p8;
-    p8 = p7;
-    p7 = p6;
-    p6 = p5;
-    p5 = p4 ^ pinit;
-    p4 = p3 ^ pinit;
-    p3 = p2 ^ pinit;
-    p2 = p1;
-    p1 = pinit;
-    gexp[i] = p1 + p2*2 + p3*4 + p4*8 + p5*16 + p6*32 + p7*64 + p8*128;
-    gexp[i+255] = gexp[i];
-  }
-	
-  for (i = 1; i < 256; i++) {
-    for (z = 0; z < 256; z++) {
-      if (gexp[z] == i) {
-	glog[i] = z;
-	break;
-      }
-    }
-  }
-}
-
 /* multiplication using logarithms */
 int gmult(int a, int b)
 {
@@ -0,0 +1,123 @@
+/*
+ * gentables.c - Writes gftables.c, rscode's constant tables.
+ *
+ * The tables are the powers of alpha (gexp) and their logarithms
+ * (glog) in GF(256), and the generator polynomial (genPoly) for
+ * every parity count from 1 to GEN_MAXPAR; ecc.h's NPAR picks one
+ * when gftables.c is compiled.  They used to be built by
+ * initialize_ecc on first use.  The output is kept in the source tree
+ * rather than made during the build, so cross-compiled libraries need
+ * not run anything on the build host.  'make rstables' regenerates
+ * it:
+ *
+ *   gentables > rscode/gftables.c
+ *
+ * The arithmetic is the same as galois.c's and rs.c's used to be.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GEN_MAXPAR 32		/* Largest parity count with a genPoly */
+
+static int gexp[512];
+static int glog[256];
+
+
+/* As init_exp_table did: an LFSR for x^8 + x^4 + x^3 + x^2 + 1 */
+static void init_exp_table(void) {
+  int i, z;
+  int pinit = 0, p1 = 1, p2 = 0, p3 = 0, p4 = 0, p5 = 0, p6 = 0, p7 = 0, p8 = 0;
+
+  gexp[0] = 1;
+  gexp[255] = gexp[0];
+  glog[0] = 0;			/* shouldn't log[0] be an error? */
+
+  for (i = 1; i < 256; i++) {
+    pinit = p8;
+    p8 = p7;
+    p7 = p6;
+    p6 = p5;
+    p5 = p4 ^ pinit;
+    p4 = p3 ^ pinit;
+    p3 = p2 ^ pinit;
+    p2 = p1;
+    p1 = pinit;
+    gexp[i] = p1 + p2*2 + p3*4 + p4*8 + p5*16 + p6*32 + p7*64 + p8*128;
+    gexp[i+255] = gexp[i];
+  }
+
+  for (i = 1; i < 256; i++) {
+    for (z = 0; z < 256; z++) {
+      if (gexp[z] == i) {
+	glog[i] = z;
+	break;
+      }
+    }
+  }
+}
+
+
+static int gmult(int a, int b) {
+  if (a == 0 || b == 0) return 0;
+  return gexp[glog[a] + glog[b]];
+}
+
+
+/* As compute_genpoly did: multiply (x + a^i) for i = 1 to nbytes */
+static void compute_genpoly(int nbytes, int genpoly[]) {
+  int i, j;
+
+  for (j = 0; j <= nbytes; j++) genpoly[j] = 0;
+  genpoly[0] = 1;
+
+  for (i = 1; i <= nbytes; i++) {
+    /* genpoly = genpoly * x + genpoly * a^i, highest term first: */
+    for (j = i; j > 0; j--)
+      genpoly[j] = genpoly[j-1] ^ gmult(genpoly[j], gexp[i]);
+    genpoly[0] = gmult(genpoly[0], gexp[i]);
+  }
+}
+
+
+static void print_table(const char *decl, const int *table, int n) {
+  int i;
+
+  printf("%s = {", decl);
+  for (i = 0; i < n; i++)
+    printf("%s%3d%s", (i % 16) ? " " : "\n  ", table[i], (i < n - 1) ? "," : "");
+  printf("\n};\n\n");
+}
+
+
+int main(void) {
+  int genpoly[GEN_MAXPAR + 1];
+  int n;
+
+  init_exp_table();
+
+  printf("/*\n"
+         " * Galois field and generator polynomial tables for rscode.\n"
+         " *\n"
+         " * Generated by gentables.c ('make rstables'); do not edit.\n"
+         " */\n\n"
+         "#include \"ecc.h\"\n\n");
+
+  printf("/* Powers of alpha, twice over so that gmult needs no modulus: */\n");
+  print_table("const int gexp[512]", gexp, 512);
+
+  printf("/* Their logarithms; glog[0] is not used: */\n");
+  print_table("const int glog[256]", glog, 256);
+
+  printf("/* The generator polynomial for NPAR parity bytes: */\n");
+  for (n = 1; n <= GEN_MAXPAR; n++) {
+    compute_genpoly(n, genpoly);
+    printf("#%s NPAR == %d\n", (n == 1) ? "if" : "elif", n);
+    print_table("const int genPoly[MAXDEG*2]", genpoly, n + 1);
+  }
+  printf("#else\n"
+         "#error \"gftables.c has no generator polynomial for this NPAR\"\n"
+         "#endif\n");
+
+  return EXIT_SUCCESS;
+}
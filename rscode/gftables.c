@@ -0,0 +1,246 @@
+/*
+ * Galois field and generator polynomial tables for rscode.
+ *
+ * Generated by gentables.c ('make rstables'); do not edit.
+ */
+
+#include "ecc.h"
+
+/* Powers of alpha, twice over so that gmult needs no modulus: */
+const int gexp[512] = {
+    1,   2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,
+   76, 152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192,
+  157,  39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,
+   70, 140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,
+   95, 190,  97, 194, 153,  47,  94, 188, 101, 202, 137,  15,  30,  60, 120, 240,
+  253, 231, 211, 187, 107, 214, 177, 127, 254, 225, 223, 163,  91, 182, 113, 226,
+  217, 175,  67, 134,  17,  34,  68, 136,  13,  26,  52, 104, 208, 189, 103, 206,
+  129,  31,  62, 124, 248, 237, 199, 147,  59, 118, 236, 197, 151,  51, 102, 204,
+  133,  23,  46,  92, 184, 109, 218, 169,  79, 158,  33,  66, 132,  21,  42,  84,
+  168,  77, 154,  41,  82, 164,  85, 170,  73, 146,  57, 114, 228, 213, 183, 115,
+  230, 209, 191,  99, 198, 145,  63, 126, 252, 229, 215, 179, 123, 246, 241, 255,
+  227, 219, 171,  75, 150,  49,  98, 196, 149,  55, 110, 220, 165,  87, 174,  65,
+  130,  25,  50, 100, 200, 141,   7,  14,  28,  56, 112, 224, 221, 167,  83, 166,
+   81, 162,  89, 178, 121, 242, 249, 239, 195, 155,  43,  86, 172,  69, 138,   9,
+   18,  36,  72, 144,  61, 122, 244, 245, 247, 243, 251, 235, 203, 139,  11,  22,
+   44,  88, 176, 125, 250, 233, 207, 131,  27,  54, 108, 216, 173,  71, 142,   1,
+    2,   4,   8,  16,  32,  64, 128,  29,  58, 116, 232, 205, 135,  19,  38,  76,
+  152,  45,  90, 180, 117, 234, 201, 143,   3,   6,  12,  24,  48,  96, 192, 157,
+   39,  78, 156,  37,  74, 148,  53, 106, 212, 181, 119, 238, 193, 159,  35,  70,
+  140,   5,  10,  20,  40,  80, 160,  93, 186, 105, 210, 185, 111, 222, 161,  95,
+  190,  97, 194, 153,  47,  94, 188, 101, 202, 137,  15,  30,  60, 120, 240, 253,
+  231, 211, 187, 107, 214, 177, 127, 254, 225, 223, 163,  91, 182, 113, 226, 217,
+  175,  67, 134,  17,  34,  68, 136,  13,  26,  52, 104, 208, 189, 103, 206, 129,
+   31,  62, 124, 248, 237, 199, 147,  59, 118, 236, 197, 151,  51, 102, 204, 133,
+   23,  46,  92, 184, 109, 218, 169,  79, 158,  33,  66, 132,  21,  42,  84, 168,
+   77, 154,  41,  82, 164,  85, 170,  73, 146,  57, 114, 228, 213, 183, 115, 230,
+  209, 191,  99, 198, 145,  63, 126, 252, 229, 215, 179, 123, 246, 241, 255, 227,
+  219, 171,  75, 150,  49,  98, 196, 149,  55, 110, 220, 165,  87, 174,  65, 130,
+   25,  50, 100, 200, 141,   7,  14,  28,  56, 112, 224, 221, 167,  83, 166,  81,
+  162,  89, 178, 121, 242, 249, 239, 195, 155,  43,  86, 172,  69, 138,   9,  18,
+   36,  72, 144,  61, 122, 244, 245, 247, 243, 251, 235, 203, 139,  11,  22,  44,
+   88, 176, 125, 250, 233, 207, 131,  27,  54, 108, 216, 173,  71, 142,   1,   0
+};
+
+/* Their logarithms; glog[0] is not used: */
+const int glog[256] = {
+    0,   0,   1,  25,   2,  50,  26, 198,   3, 223,  51, 238,  27, 104, 199,  75,
+    4, 100, 224,  14,  52, 141, 239, 129,  28, 193, 105, 248, 200,   8,  76, 113,
+    5, 138, 101,  47, 225,  36,  15,  33,  53, 147, 142, 218, 240,  18, 130,  69,
+   29, 181, 194, 125, 106,  39, 249, 185, 201, 154,   9, 120,  77, 228, 114, 166,
+    6, 191, 139,  98, 102, 221,  48, 253, 226, 152,  37, 179,  16, 145,  34, 136,
+   54, 208, 148, 206, 143, 150, 219, 189, 241, 210,  19,  92, 131,  56,  70,  64,
+   30,  66, 182, 163, 195,  72, 126, 110, 107,  58,  40,  84, 250, 133, 186,  61,
+  202,  94, 155, 159,  10,  21, 121,  43,  78, 212, 229, 172, 115, 243, 167,  87,
+    7, 112, 192, 247, 140, 128,  99,  13, 103,  74, 222, 237,  49, 197, 254,  24,
+  227, 165, 153, 119,  38, 184, 180, 124,  17,  68, 146, 217,  35,  32, 137,  46,
+   55,  63, 209,  91, 149, 188, 207, 205, 144, 135, 151, 178, 220, 252, 190,  97,
+  242,  86, 211, 171,  20,  42,  93, 158, 132,  60,  57,  83,  71, 109,  65, 162,
+   31,  45,  67, 216, 183, 123, 164, 118, 196,  23,  73, 236, 127,  12, 111, 246,
+  108, 161,  59,  82,  41, 157,  85, 170, 251,  96, 134, 177, 187, 204,  62,  90,
+  203,  89,  95, 176, 156, 169, 160,  81,  11, 245,  22, 235, 122, 117,  44, 215,
+   79, 174, 213, 233, 230, 231, 173, 232, 116, 214, 244, 234, 168,  80,  88, 175
+};
+
+/* The generator polynomial for NPAR parity bytes: */
+#if NPAR == 1
+const int genPoly[MAXDEG*2] = {
+    2,   1
+};
+
+#elif NPAR == 2
+const int genPoly[MAXDEG*2] = {
+    8,   6,   1
+};
+
+#elif NPAR == 3
+const int genPoly[MAXDEG*2] = {
+   64,  56,  14,   1
+};
+
+#elif NPAR == 4
+const int genPoly[MAXDEG*2] = {
+  116, 231, 216,  30,   1
+};
+
+#elif NPAR == 5
+const int genPoly[MAXDEG*2] = {
+   38, 197, 229,  63,  62,   1
+};
+
+#elif NPAR == 6
+const int genPoly[MAXDEG*2] = {
+  117,  49,  58, 158,   4, 126,   1
+};
+
+#elif NPAR == 7
+const int genPoly[MAXDEG*2] = {
+   24, 208, 125, 146, 164, 245, 254,   1
+};
+
+#elif NPAR == 8
+const int genPoly[MAXDEG*2] = {
+   37, 224,   8, 172,  71, 178,  44, 227,   1
+};
+
+#elif NPAR == 9
+const int genPoly[MAXDEG*2] = {
+  193,  92,  45, 114,  44, 235, 132,  27, 217,   1
+};
+
+#elif NPAR == 10
+const int genPoly[MAXDEG*2] = {
+  160, 212,  68, 188,  30, 197, 190, 140,  47, 173,   1
+};
+
+#elif NPAR == 11
+const int genPoly[MAXDEG*2] = {
+   97, 180, 203, 151, 195, 196, 219,   7, 113,  50,  69,   1
+};
+
+#elif NPAR == 12
+const int genPoly[MAXDEG*2] = {
+  120, 252, 175, 132, 170, 167, 147, 130,  51,  34, 193, 136,   1
+};
+
+#elif NPAR == 13
+const int genPoly[MAXDEG*2] = {
+  163,  73, 155,  61,  66, 129,  31,  52, 163,  13,  75,  57,  15,   1
+};
+
+#elif NPAR == 14
+const int genPoly[MAXDEG*2] = {
+   26, 156, 188,  43, 175,  36,  77,  36,  46, 100,  20, 183, 216,  28,   1
+};
+
+#elif NPAR == 15
+const int genPoly[MAXDEG*2] = {
+   59,  31,  45,  79, 170, 131, 194,  97, 105, 119, 166, 226,  95,  55,  58,   1
+};
+
+#elif NPAR == 16
+const int genPoly[MAXDEG*2] = {
+   79,  44,  81, 100,  49, 183,  56,  17, 232, 187, 126, 104,  31, 103,  52, 118,
+    1
+};
+
+#elif NPAR == 17
+const int genPoly[MAXDEG*2] = {
+  146,  75,   8,  40,  99, 206, 156, 213,   9, 249,  46, 233,  70, 211, 162,  21,
+  238,   1
+};
+
+#elif NPAR == 18
+const int genPoly[MAXDEG*2] = {
+  179,  31,  62, 180,  25, 116, 230,  99, 141, 254, 171,  51, 136,  87,  67, 209,
+  203, 195,   1
+};
+
+#elif NPAR == 19
+const int genPoly[MAXDEG*2] = {
+  174,  11, 114,  11, 205,  41,  63, 132, 160, 229, 115,   3, 223, 217, 186, 213,
+  208,  32, 153,   1
+};
+
+#elif NPAR == 20
+const int genPoly[MAXDEG*2] = {
+   89, 166, 244, 122, 150, 179,  71, 217, 139, 247, 174, 178, 100,  39, 229,  97,
+   80, 211, 222,  45,   1
+};
+
+#elif NPAR == 21
+const int genPoly[MAXDEG*2] = {
+  245, 100, 126, 152,  66,  20, 233, 170, 209, 204,  69,  89, 113,  52, 137, 154,
+  110, 216, 104, 235,  88,   1
+};
+
+#elif NPAR == 22
+const int genPoly[MAXDEG*2] = {
+   71, 110,  51,  75,  73, 203, 217,  31, 110, 117, 177, 178, 161, 244, 237, 117,
+  203,  67, 207, 108, 246, 178,   1
+};
+
+#elif NPAR == 23
+const int genPoly[MAXDEG*2] = {
+  117, 229,  60,  67, 180,  89,  88, 150, 189, 128, 200,  74,   3, 230, 112,   3,
+  101, 189,  80, 226, 164,  13, 123,   1
+};
+
+#elif NPAR == 24
+const int genPoly[MAXDEG*2] = {
+  193, 108, 199, 208, 173,  79,  45, 133, 251, 125,  44, 167, 198, 150, 174, 252,
+  218,   8, 197, 195,  20,  33, 197, 244,   1
+};
+
+#elif NPAR == 25
+const int genPoly[MAXDEG*2] = {
+   94, 117,  56, 170,  58, 124,  56, 191, 149, 124,   9, 216, 240,  97, 121, 183,
+  143, 194,  90, 157, 255, 119, 115, 196, 247,   1
+};
+
+#elif NPAR == 26
+const int genPoly[MAXDEG*2] = {
+  217, 125, 229, 227,  54,  47, 236, 157, 230, 128,  74, 227, 194, 171, 106, 236,
+  178,  57,   3,  51, 165, 208,  64, 209, 204, 241,   1
+};
+
+#elif NPAR == 27
+const int genPoly[MAXDEG*2] = {
+  197, 255, 181,   5, 150, 239, 139,  62,  65, 168, 223, 170, 146, 101, 105, 206,
+  231, 131,  45,  74, 220,  12, 247, 229, 232, 244, 253,   1
+};
+
+#elif NPAR == 28
+const int genPoly[MAXDEG*2] = {
+  170,  37, 161, 205,  84, 235, 155, 161, 104,  58, 111, 148, 155, 131, 212,  43,
+  115,  83,  28, 147, 165, 124,  44, 122, 208, 224,  36, 229,   1
+};
+
+#elif NPAR == 29
+const int genPoly[MAXDEG*2] = {
+  150,  20, 126, 117, 182, 110,  36, 192, 238, 252, 229, 173,  91, 238, 221,  87,
+  142, 152,  41,  78,   8,  13, 111,  36, 228,  39, 110,  35, 213,   1
+};
+
+#elif NPAR == 30
+const int genPoly[MAXDEG*2] = {
+   89,  69, 153, 116, 176, 117, 111,  75,  73, 233, 242, 233,  65, 210,  21, 139,
+  103, 173,  67, 118, 105, 210, 174, 110,  74,  69, 228,  82, 255, 181,   1
+};
+
+#elif NPAR == 31
+const int genPoly[MAXDEG*2] = {
+   88, 244, 195,  77,  89, 164,  46,  54, 143,  60,  19, 135,  99, 158, 169, 146,
+  158, 127, 186,  10, 151, 182, 151,  53, 247, 231, 153, 175,   1,  53, 117,   1
+};
+
+#elif NPAR == 32
+const int genPoly[MAXDEG*2] = {
+   45, 216, 239,  24, 253, 104,  27,  40, 107,  50, 163, 210, 227, 134, 224, 158,
+  119,  13, 158,   1, 238, 164,  82,  43,  15, 232, 246, 142,  50, 189,  29, 232,
+    1
+};
+
+#else
+#error "gftables.c has no generator polynomial for this NPAR"
+#endif
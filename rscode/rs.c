@@ -38,28 +38,20 @@
 #include "ecc.h"
 
 /* Encoder parity bytes */
-int pBytes[MAXDEG];
+RS_THREAD_LOCAL int pBytes[MAXDEG];
 
 /* Decoder syndrome bytes */
-int synBytes[MAXDEG];
-
-/* generator polynomial */
-int genPoly[MAXDEG*2];
+RS_THREAD_LOCAL int synBytes[MAXDEG];
 
 int DEBUG = FALSE;
 
-static void
-compute_genpoly (int nbytes, int genpoly[]);
-
-/* Initialize lookup tables, polynomials, etc. */
+/* The lookup tables and the encoder generator polynomial (genPoly)
+ * are compiled in (gftables.c), so the first block coded pays no
+ * setup and threads need not agree on who builds them.  Kept for
+ * existing callers. */
 void
 initialize_ecc ()
 {
-  /* Initialize the galois field arithmetic tables */
-    init_galois_tables();
-
-    /* Compute the encoder generator polynomial */
-    compute_genpoly(NPAR, genPoly);
 }
 
 void
@@ -152,32 +144,6 @@ debug_check_syndrome (void)
 }
 
 
-/* Create a generator polynomial for an n byte RS code. 
- * The coefficients are returned in the genPoly arg.
- * Make sure that the genPoly array which is passed in is 
- * at least n+1 bytes long.
- */
-
-static void
-compute_genpoly (int nbytes, int genpoly[])
-{
-  int i, tp[256], tp1[256];
-	
-  /* multiply (x + a^n) for n = 1 to nbytes */
-
-  zero_poly(tp1);
-  tp1[0] = 1;
-
-  for (i = 1; i <= nbytes; i++) {
-    zero_poly(tp);
-    tp[0] = gexp[i];		/* set up x+a^n */
-    tp[1] = 1;
-	  
-    mult_polys(genpoly, tp, tp1);
-    copy_poly(tp1, genpoly);
-  }
-}
-
 /* Simulate a LFSR with generator polynomial for n byte RS code. 
  * Pass in a pointer to the data array, and amount of data. 
  *
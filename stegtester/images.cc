@@ -9,7 +9,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 
-#include <jel/jel.h>
+#include <jel/jel.hpp>
 
 static jel_knobs_t knobs;
 static bool jel_ok = false;
@@ -37,7 +37,39 @@ void set_jel_embed_length(bool value){
   knobs.embed_length  = value;
 }
 
-#define IMAGES_LOG   "/tmp/stegotester.log"
+/* Progress chatter on stderr; errors are always reported. */
+static bool the_chatter = true;
+
+void set_images_verbose(bool value){
+  the_chatter = value;
+}
+
+/* Logging is off unless set_jel_log is called. */
+static const char *the_log_path = NULL;
+
+void set_jel_log(const char *path){
+  the_log_path = path;
+}
+
+/*
+ * Each thread keeps one jel context and reuses it for every image,
+ * so embedding and extracting set up no new jel objects.  It logs to
+ * the_log_path if there is one.
+ */
+static jel::Context &the_jel(){
+  static thread_local jel::Context jel;
+  static thread_local bool jel_ready = false;
+  if(!jel_ready){
+    jel_ready = true;
+    if(the_log_path != NULL){
+      if(jel_open_log(jel.get(), (char *)the_log_path) == JEL_ERR_CANTOPENLOG){
+        fprintf(stderr, "Can't open %s!\n", the_log_path);
+      }
+      jel_setprop(jel.get(), JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+    }
+  }
+  return jel;
+}
 
 static image_p *the_images = NULL;
 static int      the_images_length = 0;
@@ -58,6 +90,17 @@ void free_image(image_p im){
   }
 }
 
+unsigned char *take_image_bytes(image_p im, size_t *sizep){
+  unsigned char *bytes = NULL;
+  if(im != NULL){
+    bytes = im->bytes;
+    if(sizep != NULL){ *sizep = im->size; }
+    im->bytes = NULL;
+    free_image(im);
+  }
+  return bytes;
+}
+
 static bool grow_the_images();
 static bool grow_the_images(){
   int temp_length = 2 * (the_images_length == 0 ? 1 : the_images_length);
@@ -96,24 +139,14 @@ bool file2bytes(const char* path, unsigned char* bytes, size_t bytes_wanted){
 
 /* a playground at present */
 static int capacity(image_p image){
-  jel_config *jel = jel_init(JEL_NLEVELS);
-  int ret = jel_open_log(jel, (char *)IMAGES_LOG);
-  if (ret == JEL_ERR_CANTOPENLOG) {
-    fprintf(stderr, "Can't open %s!\n", IMAGES_LOG);
-    jel->logger = stderr;
-  }
-  
-  ret = jel_set_mem_source(jel, image->bytes, image->size);
-  if (ret != 0) {
-    fprintf(stderr, "jel: Error - exiting (need a diagnostic!)\n");
-  } else {
-    ret = jel_capacity(jel);
+  jel::Context &jel = the_jel();
+  jel::result<size_t> cap = jel.capacity(jel::bytes(image->bytes, image->size));
+  if (!cap) {
+    fprintf(stderr, "jel: capacity of %s failed (%d)\n", image->path, cap.error());
   }
-  jel_log(jel, "In capacity:\n");
-  jel_describe(jel);
-  jel_close_log(jel);
-  jel_free(jel);
-  return ret;
+  jel_log(jel.get(), "In capacity:\n");
+  if(the_log_path != NULL){ jel_describe(jel.get()); }
+  return cap ? (int)*cap : cap.error();
 }
 
 
@@ -145,7 +178,7 @@ static image_p load_image(const char* path, char* basename){
             if(image->capacity >= the_images_max_payload){
               the_images_max_payload = image->capacity;
             }
-            if(1){
+            if(the_chatter){
               fprintf(stderr, "load_image loaded %s of size %zd with capacity %d\n", image->path, image->size, image->capacity);
             }
             return image;
@@ -191,6 +224,10 @@ int load_images(const char* path){
   return retval;
 }
 
+int images_max_payload(){
+  return the_images_max_payload;
+}
+
 int unload_images(){
   int retval = 0, index;
   for(index = 0; index < the_images_offset; index++){
@@ -206,11 +243,11 @@ int unload_images(){
 
 
 static image_p get_cover_image(int size){
-  if((size > the_images_max_payload) ||  (the_images_offset > 0)){
+  if((size < the_images_max_payload) && (the_images_offset > 0)){
     image_p retval = NULL;
     int index, fails = 0;
     /* try and get a random one first */
-    while((retval != NULL) && (fails++ < 10)){
+    while((retval == NULL) && (fails++ < 10)){
       index = rand() % the_images_offset;
       retval = the_images[index];
       if(retval->capacity > size){
@@ -231,85 +268,50 @@ static image_p get_cover_image(int size){
   return NULL;
 }
 
-/* since we have to guess the size of the destination */
-static image_p embed_message_aux(image_p cover, unsigned char* message, int message_length, unsigned char* destination, int destination_length);
-static image_p embed_message_aux(image_p cover, unsigned char* message, int message_length, unsigned char* destination, int destination_length){
-  image_p retval = NULL;
-  if(destination != NULL){
-    jel_config *jel = jel_init(JEL_NLEVELS);
-    int bytes_embedded = 0;
-    int ret = jel_open_log(jel, (char *)IMAGES_LOG);
-    if (ret == JEL_ERR_CANTOPENLOG) {
-      fprintf(stderr, "extract_message: can't open %s!\n", IMAGES_LOG);
-      jel->logger = stderr;
-    }
-
-    ret = jel_set_mem_source(jel, cover->bytes, cover->size);
-    if (ret != 0) {
-      fprintf(stderr, "jel: error - setting source memory!");
-      return NULL;
-    } 
-    ret = jel_set_mem_dest(jel, destination, destination_length);
-    if (ret != 0) {
-      fprintf(stderr, "jel: error - setting dest memory!");
-      return NULL;
-    } 
-
-    jel_setprop(jel, JEL_PROP_EMBED_LENGTH, knobs.embed_length);
-    fprintf(stderr, "embed_length: %d\n", knobs.embed_length);
-    
-    jel_log(jel, "In embed_message_aux:\n");
-    jel_describe(jel);
-
-   /* insert the message */
-   jel_log(jel, "Before call to jel_embed, message[0] = %d\n", message[0]);
-   bytes_embedded = jel_embed(jel, message, message_length);
-   jel_log(jel, "After call to jel_embed, message[0] = %d\n", message[0]);
-
-   fprintf(stderr, "jel_embed: bytes_embedded = %d message_length = %d\n", bytes_embedded, message_length);
- 
-   /* figure out the real size of destination */
-   if(bytes_embedded == message_length){ 
-     if(jel->jpeglen > 0){
-       retval = alloc_image();
-       retval->bytes = destination;
-       retval->size = jel->jpeglen;
-       retval->message_length = message_length;
-     }
-   } else {
-     int  errcode = jel_error_code(jel);    /* Returns the most recent error code. */
-     char *errstr = jel_error_string(jel);  /* Returns the most recent error string. */
-     fprintf(stderr, "jel: bytes_embedded = %d message_length = %d (%d %s)\n", bytes_embedded, message_length, errcode, errstr);
-   }
-   jel_close_log(jel);
-   jel_free(jel);
-  }  
-  return retval;
-}
-
-
-  
-
 image_p embed_message(unsigned char* message, int message_length){
   image_p retval = NULL;
   if(message != NULL){
     image_p cover = get_cover_image( message_length );
     if(cover != NULL){
-      fprintf(stderr, "embed_message:  embedding %d bytes into %s\n",  message_length, cover->path);
-      int failures = 0, destination_length = cover->size;
-      unsigned char* destination = NULL;
-      
-      do {
+      if(the_chatter){ fprintf(stderr, "embed_message:  embedding %d bytes into %s\n",  message_length, cover->path); }
+      jel::Context &jel = the_jel();
+      jel_setprop(jel.get(), JEL_PROP_EMBED_LENGTH, knobs.embed_length);
+      if(the_chatter){ fprintf(stderr, "embed_length: %d\n", knobs.embed_length); }
+
+      /* we have to guess the size of the destination; it only grows
+       * if the stegged image does not fit */
+      size_t destination_length = 2 * cover->size;
+      unsigned char* destination = (unsigned char*)malloc(destination_length);
+      jel::result<size_t> size = jel::failure{JEL_ERR_NOSPACE};
+      int failures = 0;
+
+      while(destination != NULL){
+        size = jel.embed(jel::bytes(cover->bytes, cover->size),
+                         jel::bytes(message, message_length),
+                         jel::mutable_bytes(destination, destination_length));
+        if(the_chatter){ fprintf(stderr, "embed_message:  %zd  %d\n",  destination_length, size.error()); }
+        if(size || (size.error() != JEL_ERR_NOSPACE) || (failures++ >= 10)){ break; }
+        /* the message itself may not fit; that stays a failure */
+        jel_stats stats;
+        jel_get_stats(jel.get(), &stats);
+        if(stats.msg_bytes < message_length){ break; }
         destination_length *= 2;
         free(destination);
         destination = (unsigned char*)malloc(destination_length);
-        if(destination == NULL){ break; }
-        retval = embed_message_aux(cover, message, message_length, destination, destination_length);
-        fprintf(stderr, "embed_message_aux:  %d  %p\n",  destination_length, retval);
-      } while((failures++ < 10) && (retval == NULL));
+      }
 
-      if(retval != NULL){
-        fprintf(stderr, "embed_message:  resulting stegged image size = %zd\n",  retval->size);
+      jel_log(jel.get(), "In embed_message:\n");
+      if(the_log_path != NULL){ jel_describe(jel.get()); }
+
+      if(size){
+        retval = alloc_image();
+        retval->bytes = destination;
+        retval->size = *size;
+        retval->message_length = message_length;
+        if(the_chatter){ fprintf(stderr, "embed_message:  resulting stegged image size = %zd\n",  retval->size); }
+      } else {
+        fprintf(stderr, "jel: embedding %d bytes in %s failed (%d)\n", message_length, cover->path, size.error());
+        free(destination);
       }
     }
   }
@@ -322,48 +324,42 @@ int extract_message(unsigned char** messagep, int message_length, unsigned char*
   int msglen;
   
   if((messagep != NULL) && (jpeg_data != NULL)){
-    fprintf(stderr, "extract_message:  %u\n", jpeg_data_length);
-    jel_config *jel = jel_init(JEL_NLEVELS);
-    
-    int ret = jel_open_log(jel, (char *)IMAGES_LOG);
-    if (ret == JEL_ERR_CANTOPENLOG) {
-      fprintf(stderr, "extract_message: can't open %s!\n", IMAGES_LOG);
-      jel->logger = stderr;
-    }
+    if(the_chatter){ fprintf(stderr, "extract_message:  %u\n", jpeg_data_length); }
+    jel::Context &jel = the_jel();
+    jel::bytes stego(jpeg_data, jpeg_data_length);
 
-    jel_set_mem_source(jel, jpeg_data, jpeg_data_length);
+    jel_setprop(jel.get(), JEL_PROP_EMBED_LENGTH, embed_length);
 
-    fprintf(stderr, "embed_length: %d\n", embed_length);
-    fprintf(stderr, "message_length: %d\n", message_length);
+    if(the_chatter){
+      fprintf(stderr, "embed_length: %d\n", embed_length);
+      fprintf(stderr, "message_length: %d\n", message_length);
+    }
 
     if(embed_length){
-      msglen = jel_capacity(jel);
-      fprintf(stderr, "extract_message: capacity = %d\n", msglen);
+      /* the embedded length counts ECC bytes too, so it is enough
+       * room for the message; reading it decodes only the first rows */
+      jel::result<size_t> len = jel.probe_length(stego);
+      if(!len || (*len == 0)){
+        fprintf(stderr, "extract_message: no message found (%d)\n", len.error());
+        return 0;
+      }
+      msglen = (int)*len;
+      if(the_chatter){ fprintf(stderr, "extract_message: embedded length = %d\n", msglen); }
     } else {
       msglen = message_length;
     }
-  
-    /* 
-     * Here, we use 'jel_alloc_buffer( jel )' to let the jel object
-     * figure out how big the buffer (message) should be and allocate
-     * it.  Caller must explicitly free() this buffer.
-     */
-
-    // unsigned char* message = (unsigned char*)calloc(msglen+1, sizeof(unsigned char));
-    unsigned char* message = (unsigned char*) jel_alloc_buffer( jel );
-    jel_setprop(jel, JEL_PROP_EMBED_LENGTH, embed_length);
-
-    jel_log(jel, "In extract_message:\n");
-    jel_describe(jel);
-
-    //    msglen = jel_extract(jel, message, msglen);
-    msglen = jel_extract(jel, message, msglen);
-    jel_log(jel, "After call to jel_extract, message[0] = %d; jel->data[0] = %d\n", message[0], jel->data[0]);
-    jel_log(jel, "extract_message: %d bytes extracted\n", msglen);
-    jel_close_log(jel);
-    jel_free(jel);
+
+    /* Caller must explicitly free() this buffer. */
+    unsigned char* message = (unsigned char*)calloc(msglen+1, sizeof(unsigned char));
+    if(message == NULL){ return 0; }
+
+    jel::result<size_t> got = jel.extract(stego, jel::mutable_bytes(message, msglen));
+
+    jel_log(jel.get(), "In extract_message:\n");
+    if(the_log_path != NULL){ jel_describe(jel.get()); }
+    jel_log(jel.get(), "extract_message: %d bytes extracted\n", got ? (int)*got : got.error());
     *messagep = message;
-    return msglen;
+    return got ? (int)*got : got.error();
   }
   return 0;
 }
@@ -371,28 +367,21 @@ int extract_message(unsigned char** messagep, int message_length, unsigned char*
 
 int extract_message_orig(unsigned char** messagep, unsigned char* jpeg_data, unsigned int jpeg_data_length){
   if((messagep != NULL) && (jpeg_data != NULL)){
-    fprintf(stderr, "extract_message:  %u\n", jpeg_data_length);
-    jel_config *jel = jel_init(JEL_NLEVELS);
-    int ret = jel_open_log(jel, (char *)IMAGES_LOG);
-    if (ret == JEL_ERR_CANTOPENLOG) {
-      fprintf(stderr, "extract_message: can't open %s!\n", IMAGES_LOG);
-      jel->logger = stderr;
-    }
+    if(the_chatter){ fprintf(stderr, "extract_message:  %u\n", jpeg_data_length); }
+    jel::Context &jel = the_jel();
+    jel::bytes stego(jpeg_data, jpeg_data_length);
 
-    jel_set_mem_source(jel, jpeg_data, jpeg_data_length);
-    int msglen = jel_capacity(jel);
-    fprintf(stderr, "extract_message: capacity = %d\n", msglen);
+    int msglen = (int)jel.capacity(stego).value_or(0);
+    if(the_chatter){ fprintf(stderr, "extract_message: capacity = %d\n", msglen); }
     unsigned char* message = (unsigned char*)calloc(msglen+1, sizeof(unsigned char));
-    jel_setprop(jel, JEL_PROP_EMBED_LENGTH, knobs.embed_length);
-
-    jel_log(jel, "In extract_message:\n");
-    jel_describe(jel);
-
-    msglen = jel_extract(jel, message, msglen);
-    jel_log(jel, "After call to jel_extract, message[0] = %d; jel->data[0] = %d\n", message[0], jel->data[0]);
-    jel_log(jel, "extract_message: %d bytes extracted\n", msglen);
-    jel_close_log(jel);
-    jel_free(jel);
+    if(message == NULL){ return 0; }
+    jel_setprop(jel.get(), JEL_PROP_EMBED_LENGTH, knobs.embed_length);
+
+    jel::result<size_t> got = jel.extract(stego, jel::mutable_bytes(message, msglen));
+    jel_log(jel.get(), "In extract_message:\n");
+    if(the_log_path != NULL){ jel_describe(jel.get()); }
+    msglen = got ? (int)*got : got.error();
+    jel_log(jel.get(), "extract_message: %d bytes extracted\n", msglen);
     *messagep = message;
     return msglen;
   }
@@ -30,6 +30,12 @@ typedef struct jel_knobs {
 
 void set_jel_defaults();
 
+/* log libjel activity to 'path'; by default nothing is logged */
+void set_jel_log(const char *path);
+
+/* progress messages on stderr; on by default */
+void set_images_verbose(bool value);
+
 void set_jel_preferences(jel_knobs_t &knobs);
 
 /* need to do this after loading the images (since that sets the defaults) */
@@ -37,10 +43,16 @@ void set_jel_embed_length(bool value);
 
 void free_image(image_p im);
 
+/* frees the image but hands back its bytes (and their size), which the caller must free() */
+unsigned char *take_image_bytes(image_p im, size_t *sizep);
+
 int load_images(const char* path);
 
 int unload_images();
 
+/* the largest capacity among the loaded images */
+int images_max_payload();
+
 image_p embed_message(unsigned char* message, int message_length);
 
 int extract_message(unsigned char** messagep, int message_length, unsigned char* jpeg_data, unsigned int jpeg_data_length);
@@ -0,0 +1,439 @@
+/* Copyright 2011, 2012, 2013 SRI International
+ * See LICENSE for other credits and copying information
+ */
+
+/*
+ * loadgen: concurrent embed/extract traffic against libjel, through
+ * the same images.cc calls that stegtester uses.
+ *
+ * N worker threads issue a mix of embed_message and extract_message
+ * requests until the run time is up.  Payload sizes are drawn from a
+ * configurable distribution.  Extract requests work on a pool of
+ * stego images prepared before the clock starts, and every extracted
+ * message is checked.
+ *
+ * Every interval a JSON line goes to stdout with the throughput,
+ * latency percentiles for the interval and the resident set size; a
+ * summary with the whole-run histograms follows at the end.
+ * Latencies are kept in log-linear (HDR-style) histograms, one per
+ * thread, so recording never contends.
+ *
+ * By default each request holds a global lock while it is in the
+ * library, which gives the serialized baseline; -nolock lets the
+ * workers call libjel concurrently, since separate configs no longer
+ * share any state.
+ */
+
+#include <jel/jel.h>
+#include "images.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Log-linear histogram of nanosecond latencies: exact below 64ns,
+ * then 32 buckets per power of two, so every bucket is within about
+ * 3% of the values it holds.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  (HIST_SUB * 42)
+
+struct histogram {
+  std::atomic<uint64_t> counts[HIST_BUCKETS];
+
+  histogram(){ for(int i = 0; i < HIST_BUCKETS; i++){ counts[i] = 0; } }
+
+  static int index(uint64_t v){
+    if(v < 2 * HIST_SUB){ return (int)v; }
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    int i = shift * HIST_SUB + (int)(v >> shift);
+    return (i < HIST_BUCKETS) ? i : HIST_BUCKETS - 1;
+  }
+
+  /* smallest value that lands in bucket i */
+  static uint64_t lowest(int i){
+    if(i < 2 * HIST_SUB){ return (uint64_t)i; }
+    int shift = i / HIST_SUB - 1;
+    return (uint64_t)(i - shift * HIST_SUB) << shift;
+  }
+
+  void record(uint64_t ns){
+    counts[index(ns)].fetch_add(1, std::memory_order_relaxed);
+  }
+};
+
+
+/* A plain copy of one or more histograms, for reporting: */
+struct snapshot {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+
+  snapshot(){ clear(); }
+
+  void clear(){ memset(counts, 0, sizeof(counts)); total = 0; }
+
+  void add(const histogram &h){
+    for(int i = 0; i < HIST_BUCKETS; i++){
+      uint64_t c = h.counts[i].load(std::memory_order_relaxed);
+      counts[i] += c;
+      total += c;
+    }
+  }
+
+  /* this minus an earlier snapshot of the same histograms */
+  snapshot since(const snapshot &earlier) const {
+    snapshot d;
+    for(int i = 0; i < HIST_BUCKETS; i++){
+      d.counts[i] = counts[i] - earlier.counts[i];
+      d.total += d.counts[i];
+    }
+    return d;
+  }
+
+  /* latency in microseconds at quantile q */
+  double percentile(double q) const {
+    if(total == 0){ return 0.0; }
+    uint64_t rank = (uint64_t)(q * total + 0.5), seen = 0;
+    if(rank < 1){ rank = 1; }
+    for(int i = 0; i < HIST_BUCKETS; i++){
+      seen += counts[i];
+      if(seen >= rank){ return histogram::lowest(i) / 1000.0; }
+    }
+    return histogram::lowest(HIST_BUCKETS - 1) / 1000.0;
+  }
+};
+
+
+enum { OP_EMBED, OP_EXTRACT, OP_COUNT };
+static const char *op_names[OP_COUNT] = { "embed", "extract" };
+
+struct worker_stats {
+  histogram latency[OP_COUNT];
+  std::atomic<uint64_t> failures[OP_COUNT];
+
+  worker_stats(){ for(int k = 0; k < OP_COUNT; k++){ failures[k] = 0; } }
+};
+
+
+/* A prepared stego image for extract requests: */
+struct stego {
+  unsigned char *body;
+  unsigned int body_length;
+  unsigned char *message;
+  int message_length;
+};
+
+
+/* Payload size distributions: */
+enum { DIST_FIXED, DIST_UNIFORM, DIST_EXP };
+
+static int         dist_kind = DIST_FIXED;
+static int         dist_a = 1024;      /* fixed size, uniform low, or exponential mean */
+static int         dist_b = 1024;      /* uniform high */
+
+static int         nthreads = 4;
+static double      duration = 10.0;    /* seconds */
+static double      interval = 1.0;     /* seconds between reports */
+static double      extract_ratio = 0.5;
+static int         pool_size = 32;
+static bool        use_lock = true;
+static const char *image_dir = "data/jpegs";
+static const char *log_path = NULL;
+
+static std::mutex  jel_lock;
+static std::atomic<bool> stopping(false);
+static std::vector<stego> the_pool;
+static int         max_payload = 0;
+
+
+static void usage(const char *progname){
+  fprintf(stderr, "usage: %s [switches]\n", progname);
+  fprintf(stderr, "Concurrent embed/extract traffic with latency histograms.\n");
+  fprintf(stderr, "  -threads N        Worker threads (default=4).\n");
+  fprintf(stderr, "  -duration S       Seconds to run (default=10).\n");
+  fprintf(stderr, "  -interval S       Seconds between reports (default=1).\n");
+  fprintf(stderr, "  -extract F        Fraction of requests that are extracts (default=0.5).\n");
+  fprintf(stderr, "  -payload D        Payload sizes: fixed:N, uniform:A:B or exp:MEAN (default=fixed:1024).\n");
+  fprintf(stderr, "  -pool N           Stego images prepared for extracts (default=32).\n");
+  fprintf(stderr, "  -images DIR       Cover images (default=data/jpegs).\n");
+  fprintf(stderr, "  -nolock           Call libjel concurrently.\n");
+  fprintf(stderr, "  -log FILE         Log libjel activity to FILE.\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static void parse_payload(const char *progname, const char *spec){
+  if(sscanf(spec, "fixed:%d", &dist_a) == 1){
+    dist_kind = DIST_FIXED;
+  } else if(sscanf(spec, "uniform:%d:%d", &dist_a, &dist_b) == 2 && dist_a <= dist_b){
+    dist_kind = DIST_UNIFORM;
+  } else if(sscanf(spec, "exp:%d", &dist_a) == 1){
+    dist_kind = DIST_EXP;
+  } else {
+    usage(progname);
+  }
+  if(dist_a < 1){ usage(progname); }
+}
+
+
+static void parse_args(int argc, char **argv){
+  for(int argn = 1; argn < argc; argn++){
+    const char *arg = argv[argn];
+    bool more = (argn + 1 < argc);
+
+    if(strcmp(arg, "-threads") == 0 && more){
+      nthreads = atoi(argv[++argn]);
+    } else if(strcmp(arg, "-duration") == 0 && more){
+      duration = atof(argv[++argn]);
+    } else if(strcmp(arg, "-interval") == 0 && more){
+      interval = atof(argv[++argn]);
+    } else if(strcmp(arg, "-extract") == 0 && more){
+      extract_ratio = atof(argv[++argn]);
+    } else if(strcmp(arg, "-payload") == 0 && more){
+      parse_payload(argv[0], argv[++argn]);
+    } else if(strcmp(arg, "-pool") == 0 && more){
+      pool_size = atoi(argv[++argn]);
+    } else if(strcmp(arg, "-images") == 0 && more){
+      image_dir = argv[++argn];
+    } else if(strcmp(arg, "-nolock") == 0){
+      use_lock = false;
+    } else if(strcmp(arg, "-log") == 0 && more){
+      log_path = argv[++argn];
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if(nthreads < 1 || duration <= 0 || interval <= 0 || pool_size < 1 ||
+     extract_ratio < 0 || extract_ratio > 1){
+    usage(argv[0]);
+  }
+}
+
+
+/* Draw a payload size; nothing bigger than the roomiest cover: */
+static int payload_size(std::mt19937 &rng){
+  int n;
+  switch(dist_kind){
+  case DIST_UNIFORM:
+    n = std::uniform_int_distribution<int>(dist_a, dist_b)(rng);
+    break;
+  case DIST_EXP:
+    n = 1 + (int)std::exponential_distribution<double>(1.0 / dist_a)(rng);
+    break;
+  default:
+    n = dist_a;
+    break;
+  }
+  if(n >= max_payload){ n = max_payload - 1; }
+  return (n < 1) ? 1 : n;
+}
+
+
+static void fill_message(std::mt19937 &rng, unsigned char *buf, int len){
+  for(int i = 0; i < len; i++){ buf[i] = (unsigned char)rng(); }
+}
+
+
+static uint64_t now_ns(){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+static long rss_kb(){
+  long pages = 0, resident = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if(fp != NULL){
+    if(fscanf(fp, "%ld %ld", &pages, &resident) != 2){ resident = 0; }
+    fclose(fp);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+
+static bool do_embed(std::mt19937 &rng, unsigned char *message){
+  int len = payload_size(rng);
+  fill_message(rng, message, len);
+
+  image_p im;
+  if(use_lock){
+    std::lock_guard<std::mutex> guard(jel_lock);
+    im = embed_message(message, len);
+  } else {
+    im = embed_message(message, len);
+  }
+  bool ok = (im != NULL);
+  free_image(im);
+  return ok;
+}
+
+
+static bool do_extract(std::mt19937 &rng){
+  const stego &s = the_pool[rng() % the_pool.size()];
+  unsigned char *out = NULL;
+  int len;
+
+  if(use_lock){
+    std::lock_guard<std::mutex> guard(jel_lock);
+    len = extract_message(&out, 0, s.body, s.body_length);
+  } else {
+    len = extract_message(&out, 0, s.body, s.body_length);
+  }
+  bool ok = (out != NULL) && (len == s.message_length) &&
+    (memcmp(out, s.message, len) == 0);
+  free(out);
+  return ok;
+}
+
+
+static void worker(int id, worker_stats *stats){
+  std::mt19937 rng(1000 + id);
+  std::uniform_real_distribution<double> coin(0.0, 1.0);
+  unsigned char *message = (unsigned char *)malloc(max_payload + 1);
+
+  while(!stopping.load(std::memory_order_relaxed)){
+    int op = (coin(rng) < extract_ratio) ? OP_EXTRACT : OP_EMBED;
+    uint64_t t0 = now_ns();
+    bool ok = (op == OP_EMBED) ? do_embed(rng, message) : do_extract(rng);
+    stats->latency[op].record(now_ns() - t0);
+    if(!ok){ stats->failures[op].fetch_add(1, std::memory_order_relaxed); }
+  }
+  free(message);
+}
+
+
+static bool prepare_pool(){
+  std::mt19937 rng(1);
+
+  for(int i = 0; i < pool_size; i++){
+    stego s;
+    s.message_length = payload_size(rng);
+    s.message = (unsigned char *)malloc(s.message_length);
+    fill_message(rng, s.message, s.message_length);
+
+    image_p im = embed_message(s.message, s.message_length);
+    if(im == NULL){
+      fprintf(stderr, "loadgen: could not embed %d bytes for the extract pool\n", s.message_length);
+      free(s.message);
+      return false;
+    }
+    size_t body_length;
+    s.body = take_image_bytes(im, &body_length);
+    s.body_length = (unsigned int)body_length;
+    the_pool.push_back(s);
+  }
+  return true;
+}
+
+
+static void print_ops(FILE *fp, const snapshot *snaps, const uint64_t *failures, double secs){
+  for(int k = 0; k < OP_COUNT; k++){
+    const snapshot &h = snaps[k];
+    fprintf(fp, "%s\"%s\": { \"count\": %llu, \"failures\": %llu, \"per_sec\": %.1f, "
+            "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f }",
+            k ? ", " : "", op_names[k], (unsigned long long)h.total, (unsigned long long)failures[k],
+            secs > 0 ? h.total / secs : 0.0, h.percentile(0.50), h.percentile(0.90),
+            h.percentile(0.99), h.percentile(0.999), h.percentile(1.0));
+  }
+}
+
+
+static void collect(std::vector<worker_stats *> &stats, snapshot *snaps, uint64_t *failures){
+  for(int k = 0; k < OP_COUNT; k++){
+    snaps[k].clear();
+    failures[k] = 0;
+    for(size_t w = 0; w < stats.size(); w++){
+      snaps[k].add(stats[w]->latency[k]);
+      failures[k] += stats[w]->failures[k].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+
+int main(int argc, char **argv){
+  parse_args(argc, argv);
+
+  set_images_verbose(false);
+  if(log_path != NULL){ set_jel_log(log_path); }
+
+  if(load_images(image_dir) == 0){
+    fprintf(stderr, "loadgen: no usable images in %s\n", image_dir);
+    return EXIT_FAILURE;
+  }
+  set_jel_embed_length(true);
+
+  max_payload = images_max_payload();
+
+  if(!prepare_pool()){ return EXIT_FAILURE; }
+
+  std::vector<worker_stats *> stats;
+  std::vector<std::thread> threads;
+  for(int i = 0; i < nthreads; i++){ stats.push_back(new worker_stats()); }
+
+  uint64_t start = now_ns();
+  for(int i = 0; i < nthreads; i++){ threads.emplace_back(worker, i, stats[i]); }
+
+  snapshot last[OP_COUNT], now[OP_COUNT];
+  uint64_t last_fail[OP_COUNT] = { 0, 0 }, now_fail[OP_COUNT], delta_fail[OP_COUNT];
+  uint64_t last_t = start;
+
+  while(true){
+    uint64_t next = last_t + (uint64_t)(interval * 1e9);
+    uint64_t end = start + (uint64_t)(duration * 1e9);
+    if(next > end){ next = end; }
+    uint64_t t_now = now_ns();
+    if(next > t_now){ std::this_thread::sleep_for(std::chrono::nanoseconds(next - t_now)); }
+
+    uint64_t t = now_ns();
+    collect(stats, now, now_fail);
+
+    snapshot delta[OP_COUNT];
+    for(int k = 0; k < OP_COUNT; k++){
+      delta[k] = now[k].since(last[k]);
+      delta_fail[k] = now_fail[k] - last_fail[k];
+      last[k] = now[k];
+      last_fail[k] = now_fail[k];
+    }
+
+    double secs = (t - last_t) / 1e9;
+    printf("{ \"t\": %.3f, \"rss_kb\": %ld, ", (t - start) / 1e9, rss_kb());
+    print_ops(stdout, delta, delta_fail, secs);
+    printf(" }\n");
+    fflush(stdout);
+    last_t = t;
+
+    if(t >= end){ break; }
+  }
+
+  stopping = true;
+  for(auto &th : threads){ th.join(); }
+
+  double secs = (now_ns() - start) / 1e9;
+  collect(stats, now, now_fail);
+
+  printf("{ \"summary\": true, \"threads\": %d, \"locked\": %s, \"seconds\": %.3f, \"rss_kb\": %ld, "
+         "\"extract_ratio\": %.2f, \"pool\": %d, ",
+         nthreads, use_lock ? "true" : "false", secs, rss_kb(), extract_ratio, pool_size);
+  print_ops(stdout, now, now_fail, secs);
+  printf(" }\n");
+
+  int failed = 0;
+  for(int k = 0; k < OP_COUNT; k++){ failed += (int)now_fail[k]; }
+
+  for(auto s : stats){ delete s; }
+  for(auto &s : the_pool){ free(s.body); free(s.message); }
+  unload_images();
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -8,13 +8,10 @@ static unsigned int construct_jpeg_body(unsigned char* data,  unsigned int data_
   if((bodyp != NULL) && (message_lengthp != NULL)){
     image_p cover = embed_message(data, data_length);
     if(cover != NULL){
-      unsigned int body_length = (unsigned int)cover->size;
-      *bodyp = cover->bytes;
+      size_t body_length;
       *message_lengthp = cover->message_length;
-      /* steal ownership of the bytes */
-      cover->bytes = NULL;
-      free_image(cover);
-      return body_length;
+      *bodyp = take_image_bytes(cover, &body_length);
+      return (unsigned int)body_length;
     } else {
       fprintf(stderr, "embed_message failed");
     }
@@ -43,15 +40,19 @@ static unsigned int deconstruct_jpeg_body(unsigned char *body, unsigned int body
 
 
 int main(int argc, char** argv){
-  bool embed_length;
-  
-  if(argc > 1){
-    embed_length = true;
-    fprintf(stderr, "embed_length: %d\n", embed_length);
-  } else {
-    embed_length = false;
-    fprintf(stderr, "embed_length: %d\n", embed_length);
+  bool embed_length = false;
+  int argn;
+
+  for(argn = 1; argn < argc; argn++){
+    if((strcmp(argv[argn], "-log") == 0) && (argn + 1 < argc)){
+      set_jel_log(argv[++argn]);
+    } else if(strcmp(argv[argn], "-verbose") == 0){
+      verbose = 1;
+    } else {
+      embed_length = true;
+    }
   }
+  fprintf(stderr, "embed_length: %d\n", embed_length);
 
   int inM = load_images("data/jpegs");
     
@@ -0,0 +1,556 @@
+/*
+ * jeltest.c - Regression tests for libjel, run by 'make check'.
+ *
+ * Each test embeds in, or extracts from, test/test.jpg through the
+ * public API and checks what comes back.
+ *
+ * Frames with bad trailers or lengths can't be made by jel_embed, so
+ * those tests build the frame here and embed it as a bare message:
+ * with no length and no ECC, message bytes go where a frame's would.
+ */
+
+#include <jel/jel.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "misc.h"
+
+#define MSGLEN   200
+#define OUTSIZE  (1 << 20)
+#define NCOVERS  3
+
+static unsigned char *cover;
+static int coverlen;
+static unsigned char message[MSGLEN];
+static int failures = 0;
+
+
+static void check(int ok, const char *what) {
+  printf("%s: %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok) failures++;
+}
+
+
+static unsigned char *read_file(const char *path, int *len) {
+  FILE *fp = fopen(path, "rb");
+  unsigned char *buf;
+  long n;
+
+  if (fp == NULL) return NULL;
+  fseek(fp, 0, SEEK_END);
+  n = ftell(fp);
+  rewind(fp);
+  buf = malloc(n);
+  if (buf == NULL || fread(buf, 1, n, fp) != (size_t) n) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  *len = (int) n;
+  return buf;
+}
+
+
+/* Text, so that it compresses: */
+static void make_message(void) {
+  static const char *words[] = { "jpeg ", "embedding ", "library ", "test ", "message " };
+  int i, k = 0;
+
+  for (i = 0; i < MSGLEN; i++) {
+    message[i] = (unsigned char) words[k % 5][i % 5];
+    if (i % 5 == 4) k = k * 7 + 3;
+  }
+}
+
+
+/* Extract from an open source and compare with 'want': */
+static int extracts(jel_config *cfg, const unsigned char *want, int len) {
+  unsigned char buf[4096];
+  int n = jel_extract(cfg, buf, sizeof(buf));
+
+  return n == len && memcmp(buf, want, len) == 0;
+}
+
+
+/* Embed 'message' in the cover with a memory destination: */
+static int embed_mem(jel_config *cfg, unsigned char *out) {
+  if (jel_set_mem_source(cfg, cover, coverlen) != 0 ||
+      jel_set_mem_dest(cfg, out, OUTSIZE) != 0 ||
+      jel_embed(cfg, message, MSGLEN) != MSGLEN)
+    return -1;
+  return cfg->jpeglen;
+}
+
+
+/*
+ * Callback source and destination.  The source hands out the image
+ * 'chunk' bytes at a time; the destination gives out 4K pieces of
+ * one big buffer, or, with 'fail_last', one buffer for the whole
+ * image and then fails the write that hands it back.
+ */
+typedef struct {
+  const unsigned char *data;
+  int len;
+  int pos;
+  int chunk;
+  int fail_last;
+} io_state;
+
+static int cb_read(void *ctx, const unsigned char **buf) {
+  io_state *io = (io_state *) ctx;
+  int n = io->len - io->pos;
+
+  if (n > io->chunk) n = io->chunk;
+  *buf = io->data + io->pos;
+  io->pos += n;
+  return n;
+}
+
+static unsigned char *cb_write(void *ctx, unsigned char *buf, int len, int *bufsize) {
+  io_state *io = (io_state *) ctx;
+  int room;
+
+  io->pos += len;
+  if (io->fail_last && len > 0) {
+    *bufsize = -1;
+    return NULL;
+  }
+  room = io->len - io->pos;
+  *bufsize = (io->fail_last || room < 4096) ? room : 4096;
+  return (unsigned char *) io->data + io->pos;
+}
+
+
+static void test_mem(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  int len = embed_mem(cfg, out);
+
+  jel_reset(cfg);
+  check(len > 0 && jel_set_mem_source(cfg, out, len) == 0 && extracts(cfg, message, MSGLEN),
+        "memory source and destination");
+  jel_free(cfg);
+}
+
+
+static void test_stdio(void) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  FILE *fp = tmpfile();
+  int ok;
+
+  ok = fp != NULL && jel_set_mem_source(cfg, cover, coverlen) == 0 &&
+    jel_set_fp_dest(cfg, fp) == 0 && jel_embed(cfg, message, MSGLEN) == MSGLEN;
+  jel_reset(cfg);
+  if (ok) {
+    fflush(fp);
+    rewind(fp);
+    ok = jel_set_fp_source(cfg, fp) == 0 && extracts(cfg, message, MSGLEN);
+  }
+  check(ok, "stdio source and destination");
+  if (fp) fclose(fp);
+  jel_free(cfg);
+}
+
+
+static void test_fd(void) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  FILE *fp = tmpfile();
+  int fd = fp ? fileno(fp) : -1;
+  int ok;
+
+  jel_setprop(cfg, JEL_PROP_IO_BUFSIZE, 1024);
+  ok = fd >= 0 && jel_set_mem_source(cfg, cover, coverlen) == 0 &&
+    jel_set_fd_dest(cfg, fd) == 0 && jel_embed(cfg, message, MSGLEN) == MSGLEN;
+  jel_reset(cfg);
+  ok = ok && lseek(fd, 0, SEEK_SET) == 0 &&
+    jel_set_fd_source(cfg, fd) == 0 && extracts(cfg, message, MSGLEN);
+  check(ok, "file descriptor source and destination");
+  if (fp) fclose(fp);
+  jel_free(cfg);
+}
+
+
+static void test_callback(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  io_state src = { cover, 0, 0, 1000, 0 };
+  io_state dst = { out, OUTSIZE, 0, 0, 0 };
+  int ok;
+
+  src.len = coverlen;
+  ok = jel_set_callback_source(cfg, cb_read, NULL, &src) == 0 &&
+    jel_set_callback_dest(cfg, cb_write, NULL, &dst) == 0 &&
+    jel_embed(cfg, message, MSGLEN) == MSGLEN && cfg->jpeglen == dst.pos;
+  jel_reset(cfg);
+
+  src.data = out;
+  src.len = dst.pos;
+  src.pos = 0;
+  ok = ok && jel_set_callback_source(cfg, cb_read, NULL, &src) == 0 &&
+    extracts(cfg, message, MSGLEN);
+  check(ok, "callback source and destination");
+
+  /* The last write is the only one, and it fails: */
+  jel_reset(cfg);
+  dst.pos = 0;
+  dst.fail_last = 1;
+  ok = jel_set_mem_source(cfg, cover, coverlen) == 0 &&
+    jel_set_callback_dest(cfg, cb_write, NULL, &dst) == 0 &&
+    jel_embed(cfg, message, MSGLEN) < 0;
+  check(ok, "callback destination reports a failed last write");
+  jel_free(cfg);
+}
+
+
+/* Push 'len' bytes of 'jpeg' in 'chunk'-byte pieces: */
+static int push_image(jel_config *cfg, const unsigned char *jpeg, int len, int chunk) {
+  int pos, n, ret = JEL_NEED_MORE_DATA;
+
+  if (jel_set_push_source(cfg) != 0) return -1;
+  for (pos = 0; pos < len && ret == JEL_NEED_MORE_DATA; pos += n) {
+    n = (len - pos < chunk) ? len - pos : chunk;
+    ret = jel_push_source(cfg, jpeg + pos, n);
+  }
+  if (ret == JEL_NEED_MORE_DATA) ret = jel_push_source_end(cfg);
+  return ret;
+}
+
+
+static void test_push(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  int len = embed_mem(cfg, out);
+  int i, ok = len > 0;
+
+  /* Several images on one config, so the push buffer is reused: */
+  for (i = 0; ok && i < 3; i++) {
+    jel_reset(cfg);
+    ok = push_image(cfg, out, len, 777 * (i + 1)) == 0 && extracts(cfg, message, MSGLEN);
+  }
+  check(ok, "push source");
+
+  /* Pushing to a memory source, or to none at all, is refused: */
+  jel_reset(cfg);
+  ok = jel_set_mem_source(cfg, out, len) == 0;
+  jel_reset(cfg);
+  ok = ok && jel_push_source(cfg, out, 100) == JEL_ERR_INVALIDARG &&
+    jel_push_source_end(cfg) == JEL_ERR_INVALIDARG;
+  jel_free(cfg);
+  cfg = jel_init(JEL_NLEVELS);
+  ok = ok && jel_push_source(cfg, out, 100) == JEL_ERR_INVALIDARG &&
+    cfg->jel_errno == JEL_ERR_INVALIDARG;
+  check(ok, "push without a push source is refused");
+  jel_free(cfg);
+}
+
+
+/*
+ * One config through every kind of source and destination in turn:
+ * each manager struct has its own size, so jel_reset must not leave
+ * one kind's struct in place for another.
+ */
+static void test_kinds(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  unsigned char *out2 = malloc(OUTSIZE);
+  io_state dst = { out2, OUTSIZE, 0, 0, 0 };
+  io_state src = { NULL, 0, 0, 4096, 0 };
+  FILE *fp = tmpfile();
+  int len, ok;
+
+  len = embed_mem(cfg, out);
+  jel_reset(cfg);
+  ok = len > 0 && out2 != NULL && fp != NULL &&
+    push_image(cfg, out, len, 4096) == 0 && extracts(cfg, message, MSGLEN);
+  jel_reset(cfg);
+  ok = ok && jel_set_mem_source(cfg, cover, coverlen) == 0 &&
+    jel_set_callback_dest(cfg, cb_write, NULL, &dst) == 0 &&
+    jel_embed(cfg, message, MSGLEN) == MSGLEN;
+  jel_reset(cfg);
+  src.data = out2;
+  src.len = dst.pos;
+  ok = ok && jel_set_callback_source(cfg, cb_read, NULL, &src) == 0 &&
+    extracts(cfg, message, MSGLEN);
+  jel_reset(cfg);
+  ok = ok && jel_set_mem_source(cfg, cover, coverlen) == 0 &&
+    jel_set_fd_dest(cfg, fileno(fp)) == 0 && jel_embed(cfg, message, MSGLEN) == MSGLEN;
+  jel_reset(cfg);
+  ok = ok && lseek(fileno(fp), 0, SEEK_SET) == 0 &&
+    jel_set_fd_source(cfg, fileno(fp)) == 0 && extracts(cfg, message, MSGLEN);
+  jel_reset(cfg);
+  ok = ok && jel_set_mem_source(cfg, out, len) == 0 && extracts(cfg, message, MSGLEN);
+  check(ok, "changing source and destination kinds across jel_reset");
+  if (fp) fclose(fp);
+  free(out2);
+  jel_free(cfg);
+}
+
+
+static void test_frame_round_trip(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  int len;
+
+  jel_setprop(cfg, JEL_PROP_COMPRESS, JEL_COMPRESS_LZF);
+  len = embed_mem(cfg, out);
+  jel_reset(cfg);
+  check(len > 0 && jel_set_mem_source(cfg, out, len) == 0 && extracts(cfg, message, MSGLEN),
+        "compressed message frame");
+  jel_free(cfg);
+}
+
+
+/*
+ * Embed 'body' behind a frame header as a bare message, then extract
+ * it as a frame.  'crc_delta' is added to the trailer.  Returns what
+ * jel_extract does.
+ */
+static int extract_frame(unsigned char *out, int flags, const unsigned char *body, int len,
+                         int unpacked, int crc_delta, unsigned char *plain, int maxlen) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  unsigned char raw[JEL_FRAME_MAX_HEADER + 1024 + JEL_FRAME_TRAILER];
+  unsigned short crc;
+  int n, ret = -1;
+
+  n = ijel_frame_header(raw, flags, 0, len, unpacked);
+  memcpy(raw + n, body, len);
+  crc = ijel_frame_crc(0, raw, n + len) + crc_delta;
+  raw[n + len] = crc & 0xFF;
+  raw[n + len + 1] = (crc >> 8) & 0xFF;
+  n += len + JEL_FRAME_TRAILER;
+
+  jel_setprop(cfg, JEL_PROP_EMBED_LENGTH, 0);
+  jel_setprop(cfg, JEL_PROP_ECC_METHOD, JEL_ECC_NONE);
+  if (jel_set_mem_source(cfg, cover, coverlen) == 0 &&
+      jel_set_mem_dest(cfg, out, OUTSIZE) == 0 && jel_embed(cfg, raw, n) == n) {
+    n = cfg->jpeglen;
+    jel_reset(cfg);
+    jel_setprop(cfg, JEL_PROP_EMBED_LENGTH, 1);
+    jel_setprop(cfg, JEL_PROP_FRAME, JEL_FRAME_V1);
+    if (jel_set_mem_source(cfg, out, n) == 0)
+      ret = jel_extract(cfg, plain, maxlen);
+  }
+  jel_free(cfg);
+  return ret;
+}
+
+
+static void test_frame_checks(unsigned char *out) {
+  unsigned char z[MSGLEN], plain[88 * MSGLEN];
+  int zlen = ijel_lzf_compress(message, MSGLEN, z, MSGLEN - 1);
+  int n;
+
+  n = extract_frame(out, 0, message, MSGLEN, 0, 0, plain, sizeof(plain));
+  check(n == MSGLEN && memcmp(plain, message, MSGLEN) == 0, "hand-built frame extracts");
+
+  check(extract_frame(out, 0, message, MSGLEN, 0, 1, plain, sizeof(plain)) == JEL_ERR_CHECKSUM,
+        "frame with a bad CRC is rejected");
+
+  check(zlen > 0 &&
+        extract_frame(out, JEL_FRAME_FLAG_LZF, z, zlen, MSGLEN, 0, plain, sizeof(plain)) == MSGLEN &&
+        memcmp(plain, message, MSGLEN) == 0,
+        "hand-built compressed frame extracts");
+
+  /* More than LZF could make from zlen bytes, though it would fit;
+   * the header itself is refused: */
+  n = extract_frame(out, JEL_FRAME_FLAG_LZF, z, zlen, 88 * zlen + 88, 0, plain, 88 * zlen + 88);
+  check(n < 0, "compressed frame claiming too long an unpacked length is rejected");
+
+  /* Plausible, but more than the caller's buffer: */
+  check(extract_frame(out, JEL_FRAME_FLAG_LZF, z, zlen, MSGLEN, 0, plain, MSGLEN - 1) ==
+        JEL_ERR_CHECKSUM,
+        "compressed frame longer than the buffer is rejected");
+}
+
+
+static void test_max_memory(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  jel_stats stats;
+  int len, spilled;
+
+  /* Far less than the coefficients need, so most go to a temp file: */
+  jel_setprop(cfg, JEL_PROP_MAX_MEMORY, 16);
+  len = embed_mem(cfg, out);
+  jel_get_stats(cfg, &stats);
+  spilled = stats.temp_bytes > 0;
+  jel_reset(cfg);
+  check(len > 0 && spilled && jel_set_mem_source(cfg, out, len) == 0 &&
+        jel_capacity(cfg) > MSGLEN && extracts(cfg, message, MSGLEN),
+        "temp-file coefficient store");
+  jel_free(cfg);
+}
+
+
+/* Compare every coefficient of two open sources: */
+static int same_coefficients(jel_config *a, jel_config *b) {
+  int ci, row, col, k;
+
+  for (ci = 0; ci < a->srcinfo.num_components; ci++) {
+    jpeg_component_info *comp = a->srcinfo.comp_info + ci;
+    for (row = 0; row < (int) comp->height_in_blocks; row++) {
+      JBLOCKARRAY ra = (*a->srcinfo.mem->access_virt_barray)
+        ((j_common_ptr) &a->srcinfo, a->coefs[ci], row, 1, FALSE);
+      JBLOCKARRAY rb = (*b->srcinfo.mem->access_virt_barray)
+        ((j_common_ptr) &b->srcinfo, b->coefs[ci], row, 1, FALSE);
+      for (col = 0; col < (int) comp->width_in_blocks; col++)
+        for (k = 0; k < DCTSIZE2; k++)
+          if (ra[0][col][k] != rb[0][col][k]) return 0;
+    }
+  }
+  return 1;
+}
+
+
+static void test_restarts(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  jel_config *one = jel_init(JEL_NLEVELS);
+  int len, ok;
+
+  jel_setprop(cfg, JEL_PROP_RESTART_ROWS, 1);
+  len = embed_mem(cfg, out);
+  jel_reset(cfg);
+
+  /* Bands on four threads against libjpeg on one: */
+  jel_setprop(cfg, JEL_PROP_DECODE_THREADS, 4);
+  ok = len > 0 && jel_set_mem_source(cfg, out, len) == 0 &&
+    jel_set_mem_source(one, out, len) == 0 &&
+    cfg->srcinfo.restart_interval > 0 && same_coefficients(cfg, one) &&
+    extracts(cfg, message, MSGLEN);
+  check(ok, "restart interval decoding on several threads");
+  jel_free(one);
+  jel_free(cfg);
+}
+
+
+/*
+ * Multiple covers.  Each gets its own ECC block length, and the
+ * message is longer than any one cover holds.  Extraction gets the
+ * stego images in reverse order, then without one of them.
+ */
+static void test_multi(void) {
+  static const int blocklens[NCOVERS] = { 40, 100, 200 };
+  jel_config *cfgs[NCOVERS];
+  unsigned char *outs[NCOVERS], *msg, *got;
+  int lens[NCOVERS];
+  int i, len, total = 0, ok = 1;
+
+  for (i = 0; i < NCOVERS; i++) {
+    cfgs[i] = jel_init(JEL_NLEVELS);
+    outs[i] = malloc(OUTSIZE);
+    jel_setprop(cfgs[i], JEL_PROP_ECC_BLOCKLEN, blocklens[i]);
+    ok = ok && outs[i] != NULL && jel_set_mem_source(cfgs[i], cover, coverlen) == 0 &&
+      jel_set_mem_dest(cfgs[i], outs[i], OUTSIZE) == 0;
+    total += jel_capacity(cfgs[i]) - JEL_SHARD_HEADER;
+  }
+
+  len = jel_capacity(cfgs[0]) + MSGLEN;
+  msg = malloc(total + 1);
+  got = malloc(total + 1);
+  ok = ok && msg != NULL && got != NULL;
+  for (i = 0; ok && i <= total; i++) msg[i] = message[i % MSGLEN] ^ (i / MSGLEN);
+
+  ok = ok && jel_embed_multi(cfgs, NCOVERS, msg, len) == len;
+  for (i = 0; i < NCOVERS; i++) {
+    lens[i] = cfgs[i]->jpeglen;
+    jel_reset(cfgs[i]);
+  }
+
+  /* cfgs[i] reads image NCOVERS-1-i, with that cover's settings: */
+  for (i = 0; ok && i < NCOVERS; i++) {
+    int j = NCOVERS - 1 - i;
+    jel_setprop(cfgs[i], JEL_PROP_ECC_BLOCKLEN, blocklens[j]);
+    ok = jel_set_mem_source(cfgs[i], outs[j], lens[j]) == 0;
+  }
+  ok = ok && jel_extract_multi(cfgs, NCOVERS, got, total + 1) == len &&
+    memcmp(got, msg, len) == 0;
+  check(ok, "multi-cover round trip, mixed ECC block lengths, covers reversed");
+
+  check(ok && jel_extract_multi(cfgs + 1, NCOVERS - 1, got, total + 1) == JEL_ERR_SHARD,
+        "multi-cover extract with a shard missing");
+
+  /* One byte more than the covers hold between them: */
+  for (i = 0; i < NCOVERS; i++) {
+    jel_reset(cfgs[i]);
+    jel_setprop(cfgs[i], JEL_PROP_ECC_BLOCKLEN, blocklens[i]);
+    ok = ok && jel_set_mem_source(cfgs[i], cover, coverlen) == 0 &&
+      jel_set_mem_dest(cfgs[i], outs[i], OUTSIZE) == 0;
+  }
+  check(ok && jel_embed_multi(cfgs, NCOVERS, msg, total + 1) == JEL_ERR_NOSPACE,
+        "multi-cover embed of too long a message");
+
+  for (i = 0; i < NCOVERS; i++) {
+    jel_free(cfgs[i]);
+    free(outs[i]);
+  }
+  free(msg);
+  free(got);
+}
+
+
+/*
+ * Candidate settings for an image embedded with seed 77 and 100-byte
+ * ECC blocks: a wrong seed, a wrong block length, an impossible block
+ * length and, last, the right settings.
+ */
+static void test_hypotheses(unsigned char *out) {
+  jel_config *cfg = jel_init(JEL_NLEVELS);
+  jel_hypothesis hyps[4];
+  unsigned char got[4096];
+  int i, len, ok;
+
+  jel_setprop(cfg, JEL_PROP_ECC_BLOCKLEN, 100);
+  jel_setprop(cfg, JEL_PROP_FREQ_SEED, 77);
+  jel_setprop(cfg, JEL_PROP_NFREQS, 8);
+  len = embed_mem(cfg, out);
+  jel_free(cfg);
+
+  memset(hyps, 0, sizeof(hyps));
+  for (i = 0; i < 4; i++) {
+    hyps[i].seed = 77;
+    hyps[i].nfreqs = 8;
+    hyps[i].ecc_method = JEL_ECC_RSCODE;
+    hyps[i].ecc_blocklen = 100;
+  }
+  hyps[0].seed = 5;
+  hyps[1].ecc_blocklen = 40;
+  hyps[2].ecc_blocklen = JEL_ECC_MAX_BLOCKLEN + 1;
+
+  cfg = jel_init(JEL_NLEVELS);
+  ok = len > 0 && jel_set_mem_source(cfg, out, len) == 0 &&
+    jel_extract_hypotheses(cfg, hyps, 4, got, sizeof(got)) == 3 &&
+    hyps[3].result == MSGLEN && memcmp(got, message, MSGLEN) == 0;
+  check(ok, "extraction hypotheses pick the right seed and block length");
+  check(ok && hyps[0].result <= 0 && hyps[1].result <= 0 && hyps[2].result == JEL_ERR_INVALIDARG,
+        "extraction hypotheses skip an impossible ECC block length");
+  jel_free(cfg);
+}
+
+
+int main(int argc, char **argv) {
+  const char *srcdir = getenv("srcdir");
+  char path[4096];
+  unsigned char *out;
+
+  snprintf(path, sizeof(path), "%s/test/test.jpg", srcdir ? srcdir : ".");
+  cover = read_file(path, &coverlen);
+  out = malloc(OUTSIZE);
+  if (cover == NULL || out == NULL) {
+    fprintf(stderr, "jeltest: can't read %s\n", path);
+    return 1;
+  }
+  make_message();
+
+  test_mem(out);
+  test_stdio();
+  test_fd();
+  test_callback(out);
+  test_push(out);
+  test_kinds(out);
+  test_frame_round_trip(out);
+  test_frame_checks(out);
+  test_max_memory(out);
+  test_restarts(out);
+  test_multi();
+  test_hypotheses(out);
+
+  free(out);
+  free(cover);
+  printf("%d failure%s\n", failures, failures == 1 ? "" : "s");
+  return failures ? 1 : 0;
+}
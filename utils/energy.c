@@ -20,7 +20,7 @@
 int
 main (int argc, char **argv)
 {
-  int ijel_print_energies(jel_config*);
+  int ijel_print_energies(jel_config*, FILE*);
   jel_config *jel;
   FILE * input_file;
   int  ret;
@@ -33,12 +33,6 @@ main (int argc, char **argv)
 
   jel = jel_init(JEL_NLEVELS);
 
-  ret = jel_open_log(jel, "/tmp/wcap.log");
-  if(ret != 0){
-    fprintf(stderr, "Error - exiting (can't open log file)\n");
-    exit(EXIT_FAILURE);
-  }
-
   input_file = fopen(argv[1], "rb");
   ret = jel_set_fp_source(jel, input_file);
 
@@ -54,9 +48,8 @@ main (int argc, char **argv)
 
   //ecc_method = jel_getprop(jel, JEL_PROP_ECC_METHOD);
 
-  ijel_print_energies(jel);
+  ijel_print_energies(jel, stdout);
 
-  jel_close_log(jel);
   if (input_file != NULL && input_file != stdin) fclose(input_file);
 
   exit(0);
@@ -0,0 +1,1001 @@
+/*
+ * jeld.c - embed, extract and capacity service on a Unix-domain
+ * socket.
+ *
+ * Short-lived callers spend most of their time starting a process
+ * and setting up libjel.  jeld does that once: it listens on a socket
+ * and serves requests on worker threads, each of which keeps one
+ * jel_config and jel_resets it between requests.  A connection can
+ * carry any number of requests, one after another.
+ *
+ * Every request starts with a header of nine 32-bit unsigned words in
+ * network byte order:
+ *
+ *   magic    JELD_MAGIC ("JEL1")
+ *   op       JELD_CAPACITY, JELD_EMBED, JELD_EXTRACT or JELD_STATS
+ *   flags    JELD_FD_IN, JELD_FD_OUT, JELD_NOLENGTH, JELD_NOECC,
+ *            JELD_FRAME, JELD_COMPRESS
+ *   seed     as wedge -seed; 0 for none
+ *   ecclen   as wedge -ecc, JEL_ECC_MIN_BLOCKLEN to JEL_ECC_MAX_BLOCKLEN;
+ *            0 for the default
+ *   quality  as wedge -quality, 1 to 100; 0 keeps the cover's
+ *   ethresh  as wedge -ethresh
+ *   jpeglen  bytes of JPEG following the header
+ *   msglen   embed: bytes of message following the JPEG; extract:
+ *            the message length, with JELD_NOLENGTH
+ *
+ * With JELD_FD_IN the JPEG is read from a descriptor passed with the
+ * header (SCM_RIGHTS) instead, and jpeglen is 0.  It is read, never
+ * mapped: the client owns the file and could truncate it under us.
+ * With JELD_FD_OUT the result (the new JPEG,
+ * or the message) is written to the next descriptor passed instead of
+ * following the reply.  Passed descriptors are used non-blocking, and
+ * one that stays unready for -timeout seconds fails the request with
+ * JEL_ERR_MSGIO; they are closed once the request is done.
+ *
+ * Every reply is four words, followed by 'datalen' bytes:
+ *
+ *   magic    JELD_MAGIC
+ *   status   0, or a negative JEL_ERR_* code (-1 for a libjpeg error)
+ *   value    capacity, JPEG length or message length
+ *   datalen  bytes of JPEG or message (or, for JELD_STATS, counter
+ *            lines of the form "name value")
+ *
+ * A request whose seed, ecclen, quality or ethresh is out of range
+ * gets JEL_ERR_INVALIDARG.  A header that can't be parsed, one that
+ * comes with more than two descriptors, a request larger than
+ * -maxbytes, or a client that sends nothing, or reads nothing, for
+ * -timeout seconds ends the connection.
+ */
+
+#include <jel/jel.h>
+#include <ctype.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
+
+#define JELD_VERSION "1.0.0.0"
+
+#define JELD_MAGIC     0x4a454c31	/* "JEL1" */
+
+#define JELD_CAPACITY  1
+#define JELD_EMBED     2
+#define JELD_EXTRACT   3
+#define JELD_STATS     4
+#define JELD_NOPS      5
+
+#define JELD_FD_IN     0x01	/* JPEG from a passed descriptor */
+#define JELD_FD_OUT    0x02	/* Result to a passed descriptor */
+#define JELD_NOLENGTH  0x04	/* As wedge -nolength */
+#define JELD_NOECC     0x08	/* As wedge -noecc */
+#define JELD_FRAME     0x10	/* As wedge -frame */
+#define JELD_COMPRESS  0x20	/* As wedge -compress */
+
+#define JELD_HEADER    9	/* Words in a request header */
+#define JELD_REPLY     4	/* Words in a reply header */
+#define JELD_CHUNK     65536	/* Output buffer growth, in bytes. */
+#define JELD_BACKLOG   64
+
+
+static const char * progname;		/* program name for error messages */
+static char * logfilename = NULL;	/* for -log switch */
+static int nthreads = 0;		/* Workers; 0 means one per processor. */
+static long maxbytes = 64L << 20;	/* Largest request, in bytes */
+static int timeout = 30;		/* Seconds a client may leave a worker waiting */
+static int verbose = 0;
+
+static volatile sig_atomic_t stopping = 0;
+
+
+/* The counters, for JELD_STATS and the summary at exit: */
+static const char * op_names[JELD_NOPS] = { "?", "capacity", "embed", "extract", "stats" };
+
+static struct {
+  long long connections;
+  long long requests[JELD_NOPS];
+  long long failures[JELD_NOPS];
+  long long busy_ns[JELD_NOPS];
+  long long bytes_in;
+  long long bytes_out;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+#endif
+} counters;
+
+
+/* A buffer that is kept from one request to the next: */
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t size;
+  int failed;
+} jeld_buffer;
+
+
+/* One worker, with its warm context: */
+typedef struct {
+  jel_config *jel;
+  int blocklen;			/* The config's default ECC block length */
+  int conn;			/* Connection being served, or -1 */
+  jeld_buffer in;		/* Inline JPEG and message */
+  jeld_buffer fdin;		/* JPEG read from a descriptor */
+  jeld_buffer out;		/* Result */
+#ifdef HAVE_LIBPTHREAD
+  pthread_t thread;
+#endif
+} jeld_worker;
+
+
+/* Accepted connections waiting for a worker: */
+static struct {
+  int fds[JELD_BACKLOG];
+  int head, count;
+  int closed;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+#endif
+} queue;
+
+
+LOCAL(void)
+usage (void)
+/* complain about bad command line */
+{
+  fprintf(stderr, "usage: %s [switches] socket\n", progname);
+
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -threads N     Worker threads, each with its own context\n");
+  fprintf(stderr, "                 (default=one per processor).\n");
+  fprintf(stderr, "  -maxbytes N    Refuse requests larger than N bytes (Nm: N Mb; default=64m).\n");
+  fprintf(stderr, "  -timeout N     Drop a client that sends or reads nothing for N seconds (default=30; 0: never).\n");
+  fprintf(stderr, "  -log <file>    Append log output to file.\n");
+  fprintf(stderr, "  -verbose  or  -debug   Emit debug output (to stderr unless -log is given)\n");
+  fprintf(stderr, "The request format is described at the top of jeld.c.\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static boolean
+keymatch (char * arg, const char * keyword, int minchars)
+{
+  register int ca, ck;
+  register int nmatched = 0;
+
+  while ((ca = *arg++) != '\0') {
+    if ((ck = *keyword++) == '\0')
+      return FALSE;		/* arg longer than keyword, no good */
+    if (isupper(ca))		/* force arg to lcase (assume ck is already) */
+      ca = tolower(ca);
+    if (ca != ck)
+      return FALSE;		/* no good */
+    nmatched++;			/* count matched characters */
+  }
+  /* reached end of argument; fail if it's too short for unique abbrev */
+  if (nmatched < minchars)
+    return FALSE;
+  return TRUE;			/* A-OK */
+}
+
+
+LOCAL(int)
+parse_switches (int argc, char **argv)
+/* Parse optional switches.
+ * Returns argv[] index of first file-name argument (== argc if none).
+ */
+{
+  int argn;
+  char * arg;
+  char ch = 'x';
+
+  for (argn = 1; argn < argc; argn++) {
+    arg = argv[argn];
+    if (*arg != '-') break;
+    arg++;			/* advance past switch marker character */
+
+    if (keymatch(arg, "debug", 1) || keymatch(arg, "verbose", 1)) {
+      /* Enable debug printouts. */
+      verbose = 1;
+
+    } else if (keymatch(arg, "log", 3)) {
+      /* Log file name. */
+      if (++argn >= argc)	/* advance to next argument */
+	usage();
+      logfilename = argv[argn];
+
+    } else if (keymatch(arg, "threads", 2)) {
+      /* Worker threads */
+      if (++argn >= argc)
+	usage();
+      if (sscanf(argv[argn], "%d", &nthreads) != 1 || nthreads < 0)
+	usage();
+
+    } else if (keymatch(arg, "timeout", 2)) {
+      /* Receive timeout */
+      if (++argn >= argc)
+	usage();
+      if (sscanf(argv[argn], "%d", &timeout) != 1 || timeout < 0)
+	usage();
+
+    } else if (keymatch(arg, "maxbytes", 4)) {
+      /* Request size limit */
+      if (++argn >= argc)
+	usage();
+      if (sscanf(argv[argn], "%ld%c", &maxbytes, &ch) < 1 || maxbytes <= 0)
+	usage();
+      if (ch == 'm' || ch == 'M') maxbytes <<= 20;
+
+    } else {
+      usage();			/* bogus switch */
+    }
+  }
+
+  return argn;			/* return index of next arg (file name) */
+}
+
+
+static long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+static void counters_lock(void) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&counters.lock);
+#endif
+}
+
+
+static void counters_unlock(void) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&counters.lock);
+#endif
+}
+
+
+static void count_request(int op, int status, long long ns, long in, long out) {
+  counters_lock();
+  counters.requests[op]++;
+  if (status < 0) counters.failures[op]++;
+  counters.busy_ns[op] += ns;
+  counters.bytes_in += in;
+  counters.bytes_out += out;
+  counters_unlock();
+}
+
+
+/* The counters as "name value" lines; returns the length: */
+static int format_counters(char *buf, int size) {
+  int op, n;
+
+  counters_lock();
+  n = snprintf(buf, size, "connections %lld\nbytes_in %lld\nbytes_out %lld\n",
+               counters.connections, counters.bytes_in, counters.bytes_out);
+  for (op = 1; op < JELD_NOPS && n < size; op++)
+    n += snprintf(buf + n, size - n, "%s %lld\n%s_failures %lld\n%s_busy_us %lld\n",
+                  op_names[op], counters.requests[op],
+                  op_names[op], counters.failures[op],
+                  op_names[op], counters.busy_ns[op] / 1000);
+  counters_unlock();
+  return n < size ? n : size - 1;
+}
+
+
+static int reserve(jeld_buffer *b, size_t want) {
+  unsigned char *p;
+  size_t size;
+
+  if (b->size - b->len >= want) return 0;
+  size = b->size ? b->size : JELD_CHUNK;
+  while (size - b->len < want) size *= 2;
+  p = realloc(b->data, size);
+  if (p == NULL) {
+    b->failed = 1;
+    return -1;
+  }
+  b->data = p;
+  b->size = size;
+  return 0;
+}
+
+
+/* jel_write_callback: libjpeg writes straight into the output buffer */
+static unsigned char *dest_write(void *ctx, unsigned char *buf, int len, int *bufsize) {
+  jeld_buffer *b = (jeld_buffer *) ctx;
+
+  b->len += len;
+  if (reserve(b, JELD_CHUNK) < 0) return NULL;
+  *bufsize = (b->size - b->len > INT_MAX) ? INT_MAX : (int) (b->size - b->len);
+  return b->data + b->len;
+}
+
+
+/* jel_message_writer: */
+static int message_write(void *ctx, const unsigned char *buf, int len) {
+  jeld_buffer *b = (jeld_buffer *) ctx;
+
+  if (reserve(b, len) < 0) return -1;
+  memcpy(b->data + b->len, buf, len);
+  b->len += len;
+  return len;
+}
+
+
+static int read_full(int fd, void *buf, size_t n) {
+  unsigned char *p = (unsigned char *) buf;
+  ssize_t k;
+
+  while (n > 0) {
+    k = read(fd, p, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return -1;
+    p += k;
+    n -= k;
+  }
+  return 0;
+}
+
+
+static int write_full(int fd, const void *buf, size_t n) {
+  const unsigned char *p = (const unsigned char *) buf;
+  ssize_t k;
+
+  while (n > 0) {
+    k = send(fd, p, n, MSG_NOSIGNAL);
+    if (k < 0 && errno == ENOTSOCK) k = write(fd, p, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return -1;
+    p += k;
+    n -= k;
+  }
+  return 0;
+}
+
+
+/*
+ * Waits for a passed descriptor to be ready for 'events', for up to
+ * -timeout seconds.  Returns 0 when it is, -1 when the wait expires
+ * or fails.
+ */
+static int wait_fd(int fd, short events) {
+  struct pollfd pfd;
+  int k;
+
+  pfd.fd = fd;
+  pfd.events = events;
+  do k = poll(&pfd, 1, timeout > 0 ? timeout * 1000 : -1);
+  while (k < 0 && errno == EINTR);
+  return k > 0 ? 0 : -1;
+}
+
+
+/*
+ * A passed descriptor is the client's, and nothing says it will ever
+ * be read or written, so it is used non-blocking.  Returns the old
+ * file status flags, to be put back afterwards, or -1.
+ */
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+  return flags;
+}
+
+
+/* write_full for a passed, non-blocking descriptor: */
+static int write_fd(int fd, const void *buf, size_t n) {
+  const unsigned char *p = (const unsigned char *) buf;
+  ssize_t k;
+
+  while (n > 0) {
+    k = send(fd, p, n, MSG_NOSIGNAL);
+    if (k < 0 && errno == ENOTSOCK) k = write(fd, p, n);
+    if (k < 0 && errno == EINTR) continue;
+    if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (wait_fd(fd, POLLOUT) < 0) return -1;
+      continue;
+    }
+    if (k <= 0) return -1;
+    p += k;
+    n -= k;
+  }
+  return 0;
+}
+
+
+static void close_fds(int *fds, int *nfds) {
+  int i;
+
+  for (i = 0; i < *nfds; i++) close(fds[i]);
+  *nfds = 0;
+}
+
+
+/*
+ * Reads a request header and any descriptors passed with it.
+ * Returns 0, or -1 at the end of the connection (or a timeout), with
+ * any descriptors that came with a partial header closed.
+ */
+static int read_header(int conn, uint32_t *hdr, int *fds, int *nfds) {
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  ssize_t k;
+  int i, n;
+
+  *nfds = 0;
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = hdr;
+  iov.iov_len = JELD_HEADER * sizeof(uint32_t);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  do k = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  while (k < 0 && errno == EINTR);
+  if (k <= 0) return -1;
+
+  for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+    n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (i = 0; i < n; i++) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+      if (*nfds < 2) fds[(*nfds)++] = fd;
+      else close(fd);
+    }
+  }
+
+  /* More descriptors than a request can use is a protocol error: */
+  if (msg.msg_flags & MSG_CTRUNC) {
+    close_fds(fds, nfds);
+    return -1;
+  }
+
+  /* The rest of the header, if it came in pieces: */
+  if (read_full(conn, (unsigned char *) hdr + k, iov.iov_len - k) < 0) {
+    close_fds(fds, nfds);
+    return -1;
+  }
+
+  for (i = 0; i < JELD_HEADER; i++) hdr[i] = ntohl(hdr[i]);
+  return 0;
+}
+
+
+/*
+ * The JPEG of a JELD_FD_IN request, read into a buffer of the
+ * worker's.  A regular file's size only sizes the buffer; the client
+ * may change the file while we read it.  'fd' is non-blocking.
+ */
+static unsigned char *read_jpeg_fd(jeld_worker *w, int fd, long *len) {
+  struct stat st;
+  ssize_t k;
+
+  w->fdin.len = 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    if (st.st_size > maxbytes) return NULL;
+    if (reserve(&w->fdin, (size_t) st.st_size + 1) < 0) return NULL;
+  }
+
+  for (;;) {
+    if (reserve(&w->fdin, JELD_CHUNK) < 0) return NULL;
+    k = read(fd, w->fdin.data + w->fdin.len, w->fdin.size - w->fdin.len);
+    if (k < 0 && errno == EINTR) continue;
+    if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (wait_fd(fd, POLLIN) < 0) return NULL;
+      continue;
+    }
+    if (k < 0) return NULL;
+    if (k == 0) break;
+    w->fdin.len += k;
+    if ((long) w->fdin.len > maxbytes) return NULL;
+  }
+  *len = w->fdin.len;
+  return w->fdin.data;
+}
+
+
+/* JEL_ERR_INVALIDARG if a setting in the header is out of range: */
+static int check_options(uint32_t *hdr) {
+  if (hdr[3] > INT_MAX || hdr[6] > INT_MAX ||
+      (hdr[4] != 0 && (hdr[4] < JEL_ECC_MIN_BLOCKLEN || hdr[4] > JEL_ECC_MAX_BLOCKLEN)) ||
+      hdr[5] > 100)
+    return JEL_ERR_INVALIDARG;
+  return 0;
+}
+
+
+/*
+ * The request's settings.  The config keeps properties across
+ * jel_reset, so every one is set for every request:
+ */
+static void set_request_options(jeld_worker *w, uint32_t *hdr) {
+  jel_config *jel = w->jel;
+  uint32_t flags = hdr[2];
+
+  jel_setprop(jel, JEL_PROP_ECC_METHOD, (flags & JELD_NOECC) ? JEL_ECC_NONE : JEL_ECC_RSCODE);
+  jel_setprop(jel, JEL_PROP_ECC_BLOCKLEN, hdr[4] > 0 ? (int) hdr[4] : w->blocklen);
+  jel_setprop(jel, JEL_PROP_ENERGY_THRESHOLD, (int) hdr[6]);
+  jel_setprop(jel, JEL_PROP_COMPRESS, (flags & JELD_COMPRESS) ? JEL_COMPRESS_LZF : JEL_COMPRESS_NONE);
+  if (!(flags & JELD_COMPRESS))
+    jel_setprop(jel, JEL_PROP_FRAME, (flags & JELD_FRAME) ? JEL_FRAME_V1 : JEL_FRAME_NONE);
+  jel_setprop(jel, JEL_PROP_EMBED_LENGTH, !(flags & JELD_NOLENGTH));
+  jel_setprop(jel, JEL_PROP_FREQ_SEED, (int) hdr[3]);
+  jel_setprop(jel, JEL_PROP_NFREQS, 0);
+}
+
+
+/* ... and, as wedge sets them, those that depend on the source's
+ * quant tables once the source and destination are open: */
+static void set_image_options(jeld_worker *w, uint32_t *hdr) {
+  jel_config *jel = w->jel;
+
+  jel_setprop(jel, JEL_PROP_QUALITY, hdr[5] > 0 ? (int) hdr[5] : JEL_QUALITY_COVER);
+
+  if (hdr[3] > 0) jel_setprop(jel, JEL_PROP_NFREQS, 8);
+}
+
+
+/*
+ * Runs one request on the worker's context.  The result is left in
+ * w->out; returns the reply's value, or a negative error code.
+ */
+static int run_request(jeld_worker *w, uint32_t *hdr, unsigned char *jpeg, long jpeglen,
+                       unsigned char *msg, long msglen) {
+  jel_config *jel = w->jel;
+  jel_stats stats;
+  int op = hdr[1];
+  int ret, maxlen;
+
+  w->out.len = 0;
+  w->out.failed = 0;
+
+  set_request_options(w, hdr);
+  ret = jel_set_mem_source(jel, jpeg, (int) jpeglen);
+  if (ret == 0 && op == JELD_EMBED)
+    ret = jel_set_callback_dest(jel, dest_write, NULL, &w->out);
+  if (ret != 0) return ret < 0 ? ret : -1;
+  set_image_options(w, hdr);
+
+  switch (op) {
+  case JELD_CAPACITY:
+    return jel_capacity(jel);
+
+  case JELD_EMBED:
+    ret = jel_embed(jel, msg, (int) msglen);
+    if (ret < 0) return ret;
+    /* With ECC a message that was cut short still reports its whole
+     * length, but the stats count what was read: */
+    jel_get_stats(jel, &stats);
+    if (ret < msglen || (!(hdr[2] & JELD_COMPRESS) && stats.msg_bytes < msglen))
+      return JEL_ERR_NOSPACE;
+    if (w->out.failed) return JEL_ERR_MSGIO;
+    return (int) w->out.len;
+
+  case JELD_EXTRACT:
+    /* As unwedge does: */
+    maxlen = jel_raw_capacity(jel);
+    if ((hdr[2] & JELD_NOLENGTH) && hdr[8] < (uint32_t) maxlen) maxlen = (int) hdr[8];
+    /* A compressed frame unpacks to at most 88 bytes per byte: */
+    if ((hdr[2] & (JELD_FRAME | JELD_COMPRESS)) && !(hdr[2] & JELD_NOLENGTH) && maxlen > 0)
+      maxlen = (maxlen > INT_MAX / 88) ? INT_MAX : maxlen * 88;
+    ret = jel_extract_stream(jel, message_write, &w->out, maxlen);
+    return ret;
+  }
+  return JEL_ERR_INVALIDARG;
+}
+
+
+/*
+ * Serves one request.  Returns 0 to go on, -1 to end the connection.
+ */
+static int serve_request(jeld_worker *w, int conn) {
+  uint32_t hdr[JELD_HEADER], reply[JELD_REPLY];
+  int fds[2], nfds, fdn = 0, flags;
+  int op, status = 0, value = 0, keep = 0;
+  unsigned char *jpeg = NULL, *msg = NULL;
+  long jpeglen = 0, msglen = 0;
+  const unsigned char *data = NULL;
+  size_t datalen = 0;
+  char text[1024];
+  long long t0;
+
+  if (read_header(conn, hdr, fds, &nfds) < 0) return -1;
+  t0 = now_ns();
+  op = hdr[1];
+
+  if (hdr[0] != JELD_MAGIC || op < 1 || op >= JELD_NOPS ||
+      (hdr[2] & JELD_FD_IN && hdr[7] != 0) ||
+      (op == JELD_EMBED ? hdr[8] : 0) + (long) hdr[7] > maxbytes) {
+    status = JEL_ERR_INVALIDARG;
+    goto reply;
+  }
+
+  /* The inline data, even if it turns out to be unusable: */
+  jpeglen = hdr[7];
+  msglen = (op == JELD_EMBED) ? hdr[8] : 0;
+  w->in.len = 0;
+  if (reserve(&w->in, jpeglen + msglen) < 0 ||
+      read_full(conn, w->in.data, jpeglen + msglen) < 0) {
+    status = JEL_ERR_MSGIO;
+    goto reply;
+  }
+  keep = 1;
+  jpeg = w->in.data;
+  msg = w->in.data + jpeglen;
+
+  if (op == JELD_STATS) {
+    value = format_counters(text, sizeof(text));
+    data = (const unsigned char *) text;
+    datalen = value;
+    goto reply;
+  }
+
+  status = check_options(hdr);
+  if (status < 0) goto reply;
+
+  if (hdr[2] & JELD_FD_IN) {
+    if (fdn >= nfds) {
+      status = JEL_ERR_INVALIDFD;
+      goto reply;
+    }
+    flags = set_nonblocking(fds[fdn]);
+    jpeg = (flags < 0) ? NULL : read_jpeg_fd(w, fds[fdn], &jpeglen);
+    if (flags >= 0) fcntl(fds[fdn], F_SETFL, flags);
+    fdn++;
+    if (jpeg == NULL) {
+      status = JEL_ERR_MSGIO;
+      goto reply;
+    }
+  }
+
+  status = run_request(w, hdr, jpeg, jpeglen, msg, msglen);
+  jel_reset(w->jel);
+  if (status < 0) goto reply;
+
+  value = status;
+  status = 0;
+  if (op != JELD_CAPACITY) {
+    data = w->out.data;
+    datalen = w->out.len;
+  }
+
+  if (hdr[2] & JELD_FD_OUT && datalen > 0) {
+    if (fdn >= nfds) status = JEL_ERR_INVALIDFD;
+    else {
+      flags = set_nonblocking(fds[fdn]);
+      if (flags < 0 || write_fd(fds[fdn], data, datalen) < 0) status = JEL_ERR_MSGIO;
+      if (flags >= 0) fcntl(fds[fdn], F_SETFL, flags);
+    }
+    datalen = 0;
+  }
+
+ reply:
+  close_fds(fds, &nfds);
+
+  if (status < 0) {
+    value = 0;
+    datalen = 0;
+  }
+  reply[0] = htonl(JELD_MAGIC);
+  reply[1] = htonl((uint32_t) status);
+  reply[2] = htonl((uint32_t) value);
+  reply[3] = htonl((uint32_t) datalen);
+
+  if (op > 0 && op < JELD_NOPS)
+    count_request(op, status, now_ns() - t0, jpeglen + msglen, (long) datalen);
+  if (verbose)
+    fprintf(stderr, "%s: %s status %d value %d\n", progname,
+            (op > 0 && op < JELD_NOPS) ? op_names[op] : "?", status, value);
+
+  if (write_full(conn, reply, sizeof(reply)) < 0) return -1;
+  if (datalen > 0 && write_full(conn, data, datalen) < 0) return -1;
+  return keep ? 0 : -1;
+}
+
+
+static void queue_lock(void) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&queue.lock);
+#endif
+}
+
+
+static void queue_unlock(void) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&queue.lock);
+#endif
+}
+
+
+/* Hands an accepted connection to the workers; -1 if the queue is full: */
+static int queue_push(int conn) {
+  int ret = -1;
+
+  queue_lock();
+  if (!queue.closed && queue.count < JELD_BACKLOG) {
+    queue.fds[(queue.head + queue.count) % JELD_BACKLOG] = conn;
+    queue.count++;
+    ret = 0;
+#ifdef HAVE_LIBPTHREAD
+    pthread_cond_signal(&queue.ready);
+#endif
+  }
+  queue_unlock();
+  return ret;
+}
+
+
+#ifdef HAVE_LIBPTHREAD
+/* The next connection, or -1 once the queue is closed: */
+static int queue_pop(void) {
+  int conn = -1;
+
+  queue_lock();
+  while (queue.count == 0 && !queue.closed)
+    pthread_cond_wait(&queue.ready, &queue.lock);
+  if (queue.count > 0) {
+    conn = queue.fds[queue.head];
+    queue.head = (queue.head + 1) % JELD_BACKLOG;
+    queue.count--;
+  }
+  queue_unlock();
+  return conn;
+}
+#endif
+
+
+static int worker_init(jeld_worker *w) {
+  jel_config *jel;
+
+  memset(&w->in, 0, sizeof(w->in));
+  memset(&w->fdin, 0, sizeof(w->fdin));
+  memset(&w->out, 0, sizeof(w->out));
+  w->conn = -1;
+  w->jel = jel = jel_init(JEL_NLEVELS);
+  if (jel == NULL) return -1;
+
+  if (logfilename) {
+    if (jel_open_log(jel, logfilename) == JEL_ERR_CANTOPENLOG)
+      fprintf(stderr, "Can't open %s!!\n", logfilename);
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, verbose ? JEL_LOG_DEBUG : JEL_LOG_INFO);
+  } else if (verbose) {
+    jel->logger = stderr;
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+  }
+
+  w->blocklen = jel_getprop(jel, JEL_PROP_ECC_BLOCKLEN);
+  return 0;
+}
+
+
+static void worker_free(jeld_worker *w) {
+  if (w->jel) {
+    jel_close_log(w->jel);
+    jel_free(w->jel);
+  }
+  free(w->in.data);
+  free(w->fdin.data);
+  free(w->out.data);
+}
+
+
+/* Serves requests on 'conn' until the client is done, then closes it: */
+static void serve_connection(jeld_worker *w, int conn) {
+  struct timeval tv;
+
+  /* An idle client, or one that stops reading its replies, must not
+   * hold the worker forever: */
+  if (timeout > 0) {
+    tv.tv_sec = timeout;
+    tv.tv_usec = 0;
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+
+  counters_lock();
+  counters.connections++;
+  w->conn = conn;
+  counters_unlock();
+
+  while (!stopping && serve_request(w, conn) == 0)
+    ;
+
+  counters_lock();
+  w->conn = -1;
+  counters_unlock();
+  close(conn);
+}
+
+
+#ifdef HAVE_LIBPTHREAD
+static void *worker_main(void *arg) {
+  jeld_worker *w = (jeld_worker *) arg;
+  int conn;
+
+  while ((conn = queue_pop()) >= 0)
+    serve_connection(w, conn);
+  return NULL;
+}
+#endif
+
+
+static void on_signal(int sig) {
+  stopping = 1;
+}
+
+
+static int open_socket(const char *path) {
+  struct sockaddr_un addr;
+  int sock;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path %s is too long\n", progname, path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    perror(progname);
+    return -1;
+  }
+  /* A socket left by an earlier run would make bind fail: */
+  unlink(path);
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(sock, JELD_BACKLOG) < 0) {
+    fprintf(stderr, "%s: cannot listen on %s: %s\n", progname, path, strerror(errno));
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+
+/*
+ * The main program.
+ */
+
+int
+main (int argc, char **argv)
+{
+  struct sigaction sa;
+  jeld_worker *workers;
+  char text[1024];
+  int argn, sock, conn, t, started = 0;
+#ifdef HAVE_LIBPTHREAD
+  sigset_t mask, old;
+#endif
+
+  progname = argv[0];
+  if (progname == NULL || progname[0] == 0)
+    progname = "jeld";		/* in case C library doesn't provide it */
+
+  argn = parse_switches(argc, argv);
+  if (argn != argc - 1) usage();
+
+  if (verbose) fprintf(stderr, "jeld version %s\n", JELD_VERSION);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+  /* No SA_RESTART, so that accept returns on a signal: */
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  sock = open_socket(argv[argn]);
+  if (sock < 0) return EXIT_FAILURE;
+
+#ifdef HAVE_LIBPTHREAD
+  if (nthreads <= 0) nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads <= 0) nthreads = 1;
+  pthread_mutex_init(&counters.lock, NULL);
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.ready, NULL);
+#else
+  nthreads = 1;
+#endif
+
+  workers = calloc(nthreads, sizeof(jeld_worker));
+  for (t = 0; t < nthreads; t++)
+    if (workers == NULL || worker_init(&workers[t]) < 0) {
+      fprintf(stderr, "%s: cannot set up workers\n", progname);
+      return EXIT_FAILURE;
+    }
+
+#ifdef HAVE_LIBPTHREAD
+  /* Signals are left to this thread: */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mask, &old);
+  for (t = 0; t < nthreads; t++) {
+    if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) != 0) break;
+    started++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (started == 0) {
+    fprintf(stderr, "%s: cannot start workers\n", progname);
+    return EXIT_FAILURE;
+  }
+#endif
+
+  if (verbose)
+    fprintf(stderr, "%s: listening on %s with %d workers\n", progname, argv[argn], nthreads);
+
+  while (!stopping) {
+    conn = accept(sock, NULL, NULL);
+    if (conn < 0) {
+      if (errno != EINTR && errno != ECONNABORTED)
+	perror(progname);
+      continue;
+    }
+#ifdef HAVE_LIBPTHREAD
+    if (queue_push(conn) < 0) {
+      fprintf(stderr, "%s: too many waiting connections\n", progname);
+      close(conn);
+    }
+#else
+    serve_connection(&workers[0], conn);
+#endif
+  }
+
+  close(sock);
+  unlink(argv[argn]);
+
+  /* Wake idle workers, and end the connections of busy ones: */
+  queue_lock();
+  queue.closed = 1;
+  while (queue.count > 0) {
+    close(queue.fds[queue.head]);
+    queue.head = (queue.head + 1) % JELD_BACKLOG;
+    queue.count--;
+  }
+#ifdef HAVE_LIBPTHREAD
+  pthread_cond_broadcast(&queue.ready);
+#endif
+  queue_unlock();
+
+  counters_lock();
+  for (t = 0; t < nthreads; t++)
+    if (workers[t].conn >= 0) shutdown(workers[t].conn, SHUT_RDWR);
+  counters_unlock();
+
+#ifdef HAVE_LIBPTHREAD
+  for (t = 0; t < started; t++) pthread_join(workers[t].thread, NULL);
+#endif
+
+  format_counters(text, sizeof(text));
+  fprintf(stderr, "%s", text);
+
+  for (t = 0; t < nthreads; t++) worker_free(&workers[t]);
+  free(workers);
+  return 0;			/* suppress no-return-value warnings */
+}
@@ -1,16 +1,32 @@
 /*
  * jhist: Use libjel to generate DCT histograms and emit them on
  * stdout.
- * 
+ *
  * By default, emits lines of the form <k> <a1> ... <a64> where <k> is
  * the bin number, representing coefficient values ranging from -1024
  * to 1024, and <an> is the count for bin k at frequency n.
  *
+ * Any number of JPEG files and directories (whose .jpg and .jpeg
+ * files are taken, not recursively) may be named; the histogram is
+ * summed over all of them.  Files are decoded in parallel, each
+ * thread into its own histogram, and the histograms are merged at
+ * the end.  Files that cannot be decoded are reported and skipped.
+ *
+ * -format csv writes "value,f0,...,f63" rows with the signed
+ * coefficient value, leaving out empty rows.  -format binary writes
+ * a JHIST_MAGIC header followed by the full histogram (see
+ * write_binary).
  */
 
 #include <jel/jel.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 /*
  * Argument-parsing code.
@@ -21,18 +37,33 @@
  */
 
 
-#define JHIST_VERSION "0.1"
+#define JHIST_VERSION "0.2"
+
+#define JHIST_TEXT   0
+#define JHIST_CSV    1
+#define JHIST_BINARY 2
 
 static const char * progname;		/* program name for error messages */
 static char * outfilename = NULL;	/* for -outfile switch */
 static int symmetry = 0;
+static int verbose = 0;
+static int format = JHIST_TEXT;
+static int nthreads = 0;		/* 0 means one per processor. */
 
 LOCAL(void)
 usage (void)
 /* complain about bad command line */
 {
-  fprintf(stderr, "usage: %s [switches]", progname);
-  fprintf(stderr, "inputfile [outputfile]\n");
+  fprintf(stderr, "usage: %s [switches] ", progname);
+  fprintf(stderr, "input [input ...]\n");
+  fprintf(stderr, "Each input is a JPEG file or a directory of them.\n");
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -outfile name   Write the histogram to a file instead of stdout.\n");
+  fprintf(stderr, "  -format F       text (default), csv or binary.\n");
+  fprintf(stderr, "  -threads N      Decode with N threads (default=one per processor).\n");
+  fprintf(stderr, "  -symmetry       Print even/odd totals per frequency (text and csv).\n");
+  fprintf(stderr, "  -verbose  or  -debug   Emit debug output on stderr.\n");
+  fprintf(stderr, "  -version        Print version info and exit.\n");
   exit(EXIT_FAILURE);
 }
 
@@ -64,7 +95,7 @@ keymatch (char * arg, const char * keyword, int minchars)
 
 
 static int
-parse_switches (jel_config *cfg, int argc, char **argv)
+parse_switches (int argc, char **argv)
 /* Parse optional switches.
  * Returns argv[] index of first file-name argument (== argc if none).
  * Any file names with indexes <= last_file_arg_seen are ignored;
@@ -87,11 +118,25 @@ parse_switches (jel_config *cfg, int argc, char **argv)
 
     if (keymatch(arg, "debug", 1) || keymatch(arg, "verbose", 1)) {
       /* Enable debug printouts. */
-      /* On first -d, print version identification */
-      //static boolean printed_version = FALSE;
+      verbose = 1;
 
     } else if (keymatch(arg, "symmetry", 1)) {
       symmetry = 1;
+    } else if (keymatch(arg, "outfile", 1)) {
+      if (++argn >= argc)
+	usage();
+      outfilename = argv[argn];
+    } else if (keymatch(arg, "format", 1)) {
+      if (++argn >= argc)
+	usage();
+      if (keymatch(argv[argn], "text", 1)) format = JHIST_TEXT;
+      else if (keymatch(argv[argn], "csv", 1)) format = JHIST_CSV;
+      else if (keymatch(argv[argn], "binary", 1)) format = JHIST_BINARY;
+      else usage();
+    } else if (keymatch(arg, "threads", 1)) {
+      if (++argn >= argc)
+	usage();
+      nthreads = strtol(argv[argn], NULL, 10);
     } else if (keymatch(arg, "version", 7)) {
       fprintf(stderr, "jhist version %s (libjel version %s)\n",
 	      JHIST_VERSION, jel_version_string());
@@ -107,48 +152,130 @@ parse_switches (jel_config *cfg, int argc, char **argv)
 
 #define HSIZE 2048
 
-/* Accumulate DCT histograms over the image: */
+/* Bytes 0-7 of a binary dump: */
+#define JHIST_MAGIC "JHIST\0\0\1"
+
+/* Assumes 64 frequencies, and an 11-bit signed integer
+ * representation.  Counts are 64 bits, since a corpus easily has
+ * more than 2^31 zeros at a frequency: */
+typedef unsigned long long jhist_counts[DCTSIZE2][HSIZE];
+
+
+/* The files to histogram, and the workers' progress through them: */
+typedef struct {
+  char **paths;
+  int npaths;
+  int next;                     /* Next file to hand out. */
+  long failed;                  /* Files that could not be decoded. */
+  long blocks;                  /* Blocks counted, over all files. */
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+#endif
+} jhist_work;
+
+
+/* One worker's share: */
+typedef struct {
+  jhist_work *work;
+  jhist_counts *hist;
+  long failed;
+  long blocks;
+} jhist_worker;
+
+
+static int has_jpeg_suffix(const char *name) {
+  const char *dot = strrchr(name, '.');
+
+  if (dot == NULL) return 0;
+  return (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+static void add_path(jhist_work *work, const char *path) {
+  work->paths = realloc(work->paths, (work->npaths + 1) * sizeof(char *));
+  work->paths[work->npaths++] = strdup(path);
+}
+
+
+/* Add a file, or the JPEG files in a directory in name order.
+ * Anything else is added as it is, and fails when it is read: */
+static void add_input(jhist_work *work, const char *path) {
+  DIR *dp;
+  struct dirent *de;
+  struct stat st;
+  char file[4096];
+  int first = work->npaths;
+
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode) ||
+      (dp = opendir(path)) == NULL) {
+    add_path(work, path);
+    return;
+  }
+
+  while ((de = readdir(dp)) != NULL) {
+    if (!has_jpeg_suffix(de->d_name)) continue;
+    snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+    add_path(work, file);
+  }
+  closedir(dp);
+
+  qsort(work->paths + first, work->npaths - first, sizeof(char *), compare_paths);
+}
 
-int ijel_print_hist(jel_config *cfg) {
 
-  /* Assumes 64 frequencies, and an 11-bit signed integer representation: */
+static unsigned char *read_file(const char *path, int *len) {
+  FILE *fp;
+  struct stat st;
+  unsigned char *buf;
+
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+
+  fp = fopen(path, "rb");
+  if (fp == NULL) return NULL;
+
+  buf = malloc(st.st_size > 0 ? st.st_size : 1);
+  if (buf != NULL && fread(buf, 1, st.st_size, fp) != (size_t) st.st_size) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+
+  *len = (int) st.st_size;
+  return buf;
+}
+
+
+/* Accumulate DCT histograms over the image: */
+
+static long accumulate_hist(jel_config *cfg, jhist_counts *hist) {
 
-  int dct_hist[DCTSIZE2][HSIZE];
   struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
   jvirt_barray_ptr *coef_arrays = cfg->coefs;
 
-  // jel_log(cfg, "ijel_print_hist: coef_arrays = %llx\n", coef_arrays);
-
-  static int compnum = 0;  /* static?  Really?  This is the component number, 0=luminance.  */
+  int compnum = 0;  /* This is the component number, 0=luminance.  */
   int hk;
-  int blk_y, bheight, bwidth, offset_y, i, k;
-  JDIMENSION blocknum; //, MCU_cols;
+  int blk_y, bheight, bwidth, offset_y, k;
+  JDIMENSION blocknum;
   jvirt_barray_ptr comp_array = coef_arrays[compnum];
   jpeg_component_info *compptr;
   JCOEF *mcu;
   JBLOCKARRAY row_ptrs;
-
-  //size_t block_row_size = (size_t) SIZEOF(JCOEF)*DCTSIZE2*cinfo->comp_info[compnum].width_in_blocks;
-
-  //  jel_log(cfg, "ijel_print_hist: block_row_size = %d\n", block_row_size);
+  long blocks = 0;
 
   bheight = cinfo->comp_info[compnum].height_in_blocks;
   bwidth = cinfo->comp_info[compnum].width_in_blocks;
 
-  //  jel_log(cfg, "ijel_print_hist: bwidth x bheight = %dx%d\n", bwidth, bheight);
-
-  //MCU_cols = cinfo->image_width / (cinfo->max_h_samp_factor * DCTSIZE);
-
   compptr = cinfo->comp_info + compnum;
 
-  for (k = 0; k < DCTSIZE2; k++)
-    for (i = 0; i < HSIZE; i++)
-      dct_hist[k][i] = 0;
-	  
   for (blk_y = 0; blk_y < bheight;
        blk_y += compptr->v_samp_factor) {
 
-    row_ptrs = ((cinfo)->mem->access_virt_barray) 
+    row_ptrs = ((cinfo)->mem->access_virt_barray)
       ( (j_common_ptr) cinfo, comp_array, blk_y,
 	(JDIMENSION) compptr->v_samp_factor, FALSE);
 
@@ -156,61 +283,220 @@ int ijel_print_hist(jel_config *cfg) {
 	 offset_y++) {
       for (blocknum=0; blocknum < bwidth;  blocknum++) {
 	mcu =(JCOEF*) row_ptrs[offset_y][blocknum];
+        blocks++;
 
         for ( k = 0; k < DCTSIZE2; k++ ) {
           hk = mcu[k] + (HSIZE >> 1);
-          dct_hist[k][hk]++;
+          /* Out-of-range values (12-bit data) go in the end bins: */
+          if (hk < 0) hk = 0;
+          if (hk >= HSIZE) hk = HSIZE - 1;
+          (*hist)[k][hk]++;
         }
       }
     }
   }
 
-  if (symmetry) {
-    int f0, f1;
-    /* Should be the same organization as below, so change this: */
-    for ( k = 0; k < DCTSIZE2; k++) {
-      f1 = f0 = 0;
-      for (i = 0; i < HSIZE; i++) {
-        if ( i < (HSIZE>>1) ) {
-          if ( i & 1 ) f0 += dct_hist[k][i];
-          else f1 += dct_hist[k][i];
-        } else if ( i > (HSIZE>>1) ) {
-          if ( i & 1 ) f1 += dct_hist[k][i];
-          else f0 += dct_hist[k][i];
-        }
-      }
-      printf("%d %d %d %d\n", k, f0, f1, f1-f0);
+  return blocks;
+}
+
+
+static int next_file(jhist_work *work) {
+  int i;
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&work->lock);
+#endif
+  i = work->next < work->npaths ? work->next++ : -1;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&work->lock);
+#endif
+  return i;
+}
+
+
+static void *hist_worker(void *arg) {
+  jhist_worker *w = (jhist_worker *) arg;
+  jel_config *cfg;
+  unsigned char *jpeg;
+  int i, len;
+
+  while ((i = next_file(w->work)) >= 0) {
+    jpeg = read_file(w->work->paths[i], &len);
+    if (jpeg == NULL) {
+      fprintf(stderr, "%s: cannot read %s\n", progname, w->work->paths[i]);
+      w->failed++;
+      continue;
     }
-  } else {
-    /*
-     * By default, loop over bins (going from -1024 to 1024), and for
-     * each amplitude bin, print each of the 64 values (one per
-     * frequency):
-     */
-    for (i = 0; i < HSIZE; i++) {    /* Loop over amplitude bins */
-      printf("%d", i);
-      /* Now loop over frequencies: */
-      for (k = 0; k < DCTSIZE2; k++) printf(" %d", dct_hist[k][i]);
-      printf("\n");
+
+    cfg = jel_init(JEL_NLEVELS);
+    if (verbose) {
+      cfg->logger = stderr;
+      jel_setprop(cfg, JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+    }
+
+    if (jel_set_mem_source(cfg, jpeg, len) != 0) {
+      fprintf(stderr, "%s: cannot decode %s\n", progname, w->work->paths[i]);
+      w->failed++;
+    } else {
+      jel_log(cfg, "%s: jhist input %s\n", progname, w->work->paths[i]);
+      w->blocks += accumulate_hist(cfg, w->hist);
+    }
+
+    jel_free(cfg);
+    free(jpeg);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Run the workers over every file and merge their histograms into
+ * 'total'.  The calling thread is one of the workers:
+ */
+static void run_workers(jhist_work *work, jhist_counts *total, int n) {
+  jhist_worker *workers;
+  int t, k, i, started = 1;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t *threads;
+#endif
+
+  if (n < 1) n = 1;
+  if (n > work->npaths) n = work->npaths > 0 ? work->npaths : 1;
+
+  workers = calloc(n, sizeof(jhist_worker));
+  workers[0].work = work;
+  workers[0].hist = total;
+
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_init(&work->lock, NULL);
+  threads = calloc(n, sizeof(pthread_t));
+
+  for (t = 1; t < n; t++) {
+    workers[t].work = work;
+    workers[t].hist = calloc(1, sizeof(jhist_counts));
+    if (workers[t].hist == NULL ||
+        pthread_create(&threads[t], NULL, hist_worker, &workers[t]) != 0) {
+      free(workers[t].hist);
+      break;
     }
+    started++;
+  }
+#endif
+
+  hist_worker(&workers[0]);
+
+  for (t = 0; t < started; t++) {
+#ifdef HAVE_LIBPTHREAD
+    if (t > 0) pthread_join(threads[t], NULL);
+#endif
+    work->failed += workers[t].failed;
+    work->blocks += workers[t].blocks;
+    if (t == 0) continue;
+
+    for (k = 0; k < DCTSIZE2; k++)
+      for (i = 0; i < HSIZE; i++)
+        (*total)[k][i] += (*workers[t].hist)[k][i];
+    free(workers[t].hist);
   }
 
-  return k;
+#ifdef HAVE_LIBPTHREAD
+  free(threads);
+  pthread_mutex_destroy(&work->lock);
+#endif
+  free(workers);
 }
 
 
-/* 
- * Print the DCT histograms and then clean up:
+static void write_symmetry(FILE *fp, jhist_counts *hist) {
+  unsigned long long f0, f1;
+  int k, i;
+
+  if (format == JHIST_CSV) fprintf(fp, "freq,f0,f1,diff\n");
+
+  for ( k = 0; k < DCTSIZE2; k++) {
+    f1 = f0 = 0;
+    for (i = 0; i < HSIZE; i++) {
+      if ( i < (HSIZE>>1) ) {
+        if ( i & 1 ) f0 += (*hist)[k][i];
+        else f1 += (*hist)[k][i];
+      } else if ( i > (HSIZE>>1) ) {
+        if ( i & 1 ) f1 += (*hist)[k][i];
+        else f0 += (*hist)[k][i];
+      }
+    }
+    fprintf(fp, format == JHIST_CSV ? "%d,%llu,%llu,%lld\n" : "%d %llu %llu %lld\n",
+            k, f0, f1, (long long) (f1 - f0));
+  }
+}
+
+
+/*
+ * By default, loop over bins (going from -1024 to 1024), and for
+ * each amplitude bin, print each of the 64 values (one per
+ * frequency):
  */
+static void write_text(FILE *fp, jhist_counts *hist) {
+  int k, i;
+
+  for (i = 0; i < HSIZE; i++) {    /* Loop over amplitude bins */
+    fprintf(fp, "%d", i);
+    /* Now loop over frequencies: */
+    for (k = 0; k < DCTSIZE2; k++) fprintf(fp, " %llu", (*hist)[k][i]);
+    fprintf(fp, "\n");
+  }
+}
+
 
-static int jel_print_hist( jel_config * cfg ) {
-  ijel_print_hist(cfg);
+static void write_csv(FILE *fp, jhist_counts *hist) {
+  int k, i, empty;
 
-  (void) jpeg_finish_decompress(&(cfg->srcinfo));
-  jpeg_destroy_decompress(&(cfg->srcinfo));
+  fprintf(fp, "value");
+  for (k = 0; k < DCTSIZE2; k++) fprintf(fp, ",f%d", k);
+  fprintf(fp, "\n");
 
-  return 0;
+  for (i = 0; i < HSIZE; i++) {
+    for (k = 0, empty = 1; k < DCTSIZE2 && empty; k++)
+      if ((*hist)[k][i]) empty = 0;
+    if (empty) continue;
 
+    fprintf(fp, "%d", i - (HSIZE >> 1));
+    for (k = 0; k < DCTSIZE2; k++) fprintf(fp, ",%llu", (*hist)[k][i]);
+    fprintf(fp, "\n");
+  }
+}
+
+
+static void put_le(FILE *fp, unsigned long long v, int nbytes) {
+  while (nbytes-- > 0) {
+    putc((int) (v & 0xFF), fp);
+    v >>= 8;
+  }
+}
+
+
+/*
+ * Binary dump, all integers little-endian:
+ *
+ *   8 bytes    JHIST_MAGIC (the last byte is the format version)
+ *   4 bytes    number of frequencies (64)
+ *   4 bytes    number of bins (HSIZE); bin i holds value i - HSIZE/2
+ *   8 bytes    number of files histogrammed
+ *   8 bytes    number of blocks
+ *   then 8-byte counts, frequency-major: all bins of frequency 0,
+ *   then all bins of frequency 1, and so on.
+ */
+static void write_binary(FILE *fp, jhist_counts *hist, long files, long blocks) {
+  int k, i;
+
+  fwrite(JHIST_MAGIC, 1, 8, fp);
+  put_le(fp, DCTSIZE2, 4);
+  put_le(fp, HSIZE, 4);
+  put_le(fp, files, 8);
+  put_le(fp, blocks, 8);
+
+  for (k = 0; k < DCTSIZE2; k++)
+    for (i = 0; i < HSIZE; i++) put_le(fp, (*hist)[k][i], 8);
 }
 
 
@@ -221,23 +507,11 @@ static int jel_print_hist( jel_config * cfg ) {
 int
 main (int argc, char **argv)
 {
-  jel_config *jel;
-  int ret;
+  jhist_work work;
+  jhist_counts *hist;
   int k;
-  //int bytes_written;
-  FILE *sfp, *output_file;
-
-  
-  jel = jel_init(JEL_NLEVELS);
-
-  ret = jel_open_log(jel, "/tmp/jhist.log");
-  if (ret == JEL_ERR_CANTOPENLOG) {
-    fprintf(stderr, "Can't open /tmp/jhist.log!!\n");
-    jel->logger = stderr;
-  }
-
-  jel_log(jel, "jhist version %s (libjel version %s)\n",
-	  JHIST_VERSION, jel_version_string());
+  FILE *output_file;
+  static char obuf[1 << 16];
 
   progname = argv[0];
   if (progname == NULL || progname[0] == 0)
@@ -245,44 +519,62 @@ main (int argc, char **argv)
 
   if (argc <= 1) usage();
 
-  k = parse_switches(jel, argc, argv);
+  k = parse_switches(argc, argv);
+  if (k >= argc) usage();
 
-  sfp = fopen(argv[k], "rb");
-  if ( !sfp ) {
-    fprintf(stderr, "Error: Can't open input file %s!\n", argv[k]);
-    exit(EXIT_FAILURE);
+  if (verbose)
+    fprintf(stderr, "jhist version %s (libjel version %s)\n",
+            JHIST_VERSION, jel_version_string());
+
+  memset(&work, 0, sizeof(work));
+  for (; k < argc; k++) add_input(&work, argv[k]);
+
+  if (nthreads <= 0) {
+#ifdef HAVE_LIBPTHREAD
+    nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    nthreads = 1;
+#endif
   }
 
-  ret = jel_set_fp_source(jel, sfp);
-  if (ret != 0) {
-    fprintf(stderr, "Error: Can't set fp source!\n");
+  /* The histogram is 1MB, too much for the stack: */
+  hist = calloc(1, sizeof(jhist_counts));
+  if (hist == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
     exit(EXIT_FAILURE);
   }
 
-  jel_log(jel,"%s: jhist input %s\n", progname, argv[k]);
-
-  k++;
+  run_workers(&work, hist, nthreads);
 
-  if (argc == k && !outfilename) output_file = stdout;
+  if (!outfilename) output_file = stdout;
   else {
-    if (!outfilename) outfilename = strdup(argv[k]);
-
     output_file = fopen(outfilename, "wb");
-    jel_log(jel,"%s: jhist output %s\n", progname, outfilename);
+    if (!output_file) {
+      fprintf(stderr, "%s: cannot open output file %s\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
   }
+  setvbuf(output_file, obuf, _IOFBF, sizeof(obuf));
 
-  if (ret != 0) {
-    jel_log(jel,"%s: jel error %d\n", progname, ret);
-    fprintf(stderr, "Error - exiting (need a diagnostic!)\n");
-    exit(EXIT_FAILURE);
-  }
+  if (verbose)
+    fprintf(stderr, "%s: %d files, %ld failed, %ld blocks\n",
+            progname, work.npaths, work.failed, work.blocks);
 
-  jel_print_hist(jel);
+  if (format == JHIST_BINARY)
+    write_binary(output_file, hist, work.npaths - work.failed, work.blocks);
+  else if (symmetry)
+    write_symmetry(output_file, hist);
+  else if (format == JHIST_CSV)
+    write_csv(output_file, hist);
+  else
+    write_text(output_file, hist);
 
-  jel_close_log(jel);
+  if (output_file != stdout) fclose(output_file);
+  else fflush(output_file);
 
-  if (sfp != NULL && sfp != stdin) fclose(sfp);
-  if (output_file != NULL && output_file != stdout) fclose(output_file);
+  for (k = 0; k < work.npaths; k++) free(work.paths[k]);
+  free(work.paths);
+  free(hist);
 
-  return 0;			/* suppress no-return-value warnings */
+  return work.failed > 0 ? EXIT_FAILURE : 0;
 }
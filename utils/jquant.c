@@ -158,6 +158,7 @@ int main(int argc, char **argv) {
 
   jel = jel_init(JEL_NLEVELS);
   jel->logger = stderr;
+  jel_setprop(jel, JEL_PROP_LOG_LEVEL, JEL_LOG_INFO);  /* The tables are logged at INFO. */
 
   if ( argc > 1 ) {
 
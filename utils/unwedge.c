@@ -17,6 +17,13 @@
 #include <ctype.h>		/* to declare isprint() */
 
 #include <stdlib.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #define UNWEDGE_VERSION "1.0.0.4"
 
@@ -31,7 +38,6 @@
 
 static const char * progname;		/* program name for error messages */
 static char * outfilename = NULL;	/* for -outfile switch */
-static unsigned char * message = NULL;
 static int freq[64];
 static int nfreq = 0;
 static int msglen = -1;
@@ -39,6 +45,16 @@ static int embed_length = 1;
 static int ecc = 1;
 static int ecclen = 0;
 static int seed = 0;
+static int ethresh = 0;        /* If >0, skip blocks with at least this AC energy. */
+static int frame = 0;          /* If 1, use the JEL_FRAME_V1 message frame. */
+static int maxmemory = 0;      /* If >0, Kb of coefficients to keep in memory. */
+static int decodethreads = 1;  /* Restart interval decoders; 0 means one per processor. */
+static int verbose = 0;
+static char * logfilename = NULL;	/* for -log switch */
+static char * manifestname = NULL;	/* for -manifest switch */
+static char * tryname = NULL;		/* for -try switch */
+static int nthreads = 0;	/* Batch workers; 0 means one per processor. */
+static int ncovers = 0;		/* for -covers switch; 0: one image */
 
 
 LOCAL(void)
@@ -47,6 +63,8 @@ usage (void)
 {
   fprintf(stderr, "usage: %s [switches] ", progname);
   fprintf(stderr, "inputfile [outputfile]\n");
+  fprintf(stderr, "       %s [switches] inputdir outputdir\n", progname);
+  fprintf(stderr, "       %s [switches] -covers N input... [outputfile]\n", progname);
 
 
   fprintf(stderr, "Switches (names may be abbreviated):\n");
@@ -60,7 +78,24 @@ usage (void)
   fprintf(stderr, "                 If this is specified, -quanta is ignored.\n");
   fprintf(stderr, "                 NOTE: The same values must used for extraction!\n");
   fprintf(stderr, "  -seed <n>      Seed (shared secret) for random frequency selection.\n");
-  fprintf(stderr, "  -verbose  or  -debug   Emit debug output\n");
+  fprintf(stderr, "  -ethresh E     Skip blocks whose AC energy is at least E.\n");
+  fprintf(stderr, "                 NOTE: The same value must used for embedding!\n");
+  fprintf(stderr, "  -frame         The message was framed (wedge -frame).\n");
+  fprintf(stderr, "  -manifest <file>  Extract from each 'input output' line of the file\n");
+  fprintf(stderr, "                 ('-' reads stdin), reporting one status line per job.\n");
+  fprintf(stderr, "                 A directory input does the same for its .jpg files.\n");
+  fprintf(stderr, "  -threads N     Batch worker threads (default=one per processor).\n");
+  fprintf(stderr, "  -covers N      Put back together a message split by wedge -covers from\n");
+  fprintf(stderr, "                 the N inputs that follow, in any order.\n");
+  fprintf(stderr, "  -try <file>    Try each line's settings ('-' reads stdin): any of seed=N,\n");
+  fprintf(stderr, "                 quanta=N, ecc=L or ecc=none, frame or noframe, ethresh=E,\n");
+  fprintf(stderr, "                 the switches giving the rest.  The image is decoded once.\n");
+  fprintf(stderr, "  -maxmemory N   Keep at most N Kb (Nm: N Mb) of coefficients in memory,\n");
+  fprintf(stderr, "                 the rest in temporary files in $TMPDIR.\n");
+  fprintf(stderr, "  -decodethreads N  Decode an image's restart intervals on N threads\n");
+  fprintf(stderr, "                 (0: one per processor; default=1).\n");
+  fprintf(stderr, "  -log <file>    Append log output to file.\n");
+  fprintf(stderr, "  -verbose  or  -debug   Emit debug output (to stderr unless -log is given)\n");
   exit(EXIT_FAILURE);
 }
 
@@ -112,9 +147,13 @@ parse_switches (jel_config *cfg, int argc, char **argv)
 
     if (keymatch(arg, "debug", 1) || keymatch(arg, "verbose", 1)) {
       /* Enable debug printouts. */
-      /* On first -d, print version identification */
-      //static boolean printed_version = FALSE;
+      verbose = 1;
 
+    } else if (keymatch(arg, "log", 3)) {
+      /* Log file name. */
+      if (++argn >= argc)	/* advance to next argument */
+	usage();
+      logfilename = argv[argn];
 
     } else if (keymatch(arg, "outfile", 4)) {
       /* Set output file name. */
@@ -122,6 +161,32 @@ parse_switches (jel_config *cfg, int argc, char **argv)
 	usage();
       outfilename = argv[argn];	/* save it away for later use */
 
+    } else if (keymatch(arg, "manifest", 3)) {
+      /* Batch of extractions. */
+      if (++argn >= argc)
+	usage();
+      manifestname = argv[argn];
+
+    } else if (keymatch(arg, "try", 3)) {
+      /* Candidate settings */
+      if (++argn >= argc)
+	usage();
+      tryname = argv[argn];
+
+    } else if (keymatch(arg, "covers", 3)) {
+      /* Multi-cover extraction */
+      if (++argn >= argc)
+	usage();
+      ncovers = strtol(argv[argn], NULL, 10);
+      if (ncovers < 1)
+	usage();
+
+    } else if (keymatch(arg, "threads", 2)) {
+      /* Batch worker threads */
+      if (++argn >= argc)
+	usage();
+      nthreads = strtol(argv[argn], NULL, 10);
+
     } else if (keymatch(arg, "ecc", 3)) {
       /* Block length to use for error correction */
       if (++argn >= argc)
@@ -151,6 +216,31 @@ parse_switches (jel_config *cfg, int argc, char **argv)
       if (++argn >= argc)
 	usage();
       seed = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "ethresh", 2)) {
+      /* Start block */
+      if (++argn >= argc)
+	usage();
+      ethresh = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "decodethreads", 3)) {
+      /* Threads for decoding restart intervals */
+      if (++argn >= argc)
+	usage();
+      decodethreads = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "maxmemory", 3)) {
+      /* Coefficient memory limit in Kb, or Mb with an 'm' */
+      long lval;
+      char ch = 'x';
+
+      if (++argn >= argc)
+	usage();
+      if (sscanf(argv[argn], "%ld%c", &lval, &ch) < 1)
+	usage();
+      if (ch == 'm' || ch == 'M')
+        lval *= 1024L;
+      maxmemory = (int) lval;
+    } else if (keymatch(arg, "frame", 3)) {
+      /* Checked message frame */
+      frame = 1;
     } else if (keymatch(arg, "noecc", 5)) {
       /* Whether to assume error correction */
       ecc = 0;
@@ -261,20 +351,566 @@ static void ijel_describe_message(jel_config *cfg) {
 #endif
 
 
-static int ijel_fprintf_message(jel_config *cfg, FILE* fp) {
+/*
+ * Message writer for jel_extract_stream: the message goes straight
+ * to the output file as it is decoded.
+ */
+static int write_message(void *ctx, const unsigned char *buf, int len) {
+  FILE *fp = (FILE *) ctx;
+
+  if (fwrite(buf, 1, len, fp) != (size_t) len) return -1;
+  return len;
+}
+
+
+/*
+ * Candidate settings for -try, one line each, starting from the
+ * switches' settings.  Returns the number read, or -1 on a bad line:
+ */
+static int load_hypotheses(const char *path, jel_hypothesis **out) {
+  FILE *fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+  char line[1024], *tok;
+  jel_hypothesis *hyps = NULL, *h;
+  int n = 0;
+
+  if (fp == NULL) return -1;
+
+  while (fgets(line, sizeof(line), fp)) {
+    tok = strtok(line, " \t\r\n");
+    if (tok == NULL || tok[0] == '#') continue;
+
+    hyps = realloc(hyps, (n + 1) * sizeof(jel_hypothesis));
+    h = hyps + n++;
+    memset(h, 0, sizeof(jel_hypothesis));
+    h->seed = seed;
+    h->ecc_method = ecc ? JEL_ECC_RSCODE : JEL_ECC_NONE;
+    h->ecc_blocklen = ecclen;
+    h->frame = frame ? JEL_FRAME_V1 : JEL_FRAME_NONE;
+    h->ethresh = ethresh;
+
+    for (; tok != NULL; tok = strtok(NULL, " \t\r\n")) {
+      if (!strncmp(tok, "seed=", 5)) h->seed = strtol(tok + 5, NULL, 10);
+      else if (!strncmp(tok, "quanta=", 7)) h->nlevels = strtol(tok + 7, NULL, 10);
+      else if (!strcmp(tok, "ecc=none")) h->ecc_method = JEL_ECC_NONE;
+      else if (!strncmp(tok, "ecc=", 4)) {
+        h->ecc_method = JEL_ECC_RSCODE;
+        h->ecc_blocklen = strtol(tok + 4, NULL, 10);
+        if (h->ecc_blocklen < JEL_ECC_MIN_BLOCKLEN || h->ecc_blocklen > JEL_ECC_MAX_BLOCKLEN) {
+          fprintf(stderr, "%s: ECC block length must be %d to %d in '%s' in %s\n", progname,
+                  JEL_ECC_MIN_BLOCKLEN, JEL_ECC_MAX_BLOCKLEN, tok, path);
+          n = -1;
+          break;
+        }
+      } else if (!strcmp(tok, "frame")) h->frame = JEL_FRAME_V1;
+      else if (!strcmp(tok, "noframe")) h->frame = JEL_FRAME_NONE;
+      else if (!strncmp(tok, "ethresh=", 8)) h->ethresh = strtol(tok + 8, NULL, 10);
+      else {
+        fprintf(stderr, "%s: bad setting '%s' in %s\n", progname, tok, path);
+        n = -1;
+        break;
+      }
+    }
+    if (n < 0) break;
+
+    /* wedge uses 8 frequencies with a seed, 4 without: */
+    if (nfreq == 0) h->nfreqs = (h->seed > 0) ? 8 : 4;
+  }
+
+  if (fp != stdin) fclose(fp);
+  if (n <= 0) {
+    free(hyps);
+    hyps = NULL;
+  }
+  *out = hyps;
+  return n;
+}
+
+
+/* The most a framed message of 'coded' bytes can unpack to, as LZF
+ * expands a byte to no more than 88: */
+static int frame_maxlen(int coded) {
+  return (coded > INT_MAX / 88) ? INT_MAX : coded * 88;
+}
+
+
+/*
+ * -try: extract with the first candidate that carries a message.
+ * Returns 0 on success:
+ */
+static int try_hypotheses(jel_config *jel, FILE *output_file, int max_bytes) {
+  jel_hypothesis *hyps;
+  unsigned char *msg;
+  int n, i, maxlen = max_bytes;
+
+  n = load_hypotheses(tryname, &hyps);
+  if (n <= 0) {
+    fprintf(stderr, "%s: no settings to try in %s\n", progname, tryname);
+    return -1;
+  }
+
+  /* Room for a compressed message once unpacked: */
+  for (i = 0; i < n; i++)
+    if (hyps[i].frame == JEL_FRAME_V1) maxlen = frame_maxlen(max_bytes);
+
+  msg = malloc(maxlen);
+  i = msg ? jel_extract_hypotheses(jel, hyps, n, msg, maxlen) : JEL_ERR_INVALIDARG;
+  if (i >= 0) {
+    jel_log(jel, "%s: candidate %d matched, %d bytes extracted\n", progname, i + 1, hyps[i].result);
+    fprintf(stderr, "%s: candidate %d matched\n", progname, i + 1);
+    if (write_message(output_file, msg, hyps[i].result) < 0) i = JEL_ERR_MSGIO;
+  } else {
+    fprintf(stderr, "%s: no candidate matched\n", progname);
+  }
+
+  free(msg);
+  free(hyps);
+  return (i >= 0) ? 0 : -1;
+}
+
+
+/*
+ * Options that must be set before the source is opened:
+ */
+static void set_coding_options(jel_config *jel) {
+  if (!ecc) {
+    jel_setprop(jel, JEL_PROP_ECC_METHOD, JEL_ECC_NONE);
+    jel_log(jel, "Disabling ECC.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_METHOD));
+  } else if (ecclen > 0) {
+    jel_setprop(jel, JEL_PROP_ECC_BLOCKLEN, ecclen);
+    jel_log(jel, "ECC block length set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_BLOCKLEN));
+  }
+
+  if (ethresh > 0) {
+    jel_setprop(jel, JEL_PROP_ENERGY_THRESHOLD, ethresh);
+    jel_log(jel, "Energy threshold set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ENERGY_THRESHOLD));
+  }
+
+  if (frame) {
+    jel_setprop(jel, JEL_PROP_FRAME, JEL_FRAME_V1);
+    jel_log(jel, "Message frame set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_FRAME));
+  }
+
+  if (maxmemory > 0) {
+    jel_setprop(jel, JEL_PROP_MAX_MEMORY, maxmemory);
+    jel_log(jel, "Memory limit set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_MAX_MEMORY));
+  }
+
+  if (decodethreads != 1) {
+    jel_setprop(jel, JEL_PROP_DECODE_THREADS, decodethreads);
+    jel_log(jel, "Decode threads set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_DECODE_THREADS));
+  }
+}
+
+
+/*
+ * Frequency selection and length embedding.  Explicit frequencies
+ * are forgotten by jel_reset, so these are set for every image:
+ */
+static void set_extract_options(jel_config *jel) {
+  jel_freq_spec *fspec;
+  int k;
+
+  if ( seed > 0 ) {
+    jel_log(jel, "%s: Setting frequency generation seed to %d\n", progname, seed);
+    if ( jel_setprop( jel, JEL_PROP_FREQ_SEED, seed ) != seed )
+      jel_log(jel, "Failed to set frequency generation seed.\n");
+
+    jel_log(jel, "%s:      also setting nfreqs to 8\n", progname);
+    if ( jel_setprop( jel, JEL_PROP_NFREQS, 8 ) != 8 )
+      jel_log(jel, "Failed to set frequency generation seed.\n");
+  }
+
+  if (embed_length) jel_log(jel, "%s: Length is embedded.\n", progname);
+  else jel_log(jel, "%s: Length is NOT embedded.\n", progname);
+
+  jel_setprop(jel, JEL_PROP_EMBED_LENGTH, embed_length);
+
+  fspec = &(jel->freqs);
+
+  /* If supplied, copy the selected frequency components: */
+  if (nfreq > 0) {
+    fspec->nfreqs = nfreq;
+    for (k = 0; k < nfreq; k++) fspec->freqs[k] = freq[k];
+  }
+}
+
+
+/*
+ * Batch mode, for a manifest or a directory.  Each manifest line
+ * names an input and an output file, separated by white space; blank
+ * lines and lines starting with '#' are skipped.  A directory stands
+ * for its .jpg and .jpeg files, in name order, each extracted to the
+ * same name with a .msg suffix in the output directory.
+ *
+ * Worker threads take jobs in turn, each keeping one jel_config that
+ * it jel_resets between jobs.  Most images in an inbox carry nothing,
+ * so before extracting, a job decodes only as much of the image as
+ * holds the embedded length (jel_probe_length) and gives up on the
+ * image if there is no plausible length.  Every job reports one line
+ * on stdout as it finishes:
+ *
+ *   <job> ok <message bytes> <output>
+ *   <job> none - <input>
+ *   <job> error <code> <output> <reason>
+ *
+ * where <job> is the manifest line or the file's place in the
+ * directory.  The exit status is non-zero if any job failed.
+ */
+
+#define UNWEDGE_MAXPATH 4096
+
+typedef struct {
+  FILE *fp;			/* Manifest, or NULL for a directory */
+  char **paths;			/* Directory entries */
+  int npaths;
+  const char *outdir;
+  int lineno;
+  int failures;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+#endif
+} unwedge_batch;
+
+
+static void batch_lock(unwedge_batch *b) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&b->lock);
+#endif
+}
+
+
+static void batch_unlock(unwedge_batch *b) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&b->lock);
+#endif
+}
+
+
+static int has_jpeg_suffix(const char *name) {
+  const char *dot = strrchr(name, '.');
+
+  if (dot == NULL) return 0;
+  return (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+/* The directory's JPEG file names, in order, or -1 if it can't be read: */
+static int list_directory(unwedge_batch *b, const char *dir) {
+  DIR *dp = opendir(dir);
+  struct dirent *de;
+
+  if (dp == NULL) return -1;
+
+  while ((de = readdir(dp)) != NULL) {
+    if (!has_jpeg_suffix(de->d_name)) continue;
+    b->paths = realloc(b->paths, (b->npaths + 1) * sizeof(char *));
+    b->paths[b->npaths++] = strdup(de->d_name);
+  }
+  closedir(dp);
+
+  qsort(b->paths, b->npaths, sizeof(char *), compare_paths);
+  return b->npaths;
+}
+
+
+/* Next job, or 0 when there are no more: */
+static int next_job(unwedge_batch *b, const char *indir, char *input, char *output) {
+  char line[2 * UNWEDGE_MAXPATH + 16];
+  char extra[2];
+  int lineno = 0, n;
+
+  batch_lock(b);
+  if (b->fp == NULL) {
+    if (b->lineno < b->npaths) {
+      const char *name = b->paths[b->lineno++];
+      const char *dot = strrchr(name, '.');
+
+      snprintf(input, UNWEDGE_MAXPATH, "%s/%s", indir, name);
+      snprintf(output, UNWEDGE_MAXPATH, "%s/%.*s.msg", b->outdir, (int) (dot - name), name);
+      lineno = b->lineno;
+    }
+  } else {
+    while (fgets(line, sizeof(line), b->fp) != NULL) {
+      b->lineno++;
+      n = sscanf(line, "%4095s %4095s %1s", input, output, extra);
+      if (n <= 0 || input[0] == '#') continue;
+      if (n != 2) {
+        printf("%d error %d - malformed line\n", b->lineno, JEL_ERR_INVALIDARG);
+        b->failures++;
+        continue;
+      }
+      lineno = b->lineno;
+      break;
+    }
+  }
+  batch_unlock(b);
+
+  return lineno;
+}
+
+
+static unsigned char *load_file(const char *path, int *len) {
+  FILE *fp = fopen(path, "rb");
+  unsigned char *buf;
+  long n;
+
+  if (fp == NULL) return NULL;
+
+  fseek(fp, 0, SEEK_END);
+  n = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  buf = (n > 0) ? malloc(n) : NULL;
+  if (buf != NULL && fread(buf, 1, n, fp) != (size_t) n) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+
+  *len = (int) n;
+  return buf;
+}
+
+
+/*
+ * One batch job.  Returns the number of message bytes extracted, 0
+ * with *why set to NULL if the image carries no message, or a
+ * negative error code with *why set:
+ */
+static int unwedge_job(jel_config *jel, char *input, char *output, const char **why) {
+  unsigned char *jpeg;
+  int jpeglen, ret;
+  int maxlen = 0;
+  FILE *ofp = NULL;
+
+  jpeg = load_file(input, &jpeglen);
+  if (jpeg == NULL) {
+    *why = "cannot read input";
+    return JEL_ERR_CANTOPENFILE;
+  }
+
+  set_extract_options(jel);
+
+  /* The quick reject.  The probe finds the embedded length, which
+   * is all the full pass reads when the length is embedded: */
+  if (embed_length) {
+    maxlen = jel_probe_length(jel, jpeg, jpeglen);
+    if (maxlen <= 0) {
+      *why = maxlen < 0 ? "cannot decode input" : NULL;
+      free(jpeg);
+      return maxlen < 0 ? JEL_ERR_BADDIMS : 0;
+    }
+  }
+
+  if (jel_set_mem_source(jel, jpeg, jpeglen) != 0) {
+    *why = "cannot decode input";
+    ret = JEL_ERR_BADDIMS;
+    goto done;
+  }
+
+  if (!embed_length) {
+    maxlen = jel_raw_capacity(jel);
+    if (msglen < maxlen) maxlen = msglen;
+  } else if (frame) maxlen = frame_maxlen(maxlen);
+
+  ofp = fopen(output, "wb");
+  if (ofp == NULL) {
+    *why = "cannot open output";
+    ret = JEL_ERR_CANTOPENFILE;
+    goto done;
+  }
+
+  jel_log(jel, "%s: unwedge input %s, output %s\n", progname, input, output);
+
+  ret = jel_extract_stream(jel, write_message, ofp, maxlen);
+  if (ret == JEL_ERR_MSGIO) *why = "cannot write output";
+  else if (ret < 0) *why = "extraction failed";
+
+ done:
+  if (ofp != NULL && fclose(ofp) != 0 && ret >= 0) {
+    *why = "cannot write output";
+    ret = JEL_ERR_CANTOPENFILE;
+  }
+  free(jpeg);
+  return ret;
+}
+
+
+typedef struct {
+  unwedge_batch *batch;
+  const char *indir;
+} unwedge_worker;
+
+
+static void *batch_worker(void *arg) {
+  unwedge_worker *w = (unwedge_worker *) arg;
+  unwedge_batch *b = w->batch;
+  jel_config *jel = jel_init(JEL_NLEVELS);
+  char input[UNWEDGE_MAXPATH], output[UNWEDGE_MAXPATH];
+  const char *why;
+  int lineno, ret;
+
+  if (logfilename) {
+    if (jel_open_log(jel, logfilename) == JEL_ERR_CANTOPENLOG)
+      fprintf(stderr, "Can't open %s!!\n", logfilename);
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, verbose ? JEL_LOG_DEBUG : JEL_LOG_INFO);
+  } else if (verbose) {
+    jel->logger = stderr;
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+  }
+
+  set_coding_options(jel);
+
+  while ((lineno = next_job(b, w->indir, input, output)) > 0) {
+    why = "";
+    ret = unwedge_job(jel, input, output, &why);
+
+    batch_lock(b);
+    if (ret < 0) {
+      printf("%d error %d %s %s\n", lineno, ret, output, why);
+      b->failures++;
+    } else if (why == NULL) printf("%d none - %s\n", lineno, input);
+    else printf("%d ok %d %s\n", lineno, ret, output);
+    fflush(stdout);
+    batch_unlock(b);
+
+    jel_reset(jel);
+  }
+
+  jel_close_log(jel);
+  jel_free(jel);
+  return NULL;
+}
+
+
+/* Runs a manifest, or the directory 'indir' into 'outdir': */
+static int run_batch(const char *indir, const char *outdir) {
+  unwedge_batch b;
+  unwedge_worker w;
   int i;
-  int retval = 0;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t *threads;
+  int t, started = 0;
+#endif
+
+  memset(&b, 0, sizeof(b));
+  w.batch = &b;
+  w.indir = indir;
+
+  if (manifestname) {
+    b.fp = strcmp(manifestname, "-") ? fopen(manifestname, "r") : stdin;
+    if (b.fp == NULL) {
+      fprintf(stderr, "%s: cannot open manifest %s\n", progname, manifestname);
+      return EXIT_FAILURE;
+    }
+  } else {
+    b.outdir = outdir;
+    if (list_directory(&b, indir) < 0) {
+      fprintf(stderr, "%s: cannot read directory %s\n", progname, indir);
+      return EXIT_FAILURE;
+    }
+  }
+
+#ifdef HAVE_LIBPTHREAD
+  if (nthreads <= 0) nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads <= 0) nthreads = 1;
 
-  // msg->len always dictates the length:
-  for (i = 0; i < cfg->len; i++){
-    char c = cfg->data[i];
-    fputc(c, fp);
-    retval++; 
+  pthread_mutex_init(&b.lock, NULL);
+  threads = calloc(nthreads, sizeof(pthread_t));
+
+  /* This thread is the first worker: */
+  for (t = 1; t < nthreads; t++) {
+    if (pthread_create(&threads[t], NULL, batch_worker, &w) != 0) break;
+    started++;
   }
-  return retval;
+  batch_worker(&w);
+  for (t = 1; t <= started; t++) pthread_join(threads[t], NULL);
+
+  free(threads);
+  pthread_mutex_destroy(&b.lock);
+#else
+  batch_worker(&w);
+#endif
+
+  if (b.fp != NULL && b.fp != stdin) fclose(b.fp);
+  for (i = 0; i < b.npaths; i++) free(b.paths[i]);
+  free(b.paths);
+  return b.failures > 0 ? EXIT_FAILURE : 0;
 }
 
 
+/*
+ * -covers: one config per stego image, and jel_extract_multi puts
+ * the message back together from their shards.  The message is no
+ * longer than the images can carry between them.
+ */
+static int run_covers(char **inputs, FILE *output_file) {
+  jel_config **cfgs = calloc(ncovers, sizeof(jel_config *));
+  unsigned char **jpegs = calloc(ncovers, sizeof(unsigned char *));
+  unsigned char *msg = NULL;
+  int i, jpeglen, ret = 0;
+  long maxlen = 0;
+
+  if (cfgs == NULL || jpegs == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    ret = JEL_ERR_NOSPACE;
+    goto done;
+  }
+
+  for (i = 0; i < ncovers; i++) {
+    cfgs[i] = jel_init(JEL_NLEVELS);
+    if (verbose) {
+      cfgs[i]->logger = stderr;
+      jel_setprop(cfgs[i], JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+    }
+    set_coding_options(cfgs[i]);
+
+    jpegs[i] = load_file(inputs[i], &jpeglen);
+    if (jpegs[i] == NULL || jel_set_mem_source(cfgs[i], jpegs[i], jpeglen) != 0) {
+      fprintf(stderr, "%s: cannot read input %s\n", progname, inputs[i]);
+      ret = JEL_ERR_CANTOPENFILE;
+      goto done;
+    }
+    set_extract_options(cfgs[i]);
+    jel_log(cfgs[i], "%s: unwedge input %s\n", progname, inputs[i]);
+    maxlen += jel_raw_capacity(cfgs[i]);
+  }
+
+  if (frame) maxlen = frame_maxlen(maxlen > INT_MAX ? INT_MAX : (int) maxlen);
+  if (maxlen > INT_MAX) maxlen = INT_MAX;
+  msg = malloc(maxlen > 0 ? maxlen : 1);
+  if (msg == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    ret = JEL_ERR_NOSPACE;
+    goto done;
+  }
+
+  ret = jel_extract_multi(cfgs, ncovers, msg, (int) maxlen);
+  if (ret == JEL_ERR_SHARD)
+    fprintf(stderr, "%s: a shard is missing or the shards disagree\n", progname);
+  else if (ret < 0)
+    fprintf(stderr, "%s: extraction failed (%d)\n", progname, ret);
+  else if (write_message(output_file, msg, ret) < 0) {
+    fprintf(stderr, "%s: could not write the extracted message\n", progname);
+    ret = JEL_ERR_MSGIO;
+  }
+
+ done:
+  for (i = 0; i < ncovers; i++) {
+    if (cfgs && cfgs[i] != NULL) jel_free(cfgs[i]);
+    if (jpegs) free(jpegs[i]);
+  }
+  free(msg);
+  free(jpegs);
+  free(cfgs);
+  return ret < 0 ? EXIT_FAILURE : 0;
+}
+
 
 /*
  * The main program.
@@ -284,25 +920,19 @@ int
 main (int argc, char **argv)
 {
   jel_config *jel;
-  jel_freq_spec *fspec;
+  struct stat st;
 
   int max_bytes;
   int ret;
   //int file_index;
   int k; //, bw, bh;
-  int bytes_written;
   FILE *sfp, *output_file;
+  unsigned char *jpeg = NULL;
+  int jpeglen;
 
   
   jel = jel_init(JEL_NLEVELS);
 
-  ret = jel_open_log(jel, "/tmp/unwedge.log");
-  if (ret == JEL_ERR_CANTOPENLOG) {
-    fprintf(stderr, "Can't open /tmp/unwedge.log!!\n");
-    jel->logger = stderr;
-  }
-
-  jel_log(jel,"unwedge version %s\n", UNWEDGE_VERSION);
   progname = argv[0];
   if (progname == NULL || progname[0] == 0)
     progname = "unwedge";		/* in case C library doesn't provide it */
@@ -311,14 +941,46 @@ main (int argc, char **argv)
   
   k = parse_switches(jel, argc, argv);
 
-  if (!ecc) {
-    jel_setprop(jel, JEL_PROP_ECC_METHOD, JEL_ECC_NONE);
-    jel_log(jel, "Disabling ECC.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_METHOD));
-  } else if (ecclen > 0) {
-    jel_setprop(jel, JEL_PROP_ECC_BLOCKLEN, ecclen);
-    jel_log(jel, "ECC block length set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_BLOCKLEN));
+  if (manifestname) {
+    jel_free(jel);
+    return run_batch(NULL, NULL);
+  }
+
+  if (ncovers > 0) {
+    jel_free(jel);
+    if (argc - k < ncovers || argc - k > ncovers + 1) usage();
+    if (!outfilename && argc - k > ncovers) outfilename = argv[k + ncovers];
+    output_file = outfilename ? fopen(outfilename, "wb") : stdout;
+    if (!output_file) {
+      fprintf(stderr, "%s: Could not open output file %s!\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
+    ret = run_covers(argv + k, output_file);
+    if (output_file != stdout && fclose(output_file) != 0) ret = EXIT_FAILURE;
+    return ret;
+  }
+
+  if (k < argc && stat(argv[k], &st) == 0 && S_ISDIR(st.st_mode)) {
+    jel_free(jel);
+    if (!outfilename && k + 1 < argc) outfilename = argv[k + 1];
+    if (!outfilename) usage();
+    return run_batch(argv[k], outfilename);
   }
 
+  /* Logging is off unless asked for: */
+  if (logfilename) {
+    ret = jel_open_log(jel, logfilename);
+    if (ret == JEL_ERR_CANTOPENLOG)
+      fprintf(stderr, "Can't open %s!!\n", logfilename);
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, verbose ? JEL_LOG_DEBUG : JEL_LOG_INFO);
+  } else if (verbose) {
+    jel->logger = stderr;
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+  }
+
+  jel_log(jel,"unwedge version %s\n", UNWEDGE_VERSION);
+
+  set_coding_options(jel);
 
   sfp = fopen(argv[k], "rb");
   if (!sfp) {
@@ -326,7 +988,12 @@ main (int argc, char **argv)
     exit(EXIT_FAILURE);
   }
 
-  ret = jel_set_fp_source(jel, sfp);
+  if (decodethreads != 1) {
+    /* Restart intervals are only decoded in parallel from memory: */
+    jpeg = load_file(argv[k], &jpeglen);
+    ret = jpeg ? jel_set_mem_source(jel, jpeg, jpeglen) : JEL_ERR_CANTOPENFILE;
+  } else
+    ret = jel_set_fp_source(jel, sfp);
   if (ret != 0) {
     fprintf(stderr, "Error - exiting (need a diagnostic!)\n");
     exit(EXIT_FAILURE);
@@ -340,6 +1007,10 @@ main (int argc, char **argv)
     if (!outfilename) outfilename = strdup(argv[k]);
 
     output_file = fopen(outfilename, "wb");
+    if (!output_file) {
+      fprintf(stderr, "%s: Could not open output file %s!\n", progname, outfilename);
+      exit(EXIT_FAILURE);
+    }
     jel_log(jel,"%s: wedge output %s\n", progname, outfilename);
   }
 
@@ -352,37 +1023,22 @@ main (int argc, char **argv)
   /*
    * 'raw' capacity just returns the number of bytes that can be
    * stored in the image, regardless of ECC or other forms of
-   * encoding.  On this end, we just need to make sure that the
-   * allocated buffer has enough space to load every byte:
+   * encoding.  The message is streamed to the output file, so this
+   * only bounds what we will read:
    */
 
   max_bytes = jel_raw_capacity(jel);
 
-  /* Set up the buffer for receiving the incoming message.  Internals
-   * are handled by jel_extract: */
-  message = malloc(max_bytes*2);
+  set_extract_options(jel);
 
-  if ( seed > 0 ) {
-    jel_log(jel, "%s: Setting frequency generation seed to %d\n", progname, seed);
-    if ( jel_setprop( jel, JEL_PROP_FREQ_SEED, seed ) != seed )
-      jel_log(jel, "Failed to set frequency generation seed.\n");
-
-    jel_log(jel, "%s:      also setting nfreqs to 8\n", progname);
-    if ( jel_setprop( jel, JEL_PROP_NFREQS, 8 ) != 8 )
-      jel_log(jel, "Failed to set frequency generation seed.\n");
-  }
-
-  if (embed_length) jel_log(jel, "%s: Length is embedded.\n", progname);
-  else jel_log(jel, "%s: Length is NOT embedded.\n", progname);
-
-  jel_setprop(jel, JEL_PROP_EMBED_LENGTH, embed_length);
-
-  fspec = &(jel->freqs);
-
-  /* If supplied, copy the selected frequency components: */
-  if (nfreq > 0) {
-    fspec->nfreqs = nfreq;
-    for (k = 0; k < nfreq; k++) fspec->freqs[k] = freq[k];
+  if (tryname) {
+    ret = try_hypotheses(jel, output_file, max_bytes);
+    jel_close_log(jel);
+    if (sfp != NULL && sfp != stdin) fclose(sfp);
+    if (output_file != NULL && output_file != stdout) fclose(output_file);
+    jel_free(jel);
+    free(jpeg);
+    return ret ? EXIT_FAILURE : 0;
   }
 
   /* Forces unwedge to read 'msglen' bytes: */
@@ -396,24 +1052,22 @@ main (int argc, char **argv)
     jel_log(jel, "%s: Specified message length is %d.\n", progname, msglen);
   }
 
-  msglen = jel_extract(jel, message, msglen);
-
-  jel_log(jel, "%s: %d bytes extracted\n", progname, msglen);
+  if (embed_length && frame) msglen = frame_maxlen(msglen);
 
-  bytes_written = ijel_fprintf_message(jel, output_file);
+  msglen = jel_extract_stream(jel, write_message, output_file, msglen);
 
-  if( bytes_written  != msglen ){
-    jel_log(jel, "jel_fprintf_message wrote %d bytes; message contained %d bytes\n", bytes_written, msglen);
-  }
+  if (msglen == JEL_ERR_MSGIO)
+    jel_log(jel, "%s: could not write the extracted message\n", progname);
+  else
+    jel_log(jel, "%s: %d bytes extracted\n", progname, msglen);
 
   jel_close_log(jel);
 
   if (sfp != NULL && sfp != stdin) fclose(sfp);
   if (output_file != NULL && output_file != stdout) fclose(output_file);
 
-  free(message);
-
   jel_free(jel);
+  free(jpeg);
 
   return 0;			/* suppress no-return-value warnings */
 }
@@ -41,12 +41,6 @@ main (int argc, char **argv)
 
   jel = jel_init(JEL_NLEVELS);
 
-  ret = jel_open_log(jel, "/tmp/wcap.log");
-  if(ret != 0){
-    fprintf(stderr, "Error - exiting (can't open log file)\n");
-    exit(EXIT_FAILURE);
-  }
-
   input_file = fopen(argv[1], "rb");
   ret = jel_set_fp_source(jel, input_file);
 
@@ -64,7 +58,6 @@ main (int argc, char **argv)
 
   max_bytes = jel_capacity(jel);
 
-  jel_close_log(jel);
   if (input_file != NULL && input_file != stdin) fclose(input_file);
 
   printf("%d\n", max_bytes);
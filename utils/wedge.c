@@ -21,6 +21,10 @@
 #include <jel/jel.h>
 
 #include <ctype.h>		/* to declare isprint() */
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #define WEDGE_VERSION "1.0.0.4"
 
@@ -54,12 +58,24 @@ static int quality = 0;        /* If 0, do nothing.  If >0, then set the output
 static int ecc = 1;
 static int ecclen = 0;
 static int seed = 0;
+static int ethresh = 0;        /* If >0, skip blocks with at least this AC energy. */
+static int frame = 0;          /* If 1, use the JEL_FRAME_V1 message frame. */
+static int compress = 0;       /* If 1, compress the message (implies -frame). */
+static int maxmemory = 0;      /* If >0, Kb of coefficients to keep in memory. */
+static int decodethreads = 1;  /* Restart interval decoders; 0 means one per processor. */
+static int restartrows = 0;    /* If >0, MCU rows between output restart markers. */
+static int verbose = 0;
+static char * logfilename = NULL;	/* for -log switch */
+static char * manifestname = NULL;	/* for -manifest switch */
+static int nthreads = 0;	/* Manifest workers; 0 means one per processor. */
+static int ncovers = 0;		/* for -covers switch; 0: one cover */
 
 LOCAL(void)
 usage (void)
 /* complain about bad command line */
 {
   fprintf(stderr, "usage: %s [switches] inputfile [outputfile]\n", progname);
+  fprintf(stderr, "       %s [switches] -covers N cover... output...\n", progname);
   fprintf(stderr, "Embeds a message in a jpeg image.\n");
   fprintf(stderr, "Switches (names may be abbreviated):\n");
   fprintf(stderr, "  -message M      Wedge a string M into the image\n");
@@ -76,7 +92,25 @@ usage (void)
   fprintf(stderr, "  -data    <file> Use the contents of the file as the message (alternative to stdin).\n");
   fprintf(stderr, "  -outfile <file> Filename for output image.\n");
   fprintf(stderr, "  -seed <n>       Seed (shared secret) for random frequency selection.\n");
-  fprintf(stderr, "  -verbose  or  -debug   Emit debug output\n");
+  fprintf(stderr, "  -ethresh E      Skip blocks whose AC energy is at least E (default=0, no limit).\n");
+  fprintf(stderr, "                  NOTE: The same value must used for extraction!\n");
+  fprintf(stderr, "  -frame          Frame the message with a checked header and a CRC.\n");
+  fprintf(stderr, "                  NOTE: The same option must used for extraction!\n");
+  fprintf(stderr, "  -compress       Compress the message when that helps (implies -frame).\n");
+  fprintf(stderr, "                  Extract it with unwedge -frame.\n");
+  fprintf(stderr, "  -maxmemory N    Keep at most N Kb (Nm: N Mb) of coefficients in memory,\n");
+  fprintf(stderr, "                  the rest in temporary files in $TMPDIR.\n");
+  fprintf(stderr, "  -decodethreads N  Decode a cover's restart intervals on N threads\n");
+  fprintf(stderr, "                  (0: one per processor; default=1).\n");
+  fprintf(stderr, "  -restart N      Put a restart marker every N MCU rows of the output.\n");
+  fprintf(stderr, "  -log <file>     Append log output to file.\n");
+  fprintf(stderr, "  -manifest <file>  Embed each 'cover message output' line of the file\n");
+  fprintf(stderr, "                  ('-' for stdin), reporting a status line for each.\n");
+  fprintf(stderr, "                  The message is the name of a file.\n");
+  fprintf(stderr, "  -threads N      Manifest worker threads (default=one per processor).\n");
+  fprintf(stderr, "  -covers N       Split the message across N covers: the first N file\n");
+  fprintf(stderr, "                  names are the covers, the next N the outputs.\n");
+  fprintf(stderr, "  -verbose  or  -debug   Emit debug output (to stderr unless -log is given)\n");
   fprintf(stderr, "  -version        Print version info and exit.\n");
   exit(EXIT_FAILURE);
 }
@@ -150,6 +184,60 @@ parse_switches (jel_config *cfg, int argc, char **argv)
       if(outfilename != NULL){ free(outfilename); }
       outfilename = strdup(argv[argn]);	/* save it away for later use */
 
+    } else if (keymatch(arg, "log", 3)) {
+      /* Log file name. */
+      if (++argn >= argc)	/* advance to next argument */
+        usage();
+      logfilename = argv[argn];
+
+    } else if (keymatch(arg, "manifest", 3)) {
+      /* Manifest of jobs. */
+      if (++argn >= argc)	/* advance to next argument */
+        usage();
+      manifestname = argv[argn];
+
+    } else if (keymatch(arg, "threads", 2)) {
+      /* Manifest workers. */
+      if (++argn >= argc)	/* advance to next argument */
+        usage();
+      nthreads = strtol(argv[argn], NULL, 10);
+
+    } else if (keymatch(arg, "covers", 3)) {
+      /* Multi-cover embedding */
+      if (++argn >= argc)	/* advance to next argument */
+        usage();
+      ncovers = strtol(argv[argn], NULL, 10);
+      if (ncovers < 1) {
+        usage();
+        exit(EXIT_FAILURE);
+      }
+
+    } else if (keymatch(arg, "debug", 1) || keymatch(arg, "verbose", 1)) {
+      /* Enable debug printouts. */
+      verbose = 1;
+
+    } else if (keymatch(arg, "decodethreads", 3)) {
+      /* Threads for decoding restart intervals */
+      if (++argn >= argc)
+      usage();
+      decodethreads = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "restart", 3)) {
+      /* Restart markers in the output, every N MCU rows */
+      if (++argn >= argc)
+        usage();
+      restartrows = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "maxmemory", 3)) {
+      /* Coefficient memory limit in Kb, or Mb with an 'm' */
+      long lval;
+      char ch = 'x';
+
+      if (++argn >= argc)
+        usage();
+      if (sscanf(argv[argn], "%ld%c", &lval, &ch) < 1)
+        usage();
+      if (ch == 'm' || ch == 'M')
+        lval *= 1024L;
+      maxmemory = (int) lval;
     } else if (keymatch(arg, "message", 3)) {
       /* Message string */
       if (++argn >= argc)	/* advance to next argument */
@@ -169,6 +257,17 @@ parse_switches (jel_config *cfg, int argc, char **argv)
       if (++argn >= argc)
         usage();
       ecclen = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "ethresh", 2)) {
+      /* Energy threshold for usable blocks */
+      if (++argn >= argc)
+        usage();
+      ethresh = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "frame", 3)) {
+      /* Checked message frame */
+      frame = 1;
+    } else if (keymatch(arg, "compress", 4)) {
+      /* Compressed, framed message */
+      compress = 1;
     } else if (keymatch(arg, "frequencies", 4)) {
       /* freq. components */
       if (++argn >= argc)
@@ -311,53 +410,460 @@ static size_t read_message(char *filename, unsigned char *message, int maxlen, i
 
 
 
+/*
+ * Options that must be set before the source is opened:
+ */
+static void set_coding_options(jel_config *jel) {
+  if (!ecc) {
+    jel_setprop(jel, JEL_PROP_ECC_METHOD, JEL_ECC_NONE);
+    jel_log(jel, "Disabling ECC.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_METHOD));
+  } else if (ecclen > 0) {
+    jel_setprop(jel, JEL_PROP_ECC_BLOCKLEN, ecclen);
+    jel_log(jel, "ECC block length set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_BLOCKLEN));
+  }
+
+  if (ethresh > 0) {
+    jel_setprop(jel, JEL_PROP_ENERGY_THRESHOLD, ethresh);
+    jel_log(jel, "Energy threshold set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ENERGY_THRESHOLD));
+  }
+
+  if (frame) {
+    jel_setprop(jel, JEL_PROP_FRAME, JEL_FRAME_V1);
+    jel_log(jel, "Message frame set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_FRAME));
+  }
+
+  if (compress) {
+    jel_setprop(jel, JEL_PROP_COMPRESS, JEL_COMPRESS_LZF);
+    jel_log(jel, "Compression set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_COMPRESS));
+  }
+
+  if (maxmemory > 0) {
+    jel_setprop(jel, JEL_PROP_MAX_MEMORY, maxmemory);
+    jel_log(jel, "Memory limit set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_MAX_MEMORY));
+  }
+
+  if (decodethreads != 1) {
+    jel_setprop(jel, JEL_PROP_DECODE_THREADS, decodethreads);
+    jel_log(jel, "Decode threads set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_DECODE_THREADS));
+  }
+
+  if (restartrows > 0) {
+    jel_setprop(jel, JEL_PROP_RESTART_ROWS, restartrows);
+    jel_log(jel, "Restart rows set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_RESTART_ROWS));
+  }
+}
+
+
+/*
+ * Options that depend on the source's quant tables, so they are set
+ * once the source and destination are open:
+ */
+static void set_embed_options(jel_config *jel) {
+  jel_freq_spec *fspec;
+  int k;
+
+  if ( quality > 0 ) {
+    jel_log(jel, "%s: Setting output quality to %d\n", progname, quality);
+    if ( jel_setprop( jel, JEL_PROP_QUALITY, quality ) != quality )
+      jel_log(jel, "Failed to set output quality.\n");
+  }
+
+  if ( seed > 0 ) {
+    jel_log(jel, "%s: Setting frequency generation seed to %d\n", progname, seed);
+    if ( jel_setprop( jel, JEL_PROP_FREQ_SEED, seed ) != seed )
+      jel_log(jel, "Failed to set frequency generation seed.\n");
+    jel_log(jel, "%s:      also setting nfreqs to 8\n", progname);
+    if ( jel_setprop( jel, JEL_PROP_NFREQS, 8 ) != 8 )
+      jel_log(jel, "Failed to set frequency pool.\n");
+  }
+  
+  jel_setprop(jel, JEL_PROP_EMBED_LENGTH, embed_length);
+
+  fspec = &(jel->freqs);
+
+  if (nfreq > 0) {
+    fspec->nfreqs = nfreq;
+    for (k = 0; k < nfreq; k++) fspec->freqs[k] = freq[k];
+  }
+}
+
+
+/*
+ * Manifest mode.  Each line of the manifest names a cover, a message
+ * file and an output file, separated by white space; blank lines and
+ * lines starting with '#' are skipped.  Worker threads take lines in
+ * turn.  Each worker keeps one jel_config for all of its jobs and
+ * jel_resets it in between, so a job costs an image, not a process
+ * and a context.  Every job reports one line on stdout, as it
+ * finishes:
+ *
+ *   <line> ok <message bytes> <output>
+ *   <line> error <code> <output> <reason>
+ *
+ * The exit status is non-zero if any job failed.
+ */
+
+#define WEDGE_MAXPATH 4096
+
+typedef struct {
+  FILE *fp;
+  int lineno;
+  int failures;
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_t lock;
+#endif
+} wedge_manifest;
+
+
+static void manifest_lock(wedge_manifest *m) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_lock(&m->lock);
+#endif
+}
+
+
+static void manifest_unlock(wedge_manifest *m) {
+#ifdef HAVE_LIBPTHREAD
+  pthread_mutex_unlock(&m->lock);
+#endif
+}
+
+
+/* Next job, or 0 at the end of the manifest: */
+static int next_job(wedge_manifest *m, char *cover, char *msgfile, char *output) {
+  char line[3 * WEDGE_MAXPATH + 16];
+  char extra[2];
+  int lineno = 0, n;
+
+  manifest_lock(m);
+  while (fgets(line, sizeof(line), m->fp) != NULL) {
+    m->lineno++;
+    n = sscanf(line, "%4095s %4095s %4095s %1s", cover, msgfile, output, extra);
+    if (n <= 0 || cover[0] == '#') continue;
+    if (n != 3) {
+      printf("%d error %d - malformed line\n", m->lineno, JEL_ERR_INVALIDARG);
+      m->failures++;
+      continue;
+    }
+    lineno = m->lineno;
+    break;
+  }
+  manifest_unlock(m);
+
+  return lineno;
+}
+
+
+static unsigned char *load_file(const char *path, int *len) {
+  FILE *fp = fopen(path, "rb");
+  unsigned char *buf;
+  long n;
+
+  if (fp == NULL) return NULL;
+
+  fseek(fp, 0, SEEK_END);
+  n = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  buf = (n >= 0) ? malloc(n + 1) : NULL;
+  if (buf != NULL && fread(buf, 1, n, fp) != (size_t) n) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+
+  *len = (int) n;
+  return buf;
+}
+
+
+/*
+ * One manifest job.  Returns the number of message bytes embedded,
+ * or a negative error code with *why set:
+ */
+static int wedge_job(jel_config *jel, char *cover, char *msgfile, char *output,
+                     const char **why) {
+  unsigned char *jpeg = NULL, *msg = NULL;
+  int jpeglen, msglen, ret;
+  FILE *dfp = NULL;
+
+  jpeg = load_file(cover, &jpeglen);
+  if (jpeg == NULL) {
+    *why = "cannot read cover";
+    ret = JEL_ERR_CANTOPENFILE;
+    goto done;
+  }
+
+  msg = load_file(msgfile, &msglen);
+  if (msg == NULL) {
+    *why = "cannot read message";
+    ret = JEL_ERR_CANTOPENFILE;
+    goto done;
+  }
+
+  if (jel_set_mem_source(jel, jpeg, jpeglen) != 0) {
+    *why = "cannot decode cover";
+    ret = JEL_ERR_BADDIMS;
+    goto done;
+  }
+
+  dfp = fopen(output, "wb");
+  if (dfp == NULL || jel_set_fp_dest(jel, dfp) != 0) {
+    *why = "cannot open output";
+    ret = JEL_ERR_CANTOPENFILE;
+    goto done;
+  }
+
+  if (msglen > (compress ? jel_compressed_capacity(jel, msg, msglen) : jel_capacity(jel))) {
+    *why = "message too long for cover";
+    ret = JEL_ERR_NOSPACE;
+    goto done;
+  }
+
+  set_embed_options(jel);
+
+  jel_log(jel, "%s: wedge source %s, data %s, output %s\n", progname, cover, msgfile, output);
+
+  ret = jel_embed(jel, msg, msglen);
+  if (ret < 0) *why = "embedding failed";
+  else if (ret < msglen) {
+    *why = "message truncated";
+    ret = JEL_ERR_NOSPACE;
+  }
+
+ done:
+  if (dfp != NULL && fclose(dfp) != 0 && ret >= 0) {
+    *why = "cannot write output";
+    ret = JEL_ERR_CANTOPENFILE;
+  }
+  free(msg);
+  free(jpeg);
+  return ret;
+}
+
+
+static void *manifest_worker(void *arg) {
+  wedge_manifest *m = (wedge_manifest *) arg;
+  jel_config *jel = jel_init(JEL_NLEVELS);
+  char cover[WEDGE_MAXPATH], msgfile[WEDGE_MAXPATH], output[WEDGE_MAXPATH];
+  const char *why;
+  int lineno, ret;
+
+  if (logfilename) {
+    if (jel_open_log(jel, logfilename) == JEL_ERR_CANTOPENLOG)
+      fprintf(stderr, "Can't open %s!!\n", logfilename);
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, verbose ? JEL_LOG_DEBUG : JEL_LOG_INFO);
+  } else if (verbose) {
+    jel->logger = stderr;
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+  }
+
+  set_coding_options(jel);
+
+  while ((lineno = next_job(m, cover, msgfile, output)) > 0) {
+    why = "";
+    ret = wedge_job(jel, cover, msgfile, output, &why);
+
+    manifest_lock(m);
+    if (ret >= 0) printf("%d ok %d %s\n", lineno, ret, output);
+    else {
+      printf("%d error %d %s %s\n", lineno, ret, output, why);
+      m->failures++;
+    }
+    fflush(stdout);
+    manifest_unlock(m);
+
+    jel_reset(jel);
+  }
+
+  jel_close_log(jel);
+  jel_free(jel);
+  return NULL;
+}
+
+
+static int run_manifest(void) {
+  wedge_manifest m;
+#ifdef HAVE_LIBPTHREAD
+  pthread_t *threads;
+  int t, started = 0;
+#endif
+
+  memset(&m, 0, sizeof(m));
+  m.fp = strcmp(manifestname, "-") ? fopen(manifestname, "r") : stdin;
+  if (m.fp == NULL) {
+    fprintf(stderr, "%s: cannot open manifest %s\n", progname, manifestname);
+    return EXIT_FAILURE;
+  }
+
+#ifdef HAVE_LIBPTHREAD
+  if (nthreads <= 0) nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads <= 0) nthreads = 1;
+
+  pthread_mutex_init(&m.lock, NULL);
+  threads = calloc(nthreads, sizeof(pthread_t));
+
+  /* This thread is the first worker: */
+  for (t = 1; t < nthreads; t++) {
+    if (pthread_create(&threads[t], NULL, manifest_worker, &m) != 0) break;
+    started++;
+  }
+  manifest_worker(&m);
+  for (t = 1; t <= started; t++) pthread_join(threads[t], NULL);
+
+  free(threads);
+  pthread_mutex_destroy(&m.lock);
+#else
+  manifest_worker(&m);
+#endif
+
+  if (m.fp != stdin) fclose(m.fp);
+  return m.failures > 0 ? EXIT_FAILURE : 0;
+}
+
+
+/*
+ * -covers: one config per cover, and jel_embed_multi splits the
+ * message between them in proportion to their capacities.  unwedge
+ * -covers puts it back together from the outputs, in any order.
+ */
+static int run_covers(char **covers, char **outputs) {
+  jel_config **cfgs = calloc(ncovers, sizeof(jel_config *));
+  unsigned char **jpegs = calloc(ncovers, sizeof(unsigned char *));
+  FILE **dfps = calloc(ncovers, sizeof(FILE *));
+  unsigned char *msg = message;
+  int i, jpeglen, msglen = 0, ret = 0;
+
+  if (cfgs == NULL || jpegs == NULL || dfps == NULL) {
+    fprintf(stderr, "%s: out of memory\n", progname);
+    ret = JEL_ERR_NOSPACE;
+    goto done;
+  }
+
+  if (message) msglen = strlen((char *) message);
+  else if (msgfilename) msg = load_file(msgfilename, &msglen);
+  if (msg == NULL) {
+    fprintf(stderr, "%s: -covers needs -message or -data\n", progname);
+    ret = JEL_ERR_CANTOPENFILE;
+    goto done;
+  }
+
+  for (i = 0; i < ncovers; i++) {
+    cfgs[i] = jel_init(JEL_NLEVELS);
+    if (verbose) {
+      cfgs[i]->logger = stderr;
+      jel_setprop(cfgs[i], JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+    }
+    set_coding_options(cfgs[i]);
+
+    jpegs[i] = load_file(covers[i], &jpeglen);
+    if (jpegs[i] == NULL || jel_set_mem_source(cfgs[i], jpegs[i], jpeglen) != 0) {
+      fprintf(stderr, "%s: cannot read cover %s\n", progname, covers[i]);
+      ret = JEL_ERR_CANTOPENFILE;
+      goto done;
+    }
+    dfps[i] = fopen(outputs[i], "wb");
+    if (dfps[i] == NULL || jel_set_fp_dest(cfgs[i], dfps[i]) != 0) {
+      fprintf(stderr, "%s: cannot open output %s\n", progname, outputs[i]);
+      ret = JEL_ERR_CANTOPENFILE;
+      goto done;
+    }
+    set_embed_options(cfgs[i]);
+    jel_log(cfgs[i], "%s: wedge source %s, output %s\n", progname, covers[i], outputs[i]);
+  }
+
+  ret = jel_embed_multi(cfgs, ncovers, msg, msglen);
+  if (ret == JEL_ERR_NOSPACE)
+    fprintf(stderr, "%s: message too long for the covers\n", progname);
+  else if (ret < 0)
+    fprintf(stderr, "%s: embedding failed (%d)\n", progname, ret);
+
+ done:
+  for (i = 0; i < ncovers; i++) {
+    if (dfps && dfps[i] != NULL && fclose(dfps[i]) != 0 && ret >= 0) {
+      fprintf(stderr, "%s: cannot write output %s\n", progname, outputs[i]);
+      ret = JEL_ERR_CANTOPENFILE;
+    }
+    if (cfgs && cfgs[i] != NULL) jel_free(cfgs[i]);
+    if (jpegs) free(jpegs[i]);
+  }
+  if (msg != message) free(msg);
+  free(dfps);
+  free(jpegs);
+  free(cfgs);
+  return ret < 0 ? EXIT_FAILURE : 0;
+}
+
+
 int
 main (int argc, char **argv)
 {
   jel_config *jel;
-  jel_freq_spec *fspec;
   int abort_on_overflow = 1;
   //int file_index;
   int k, ret;
   int max_bytes;
   FILE *sfp, *dfp;
+  unsigned char *jpeg = NULL;
+  int jpeglen;
 
   jel = jel_init(JEL_NLEVELS);
 
-  ret = jel_open_log(jel, "/tmp/wedge.log");
-  if (ret == JEL_ERR_CANTOPENLOG) {
-    fprintf(stderr, "Can't open /tmp/wedge.log!!\n");
-    jel->logger = stderr;
-  }
-
-  jel_log(jel,"wedge version %s\n", WEDGE_VERSION);
-
-
   progname = argv[0];
   if (progname == NULL || progname[0] == 0)
     progname = "wedge";		/* in case C library doesn't provide it */
 
   k = parse_switches(jel, argc, argv);
+  if (manifestname) {
+    jel_free(jel);
+    ret = run_manifest();
+    clean_up_statics();
+    return ret;
+  }
+
   if (argc == k) {
     usage();
     exit(-1);
   }
 
-  if (!ecc) {
-    jel_setprop(jel, JEL_PROP_ECC_METHOD, JEL_ECC_NONE);
-    jel_log(jel, "Disabling ECC.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_METHOD));
-  } else if (ecclen > 0) {
-    jel_setprop(jel, JEL_PROP_ECC_BLOCKLEN, ecclen);
-    jel_log(jel, "ECC block length set.  getprop=%d\n", jel_getprop(jel, JEL_PROP_ECC_BLOCKLEN));
+  if (ncovers > 0) {
+    if (argc - k != 2 * ncovers) {
+      usage();
+      exit(-1);
+    }
+    jel_free(jel);
+    ret = run_covers(argv + k, argv + k + ncovers);
+    clean_up_statics();
+    return ret;
   }
 
+  /* Logging is off unless asked for: */
+  if (logfilename) {
+    ret = jel_open_log(jel, logfilename);
+    if (ret == JEL_ERR_CANTOPENLOG)
+      fprintf(stderr, "Can't open %s!!\n", logfilename);
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, verbose ? JEL_LOG_DEBUG : JEL_LOG_INFO);
+  } else if (verbose) {
+    jel->logger = stderr;
+    jel_setprop(jel, JEL_PROP_LOG_LEVEL, JEL_LOG_DEBUG);
+  }
+
+  jel_log(jel,"wedge version %s\n", WEDGE_VERSION);
+
+  set_coding_options(jel);
+
   sfp = fopen(argv[k], "rb");
   if (!sfp) {
     jel_log(jel, "%s: Could not open source JPEG file %s!\n", progname, argv[k]);
     exit(EXIT_FAILURE);
   }
 
-  ret = jel_set_fp_source(jel, sfp);
+  if (decodethreads != 1) {
+    /* Restart intervals are only decoded in parallel from memory: */
+    jpeg = load_file(argv[k], &jpeglen);
+    ret = jpeg ? jel_set_mem_source(jel, jpeg, jpeglen) : JEL_ERR_CANTOPENFILE;
+  } else
+    ret = jel_set_fp_source(jel, sfp);
   if (ret != 0) {
     jel_log(jel, "%s: jel_set_fp_source failed and returns %d.\n", progname, ret);
     fprintf(stderr, "Error - exiting (need a diagnostic!)\n");
@@ -387,6 +893,8 @@ main (int argc, char **argv)
   if (message) message_length = strlen( (char *) message);
   else {
     max_bytes = jel_capacity(jel);
+    /* Read as much as could possibly fit once compressed: */
+    if (compress) max_bytes = jel_raw_capacity(jel) * 88;
     message = (unsigned char*)calloc(max_bytes+1, sizeof(unsigned char));
     
     jel_log(jel,"%s: wedge data %s\n", progname, msgfilename);
@@ -396,22 +904,7 @@ main (int argc, char **argv)
 
   }
 
-  if ( quality > 0 ) {
-    jel_log(jel, "%s: Setting output quality to %d\n", progname, quality);
-    if ( jel_setprop( jel, JEL_PROP_QUALITY, quality ) != quality )
-      jel_log(jel, "Failed to set output quality.\n");
-  }
-
-  if ( seed > 0 ) {
-    jel_log(jel, "%s: Setting frequency generation seed to %d\n", progname, seed);
-    if ( jel_setprop( jel, JEL_PROP_FREQ_SEED, seed ) != seed )
-      jel_log(jel, "Failed to set frequency generation seed.\n");
-    jel_log(jel, "%s:      also setting nfreqs to 8\n", progname);
-    if ( jel_setprop( jel, JEL_PROP_NFREQS, 8 ) != 8 )
-      jel_log(jel, "Failed to set frequency pool.\n");
-  }
-  
-  jel_setprop(jel, JEL_PROP_EMBED_LENGTH, embed_length);
+  set_embed_options(jel);
 
   /* If message is NULL, shouldn't we punt? */
   if (!message) {
@@ -419,13 +912,6 @@ main (int argc, char **argv)
     exit(-2);
   }
 
-  fspec = &(jel->freqs);
-
-  if (nfreq > 0) {
-    fspec->nfreqs = nfreq;
-    for (k = 0; k < nfreq; k++) fspec->freqs[k] = freq[k];
-  }
-
   //  if (verbose) describeMessage(msg);
 
   /* Insert the message: */
@@ -441,6 +927,7 @@ main (int argc, char **argv)
   if (dfp != NULL && dfp != stdout) fclose(dfp);
 
   jel_free(jel);
+  free(jpeg);
 
   clean_up_statics();
 